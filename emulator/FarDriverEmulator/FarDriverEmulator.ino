@@ -14,7 +14,7 @@
  * 
  * Packet Types:
  * - Index 0: Main data (RPM, gear, current iq/id)
- * - Index 1: Voltage data
+ * - Index 1: Voltage and battery current (iQin)
  * - Index 4: Controller temperature
  * - Index 13: Motor temperature and throttle
  * 
@@ -25,6 +25,8 @@
 #include <NimBLEDevice.h>
 #include <math.h>
 
+#include "powertrain.h"
+
 // Configuration constants
 #define DEVICE_NAME "FarDriver_Emu"
 #define LED_PIN 2
@@ -48,7 +50,7 @@ void restart_ble_advertising();
 // Packet indices for different data types
 enum PacketIndex {
     INDEX_MAIN_DATA = 0,    // RPM, gear, current
-    INDEX_VOLTAGE = 1,      // Voltage, power
+    INDEX_VOLTAGE = 1,      // Voltage, battery current
     INDEX_CONTROLLER_TEMP = 4, // Controller temperature
     INDEX_MOTOR_THROTTLE = 13   // Motor temp, throttle
 };
@@ -58,6 +60,7 @@ struct EbikeState {
     float current_speed;      // Current speed in km/h
     float target_speed;       // Target speed for acceleration/deceleration
     float acceleration_rate;  // Acceleration rate in km/h per second
+    float accel;              // Acceleration now in km/h per second, negative when slowing
     float throttle_position;  // Throttle position (0.0 to 1.0)
     bool is_accelerating;     // Whether currently accelerating
     bool is_decelerating;     // Whether currently decelerating
@@ -73,11 +76,15 @@ bool deviceConnected = false;
 unsigned long lastBlinkTime = 0;
 bool ledState = false;
 
+// Currents and voltage for the speed and acceleration
+powertrain_t powertrain = {};
+
 // Ebike simulation state
 EbikeState ebike_state = {
     .current_speed = 0.0f,
     .target_speed = 0.0f,
     .acceleration_rate = 2.0f,  // 2 km/h per second
+    .accel = 0.0f,
     .throttle_position = 0.0f,
     .is_accelerating = false,
     .is_decelerating = false,
@@ -170,7 +177,9 @@ void update_ebike_simulation() {
     }
     
     // Update speed based on current state
+    ebike_state.accel = 0.0f;
     if (ebike_state.is_accelerating) {
+        ebike_state.accel = ebike_state.acceleration_rate;
         ebike_state.current_speed += ebike_state.acceleration_rate * delta_time;
         if (ebike_state.current_speed >= ebike_state.target_speed) {
             ebike_state.current_speed = ebike_state.target_speed;
@@ -179,6 +188,7 @@ void update_ebike_simulation() {
         // Increase throttle during acceleration
         ebike_state.throttle_position = min(1.0f, ebike_state.throttle_position + 0.1f * delta_time);
     } else if (ebike_state.is_decelerating) {
+        ebike_state.accel = -ebike_state.acceleration_rate;
         ebike_state.current_speed -= ebike_state.acceleration_rate * delta_time;
         if (ebike_state.current_speed <= ebike_state.target_speed) {
             ebike_state.current_speed = ebike_state.target_speed;
@@ -195,6 +205,8 @@ void update_ebike_simulation() {
     if (ebike_state.current_speed < 0.0f) {
         ebike_state.current_speed = 0.0f;
     }
+    
+    powertrain_update(&powertrain, ebike_state.current_speed, ebike_state.accel);
 }
 
 // Optimized packet generation with dynamic ebike simulation
@@ -211,11 +223,11 @@ void fill_packet(uint8_t* data, uint8_t index, uint32_t timestamp) {
     
     switch(index) {
         case 0: {  // Index 0: RPM, gear, current
-            // Gear bits (mid position) - bits 2-3 of byte 2
+            // Gear bits (mid position) - bits 2-3 of pData[2], which is data[4]
             // Firmware expects: ((pData[2] >> 2) & 0x03) then subtracts 1
             // 00=high, 11=mid, 10=low, (00=Disabled)
             // For mid gear (2), we need 11 in bits 2-3, so 0x0C
-            data[2] = 0x0C;  // 11 = mid gear (bits 2-3)
+            data[4] = 0x0C;  // 11 = mid gear (bits 2-3)
             
             // Calculate RPM based on speed (realistic ebike relationship)
             // Assuming 4:1 gear ratio and 1.35m wheel circumference
@@ -229,9 +241,9 @@ void fill_packet(uint8_t* data, uint8_t index, uint32_t timestamp) {
             if (rpm < 50) rpm = 50;  // Lower minimum to allow for low speeds
             if (rpm > 3000) rpm = 3000;
             
-            // RPM at bytes 4-5 (firmware expects: ((uint16_t)pData[4] << 8) | pData[5])
-            data[4] = (rpm >> 8) & 0xFF;
-            data[5] = rpm & 0xFF;
+            // RPM at bytes 6-7 (firmware expects: ((uint16_t)pData[4] << 8) | pData[5])
+            data[6] = (rpm >> 8) & 0xFF;
+            data[7] = rpm & 0xFF;
             
             // Debug output for speed and RPM
             if (index == 0) { // Only for main data packet
@@ -239,31 +251,15 @@ void fill_packet(uint8_t* data, uint8_t index, uint32_t timestamp) {
                     ebike_state.current_speed, rpm, ebike_state.throttle_position * 100.0f);
             }
             
-            // Calculate current values based on throttle and speed
-            float power_factor = ebike_state.throttle_position * (ebike_state.current_speed / 25.0f);
-            int16_t iq = (int16_t)(300 + 400 * power_factor); // 3A to 7A range
-            int16_t id = (int16_t)(100 + 200 * power_factor); // 1A to 3A range
-            
-            // Add some variation
-            iq += (int16_t)(20 * sin(timestamp / 300.0f));
-            id += (int16_t)(10 * sin(timestamp / 400.0f));
-            
-            // Current values at bytes 8-11 (firmware expects: pData[8-9] for iq, pData[10-11] for id)
-            data[8] = (iq >> 8) & 0xFF;
-            data[9] = iq & 0xFF;
-            data[10] = (id >> 8) & 0xFF;
-            data[11] = id & 0xFF;
+            // Current vector at bytes 10-13 (firmware expects: pData[8-9] for iq, pData[10-11] for id)
+            powertrain_fill(&powertrain, index, data);
             break;
         }
         
-        case 1: {  // Index 1: Voltage
-            // Voltage with slight variation based on load
-            float voltage_variation = 1.0f - (ebike_state.throttle_position * 0.05f); // 5% drop under load
-            uint16_t voltage = (uint16_t)(900 * voltage_variation); // Base 90.0V in 100mV steps
-            
-            // Voltage at bytes 0-1 (firmware expects: ((uint16_t)pData[0] << 8) | pData[1])
-            data[2] = (voltage >> 8) & 0xFF;
-            data[3] = voltage & 0xFF;
+        case 1: {  // Index 1: Voltage, battery current
+            // Voltage at bytes 2-3 and iQin at bytes 8-9, negative when driving
+            // (firmware expects: pData[0-1] and pData[6-7])
+            powertrain_fill(&powertrain, index, data);
             break;
         }
         
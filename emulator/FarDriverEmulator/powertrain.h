@@ -0,0 +1,79 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+
+/*
+ * Emulated drive train
+ *
+ * Works out from the bike's speed and acceleration the force at the wheel, the battery
+ * current and voltage, and the motor current vector, and writes them into frames the way
+ * the controller reports them:
+ *   index 0  words 4, 5   iq, id in 0.01 A, iq negative when braking
+ *   index 1  word 0       battery voltage in 0.1 V
+ *   index 1  word 3       iQin, battery current in 0.01 A, negative when driving
+ * Above PT_WEAKEN_KMH the field is weakened, so id goes negative whether driving or not.
+ *
+ * Plain C so host/test_power.cpp can check the instrument's power against the same model.
+ */
+
+#define PT_MASS_KG     120.0f  // bike and rider
+#define PT_ROLLING_N   15.0f   // rolling resistance
+#define PT_DRAG        0.3f    // air drag, N per (m/s)^2
+#define PT_EFFICIENCY  0.85f   // battery to wheel, and wheel to battery on regen
+#define PT_BATTERY_V   90.0f   // open circuit voltage
+#define PT_BATTERY_R   0.15f   // internal resistance, ohm
+#define PT_IQ_PER_N    0.25f   // motor current for each N at the wheel
+#define PT_WEAKEN_KMH  15.0f   // field weakening from here up
+#define PT_ID_PER_KMH  0.8f    // A of negative id for each km/h above that
+
+typedef struct {
+  float force;    // N at the wheel, negative when braking
+  float power;    // battery power in kW, negative when driving, as the instrument shows it
+  float current;  // battery current in A, negative when driving
+  float voltage;  // battery voltage in V, sags when driving
+  float iq, id;   // motor current vector in A
+} powertrain_t;
+
+static inline void powertrain_update(powertrain_t *pt, float kmh, float accel_kmh_s) {
+  float v = kmh / 3.6f;
+  float wheel;  // W at the wheel
+
+  if (v < 0.1f)
+    pt->force = 0;  // standing
+  else
+    pt->force = PT_MASS_KG * accel_kmh_s / 3.6f + PT_ROLLING_N + PT_DRAG * v * v;
+  wheel = pt->force * v;
+
+  // power out of the battery, less is put back on regen than the wheel gives
+  float out = (wheel > 0) ? wheel / PT_EFFICIENCY : wheel * PT_EFFICIENCY;
+
+  // the voltage sags with the current drawn: V = Voc - R * out / V
+  float d = PT_BATTERY_V * PT_BATTERY_V - 4 * PT_BATTERY_R * out;
+  pt->voltage = (PT_BATTERY_V + sqrtf(d > 0 ? d : 0)) / 2;
+  pt->current = -out / pt->voltage;
+  pt->power = pt->current * pt->voltage / 1000.0f;
+
+  pt->iq = pt->force * PT_IQ_PER_N;
+  pt->id = (kmh > PT_WEAKEN_KMH) ? -(kmh - PT_WEAKEN_KMH) * PT_ID_PER_KMH : 0;
+}
+
+static inline void pt_word(uint8_t *frame, int word, float value) {
+  uint16_t u = (uint16_t)(int16_t)lroundf(value);
+
+  frame[2 + 2 * word] = u >> 8;
+  frame[3 + 2 * word] = u & 0xFF;
+}
+
+// fill in this frame's current and voltage words, the other bytes are left as they are
+static inline void powertrain_fill(const powertrain_t *pt, uint8_t index, uint8_t *frame) {
+  switch (index) {
+    case 0:
+      pt_word(frame, 4, pt->iq * 100);
+      pt_word(frame, 5, pt->id * 100);
+      break;
+    case 1:
+      pt_word(frame, 0, pt->voltage * 10);
+      pt_word(frame, 3, pt->current * 100);
+      break;
+  }
+}
@@ -47,13 +47,13 @@ def test_packet_0():
     data = bytearray(16)
     data[0] = 0xAA  # Header
     data[1] = 0x00  # Index
-    data[2] = 0x0C  # Gear bits (11 = mid gear)
-    data[4] = 0x04  # RPM high byte (1024 RPM)
-    data[5] = 0x00  # RPM low byte
-    data[8] = 0x01  # iq high byte (256 = 2.56A)
-    data[9] = 0x00  # iq low byte
-    data[10] = 0x00  # id high byte (128 = 1.28A)
-    data[11] = 0x80  # id low byte
+    data[4] = 0x0C  # Gear bits (11 = mid gear)
+    data[6] = 0x04  # RPM high byte (1024 RPM)
+    data[7] = 0x00  # RPM low byte
+    data[10] = 0x01  # iq high byte (256 = 2.56A)
+    data[11] = 0x00  # iq low byte
+    data[12] = 0x00  # id high byte (128 = 1.28A)
+    data[13] = 0x80  # id low byte
     
     # Calculate and set checksum
     data[14] = calculate_checksum(data)
@@ -66,10 +66,10 @@ def test_packet_0():
         
         # Test firmware parsing
         pData = data[2:]  # Skip header and index
-        rpm = (pData[2] << 8) | pData[3]
-        gear = ((pData[0] >> 2) & 0x03)
-        iq = ((pData[6] << 8) | pData[7]) / 100.0
-        id = ((pData[8] << 8) | pData[9]) / 100.0
+        rpm = (pData[4] << 8) | pData[5]
+        gear = ((pData[2] >> 2) & 0x03)
+        iq = int.from_bytes(pData[8:10], "big", signed=True) / 100.0
+        id = int.from_bytes(pData[10:12], "big", signed=True) / 100.0
         
         print(f"  RPM: {rpm}")
         print(f"  Gear: {gear}")
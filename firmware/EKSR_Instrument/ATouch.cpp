@@ -174,6 +174,30 @@ uint8_t ATouch::getTouch(uint16_t *x, uint16_t *y, uint16_t threshold){
   return valid;
 }
 
+/***************************************************************************************
+** Function name:           sample
+** Description:             take one calibrated sample without any delays, for streaming
+**                          at a steady rate. Return false if not pressed.
+***************************************************************************************/
+uint8_t ATouch::sample(uint16_t *x, uint16_t *y){
+  uint16_t x_tmp, y_tmp;
+
+  if (getTouchRawZ() <= Z_THRESHOLD) return false;
+
+  getTouchRaw(&x_tmp, &y_tmp);
+
+  // released while measuring, the position can't be trusted
+  if (getTouchRawZ() <= Z_THRESHOLD) return false;
+
+  convertRawXY(&x_tmp, &y_tmp);
+
+  if (x_tmp >= _width || y_tmp >= _height) return false;
+
+  *x = x_tmp;
+  *y = y_tmp;
+  return true;
+}
+
 /***************************************************************************************
 ** Function name:           convertRawXY
 ** Description:             convert raw touch x,y values to screen coordinates
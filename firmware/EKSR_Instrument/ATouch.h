@@ -32,6 +32,10 @@ class ATouch {
            // The returned value can be treated as a bool type, false or 0 means touch not detected
            // In future the function may return an 8 "quality" (jitter) value.
   uint8_t  getTouch(uint16_t *x, uint16_t *y, uint16_t threshold = 600);
+           // Take a single calibrated sample without waiting for the touch to settle,
+           // returns true if the screen is touched. Meant to be called at a steady rate
+           // with the samples fed to a gesture recogniser.
+  uint8_t  sample(uint16_t *x, uint16_t *y);
 
            // Run screen calibration and test, report calibration values to the serial port
   void     calibrateTouch(uint16_t *data, uint32_t color_fg, uint32_t color_bg, uint8_t size);
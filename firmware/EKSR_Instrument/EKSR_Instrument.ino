@@ -12,20 +12,55 @@
 */
 #define USE_NIMBLE 1
 
+// FarDriver controllers on the vehicle, 2 for front and rear hub motors. They are taken in the
+// order they are found, give their addresses in controller_address[] to fix which is which
+#define NUM_CONTROLLERS 1
+
+// set to 1 to advertise the firmware update service from start up, for updating a fleet.
+// Otherwise it is switched on with "ota on" on the serial port. Updates must be signed with
+// the key in ota_key.h, and the uploader paired with OTA_PASSKEY (6 digits), or with a new
+// passkey every start up when 0, printed by "ota on"
+#define OTA_ADVERTISE 0
+#define OTA_PASSKEY 0
+#if OTA_ADVERTISE && !OTA_PASSKEY
+#error "OTA_ADVERTISE needs a fixed OTA_PASSKEY, no one could pair otherwise"
+#endif
+
 // uncomment this to include functions for message debugging on screen
 //#define ON_SCREEN_MSG_DEBUG 1
 
+// uncomment this to print every touch sample and gesture on the serial port, for recording touch traces
+//#define TOUCH_TRACE 1
+
 
 #if USE_NIMBLE
 #include "nimble.h"
+#else
+#define NIMBLE_LINKS 1
 #endif
 
+#include "wheelspeed.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "profiler.h"
+
 
 #include <Preferences.h>
 Preferences preferences;
 
+#include "esp_rom_crc.h"
+#include "odometer.h"
+#include "fardriver.h"
+#include "battery.h"
+#include "latency.h"
+#include "rides.h"
+#include "ridestate.h"
+#include "ota.h"
+#include "esp_partition.h"
+
 #include "Free_Fonts.h"      // Include the header file attached to this sketch
-#include "NotoSansBold36.h"  // Font attached to this sketch
+#include "NotoSansBold36.h"  // Font attached to this sketch, digits and '.' only, subset with host/fontpack
+#include "fontpack.h"
 #define AA_FONT_LARGE NotoSansBold36
 
 
@@ -33,19 +68,28 @@ Preferences preferences;
 #include <ATouch.h>
 ATouch AT;
 
+#include "gesture.h"
+#include "pixels.h"
+#include "pal4.h"
+#include "spitune.h"
+QueueHandle_t gesture_queue;
+
 // TFT class and vars
 #include <TFT_eSPI.h>                  // Master copy here: https://github.com/Bodmer/TFT_eSPI
 TFT_eSPI tft = TFT_eSPI();             // Invoke library, pins defined in User_Setup_Select.h
-TFT_eSprite spr = TFT_eSprite(&tft);   // Sprite for meter reading
-TFT_eSprite vspr = TFT_eSprite(&tft);  // Sprite for voltage
+pal4_sprite_t spr;   // Sprite for meter reading
+pal4_sprite_t vspr;  // Sprite for voltage
 
-uint16_t spr_width = 0;
-uint16_t vspr_width = 0;
+pal4_font_t large_font;
+pal4_palette_t pal_white, pal_green, pal_red;  // text colours on black
+pal4_pairs_t pal4_table;                       // for the colour sent last
+uint32_t pal4_bytes;                           // sent by the last push, for numbench
 
 typedef enum {
   AS_CONNECTING,
   AS_MAIN,
   AS_ODOMETER,
+  AS_HISTORY,
   AS_SETTINGS,
 } active_screen_e;
 
@@ -62,13 +106,28 @@ public:
   volatile float speed;
   volatile float power;
   volatile float voltage;
+  volatile float controller_temps[NIMBLE_LINKS];  // each controller's, the ones above are the hottest
+  volatile float motor_temps[NIMBLE_LINKS];
 };
 
 controller_data ctr_data;
+fd_state_t fd_links[NIMBLE_LINKS];  // raw values from each controller's frames
+fd_state_t fd_state;                // all controllers as one, see fd_combine()
+battery_t battery;    // state of charge and health, guarded by odo_mux
+latency_t latency;    // control loop latency histograms, off until "lat start"
+ride_t ride;          // the ride going on, guarded by odo_mux
+ridestate_t ride_state;  // riding, paused or parked, only changed by message_handler()
+rides_log_t rides_log;  // ride history in the spiffs partition, only used from loop()
 
 
 volatile float backlight = 50;
 
+// display brightness, dimmed while parked until touched or ridden
+#define BACKLIGHT_ON   100
+#define BACKLIGHT_IDLE 10
+#define WAKE_MS        30000  // a touch keeps it on this long
+uint32_t awake_until;
+
 
 // Limits for battery stack display and power bar
 float low_batt_limit = 86;
@@ -81,6 +140,18 @@ float max_power = 20;
 //
 float wheel_circumference = 1.350;  // actual circumference, non-loaded is 1520mm
 
+//
+// controller BLE addresses, e.g. "c8:47:8c:12:34:56" for the front motor, NULL for any
+//
+const char *controller_address[NIMBLE_LINKS] = { NULL };
+
+//
+// battery pack, cells in series and capacity when new
+// adapt this to fit your battery
+//
+#define BATTERY_CELLS     24
+#define BATTERY_RATED_MAH 20000
+
 #if ON_SCREEN_MSG_DEBUG
 // storage for incoming messages
 uint8_t message_store[30][12];
@@ -90,12 +161,35 @@ uint8_t message_store[30][12];
 // states for connection status ISM
 typedef enum {
   CS_SEARCHING,
+  CS_CONNECTING,
   CS_CONNECTED,
   CS_DISCONNECTED,
 } connection_state_e;
 connection_state_e connection_state = CS_SEARCHING;
 
 
+// scheduler jobs and their events
+int job_connection = -1;
+int job_keepalive = -1;
+int job_persist = -1;
+int job_touch = -1;
+int job_render = -1;
+int job_stats = -1;
+int job_console = -1;
+int job_spicheck = -1;
+int job_ota = -1;
+uint32_t ota_passkey;  // for pairing the update uploader
+
+#define EV_SCREEN_NEXT 0x01  // render: switch to the next screen
+#define EV_SCREEN_INIT 0x02  // render: redraw the active screen from scratch
+#define EV_SCREEN_PREV 0x04  // render: switch to the previous screen
+#define EV_SCREEN_HOME 0x08  // render: switch to the main screen
+#define EV_SAVE        0x01  // persist: save the odometers now
+#define EV_RIDE_END    0x02  // persist: the ride state detector has ended the ride
+#define EV_GESTURE     0x01  // touch: gestures are waiting in the queue
+#define EV_RESTART     0x01  // ota: the new firmware is in, save and restart
+
+
 
 
 
@@ -111,6 +205,10 @@ void ui_switch(void) {
       odometer_screen_init();
       break;
     case AS_ODOMETER:
+      active_screen = AS_HISTORY;
+      history_screen_init();
+      break;
+    case AS_HISTORY:
       active_screen = AS_SETTINGS;
       settings_screen_init();
       break;
@@ -122,6 +220,51 @@ void ui_switch(void) {
 }
 
 
+void ui_switch_back(void) {
+  switch (active_screen) {
+    case AS_CONNECTING:
+      break;
+    case AS_MAIN:
+      active_screen = AS_SETTINGS;
+      settings_screen_init();
+      break;
+    case AS_ODOMETER:
+      active_screen = AS_MAIN;
+      main_screen_init();
+      break;
+    case AS_HISTORY:
+      active_screen = AS_ODOMETER;
+      odometer_screen_init();
+      break;
+    case AS_SETTINGS:
+      active_screen = AS_HISTORY;
+      history_screen_init();
+      break;
+  }
+}
+
+
+void ui_init(void) {
+  switch (active_screen) {
+    case AS_CONNECTING:
+      start_screen_init();
+      break;
+    case AS_MAIN:
+      main_screen_init();
+      break;
+    case AS_ODOMETER:
+      odometer_screen_init();
+      break;
+    case AS_HISTORY:
+      history_screen_init();
+      break;
+    case AS_SETTINGS:
+      settings_screen_init();
+      break;
+  }
+}
+
+
 void ui_update(void) {
   switch (active_screen) {
     case AS_CONNECTING:
@@ -132,6 +275,8 @@ void ui_update(void) {
     case AS_ODOMETER:
       odometer_screen_update();
       break;
+    case AS_HISTORY:
+      break;  // drawn once per page, from flash
     case AS_SETTINGS:
       settings_screen_update();
       break;
@@ -153,21 +298,16 @@ public:
     _w = w;
     _h = h;
   }
-  bool hit();
+  bool hit(uint16_t x, uint16_t y);
 protected:
   int _x, _y, _w, _h;
 };
 
 
-bool Field::hit() {
-  uint16_t x, y;
-  if ((AT.getTouch(&x, &y)) > 0) {
-    printf("touch at %d,%d\r\n", x, y);
-
-    if ((x > _x) && (x < (_x + _w)) && (y > _y) && (y < (_y + _h))) {
-      printf("field hit at %d,%d\r\n", x, y);
-      return true;
-    }
+bool Field::hit(uint16_t x, uint16_t y) {
+  if ((x > _x) && (x < (_x + _w)) && (y > _y) && (y < (_y + _h))) {
+    printf("field hit at %d,%d\r\n", x, y);
+    return true;
   }
   return false;
 }
@@ -233,41 +373,44 @@ Button bReset(70, 200, 100, 40, "Reset");
 
     km per kW
     
-    Later, can perhaps add estimated range?  
+    Range left, from the battery estimator (Total only)
  */
 
+// guards the odometers, they are updated from the BLE task
+portMUX_TYPE odo_mux = portMUX_INITIALIZER_UNLOCKED;
+
 //
 // Odometer Class
 //
 class Odometer {
 public:
   Odometer(const char *label, bool can_reset = false);
-  void update_distance(float distance);
+  void update_distance(uint32_t distance);
   void update_speed(float speed);
   void update_power(float power);
+  void update_energy(float energy);
   void draw();
-  void load();
-  void save();
   void reset();
   //private:
   String _label;
 
   bool _can_reset;
-  float _distance;
+  uint64_t _distance;  // mm
   float _speed;
   float _power;
-  float _last_distance;
-  float _last_speed;
-  float _last_power;
+  float _energy;  // Wh
 };
 
 Odometer::Odometer(const char *label, bool can_reset) {
   _label = String(label);
   _can_reset = can_reset;
-  load();
+  _distance = 0;
+  _speed = 0;
+  _power = 0;
+  _energy = 0;
 }
 
-void Odometer::update_distance(float distance) {
+void Odometer::update_distance(uint32_t distance) {
   _distance += distance;
 }
 
@@ -281,6 +424,10 @@ void Odometer::update_power(float power) {
     _power = power;
 }
 
+void Odometer::update_energy(float energy) {
+  _energy += energy;
+}
+
 void Odometer::draw() {
   bool isTotal = false;
   if (!_can_reset)  // sneaky way to determine if this is the Total page
@@ -294,19 +441,28 @@ void Odometer::draw() {
   tft.drawString("Speed", 0, 120);
   tft.drawString("Power", 0, 160);
 
-  if (isTotal)
-    tft.drawString("km/kW", 0, 200);
+  if (isTotal) {
+    tft.drawString("km/kWh", 0, 200);
+    tft.drawString("Range", 0, 240);
+  }
 
 
   tft.setTextDatum(TR_DATUM);
-  tft.drawFloat(_distance, 1, 195, 80);
+  tft.drawFloat(_distance / 1000000.0, 1, 195, 80);
   tft.drawFloat(_speed, 1, 195, 120);
   tft.drawFloat(_power, 1, 195, 160);
   if (isTotal) {
     float kmkw = 0;
 
-    // need power consumtion for this
+    if (_energy > 1.0)
+      kmkw = (_distance / 1000000.0) / (_energy / 1000.0);
     tft.drawFloat(kmkw, 1, 195, 200);
+
+    // range from the energy left in the battery at the average consumption so far
+    portENTER_CRITICAL(&odo_mux);
+    uint32_t wh = battery_remaining_wh(&battery);
+    portEXIT_CRITICAL(&odo_mux);
+    tft.drawFloat(wh / 1000.0 * kmkw, 0, 195, 240);
   }
 
   tft.setFreeFont(FSS9);
@@ -317,6 +473,8 @@ void Odometer::draw() {
   tft.drawString("km/h", 200, 123);
   tft.setTextPadding(tft.textWidth("77"));
   tft.drawString("kW", 200, 163);
+  if (isTotal)
+    tft.drawString("km", 200, 243);
 
 
   // draw buttons
@@ -329,27 +487,14 @@ void Odometer::draw() {
 }
 
 
-void Odometer::load() {
-  _distance = _last_distance = preferences.getULong((_label + String("_km")).c_str(), 0) / 10.0;
-  _speed = _last_speed = preferences.getULong((_label + String("_speed")).c_str(), 0) / 10.0;
-  _power = _last_power = preferences.getULong((_label + String("_power")).c_str(), 0) / 10.0;
-}
-
-void Odometer::save() {
-  preferences.getULong((_label + String("_km")).c_str(), _distance * 10.0);
-  preferences.getULong((_label + String("_speed")).c_str(), _speed * 10.0);
-  preferences.getULong((_label + String("_power")).c_str(), _power * 10.0);
-  _last_distance = _distance;
-  _last_speed = _speed;
-  _last_power = _power;
-}
-
 void Odometer::reset() {
   if (_can_reset) {
-    _distance = _last_distance = 0;
-    _speed = _last_speed = 0;
-    _power = _last_power = 0;
-    save();
+    portENTER_CRITICAL(&odo_mux);
+    _distance = 0;
+    _speed = 0;
+    _power = 0;
+    _energy = 0;
+    portEXIT_CRITICAL(&odo_mux);
   }
 }
 
@@ -360,6 +505,375 @@ Odometer odo_trip1("Trip1", true);
 Odometer odo_trip2("Trip2", true);
 Odometer *current_odo = &odo_total;
 
+Odometer *const odometers[NUM_ODOMETERS] = { &odo_total, &odo_trip1, &odo_trip2 };
+
+/*********************************************************/
+
+uint64_t odo_saved_distance;  // total distance at last save
+
+// live copy of the odometers, kept over software, watchdog and panic resets.
+// Two slots written in turn, so a reset half way through a write leaves the other one intact.
+RTC_NOINIT_ATTR odo_record_t odo_rtc[2];
+uint32_t odo_rtc_seq;
+
+//
+// after a warm reset RTC memory still holds what was there before it, newer than flash
+//
+bool rtc_kept(void) {
+  esp_reset_reason_t reason = esp_reset_reason();
+
+  return (reason == ESP_RST_SW) || (reason == ESP_RST_PANIC) || (reason == ESP_RST_INT_WDT)
+         || (reason == ESP_RST_TASK_WDT) || (reason == ESP_RST_WDT);
+}
+
+//
+// copy all odometers at once, message_handler() can't update them half way through
+//
+void odometers_snapshot(odo_record_t *rec) {
+  memset(rec, 0, sizeof(odo_record_t));  // no random padding in the crc
+
+  portENTER_CRITICAL(&odo_mux);
+  for (int i = 0; i < NUM_ODOMETERS; i++) {
+    rec->odo[i].distance = odometers[i]->_distance;
+    rec->odo[i].speed = odometers[i]->_speed;
+    rec->odo[i].power = odometers[i]->_power;
+    rec->odo[i].energy = odometers[i]->_energy;
+  }
+  rec->seq = odo_rtc_seq;
+  portEXIT_CRITICAL(&odo_mux);
+
+  rec->version = ODO_RECORD_VERSION;
+}
+
+//
+// update the RTC copy, cheap enough to do on every message
+//
+void odometers_mirror(void) {
+  odo_record_t rec;
+
+  odometers_snapshot(&rec);
+
+  portENTER_CRITICAL(&odo_mux);  // also called from loop(), keep the slots in order
+  rec.seq = ++odo_rtc_seq;
+  rec.crc = esp_rom_crc32_le(0, (const uint8_t *)&rec, offsetof(odo_record_t, crc));
+  odo_rtc[rec.seq & 1] = rec;
+  portEXIT_CRITICAL(&odo_mux);
+}
+
+bool odometers_valid(const odo_record_t *rec) {
+  return (rec->version == ODO_RECORD_VERSION)
+         && (rec->crc == esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(odo_record_t, crc)));
+}
+
+void odometers_write(odo_record_t *rec) {
+  rec->crc = esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(odo_record_t, crc));
+  if (preferences.putBytes("odometers", rec, sizeof(odo_record_t)) == sizeof(odo_record_t))
+    odo_saved_distance = rec->odo[0].distance;
+  else
+    Serial.println("Odometer save failed");
+}
+
+//
+// read the saved record, converting from older versions
+//
+bool odometers_read(odo_record_t *rec) {
+  odo_record_v1_t v1;
+
+  memset(rec, 0, sizeof(odo_record_t));
+
+  switch (preferences.getBytesLength("odometers")) {
+    case sizeof(odo_record_t):
+      preferences.getBytes("odometers", rec, sizeof(odo_record_t));
+      return odometers_valid(rec);
+
+    case sizeof(odo_record_v1_t):
+      preferences.getBytes("odometers", &v1, sizeof(v1));
+      if ((v1.version != 1) || (v1.crc != esp_rom_crc32_le(0, (const uint8_t *)&v1, offsetof(odo_record_v1_t, crc))))
+        return false;
+      for (int i = 0; i < NUM_ODOMETERS; i++) {
+        rec->odo[i].distance = v1.odo[i].distance;
+        rec->odo[i].speed = v1.odo[i].speed;
+        rec->odo[i].power = v1.odo[i].power;
+      }
+      rec->version = ODO_RECORD_VERSION;
+      return true;
+  }
+  return false;
+}
+
+void odometers_load(void) {
+  odo_record_t rec;
+  const odo_record_t *live = NULL;
+
+  if (odometers_read(&rec))
+    odo_saved_distance = rec.odo[0].distance;
+  else {
+    Serial.println("No valid odometer record, starting from zero");
+    memset(&rec, 0, sizeof(rec));
+    odo_saved_distance = 0;
+  }
+
+  if (rtc_kept()) {
+    for (int i = 0; i < 2; i++) {
+      if (odometers_valid(&odo_rtc[i]) && (!live || (int32_t)(odo_rtc[i].seq - live->seq) > 0))
+        live = &odo_rtc[i];
+    }
+  }
+
+  if (live) {
+    rec = *live;
+    odo_rtc_seq = live->seq;
+    Serial.printf("Odometers restored from RTC memory, %llu m not yet saved\r\n",
+                  (unsigned long long)((rec.odo[0].distance - odo_saved_distance) / 1000));
+  }
+
+  portENTER_CRITICAL(&odo_mux);
+  for (int i = 0; i < NUM_ODOMETERS; i++) {
+    odometers[i]->_distance = rec.odo[i].distance;
+    odometers[i]->_speed = rec.odo[i].speed;
+    odometers[i]->_power = rec.odo[i].power;
+    odometers[i]->_energy = rec.odo[i].energy;
+  }
+  portEXIT_CRITICAL(&odo_mux);
+
+  odometers_mirror();  // start the RTC copy, it is garbage after power on
+}
+
+/*********************************************************/
+
+// the battery's state of charge, kept over warm resets as the odometers are
+RTC_NOINIT_ATTR battery_live_t battery_rtc[2];
+uint32_t battery_rtc_seq;
+
+//
+// update the RTC copy, after every battery frame
+//
+void battery_mirror(void) {
+  battery_live_t live;
+
+  portENTER_CRITICAL(&odo_mux);
+  battery_save_live(&battery, &live);
+  live.seq = ++battery_rtc_seq;
+  portEXIT_CRITICAL(&odo_mux);
+
+  live.crc = esp_rom_crc32_le(0, (const uint8_t *)&live, offsetof(battery_live_t, crc));
+  battery_rtc[live.seq & 1] = live;
+}
+
+//
+// save what the battery estimator has learnt, only written when it learns something
+//
+void battery_write(void) {
+  battery_record_t rec;
+
+  portENTER_CRITICAL(&odo_mux);
+  battery_save(&battery, &rec);
+  battery.dirty = false;
+  portEXIT_CRITICAL(&odo_mux);
+
+  rec.crc = esp_rom_crc32_le(0, (const uint8_t *)&rec, offsetof(battery_record_t, crc));
+  if (preferences.putBytes("battery", &rec, sizeof(rec)) != sizeof(rec))
+    Serial.println("Battery save failed");
+}
+
+void battery_load(void) {
+  battery_record_t rec;
+  const battery_live_t *live = NULL;
+
+  battery_init(&battery, BATTERY_CELLS, BATTERY_RATED_MAH);
+
+  if ((preferences.getBytesLength("battery") != sizeof(rec))
+      || (preferences.getBytes("battery", &rec, sizeof(rec)) != sizeof(rec))
+      || (rec.crc != esp_rom_crc32_le(0, (const uint8_t *)&rec, offsetof(battery_record_t, crc)))
+      || !battery_restore(&battery, &rec))
+    Serial.println("No valid battery record, starting from the rated capacity");
+  else
+    Serial.printf("Battery %lu mAh (%lu%% of rated), %.1f mOhm, %u estimates\r\n", (unsigned long)battery.capacity_mah,
+                  (unsigned long)battery_health(&battery), battery.resistance / (float)(1 << BATTERY_R_Q), battery.learnt);
+
+  // a lost connection restarts the instrument in the middle of a ride, the pack is not rested then
+  if (rtc_kept()) {
+    for (int i = 0; i < 2; i++) {
+      if ((battery_rtc[i].crc == esp_rom_crc32_le(0, (const uint8_t *)&battery_rtc[i], offsetof(battery_live_t, crc)))
+          && (!live || (int32_t)(battery_rtc[i].seq - live->seq) > 0))
+        live = &battery_rtc[i];
+    }
+  }
+  if (live && battery_restore_live(&battery, live)) {
+    battery_rtc_seq = live->seq;
+    Serial.println("Battery state of charge restored from RTC memory");
+  } else
+    battery.cold_start = (esp_reset_reason() == ESP_RST_POWERON);
+
+  battery_mirror();  // start the RTC copy, it is garbage after power on
+}
+
+//
+// print the state of charge, what has been learnt, and the history, newest first
+//
+void battery_print(void) {
+  battery_t b;
+
+  portENTER_CRITICAL(&odo_mux);
+  b = battery;
+  portEXIT_CRITICAL(&odo_mux);
+
+  int32_t soc = battery_soc(&b);
+  if (soc < 0)
+    Serial.println("State of charge: not known until the pack has rested");
+  else
+    Serial.printf("State of charge: %.1f%%, %lu Wh left\r\n", soc * 100.0 / (1 << BATTERY_SOC_Q),
+                  (unsigned long)battery_remaining_wh(&b));
+  Serial.printf("Capacity: %lu mAh, %lu%% of %lu mAh rated\r\n", (unsigned long)b.capacity_mah,
+                (unsigned long)battery_health(&b), (unsigned long)b.rated_mah);
+  Serial.printf("Resistance: %.1f mOhm\r\n", b.resistance / (float)(1 << BATTERY_R_Q));
+  Serial.printf("Discharged: %lu mAh\r\n", (unsigned long)(b.discharged / BATTERY_CAMS_PER_MAH));
+  for (int i = 0; i < BATTERY_HISTORY && i < b.learnt; i++) {
+    const battery_history_t *h = &b.history[(b.head + BATTERY_HISTORY - 1 - i) % BATTERY_HISTORY];
+    Serial.printf("  %6.2f Ah %6.1f mOhm  over %4.1f%%  at %5.1f cycles\r\n", h->capacity / 100.0, h->resistance / 10.0,
+                  h->swing / 10.0, h->cycles / 10.0);
+  }
+}
+
+/*********************************************************/
+
+//
+// the ride history table is the spiffs partition, used raw, nothing mounts it as a file system
+//
+const esp_partition_t *rides_part;
+
+bool rides_flash_read(uint32_t offset, void *data, size_t len) {
+  return esp_partition_read(rides_part, offset, data, len) == ESP_OK;
+}
+
+bool rides_flash_write(uint32_t offset, const void *data, size_t len) {
+  return esp_partition_write(rides_part, offset, data, len) == ESP_OK;
+}
+
+bool rides_flash_erase(uint32_t offset, size_t len) {
+  return esp_partition_erase_range(rides_part, offset, len) == ESP_OK;
+}
+
+rides_flash_t rides_flash = { rides_flash_read, rides_flash_write, rides_flash_erase, 0 };
+
+void rides_index_write(void) {
+  rides_index_t index;
+
+  rides_index(&rides_log, &index);
+  if (preferences.putBytes("rides", &index, sizeof(index)) != sizeof(index))
+    Serial.println("Ride index save failed");
+}
+
+//
+// the summary of the ride going on, false if there is none
+//
+bool ride_snapshot(ride_record_t *rec, bool close) {
+  bool keep;
+
+  portENTER_CRITICAL(&odo_mux);
+  if (close)
+    keep = ride_close(&ride, rec);
+  else {
+    keep = ride.open;
+    ride_summary(&ride, rec);
+  }
+  rec->start_odo = odo_total._distance / 1000 - rec->distance_m;
+  portEXIT_CRITICAL(&odo_mux);
+
+  return keep;
+}
+
+//
+// keep the ride so far with the odometers, it is closed at the next start if the power goes
+//
+void ride_write(void) {
+  ride_record_t rec;
+
+  if (!ride_snapshot(&rec, false))
+    return;
+  rides_seal(&rec);
+  if (preferences.putBytes("ride", &rec, sizeof(rec)) != sizeof(rec))
+    Serial.println("Ride save failed");
+}
+
+//
+// the ride is over, on disconnect or when the ride state detector ends it
+//
+void ride_end(void) {
+  ride_record_t rec;
+  bool keep = ride_snapshot(&rec, true);
+
+  if (preferences.isKey("ride"))
+    preferences.remove("ride");
+  if (!keep || !rides_part)
+    return;
+
+  if (rides_append(&rides_log, &rec))
+    Serial.printf("Ride %lu: %.1f km in %lu min\r\n", (unsigned long)rec.seq, rec.distance_m / 1000.0,
+                  (unsigned long)rec.duration_s / 60);
+  else
+    Serial.println("Ride history write failed");
+  rides_index_write();
+}
+
+void rides_load(void) {
+  rides_index_t index;
+  ride_record_t rec;
+  bool have_index;
+
+  ride_init(&ride);
+  rs_init(&ride_state);
+
+  rides_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  if (rides_part)
+    rides_flash.size = rides_part->size;
+  have_index = (preferences.getBytesLength("rides") == sizeof(index))
+               && (preferences.getBytes("rides", &index, sizeof(index)) == sizeof(index));
+  if (!rides_part || !rides_open(&rides_log, &rides_flash, have_index ? &index : NULL)) {
+    Serial.println("No spiffs partition for the ride history");
+    rides_part = NULL;
+    return;
+  }
+
+  // the ride that was going on when the power went
+  if (preferences.isKey("ride")) {
+    if ((preferences.getBytes("ride", &rec, sizeof(rec)) == sizeof(rec)) && rides_valid(&rec)
+        && (rec.distance_m >= RIDE_MIN_M))
+      rides_append(&rides_log, &rec);
+    preferences.remove("ride");
+  }
+
+  if (!have_index || (index.next != rides_log.next))
+    rides_index_write();  // rebuilt, or rides were added since it was saved
+  Serial.printf("Ride history: rides %lu to %lu of %lu slots\r\n", (unsigned long)rides_first(&rides_log),
+                (unsigned long)rides_log.next, (unsigned long)rides_log.slots);
+}
+
+//
+// print the newest rides, straight from flash
+//
+void rides_print(void) {
+  ride_record_t rec;
+  uint32_t first = rides_first(&rides_log);
+
+  for (uint32_t n = rides_log.next; (n-- > first) && (rides_log.next - n <= 20);) {
+    if (!rides_read(&rides_log, n, &rec))
+      continue;
+    Serial.printf("#%lu at %lu km, %.1f h ridden: %.1f km in %lu:%02lu (%lu min moving)\r\n", (unsigned long)n,
+                  (unsigned long)rec.start_odo / 1000, rec.start_s / 3600.0, rec.distance_m / 1000.0,
+                  (unsigned long)rec.duration_s / 3600, (unsigned long)rec.duration_s / 60 % 60,
+                  (unsigned long)rec.moving_s / 60);
+    Serial.printf("  %.0f Wh, %.0f Wh regen, max %.1f km/h, %u W, %u W regen, %.1f to %.1f V (min %.1f)\r\n",
+                  rec.energy_wh, rec.regen_wh, rec.max_speed / 10.0, rec.max_power, rec.max_regen,
+                  rec.start_voltage / 10.0, rec.end_voltage / 10.0, rec.min_voltage / 10.0);
+    Serial.printf("  controller %u C, motor %u C, %u faults, flags %04X, %u stops\r\n", rec.max_controller_temp,
+                  rec.max_motor_temp, rec.faults, rec.fault_flags, rec.pauses);
+  }
+  Serial.printf("now %s, still for %lu s\r\n",
+                ride_state.state == RS_RIDING ? "riding" : ride_state.state == RS_PAUSED ? "paused" : "parked",
+                (unsigned long)ride_state.still_ms / 1000);
+}
+
 
 
 /*****************************************************************************************************/
@@ -369,23 +883,35 @@ Odometer *current_odo = &odo_total;
 void setup() {
   Serial.begin(115200);
   Serial.println("EKSR Instrument");
+  trace_boot();  // print what happened before a crash or watchdog reset
 
   // open up preferences
   preferences.begin("my-app", false);
+  odometers_load();
+  battery_load();
+  rides_load();
 
   Serial.println("Init TFT");
   // Initialise the screen
   tft.init();
   Serial.println("After TFT");
+  pal4_ramp(&pal_white, TFT_WHITE, TFT_BLACK);
+  pal4_ramp(&pal_green, TFT_GREEN, TFT_BLACK);
+  pal4_ramp(&pal_red, TFT_RED, TFT_BLACK);
   // set portrait orientation
   tft.setRotation(0);
 
+  spitune_begin(&tft, &preferences);  // fastest SPI clock this display takes
+  tft.initDMA();                      // for the palette sprites
+
     // start up Nimble
 #if USE_NIMBLE
   active_screen = AS_CONNECTING;
   start_screen_init();  // spinner screen
   Serial.println("Start NIMBLE");
-  nimble_start();
+  nimble_start(NUM_CONTROLLERS, controller_address);
+  ota_passkey = OTA_PASSKEY ? OTA_PASSKEY : esp_random() % 1000000;
+  nimble_ota_start(OTA_ADVERTISE, ota_passkey, ota_done);
 #else
   active_screen = AS_MAIN;
   main_screen_init();  // main screen
@@ -398,8 +924,30 @@ void setup() {
   // configure LED PWM functionalities (Arduino-ESP32 3.0+ syntax)
   ledcAttachChannel(9, 5000, 8, 0);  // pin, freq, resolution, channel
   // set duty cycle (0-255 for 8 bits)
-  ledcWrite(9, 100);
+  ledcWrite(9, BACKLIGHT_ON);
+
+
+  // optional wheel speed sensor
+  wheelspeed_start(wheel_circumference * 1000.0);
+
+  // everything after this runs as scheduler jobs
+#if USE_NIMBLE
+  job_connection = sched_add("connection", connection_job, 0, 50);
+  job_keepalive = sched_add("keepalive", keepalive_job, 0, 2000);
+  job_ota = sched_add("ota", ota_job, 3, 0);
+#endif
+  job_touch = sched_add("touch", touch_job, 1, 0);
+  job_render = sched_add("render", render_job, 2, 50);
+#if !ON_SCREEN_MSG_DEBUG
+  job_persist = sched_add("persist", persist_job, 3, 1000);
+#endif
+  job_stats = sched_add("stats", stats_job, 4, 10000);
+  job_console = sched_add("console", console_job, 4, 100);
+  job_spicheck = sched_add("spicheck", spicheck_job, 4, 30000);
 
+  // touch sampling and gesture recognition, on the same core as loop() but at a higher priority
+  gesture_queue = xQueueCreate(8, sizeof(gesture_t));
+  xTaskCreatePinnedToCore(touch_task, "touch", 3072, NULL, 2, NULL, ARDUINO_RUNNING_CORE);
 
   Serial.println("Started");
 }
@@ -409,91 +957,564 @@ void setup() {
 /*****************************************************************************************************/
 
 void loop() {
-  static uint32_t lastMillis;
-  static int active = 0;
-  uint16_t x, y;
+  sched_run();
+}
+
 
+/*********************************************************/
 
 #if USE_NIMBLE
 
-  switch (connection_state) {
-    case CS_SEARCHING:
-      spinner(120, 200, active);
-      active += 30;
-      active %= 360;
-      delay(50);
-      if (service_found) {
-        if (connectToServer()) {
-          is_connected = true;
-          service_found = false;
-          connection_state = CS_CONNECTED;
-          active_screen = AS_MAIN;
-          main_screen_init();
-          odo_trip2.reset();  // auto-reset TRIP2
-        } else
-          connection_state = CS_DISCONNECTED;
+//
+// connection state machine. The first controller to connect brings up the main screen, the
+// others join as they are found, one attempt at a time and taking turns so one that keeps
+// failing doesn't hold up the rest. A controller lost is looked for again while another is
+// still connected, when none are the instrument restarts
+//
+void connection_job(uint32_t events) {
+  static bool attempt = false;  // a connection attempt is going on
+  static uint8_t next = 0;      // link to try first
+  static uint32_t up = 0;       // links connected at the last run
+  connection_state_e last_state = connection_state;
+  uint32_t now_up;
+
+  // the attempt going on has finished
+  if (attempt && (connect_phase == CONNECT_DONE || connect_phase == CONNECT_FAILED)) {
+    attempt = false;
+    if (connect_phase == CONNECT_DONE && connection_state != CS_CONNECTED) {
+      connection_state = CS_CONNECTED;
+      active_screen = AS_MAIN;
+      sched_post(job_render, EV_SCREEN_INIT);
+      sched_post(job_persist, EV_SAVE);
+      ota_confirm();  // this firmware gets as far as the controller, keep it
+    } else if (connect_phase == CONNECT_FAILED && nimble_primary() < 0)
+      connection_state = CS_DISCONNECTED;
+    nimble_scan();  // for the controllers still missing
+  }
+
+  // start the next attempt, with the link after the last one tried
+  if (!attempt && connection_state != CS_DISCONNECTED) {
+    for (int k = 0; k < num_links; k++) {
+      uint8_t i = (next + k) % num_links;
+      if (links[i].found && !links[i].connected) {
+        nimble_connect(i);  // runs in its own task, the UI keeps going
+        attempt = true;
+        next = i + 1;
+        if (connection_state == CS_SEARCHING)
+          connection_state = CS_CONNECTING;
+        break;
+      }
+    }
+  }
+
+  now_up = links_up();
+  if (connection_state == CS_CONNECTED && (up & ~now_up)) {
+    Serial.printf("Controller lost, %d of %d connected\r\n", __builtin_popcount(now_up), num_links);
+    if (!now_up && !attempt)
+      connection_state = CS_DISCONNECTED;
+    else
+      nimble_scan();
+  }
+  up = now_up;
+
+  if (connection_state == CS_DISCONNECTED) {
+    ride_end();
+    preferences.end();
+    Serial.println("Failed to connect or disconnected... Restarting");
+    trace(TR_RESTART);
+    ESP.restart();
+  }
+
+  if (connection_state != last_state)
+    trace(TR_CONN_STATE, connection_state);
+}
+
+/*********************************************************/
+
+//
+// the update task has switched the boot partition, called from it
+//
+void ota_done(void) {
+  sched_post(job_ota, EV_RESTART);
+}
+
+//
+// save everything, as on a disconnect, and start the new firmware
+//
+void ota_job(uint32_t events) {
+  odo_record_t rec;
+
+  if (!(events & EV_RESTART))
+    return;
+
+  odometers_mirror();
+  odometers_snapshot(&rec);
+  odometers_write(&rec);
+  if (battery.dirty)
+    battery_write();
+  ride_write();  // closed into the history when the new firmware starts
+
+  preferences.end();
+  Serial.println("Restarting into the new firmware");
+  trace(TR_RESTART);
+  ESP.restart();
+}
+
+/*********************************************************/
+
+//
+// send a keep-alive packet to every controller every 2 seconds
+//
+void keepalive_job(uint32_t events) {
+  uint8_t buffer[] = { 0xAA, 0x13, 0xec, 0x07, 0x01, 0xF1, 0xA2, 0x5D };
+
+  if (connection_state != CS_CONNECTED)
+    return;
+
+  for (int i = 0; i < num_links; i++)
+    if (links[i].connected && !nimble_send(i, buffer, 8))
+      Serial.printf("    Write Failed, controller %d *****************************\r\n", i + 1);
+}
+
+#endif
+
+/*********************************************************/
+
+//
+// save the odometers, and the battery estimator when it has learnt something.
+// End the ride when the ride state detector says it is over
+//
+void persist_job(uint32_t events) {
+  odo_record_t rec;
+
+  odometers_mirror();  // catches trip resets from the UI
+  odometers_snapshot(&rec);
+
+  if (battery.dirty)  // learnt a capacity, a few times a ride at most
+    battery_write();
+
+  if (events & EV_RIDE_END)
+    ride_end();
+
+  if (events & EV_SAVE) {
+    odometers_write(&rec);
+    ride_write();
+    return;
+  }
+
+  //  driving at 60km/h, each 1km interval every 60 seconds (60 times per hour)
+  //
+  // resets are covered by the RTC copy, flash is only needed against power off,
+  // so only update odometer every 1km
+  // and only save if rpm > 0 to avoid saving at power off time
+  //
+  if (((rec.odo[0].distance - odo_saved_distance) > 1000000) && (ctr_data.rpm > 0)) {
+    odometers_write(&rec);
+    ride_write();
+  }
+}
+
+/*********************************************************/
+
+//
+// sample the touch panel at a steady rate, independent of how long drawing takes,
+// and pass recognised gestures on to the touch job
+//
+void touch_task(void *param) {
+  gesture_state_t gestures;
+  TickType_t wake = xTaskGetTickCount();
+
+  gesture_init(&gestures);
+
+  for (;;) {
+    uint16_t x = 0, y = 0;
+
+    bool pressed = AT.sample(&x, &y);
+    gesture_t g = gesture_feed(&gestures, pressed, x, y);
+
+#if TOUCH_TRACE
+    Serial.printf("T %lu %d %u %u\r\n", millis(), pressed, x, y);
+    if (g.type != GESTURE_NONE)
+      Serial.printf("G %lu %s\r\n", millis(), gesture_name(g.type));
+#endif
+
+    if (g.type != GESTURE_NONE) {
+      trace(TR_TOUCH, g.type);
+      xQueueSend(gesture_queue, &g, 0);
+      sched_post(job_touch, EV_GESTURE);
+    }
+
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(GESTURE_SAMPLE_MS));
+  }
+}
+
+//
+// act on the recognised gestures
+//
+void touch_job(uint32_t events) {
+  gesture_t g;
+
+  while (xQueueReceive(gesture_queue, &g, 0) == pdTRUE) {
+    awake_until = millis() + WAKE_MS;  // the display comes back on
+    if (active_screen != AS_CONNECTING)
+      touch_gesture(g);
+  }
+}
+
+void touch_gesture(gesture_t g) {
+  printf("%s at %d,%d\r\n", gesture_name(g.type), g.x, g.y);
+
+  switch (g.type) {
+    case GESTURE_SWIPE_LEFT:
+      sched_post(job_render, EV_SCREEN_NEXT);
+      break;
+
+    case GESTURE_SWIPE_RIGHT:
+      sched_post(job_render, EV_SCREEN_PREV);
+      break;
+
+    case GESTURE_LONG_PRESS:
+      sched_post(job_render, EV_SCREEN_HOME);
+      break;
+
+    case GESTURE_SWIPE_UP:
+    case GESTURE_SWIPE_DOWN:
+      if (active_screen == AS_ODOMETER)
+        odometer_screen_cycle(g.type == GESTURE_SWIPE_UP);
+      else if (active_screen == AS_HISTORY)
+        history_screen_page(g.type == GESTURE_SWIPE_UP);
+      else if (active_screen == AS_SETTINGS) {
+        // start a new profile, or stop it and dump it on the serial port
+        if (prof_running())
+          prof_dump();
+        else {
+          prof_clear();
+          prof_start();
+        }
       }
       break;
 
-    case CS_CONNECTED:
-      if (!is_connected)
-        connection_state = CS_DISCONNECTED;
+    case GESTURE_TAP:
+      if (fNext.hit(g.x, g.y)) {                 // check if there is a touch on the main UI switch field
+        sched_post(job_render, EV_SCREEN_NEXT);  // if so, switch to next UI
+        break;
+      }
+      if (active_screen == AS_ODOMETER)
+        odometer_screen_touch(g.x, g.y);
       break;
 
-    case CS_DISCONNECTED:
-      preferences.end();
-      Serial.println("Failed to connect or disconnected... Restarting");
-      ESP.restart();
+    default:
       break;
   }
+}
 
+/*********************************************************/
+
+//
+// parked for a while, dim the display and draw it less often
+//
+void power_idle(bool idle) {
+  ledcWrite(9, idle ? BACKLIGHT_IDLE : BACKLIGHT_ON);
+  sched_period(job_render, idle ? 500 : 50);
+  Serial.println(idle ? "Display dimmed" : "Display on");
+}
+
+//
+// draw the active screen
+//
+void render_job(uint32_t events) {
+  static int active = 0;
+  static bool idle = false;
+  uint32_t start = micros();
+
+  bool now_idle = rs_idle(&ride_state) && (int32_t)(millis() - awake_until) >= 0;
+  if (now_idle != idle) {
+    idle = now_idle;
+    power_idle(idle);
+  }
 
-  if (!is_connected && !service_found) {
+  if (events & EV_SCREEN_HOME) {
+    active_screen = AS_MAIN;
+    ui_init();
+  } else if (events & EV_SCREEN_NEXT)
+    ui_switch();
+  else if (events & EV_SCREEN_PREV)
+    ui_switch_back();
+  else if (events & EV_SCREEN_INIT)
+    ui_init();
+
+  if (active_screen == AS_CONNECTING) {
     spinner(120, 200, active);
     active += 30;
     active %= 360;
-    delay(50);
+#if USE_NIMBLE
+    // show which phase of the connection we are in
+    tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+    tft.setTextDatum(TC_DATUM);
+    tft.setTextPadding(120);
+    tft.drawString(connection_state == CS_SEARCHING ? "scan" : connect_phase_name(connect_phase), 120, 230, 2);
+    tft.setTextPadding(0);
+#endif
+    trace(TR_RENDER, active_screen, micros() - start);
     return;
   }
 
-  if (connection_state == CS_CONNECTED) {
-    uint8_t buffer[] = { 0xAA, 0x13, 0xec, 0x07, 0x01, 0xF1, 0xA2, 0x5D };
-    uint32_t currentMillis = millis();
-    if (currentMillis - lastMillis >= 2000) {
-      lastMillis = currentMillis;
-      // send a keep-alive packet every 2 seconds
-      if (!nimble_send(buffer, 8))
-        Serial.println("    Write Failed *****************************");
-    }
-#else
-  if (1) {
-#endif
-    /*********************************************************/
-
 #if ON_SCREEN_MSG_DEBUG
+  if (nimble_primary() >= 0)
     debug_packets();
-#else
+#endif
 
-    //  driving at 60km/h, each 1km interval every 60 seconds (60 times per hour), 100m every 6 seconds (600 times per hour)
-    //
-    // only update odometer every 100m
-    // and only save if rpm > 0 to avoid saving at power off time
-    //
-    if (((odo_total._distance - odo_total._last_distance) > 100) && (ctr_data.rpm > 0)) {
-      odo_total.save();
-      odo_trip1.save();
-      odo_trip2.save();
-    }
+  ui_update();
+  trace(TR_RENDER, active_screen, micros() - start);
+}
 
-#endif
+/*********************************************************/
+
+void stats_job(uint32_t events) {
+  sched_report();
+}
+
+/*********************************************************/
+
+//
+// time the pixel kernels on the device, where the fill uses the PIE vector unit
+//
+void pixels_bench(void) {
+  const size_t n = 240 * 40;
+  uint16_t *buf = (uint16_t *)malloc(n * 2);
+  uint8_t *alpha = (uint8_t *)malloc(n);
+  uint32_t t0, t1, t2;
+
+  if (!buf || !alpha) {
+    free(buf);
+    free(alpha);
+    return;
   }
+  for (size_t i = 0; i < n; i++)
+    alpha[i] = i * 7;
+
+  Serial.printf("us for %u pixels    ref  kernel\r\n", (unsigned)n);
+
+  t0 = micros();
+  pix_fill16_ref(buf, 0x1234, n);
+  t1 = micros();
+  pix_fill16(buf, 0x1234, n);
+  t2 = micros();
+  Serial.printf("fill           %6lu  %6lu\r\n", (unsigned long)(t1 - t0), (unsigned long)(t2 - t1));
+
+  t0 = micros();
+  pix_blend16_ref(buf, alpha, n, TFT_RED, TFT_BLACK, true);
+  t1 = micros();
+  pix_blend16(buf, alpha, n, TFT_RED, TFT_BLACK, true);
+  t2 = micros();
+  Serial.printf("blend + swap   %6lu  %6lu\r\n", (unsigned long)(t1 - t0), (unsigned long)(t2 - t1));
+
+  free(buf);
+  free(alpha);
+}
 
+//
+// time loading the large font into a sprite, and unpacking it first if it is packed
+//
+void font_bench(void) {
+  size_t size = fontpack_size(AA_FONT_LARGE);
+  uint8_t *ram = size ? (uint8_t *)malloc(size) : NULL;
+  const uint8_t *font = size ? ram : AA_FONT_LARGE;
+  TFT_eSprite fspr = TFT_eSprite(&tft);
+  uint32_t t0, t1, t2;
+
+  if (!font)
+    return;
+
+  t0 = micros();
+  if (size)
+    fontpack_unpack(AA_FONT_LARGE, sizeof(AA_FONT_LARGE), ram, size);
+  t1 = micros();
+  fspr.loadFont(font);
+  t2 = micros();
+  fspr.unloadFont();
+
+  Serial.printf("font flash %u bytes, %u bytes of RAM\r\n", (unsigned)sizeof(AA_FONT_LARGE), (unsigned)size);
+  Serial.printf("unpack %lu us, loadFont %lu us\r\n", (unsigned long)(t1 - t0), (unsigned long)(t2 - t1));
+  free(ram);
+}
+
+//
+// render and send the power reading the old way, a 16 bit sprite, and with the palette sprite
+//
+void num_bench(void) {
+  TFT_eSprite old = TFT_eSprite(&tft);
+  const int frames = 50;
+  uint32_t t0, t1, t2, bytes = 0;
+  char str[12];
 
-  if (fNext.hit()) {  // check if there is a touch on the main UI switch field
-    ui_switch();      // if so, switch to next UI
+  if (!spr.pix)
+    return;
+
+  old.loadFont(large_font.data);
+  if (!old.createSprite(spr.w, spr.h))
+    return;
+  old.setTextColor(TFT_GREEN, TFT_BLACK, true);
+  old.setTextDatum(MC_DATUM);
+  old.setTextPadding(spr.w);
+
+  t0 = micros();
+  for (int i = 0; i < frames; i++) {
+    old.drawFloat((i * 37 % 200) / 10.0, 1, spr.w / 2, spr.h / 2);
+    old.pushSprite(120 - spr.w / 2, 80);
+  }
+  t1 = micros();
+  spr.pal = &pal_green;
+  spr.shown_pal = NULL;
+  for (int i = 0; i < frames; i++) {
+    snprintf(str, sizeof(str), "%.1f", (i * 37 % 200) / 10.0);
+    pal4_text(&spr, &large_font, str);
+    pal4_push(&spr, 120 - spr.w / 2, 80);
+    bytes += pal4_bytes;
   }
+  t2 = micros();
 
-  ui_update();
+  old.unloadFont();
+  old.deleteSprite();
+
+  // RAM for both readings: the palette sprites keep what is shown as well, and share the
+  // ramps, the pair table and the bands
+  uint32_t area = spr.w * spr.h + (vspr.pix ? vspr.w * vspr.h : 0);
+  uint32_t pal_ram = area + 3 * sizeof(pal4_palette_t) + sizeof(pal4_pairs_t) + 2 * pal4_band_pixels * 2;
+
+  Serial.printf("%dx%d sprite        16 bit  palette\r\n", spr.w, spr.h);
+  Serial.printf("RAM, both sprites  %6u   %6u\r\n", (unsigned)(area * 2), (unsigned)pal_ram);
+  Serial.printf("us per frame       %6lu   %6lu\r\n", (unsigned long)(t1 - t0) / frames, (unsigned long)(t2 - t1) / frames);
+  Serial.printf("SPI bytes per frame%6u   %6u\r\n", (unsigned)(spr.w * spr.h * 2), (unsigned)(bytes / frames));
+}
+
+/*********************************************************/
+
+//
+// print the latency histograms, one line per bucket that has anything in it
+//
+void latency_print(void) {
+  static const char *names[LAT_HISTS] = { "throttle to torque", "data to photon" };
+
+  for (int i = 0; i < LAT_HISTS; i++) {
+    const lat_hist_t *h = &latency.hist[i];
+    uint32_t most = 1;
+
+    Serial.printf("%s: %lu, mean %.1f ms, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\r\n", names[i], (unsigned long)h->n,
+                  h->n ? h->total / 1000.0 / h->n : 0.0, lat_percentile(h, 50) / 1000.0, lat_percentile(h, 90) / 1000.0,
+                  lat_percentile(h, 99) / 1000.0, h->max / 1000.0);
+
+    for (int b = 0; b < LAT_BUCKETS; b++)
+      most = max(most, h->count[b]);
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+      if (!h->count[b])
+        continue;
+      int bar = (h->count[b] * 40 + most - 1) / most;
+      Serial.printf("  %8.2f ms %6lu ", lat_bucket_floor(b) / 1000.0, (unsigned long)h->count[b]);
+      while (bar--)
+        Serial.print('#');
+      Serial.println();
+    }
+  }
+  Serial.printf("throttle steps with no response: %lu\r\n", (unsigned long)latency.timeouts);
+}
+
+/*********************************************************/
+
+//
+// commands typed on the serial port
+//
+//   prof start [hz]   start the profiler
+//   prof stop         stop it
+//   prof dump         stop it and print the samples for host/profsym
+//   prof clear        throw away the samples
+//   pixbench          time the pixel kernels against plain loops
+//   fontbench         time loading the large font
+//   numbench          time the power reading as a 16 bit and as a palette sprite
+//   spitune           find the fastest display SPI clock again
+//   battery           state of charge, learnt capacity and resistance, and their history
+//   lat start         clear the latency histograms and start collecting
+//   lat stop          stop collecting
+//   lat               print the throttle to torque and data to photon histograms
+//   rides             the newest rides in the history
+//   links             each controller's connection, frames and readings
+//   ota on            advertise the firmware update service, and print the passkey
+//   ota off           stop advertising it
+//   ota forget        forget the paired uploaders
+//   ota               state of the last update
+//
+void console_job(uint32_t events) {
+  static char line[40];
+  static int len = 0;
+
+  while (Serial.available()) {
+    char c = Serial.read();
+
+    if (c != '\r' && c != '\n') {
+      if (len < (int)sizeof(line) - 1)
+        line[len++] = c;
+      continue;
+    }
+    if (len == 0)
+      continue;
+    line[len] = 0;
+    len = 0;
+
+    if (strncmp(line, "prof start", 10) == 0) {
+      int hz = atoi(line + 10);
+      prof_start(hz > 0 ? hz : PROF_HZ);
+    } else if (strcmp(line, "prof stop") == 0)
+      prof_stop();
+    else if (strcmp(line, "prof dump") == 0)
+      prof_dump();
+    else if (strcmp(line, "prof clear") == 0)
+      prof_clear();
+    else if (strcmp(line, "pixbench") == 0)
+      pixels_bench();
+    else if (strcmp(line, "fontbench") == 0)
+      font_bench();
+    else if (strcmp(line, "numbench") == 0)
+      num_bench();
+    else if (strcmp(line, "spitune") == 0) {
+      spitune_begin(&tft, &preferences, true);
+      sched_post(job_render, EV_SCREEN_INIT);  // the test patterns are on the screen
+    } else if (strcmp(line, "battery") == 0)
+      battery_print();
+    else if (strcmp(line, "lat start") == 0)
+      latency_start(&latency);
+    else if (strcmp(line, "lat stop") == 0)
+      latency.on = false;
+    else if (strcmp(line, "lat") == 0)
+      latency_print();
+    else if (strcmp(line, "rides") == 0)
+      rides_print();
+#if USE_NIMBLE
+    else if (strcmp(line, "links") == 0) {
+      for (int i = 0; i < num_links; i++)
+        Serial.printf("controller %d: %s, %lu frames, %.2f kW, controller %u C, motor %u C\r\n", i + 1,
+                      links[i].connected ? "connected" : links[i].found ? "found" : "searching",
+                      (unsigned long)links[i].frames, fd_links[i].power, fd_links[i].controller_temp,
+                      fd_links[i].motor_temp);
+    }
+    else if (strcmp(line, "ota on") == 0) {
+      nimble_ota_advertise(true);
+      Serial.printf("Pair with passkey %06lu\r\n", (unsigned long)ota_passkey);
+    }
+    else if (strcmp(line, "ota off") == 0)
+      nimble_ota_advertise(false);
+    else if (strcmp(line, "ota forget") == 0)
+      nimble_ota_forget();
+    else if (strcmp(line, "ota") == 0) {
+      ota_status_t st;
+      ota_get_status(&st);
+      Serial.printf("OTA %s, state %u, error %u, %lu packed bytes in, %lu written\r\n",
+                    nimble_ota_advertising() ? "advertised" : "off", st.state, st.error, (unsigned long)st.received,
+                    (unsigned long)st.written);
+    }
+#endif
+    else
+      Serial.printf("Unknown command: %s\r\n", line);
+  }
 }
 
 
@@ -503,6 +1524,7 @@ void loop() {
 /*****************************************************************************************************/
 
 
+
 void odometer_screen_init(void) {
 
   tft.fillScreen(TFT_BLACK);
@@ -516,24 +1538,129 @@ void odometer_screen_init(void) {
 }
 
 void odometer_screen_update(void) {
+}
+
+void odometer_screen_touch(uint16_t x, uint16_t y) {
   Odometer *pold = current_odo;
 
   // check touch on buttons
-  if (bTotal.hit())
+  if (bTotal.hit(x, y))
     current_odo = &odo_total;
-  if (bTrip1.hit())
+  if (bTrip1.hit(x, y))
     current_odo = &odo_trip1;
-  if (bTrip2.hit())
+  if (bTrip2.hit(x, y))
     current_odo = &odo_trip2;
 
   // check for reset
-  if (bReset.hit())
+  if (bReset.hit(x, y) && current_odo->_can_reset) {
     current_odo->reset();
+    sched_post(job_persist, EV_SAVE);
+    sched_post(job_render, EV_SCREEN_INIT);  // redraw with the cleared values
+  }
 
   // if any change
-  if (current_odo != pold) {
-    odometer_screen_init();  //redraw
+  if (current_odo != pold)
+    sched_post(job_render, EV_SCREEN_INIT);  //redraw
+}
+
+// swipe up/down through Total, Trip1 and Trip2
+void odometer_screen_cycle(bool forward) {
+  int i = 0;
+  while (odometers[i] != current_odo)
+    i++;
+
+  i += forward ? 1 : NUM_ODOMETERS - 1;
+  current_odo = odometers[i % NUM_ODOMETERS];
+  sched_post(job_render, EV_SCREEN_INIT);
+}
+
+
+
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+/*****************************************************************************************************/
+
+//
+// Ride history, newest first, HISTORY_ROWS rides to a page. Each page is read from flash
+// when it is drawn, one read per ride, so paging back through years of rides costs the same.
+//
+#define HISTORY_ROWS 4
+#define HISTORY_ROW_H 60
+
+uint32_t history_page;  // 0 is the newest rides
+
+void history_screen_init(void) {
+  ride_record_t rec;
+  char str[40];
+  uint32_t first = rides_first(&rides_log);
+  uint32_t count = rides_log.next - first;
+  uint32_t pages = (count + HISTORY_ROWS - 1) / HISTORY_ROWS;
+
+  if (history_page >= pages)
+    history_page = pages ? pages - 1 : 0;
+
+  tft.fillScreen(TFT_BLACK);
+  tft.setFreeFont(FSS12);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.setTextDatum(TC_DATUM);
+  tft.drawString("History", 120, 5);
+
+  tft.setTextDatum(TL_DATUM);
+  if (!count) {
+    tft.drawString(rides_part ? "No rides yet" : "No flash for rides", 10, 80, 2);
+    return;
   }
+
+  for (int row = 0; row < HISTORY_ROWS; row++) {
+    uint32_t n = rides_log.next - 1 - history_page * HISTORY_ROWS - row;
+    int y = 45 + row * HISTORY_ROW_H;
+
+    if ((int32_t)(n - first) < 0)
+      break;
+    tft.drawFastHLine(0, y - 4, 240, TFT_DARKGREY);
+    if (!rides_read(&rides_log, n, &rec)) {
+      tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+      snprintf(str, sizeof(str), "#%lu  not readable", (unsigned long)n);
+      tft.drawString(str, 5, y, 2);
+      continue;
+    }
+
+    tft.setTextColor(TFT_WHITE, TFT_BLACK);
+    snprintf(str, sizeof(str), "#%lu  %.1f km  %lu:%02lu h", (unsigned long)n, rec.distance_m / 1000.0,
+             (unsigned long)rec.duration_s / 3600, (unsigned long)rec.duration_s / 60 % 60);
+    tft.drawString(str, 5, y, 2);
+
+    tft.setTextColor(TFT_LIGHTGREY, TFT_BLACK);
+    snprintf(str, sizeof(str), "%.0f Wh  %.1f Wh/km  %.0f km/h", rec.energy_wh,
+             rec.distance_m ? rec.energy_wh * 1000 / rec.distance_m : 0.0, rec.max_speed / 10.0);
+    tft.drawString(str, 5, y + 17, 2);
+
+    snprintf(str, sizeof(str), "%.1f kW  %.1f V min  ", rec.max_power / 1000.0, rec.min_voltage / 10.0);
+    int w = tft.drawString(str, 5, y + 34, 2);
+    if (rec.faults) {
+      tft.setTextColor(TFT_RED, TFT_BLACK);
+      snprintf(str, sizeof(str), "%u faults", rec.faults);
+      tft.drawString(str, 5 + w, y + 34, 2);
+    }
+  }
+
+  tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+  tft.setTextDatum(BC_DATUM);
+  snprintf(str, sizeof(str), "page %lu of %lu", (unsigned long)history_page + 1, (unsigned long)pages);
+  tft.drawString(str, 120, 318, 2);
+}
+
+// swipe up for older rides, down for newer
+void history_screen_page(bool older) {
+  uint32_t count = rides_log.next - rides_first(&rides_log);
+
+  if (older && (history_page + 1) * HISTORY_ROWS < count)
+    history_page++;
+  else if (!older && history_page > 0)
+    history_page--;
+  else
+    return;
+  sched_post(job_render, EV_SCREEN_INIT);
 }
 
 
@@ -567,6 +1694,7 @@ void settings_screen_init(void) {
   tft.drawString("High Batt", 0, 160);
   tft.drawString("Max Power", 0, 200);
   tft.drawString("Wheel circ.", 0, 240);
+  tft.drawString("Profiler", 0, 280);
 
   tft.setTextPadding(tft.textWidth("77777"));
 
@@ -576,6 +1704,7 @@ void settings_screen_init(void) {
   tft.drawFloat(high_batt_limit, 1, 195, 160);
   tft.drawFloat(max_power, 1, 195, 200);
   tft.drawFloat(wheel_circumference, 2, 195, 240);
+  tft.drawString(prof_running() ? "on" : "off", 195, 280);
 }
 
 void settings_screen_update(void) {
@@ -586,6 +1715,7 @@ void settings_screen_update(void) {
   tft.drawFloat(high_batt_limit, 1, 195, 160);
   tft.drawFloat(max_power, 1, 195, 200);
   tft.drawFloat(wheel_circumference, 2, 195, 240);
+  tft.drawString(prof_running() ? "on" : "off", 195, 280);  // swipe up or down to start / stop
 }
 
 /*****************************************************************************************************/
@@ -611,15 +1741,16 @@ void main_screen_init(void) {
   tft.setTextDatum(MC_DATUM);
   tft.drawString("kW", 120, 70, 4);
 
+  ring_init();  // the ring meter is drawn on the first update
+
 
-  // Load the font and create the Sprite for reporting the value
-  spr.loadFont(AA_FONT_LARGE);
-  spr_width = spr.textWidth("7777");  // 7 is widest numeral in this font
-  spr.createSprite(spr_width, spr.fontHeight());
-  spr.fillSprite(TFT_BLACK);
-  spr.setTextColor(TFT_WHITE, TFT_BLACK, true);
-  spr.setTextDatum(MC_DATUM);
-  spr.setTextPadding(spr_width);
+  // Load the font and create the Sprite for reporting the value, the font is read straight
+  // from flash, font_load() only copies it into RAM if it is packed
+  if (!large_font.data && !pal4_font(&large_font, font_load(AA_FONT_LARGE, sizeof(AA_FONT_LARGE))))
+    Serial.println("Large font: out of memory");
+  if (large_font.data && !spr.pix)
+    pal4_create(&spr, pal4_text_width(&large_font, "7777"), large_font.height);  // 7 is widest numeral in this font
+  spr.shown_pal = NULL;  // the screen was cleared, send all of it next time
 
 
   // Plot the label text
@@ -631,14 +1762,10 @@ void main_screen_init(void) {
 
 
 
-  // Load the font and create the Sprite for reporting the voltage
-  vspr.loadFont(AA_FONT_LARGE);
-  vspr_width = vspr.textWidth("77777");  // 7 is widest numeral in this font
-  vspr.createSprite(vspr_width, vspr.fontHeight());
-  vspr.fillSprite(TFT_BLACK);
-  vspr.setTextColor(TFT_WHITE, TFT_BLACK, true);
-  vspr.setTextDatum(MC_DATUM);
-  vspr.setTextPadding(vspr_width);
+  // Create the Sprite for reporting the voltage
+  if (large_font.data && !vspr.pix)
+    pal4_create(&vspr, pal4_text_width(&large_font, "77777"), large_font.height);
+  vspr.shown_pal = NULL;
 
 
   // Plot label texts
@@ -677,9 +1804,24 @@ void main_screen_update(void) {
 /*****************************************************************************************************/
 /*****************************************************************************************************/
 
-void show_power() {
+//
+// The ring meter segments never move, only their colour changes. Each is drawn once with
+// drawWedgeLine into a sprite to get its anti-aliased shape as an alpha mask, after that
+// a segment is redrawn by blending its colour over black with the mask, and only when
+// it changes between lit and dim.
+//
+#define RING_SEGMENTS 19  // -90 to 90 degrees in steps of 10
+#define RING_DIM_COLOUR 0b0101001010001010
+
+struct ring_segment_t {
+  int16_t x, y;  // top left of the mask on the screen
+  uint8_t w, h;
+  uint8_t *mask;  // w * h alpha values
+  int8_t lit;     // -1 = not drawn yet
+};
+ring_segment_t ring[RING_SEGMENTS];
 
-  // Draw a segmented ring meter type display
+void ring_init(void) {
   // Centre of screen
   int cx = tft.width() / 2;
   int cy = 105;  //tft.height() / 2;
@@ -698,6 +1840,138 @@ void show_power() {
   float px2 = 0.0;
   float py2 = 0.0;
 
+  TFT_eSprite mspr = TFT_eSprite(&tft);
+
+  for (int i = 0; i < RING_SEGMENTS; i++) {
+    ring_segment_t *seg = &ring[i];
+
+    seg->lit = -1;
+    if (seg->mask)
+      continue;  // already made
+
+    getCoord(cx, cy, &px1, &py1, &px2, &py2, r1, r2, -90 + i * 10);
+    seg->x = floorf(fminf(px1, px2)) - w2 - 1;
+    seg->y = floorf(fminf(py1, py2)) - w2 - 1;
+    seg->w = ceilf(fmaxf(px1, px2)) + w2 + 2 - seg->x;
+    seg->h = ceilf(fmaxf(py1, py2)) + w2 + 2 - seg->y;
+    seg->mask = (uint8_t *)malloc(seg->w * seg->h);
+    if (!seg->mask || !mspr.createSprite(seg->w, seg->h)) {
+      free(seg->mask);  // made again next time, rather than drawn from garbage
+      seg->mask = NULL;
+      continue;
+    }
+
+    // draw white on black, the green channel is the coverage
+    pix_fill16((uint16_t *)mspr.getPointer(), TFT_BLACK, seg->w * seg->h);
+    mspr.drawWedgeLine(px1 - seg->x, py1 - seg->y, px2 - seg->x, py2 - seg->y, w1, w2, TFT_WHITE, TFT_BLACK);
+    for (int y = 0; y < seg->h; y++) {
+      for (int x = 0; x < seg->w; x++) {
+        uint8_t g = (mspr.readPixel(x, y) >> 5) & 0x3F;
+        seg->mask[y * seg->w + x] = (g << 2) | (g >> 4);
+      }
+    }
+    mspr.deleteSprite();
+  }
+}
+
+//
+// blend one segment onto the screen, row by row so the black corners of its
+// box don't overwrite the neighbouring segments
+//
+void ring_draw(int i, uint16_t color) {
+  ring_segment_t *seg = &ring[i];
+  uint16_t line[64];
+
+  if (!seg->mask || seg->w > 64)
+    return;
+
+  tft.startWrite();
+  for (int y = 0; y < seg->h; y++) {
+    const uint8_t *m = seg->mask + y * seg->w;
+    int start = 0;
+    int end = seg->w;
+
+    while (start < end && !m[start])
+      start++;
+    while (end > start && !m[end - 1])
+      end--;
+    if (start == end)
+      continue;
+
+    pix_blend16(line, m + start, end - start, color, TFT_BLACK, true);  // swapped, as the display wants them
+    tft.pushImage(seg->x + start, seg->y + y, end - start, 1, line);
+  }
+  tft.endWrite();
+}
+
+//
+// send what changed in a palette sprite, expanding one band of lines to RGB565
+// while the band before goes out by DMA
+//
+void pal4_push(pal4_sprite_t *s, int x, int y) {
+  int x0, y0, x1, y1;
+  int b = 0;
+
+  pal4_bytes = 0;
+  if (!s->pix || !s->pal || !pal4_dirty(s, &x0, &y0, &x1, &y1))
+    return;  // nothing changed, nothing sent
+
+  int w = x1 - x0;
+  int lines = pal4_band_pixels / w;
+
+  pal4_pairs(&pal4_table, s->pal);
+  tft.startWrite();
+  for (int row = y0; row < y1; row += lines) {
+    int n = min(lines, y1 - row);
+    uint16_t *band = pal4_band[b];
+
+    b ^= 1;
+    for (int r = 0; r < n; r++)
+      pal4_expand(band + r * w, s->pix + (row + r) * (s->w / 2) + x0 / 2, w / 2, &pal4_table);
+    tft.pushImageDMA(x + x0, y + row, w, n, band);  // waits for the band before to finish
+  }
+  tft.dmaWait();
+  tft.endWrite();
+
+  pal4_shown(s);
+  pal4_bytes = w * (y1 - y0) * 2;
+}
+
+//
+// read back the power reading and compare it with what was sent, if it's wrong twice
+// in a row the SPI clock is too fast for this unit after all
+//
+void spicheck_job(uint32_t events) {
+  static int faults = 0;
+  uint16_t *sent = pal4_band[0];
+  uint16_t *got = pal4_band[1];
+  bool ok = true;
+
+  if (active_screen != AS_MAIN || !spr.shown_pal || !spitune_can_check())
+    return;
+
+  pal4_pairs(&pal4_table, spr.shown_pal);
+  for (int row = 0; row < spr.h && ok; row++) {
+    pal4_expand(sent, spr.shown + row * (spr.w / 2), spr.w / 2, &pal4_table);
+    tft.readRect(120 - spr.w / 2, 80 + row, spr.w, 1, got);
+    for (int x = 0; x < spr.w && ok; x++)
+      ok = (got[x] == sent[x]);  // both in SPI byte order, the palette is and readRect() gives that
+  }
+
+  if (ok) {
+    faults = 0;
+  } else if (++faults >= 2) {
+    faults = 0;
+    spitune_fault(&tft, &preferences);
+    sched_post(job_render, EV_SCREEN_INIT);  // anything could be on the screen, draw it all again
+  }
+}
+
+void show_power() {
+  char str[12];
+  uint32_t data_us = latency.data_us;  // arrival of the frame the reading comes from
+  bool sent = false;
+
   // angle for current power
   // 20kW at max
   int curpow = -90 + (int)(180.0 * fabs(ctr_data.power) / 20.0);
@@ -705,26 +1979,32 @@ void show_power() {
   //Serial.println(curpow);
   //curpow = -90;
 
-  // Wedge line function, an anti-aliased wide line between 2 points, with different
-  // line widths at the two ends. Background colour is black.
-  for (int angle = -90; angle <= 90; angle += 10) {
-    getCoord(cx, cy, &px1, &py1, &px2, &py2, r1, r2, angle);
-    uint16_t color = rainbow(map(angle, -90, 90, 64, 127));
-    if (angle >= curpow) color = 0b0101001010001010;
-    tft.drawWedgeLine(px1, py1, px2, py2, w1, w2, color, TFT_BLACK);
+  // Segmented ring meter, only the segments that changed are redrawn
+  for (int i = 0; i < RING_SEGMENTS; i++) {
+    int angle = -90 + i * 10;
+    int8_t lit = (angle < curpow);
+
+    if (ring[i].lit == lit)
+      continue;
+    ring[i].lit = lit;
+    ring_draw(i, lit ? rainbow(map(angle, -90, 90, 64, 127)) : RING_DIM_COLOUR);
+    sent = true;
   }
 
   // Update the number at the centre of the dial
   if (ctr_data.power == 0)
-    spr.setTextColor(TFT_WHITE, TFT_BLACK, true);  // idle, white
+    spr.pal = &pal_white;  // idle, white
   else if (ctr_data.power < 0)
-    spr.setTextColor(TFT_GREEN, TFT_BLACK, true);  // driving power, green
+    spr.pal = &pal_green;  // driving power, green
   else
-    spr.setTextColor(TFT_RED, TFT_BLACK, true);  // regen power, red
+    spr.pal = &pal_red;  // regen power, red
 
-  spr.drawFloat(fabs(ctr_data.power), 1, spr_width / 2, spr.fontHeight() / 2);
+  snprintf(str, sizeof(str), "%.1f", fabs(ctr_data.power));
+  pal4_text(&spr, &large_font, str);
+  pal4_push(&spr, 120 - spr.w / 2, 80);  // waits for the DMA, so the pixels are on the panel
 
-  spr.pushSprite(120 - spr_width / 2, 80);
+  if (sent || pal4_bytes)  // only a reading that changed shows when its data came
+    latency_shown(&latency, data_us, micros());
 }
 
 
@@ -741,9 +2021,9 @@ void show_battery() {
 
   // Update the voltage text
   sprintf(str, "%3.1f", ctr_data.voltage);
-  vspr.setTextColor(TFT_WHITE, TFT_BLACK, true);
-  vspr.drawString(str, vspr_width / 2, vspr.fontHeight() / 2);
-  vspr.pushSprite(240 - vspr_width, 320 - vspr.fontHeight() + 5);
+  vspr.pal = &pal_white;
+  pal4_text(&vspr, &large_font, str);
+  pal4_push(&vspr, 240 - vspr.w, 320 - vspr.h + 5);
 
 
   float low_limit = 84.0;
@@ -764,6 +2044,13 @@ void show_battery() {
   float range = high_limit - low_limit;
   int topstep = (ctr_data.voltage - low_limit) / (range / (float)steps);
 
+  // from the state of charge once the battery estimator has one, the voltage sags under load
+  portENTER_CRITICAL(&odo_mux);
+  int32_t soc = battery_soc(&battery);
+  portEXIT_CRITICAL(&odo_mux);
+  if (soc >= 0)
+    topstep = ((soc * steps) >> BATTERY_SOC_Q) - 1;
+
   for (int i = 0; i < steps; i++) {
     int n = steps - i;
     int mapmax = steps * steps * steps;
@@ -782,14 +2069,32 @@ void show_gear() {
 
 /*********************************************************/
 
+//
+// one temperature per controller, "62/58" with two
+//
+void show_temps(volatile float *temps, float hottest, int y) {
+  char str[24];
+  int len = 0;
+
+  if (NUM_CONTROLLERS == 1) {
+    tft.drawFloat(hottest, 0, 150, y, 4);
+    return;
+  }
+  for (int i = 0; i < NUM_CONTROLLERS && i < NIMBLE_LINKS; i++)
+    len += snprintf(str + len, sizeof(str) - len, i ? "/%.0f" : "%.0f", temps[i]);
+  tft.setTextPadding(tft.textWidth("888/888", 4));
+  tft.drawString(str, 150, y, 4);
+  tft.setTextPadding(0);
+}
+
 void show_motor_temp() {
-  tft.drawFloat(ctr_data.motor_temp, 0, 150, 135, 4);
+  show_temps(ctr_data.motor_temps, ctr_data.motor_temp, 135);
 }
 
 /*********************************************************/
 
 void show_controller_temp() {
-  tft.drawFloat(ctr_data.controller_temp, 0, 150, 160, 4);
+  show_temps(ctr_data.controller_temps, ctr_data.controller_temp, 160);
 }
 
 
@@ -954,74 +2259,122 @@ std::string string_to_hex(const std::string& input) {
 /*********************************************************/
 
 
+//
+// the controllers connected, a bit for each link
+//
+uint32_t links_up(void) {
+#if USE_NIMBLE
+  uint32_t up = 0;
+
+  for (int i = 0; i < num_links; i++)
+    if (links[i].connected)
+      up |= 1 << i;
+  return up;
+#else
+  return 1;
+#endif
+}
+
 //
 // this callback is called everytime a message comes in on the BLE connection
 // this happens every 30 ms (but is jittery here, due to various delays and message lengths)
 // so the timing between calls are somewhere around 20 to 40 ms
 //
-void message_handler(uint8_t *pData) {
+// With more than one controller each link has its own decoder state, and the frames of all
+// of them come through here from the one NimBLE host task, so they never overlap. Speed,
+// distance, energy and the battery are worked out on the first connected controller's frames
+// only, with the power and currents of all of them added up, so nothing is counted twice
+//
+void message_handler(uint8_t link, uint8_t *pData, uint32_t arrival_us) {
   uint8_t index;
+  fd_words_t words;
+  uint32_t up = links_up();
+  bool primary = (up & ((1u << link) - 1)) == 0;  // no lower link connected
 
-  int16_t current;
-  float rear_wheel_rpm;    // revs per min on rear wheel
-  float distance_per_min;  // distance travelled in m/min
-  float distance;
-  float iq, id, is;
+  int32_t rpm_speed;       // speed from motor rpm, mm/s << SPEED_Q
+  int32_t fused_speed;     // speed fused with the wheel sensor, mm/s << SPEED_Q
+  uint32_t distance;       // distance travelled in mm
+  float energy;            // Wh used since the last msg_1, negative on regen
+  ride_event_e ride_event;
+  static distance_acc_t travelled;  // part of a mm not yet added to the odometers
 
-  static uint32_t last_millis = millis();  // time since last msg_0
+  static uint32_t last_millis = millis();  // time of last msg_0
+  static uint32_t last_power_millis = millis();  // time of last msg_1
 
   uint32_t current_millis = millis();
-  uint32_t delta_t = current_millis - last_millis;  // ms since last call
-  last_millis = current_millis;
+  uint32_t delta_t;
+  uint32_t start = micros();
 
   //std::string str = string_to_hex(std::string((char*)pData, 16));
 
-  pData++;           // skip the 0xAA header
-  index = *pData++;  // get address and inc pointer
-  if (index > 29)    // if invalid address
-    return;          // skip out
+  // split into index and data words, the checksum is not checked as it
+  // hasn't been confirmed against a real controller, only the emulator
+  fd_decode(pData, &words);
+  index = words.index;
+  if (index > FD_MAX_INDEX)  // if invalid address
+    return;                  // skip out
+
+  trace(TR_FRAME, index);
 
 #if ON_SCREEN_MSG_DEBUG
-  // save data to message store, skipping the checksum
-  memcpy(message_store[index], pData, 12);
+  // save data to message store, skipping the header and checksum
+  if (primary)
+    memcpy(message_store[index], pData + 2, 12);
 #endif
 
+  fd_update(&fd_links[link], &words);
+  fd_combine(fd_links, NIMBLE_LINKS, up | (1u << link), &fd_state);
+
+  // the others only add their currents and temperatures
+  if (!primary && index != 4 && index != 13) {
+    trace(TR_DECODE, index, micros() - start);
+    return;
+  }
+
   switch (index) {
     case 0:
-      ctr_data.rpm = ((uint16_t)pData[4] << 8) | pData[5];
+      delta_t = current_millis - last_millis;  // ms since last msg_0
+      last_millis = current_millis;
 
-      // calculate speed
-      rear_wheel_rpm = (float)ctr_data.rpm / 4.0;               // revs per min on rear wheel / gearing
-      distance_per_min = rear_wheel_rpm * wheel_circumference;  // distance travelled in m/min
-      ctr_data.speed = distance_per_min * 0.06;                 // speed in km/h
+      ctr_data.rpm = fd_state.rpm;
 
-      // calculate distance travelled, since last call
-      distance = distance_per_min / 60000.0 * (float)delta_t / 1000.0;  // distance in km
+      // calculate speed, in mm/s << SPEED_Q
+      rpm_speed = rpm_to_speed(ctr_data.rpm, wheel_circumference * 1000.0);
+      fused_speed = wheelspeed_fuse(rpm_speed, current_millis);  // corrected by the wheel sensor, if fitted
 
-      ctr_data.gear = ((pData[2] >> 2) & 0x03);  // Gear, 00=high, 11=mid, 10=low, (00=Disabled)
+      ctr_data.speed = fused_speed * (3.6 / 1000.0 / (1 << SPEED_Q));  // speed in km/h
 
-      ctr_data.gear -= 1;  // massage gear into 1=low, 2=mid, 3=high
-      if (ctr_data.gear > 2)
-        ctr_data.gear = 3;
+      // calculate distance travelled since last call, exact integer mm with the remainder carried over
+      distance = distance_add(&travelled, fused_speed, delta_t);
 
-      iq = (float)(((uint16_t)pData[8] << 8) | pData[9]) / 100.0;    // iq_out in Amps
-      id = (float)(((uint16_t)pData[10] << 8) | pData[11]) / 100.0;  // id_out in Amps
-      is = sqrt(iq * iq + id * id);                                  // calc vector
+      ctr_data.gear = fd_gear(&fd_state);  // 1=low, 2=mid, 3=high
 
-      ctr_data.power = -is * ctr_data.voltage / 1000.0;  // power in kW
+      // riding, stopped or parked. A new ride resets TRIP2
+      ride_event = rs_update(&ride_state, fd_state.rpm, fd_state.iq, distance, delta_t);
+      if (ride_event == RS_START)
+        odo_trip2.reset();
 
-      if ((iq < 0) || (id < 0))  // regen?
-        ctr_data.power = -ctr_data.power;
-
-      // update odometer
-      odo_total.update_speed(ctr_data.speed);
-      odo_trip1.update_speed(ctr_data.speed);
-      odo_trip2.update_speed(ctr_data.speed);
+      // update odometers, all at once
+      portENTER_CRITICAL(&odo_mux);
+      for (int i = 0; i < NUM_ODOMETERS; i++) {
+        odometers[i]->update_speed(ctr_data.speed);
+        odometers[i]->update_distance(distance);
+      }
+      if (ride_event == RS_START) {
+        // the way to being sure it is a ride, this frame's distance is added below
+        odo_trip2.update_distance(ride_state.start_mm - distance);
+        ride_start(&ride, ride_state.start_mm - distance);
+      }
+      ride_move(&ride, &fd_state, ctr_data.speed * 10, distance, delta_t);
+      if (ride_event == RS_RESUME)
+        ride_resume(&ride);
+      portEXIT_CRITICAL(&odo_mux);
+      odometers_mirror();
 
-      // update distance
-      odo_total.update_distance(distance);
-      odo_trip1.update_distance(distance);
-      odo_trip2.update_distance(distance);
+      if (ride_event == RS_END)
+        sched_post(job_persist, EV_RIDE_END);  // into the history, flash is written from loop()
+      if (ride_event != RS_NONE)
+        Serial.printf("Ride %s\r\n", rs_event_name(ride_event));
 
       // --- Serial output for debugging ---
       Serial.println("\n[FarDriver Data Update]");
@@ -1031,35 +2384,51 @@ void message_handler(uint8_t *pData) {
       Serial.println(ctr_data.speed, 2);
       Serial.print("Gear: ");
       Serial.println(ctr_data.gear);
-      Serial.print("Power (kW): ");
-      Serial.println(ctr_data.power, 2);
       break;
 
     case 1:
-      ctr_data.voltage = ((uint16_t)pData[0] << 8) | pData[1];  // battery voltage
-      ctr_data.voltage /= 10.0;                                 // voltage is given in 100mV steps, convert to float
+      delta_t = current_millis - last_power_millis;  // ms since last msg_1
+      last_power_millis = current_millis;
 
-      //current = ((int16_t) pData[6] << 8) | pData[7];     // iQin, negative when driving, positive on regen
-      //power = ((float) current/100.0) * voltage / 1000.0;  // power in kW (neg on driving, pos on regen)
+      ctr_data.voltage = fd_state.voltage / 10.0;  // battery voltage, given in 100mV steps
 
-      odo_total.update_power(-ctr_data.power);
-      odo_trip1.update_power(-ctr_data.power);
-      odo_trip2.update_power(-ctr_data.power);
+      // battery power in kW from iQin and the voltage, negative when driving, positive on regen.
+      // The ring meter, the peak power and the energy all take this one value
+      ctr_data.power = fd_state.power;
+
+      energy = 0;
+      if (delta_t <= DISTANCE_MAX_DT)                  // not across a gap in the messages
+        energy = -ctr_data.power * delta_t / 3600.0;  // kW * ms / 3600 = Wh
+
+      portENTER_CRITICAL(&odo_mux);
+      for (int i = 0; i < NUM_ODOMETERS; i++) {
+        odometers[i]->update_power(-ctr_data.power);
+        odometers[i]->update_energy(energy);
+      }
+      battery_update(&battery, fd_state.iqin, fd_state.voltage, delta_t);  // counts the charge from iQin
+      ride_power(&ride, &fd_state, energy);
+      portEXIT_CRITICAL(&odo_mux);
+      odometers_mirror();
+      battery_mirror();
       // --- Serial output for debugging ---
       Serial.print("Voltage (V): ");
       Serial.println(ctr_data.voltage, 2);
+      Serial.print("Power (kW): ");
+      Serial.println(ctr_data.power, 2);
       break;
 
     case 4:
-      ctr_data.controller_temp = (float)pData[2];  // deg C
+      ctr_data.controller_temps[link] = fd_links[link].controller_temp;
+      ctr_data.controller_temp = (float)fd_state.controller_temp;  // deg C, the hottest
       // --- Serial output for debugging ---
       Serial.print("Controller Temp (C): ");
       Serial.println(ctr_data.controller_temp, 1);
       break;
 
     case 13:
-      ctr_data.motor_temp = (float)pData[0];                     // deg C
-      ctr_data.throttle = ((uint16_t)pData[2] << 8) | pData[3];  // raw ADC reading 0-4095
+      ctr_data.motor_temps[link] = fd_links[link].motor_temp;
+      ctr_data.motor_temp = (float)fd_state.motor_temp;  // deg C, the hottest
+      ctr_data.throttle = fd_state.throttle;             // raw ADC reading 0-4095
       // --- Serial output for debugging ---
       Serial.print("Motor Temp (C): ");
       Serial.println(ctr_data.motor_temp, 1);
@@ -1067,6 +2436,11 @@ void message_handler(uint8_t *pData) {
       Serial.println(ctr_data.throttle);
       break;
   }
+
+  if (primary)
+    latency_frame(&latency, index, &fd_state, arrival_us);  // after ctr_data, so a stamp is never newer than it
+
+  trace(TR_DECODE, index, micros() - start);
 }
 
 
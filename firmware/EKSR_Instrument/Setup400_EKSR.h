@@ -33,7 +33,11 @@
 // FSPI (or VSPI) port (SPI2) used unless following defined. HSPI port is (SPI3) on S3.
 //#define USE_HSPI_PORT
 
-#define SPI_FREQUENCY  40000000       // Maximum for ILI9341
+// The write clock is a variable, tuned for each unit at start up by spitune.cpp in the sketch.
+// It starts at 40 MHz, which every unit so far has managed.
+#include <stdint.h>
+extern uint32_t tft_spi_frequency;
+#define SPI_FREQUENCY  tft_spi_frequency
 
 #define SPI_READ_FREQUENCY  6000000   // 6 MHz is the maximum SPI read speed for the ST7789V
 
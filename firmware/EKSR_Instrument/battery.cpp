@@ -0,0 +1,254 @@
+
+#include "battery.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SOC_FULL (1 << BATTERY_SOC_Q)
+
+// open circuit voltage of a Li-ion (NMC) cell in mV, at 0, 10, .. 100 % state of charge
+static const uint16_t ocv_mv[] = { 3000, 3450, 3550, 3620, 3680, 3740, 3820, 3900, 3980, 4080, 4200 };
+#define OCV_STEPS 10
+
+/*********************************************************/
+
+void battery_init(battery_t *b, uint16_t cells, uint32_t rated_mah) {
+  memset(b, 0, sizeof(battery_t));
+  b->cells = cells;
+  b->rated_mah = rated_mah;
+  b->capacity_mah = rated_mah;  // until one is learnt
+}
+
+/*********************************************************/
+
+//
+// state of charge of a pack at rest, from the cell OCV curve
+//
+int32_t battery_ocv_soc(uint16_t voltage, uint16_t cells) {
+  uint32_t mv = (uint32_t)voltage * 100 / cells;  // per cell
+
+  if (mv <= ocv_mv[0])
+    return 0;
+  for (int i = 0; i < OCV_STEPS; i++) {
+    if (mv < ocv_mv[i + 1])
+      return (i * SOC_FULL + (int32_t)((mv - ocv_mv[i]) * SOC_FULL / (ocv_mv[i + 1] - ocv_mv[i]))) / OCV_STEPS;
+  }
+  return SOC_FULL;
+}
+
+int32_t battery_soc(const battery_t *b) {
+  int64_t soc;
+
+  if (!b->anchored)
+    return -1;
+  soc = b->anchor_soc - b->since_anchor * SOC_FULL / ((int64_t)b->capacity_mah * BATTERY_CAMS_PER_MAH);
+
+  if (soc < 0)
+    return 0;
+  return soc > SOC_FULL ? SOC_FULL : (int32_t)soc;
+}
+
+//
+// energy left, the area under the OCV curve from empty up to the state of charge
+//
+uint32_t battery_remaining_wh(const battery_t *b) {
+  int32_t soc = battery_soc(b);
+  uint64_t area = 0;  // mV << BATTERY_SOC_Q
+
+  if (soc <= 0)
+    return 0;
+
+  int seg = soc * OCV_STEPS >> BATTERY_SOC_Q;
+  uint32_t frac = (soc * OCV_STEPS) & (SOC_FULL - 1);
+
+  for (int i = 0; i < seg; i++)
+    area += (uint64_t)(ocv_mv[i] + ocv_mv[i + 1]) * SOC_FULL / (2 * OCV_STEPS);
+  if (seg < OCV_STEPS) {
+    uint32_t end = ocv_mv[seg] + ((ocv_mv[seg + 1] - ocv_mv[seg]) * frac >> BATTERY_SOC_Q);
+    area += (uint64_t)(ocv_mv[seg] + end) * frac / (2 * OCV_STEPS);
+  }
+
+  // mV * mAh = uWh
+  return area * b->capacity_mah * b->cells / ((uint64_t)SOC_FULL * 1000000);
+}
+
+uint32_t battery_health(const battery_t *b) {
+  return b->capacity_mah * 100 / b->rated_mah;
+}
+
+/*********************************************************/
+
+//
+// the pack has rested and the last anchor is its open circuit voltage. If the state of
+// charge has moved far enough since the anchor learning started from, the charge counted
+// in between gives the capacity
+//
+static void learn(battery_t *b) {
+  if (b->learning) {
+    int32_t swing = b->learn_soc - b->anchor_soc;       // positive when discharged
+    int64_t charge = b->since_learn - b->since_anchor;  // between the two anchors
+
+    if (abs(swing) < BATTERY_LEARN_SWING)
+      return;  // keep the older anchor and learn over more
+
+    if ((swing > 0) == (charge > 0)) {
+      int64_t est = charge * SOC_FULL / swing / BATTERY_CAMS_PER_MAH;  // mAh
+
+      if (est > b->rated_mah / 4 && est < b->rated_mah * 3 / 2) {
+        // the first estimates are averaged, then newer ones weigh in by the swing they had
+        int32_t weight = abs(swing) / 2;
+        if (weight < SOC_FULL / (b->learnt + 1))
+          weight = SOC_FULL / (b->learnt + 1);
+        b->capacity_mah += (est - (int64_t)b->capacity_mah) * weight >> BATTERY_SOC_Q;
+
+        battery_history_t *h = &b->history[b->head];
+        h->capacity = b->capacity_mah / 10;
+        h->resistance = (b->resistance * 10) >> BATTERY_R_Q;
+        h->swing = abs(swing) * 1000 >> BATTERY_SOC_Q;
+        h->cycles = b->discharged * 10 / BATTERY_CAMS_PER_MAH / b->rated_mah;
+        b->head = (b->head + 1) % BATTERY_HISTORY;
+        if (b->learnt < UINT16_MAX)
+          b->learnt++;
+        b->dirty = true;
+      }
+    }
+  }
+
+  b->learning = true;
+  b->learn_soc = b->anchor_soc;
+  b->since_learn = b->since_anchor;
+}
+
+//
+// the voltage follows a current step at once, before the pack starts to relax
+//
+static void step(battery_t *b, int16_t current, uint16_t voltage) {
+  int32_t di = current - b->last_current;
+  int32_t dv = voltage - b->last_voltage;
+
+  if (abs(di) < BATTERY_STEP_CA)
+    return;
+
+  // 0.1 V / 0.01 A = 10 Ohm = 10000 mOhm, the voltage drops as the current goes more negative
+  int32_t r = ((int64_t)dv * 10000 << BATTERY_R_Q) / di;
+  if (r <= 0 || r > (2000 << BATTERY_R_Q))
+    return;  // not the pack, the controller changed something else too
+
+  if (b->resistance)
+    b->resistance += (r - (int32_t)b->resistance) / 16;
+  else
+    b->resistance = r;
+}
+
+//
+// one battery frame, delta_ms after the last one
+//
+void battery_update(battery_t *b, int16_t current, uint16_t voltage, uint32_t delta_ms) {
+  bool counted = b->have_last && (delta_ms <= BATTERY_MAX_DT);
+
+  if (counted) {
+    int64_t q = -(int32_t)current * (int64_t)delta_ms;  // out of the pack
+
+    b->since_anchor += q;
+    b->since_learn += q;
+    if (q > 0)
+      b->discharged += q;
+
+    if (delta_ms <= BATTERY_STEP_MS)
+      step(b, current, voltage);
+  }
+
+  if (abs(current) <= BATTERY_REST_CA) {
+    if (!counted)
+      b->rest_ms = 0;  // don't know what happened in the gap
+    else if (b->rest_ms < BATTERY_REST_MS)
+      b->rest_ms += delta_ms;
+
+    if (b->rest_ms >= BATTERY_REST_MS) {
+      // re-anchored all through the rest, the voltage is still settling
+      b->anchor_soc = battery_ocv_soc(voltage, b->cells);
+      b->since_anchor = 0;
+      b->anchored = true;
+      b->rested = true;
+    } else if (!b->have_last && b->cold_start) {
+      // most likely stood while switched off, good enough for a state of charge but not
+      // to learn a capacity from, so not rested
+      b->anchor_soc = battery_ocv_soc(voltage, b->cells);
+      b->since_anchor = 0;
+      b->anchored = true;
+    }
+  } else {
+    if (b->rested)
+      learn(b);  // from the last, most settled, voltage of the rest
+    b->rested = false;
+    b->rest_ms = 0;
+  }
+
+  b->last_current = current;
+  b->last_voltage = voltage;
+  b->have_last = true;
+}
+
+/*********************************************************/
+
+void battery_save(const battery_t *b, battery_record_t *rec) {
+  memset(rec, 0, sizeof(battery_record_t));  // no random padding in the crc
+  rec->version = BATTERY_RECORD_VERSION;
+  rec->capacity_mah = b->capacity_mah;
+  rec->resistance = b->resistance;
+  rec->discharged_mah = b->discharged / BATTERY_CAMS_PER_MAH;
+  rec->learnt = b->learnt;
+  rec->head = b->head;
+  memcpy(rec->history, b->history, sizeof(rec->history));
+}
+
+//
+// take back what was learnt, the crc has been checked already
+//
+bool battery_restore(battery_t *b, const battery_record_t *rec) {
+  if (rec->version != BATTERY_RECORD_VERSION || !rec->capacity_mah || rec->head >= BATTERY_HISTORY)
+    return false;
+
+  b->capacity_mah = rec->capacity_mah;
+  b->resistance = rec->resistance;
+  b->discharged = rec->discharged_mah * BATTERY_CAMS_PER_MAH;
+  b->learnt = rec->learnt;
+  b->head = rec->head;
+  memcpy(b->history, rec->history, sizeof(b->history));
+  return true;
+}
+
+//
+// the anchor and the charge counted since, for RTC memory. The crc is left to the caller
+//
+void battery_save_live(const battery_t *b, battery_live_t *live) {
+  memset(live, 0, sizeof(battery_live_t));
+  live->version = BATTERY_LIVE_VERSION;
+  live->anchor_soc = b->anchor_soc;
+  live->learn_soc = b->learn_soc;
+  live->since_anchor = b->since_anchor;
+  live->since_learn = b->since_learn;
+  live->discharged = b->discharged;
+  live->anchored = b->anchored;
+  live->learning = b->learning;
+  live->rested = b->rested;
+}
+
+//
+// carry on after a warm reset, the crc has been checked already. The frames start again
+// after a gap, so the rest is counted again from the first one
+//
+bool battery_restore_live(battery_t *b, const battery_live_t *live) {
+  if (live->version != BATTERY_LIVE_VERSION || live->discharged < b->discharged)
+    return false;  // older than the saved record
+
+  b->anchor_soc = live->anchor_soc;
+  b->learn_soc = live->learn_soc;
+  b->since_anchor = live->since_anchor;
+  b->since_learn = live->since_learn;
+  b->discharged = live->discharged;
+  b->anchored = live->anchored;
+  b->learning = live->learning;
+  b->rested = live->rested;
+  return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Battery state of charge and health
+//
+// The battery current (iQin) is counted up over time, so the state of charge follows the
+// charge taken out. When the current has stayed small for BATTERY_REST_MS the pack voltage is
+// close to its open circuit voltage, which gives the state of charge directly, and the count is
+// anchored to it again. Two anchors far enough apart, with the charge counted between them,
+// give the pack's real capacity, and steps in the current give its internal resistance.
+// Both are learnt slowly across rides and saved with a short history in one record.
+//
+// Switched on from power off, the pack has most likely stood, so the first frame with a small
+// current anchors the state of charge. That is only an assumption: learning waits for a rest
+// that was seen. Over a warm reset the anchor and the charge counted since are kept in RTC
+// memory instead, and the reset is a gap in the frames like any other.
+// Updates are integer only and constant time, there is a division only when anchoring or when
+// the current steps.
+//
+// Units are the controller's: current in 0.01 A, negative when driving, voltage in 0.1 V.
+// Charge is counted in 0.01 A * ms, the state of charge is 1 << BATTERY_SOC_Q when full.
+//
+#define BATTERY_SOC_Q          16
+#define BATTERY_R_Q            8                             // fraction bits of the resistance in mOhm
+#define BATTERY_MAX_DT         2000                          // ms, longer gaps between frames are not counted
+#define BATTERY_REST_CA        50                            // 0.5 A at most while the pack rests
+#define BATTERY_REST_MS        60000                         // of rest before the voltage is open circuit
+#define BATTERY_LEARN_SWING    ((1 << BATTERY_SOC_Q) / 5)    // state of charge change to learn the capacity over
+#define BATTERY_STEP_CA        1000                          // 10 A at least of current step for the resistance
+#define BATTERY_STEP_MS        500                           // between the two frames of a step, at most
+#define BATTERY_HISTORY        16
+#define BATTERY_RECORD_VERSION 1
+#define BATTERY_LIVE_VERSION   1
+
+#define BATTERY_CAMS_PER_MAH 360000LL  // 0.01 A * ms in a mAh
+
+// one capacity estimate, as learnt
+typedef struct {
+  uint16_t capacity;    // 10 mAh
+  uint16_t resistance;  // 0.1 mOhm
+  uint16_t swing;       // state of charge change it was learnt over, 0.1 %
+  uint16_t cycles;      // equivalent full cycles of the pack by then, 0.1
+} battery_history_t;
+
+// what is kept over power off, in a single NVS blob
+typedef struct {
+  uint32_t version;
+  uint32_t capacity_mah;    // learnt capacity
+  uint32_t resistance;      // learnt internal resistance, mOhm << BATTERY_R_Q
+  uint32_t discharged_mah;  // taken out over the pack's life
+  uint16_t learnt;          // capacity estimates taken in
+  uint16_t head;            // next history entry
+  battery_history_t history[BATTERY_HISTORY];
+  uint32_t crc;  // of everything above
+} battery_record_t;
+
+// the state of charge as it is, kept in RTC memory over warm resets
+typedef struct {
+  uint32_t version;
+  uint32_t seq;
+  int32_t anchor_soc;
+  int32_t learn_soc;
+  int64_t since_anchor;
+  int64_t since_learn;
+  uint64_t discharged;
+  uint8_t anchored, learning, rested;
+  uint8_t pad;
+  uint32_t crc;  // of everything above
+} battery_live_t;
+
+typedef struct {
+  // the pack
+  uint16_t cells;  // in series
+  uint32_t rated_mah;
+
+  // learnt
+  uint32_t capacity_mah;
+  uint32_t resistance;
+  uint64_t discharged;  // 0.01 A * ms
+  uint16_t learnt;
+  uint16_t head;
+  battery_history_t history[BATTERY_HISTORY];
+  bool dirty;  // learnt something since the last save
+
+  // state of charge, from the last anchor and the charge taken out since
+  bool anchored;
+  int32_t anchor_soc;
+  int64_t since_anchor;
+
+  // capacity learning, from the first anchor it is learnt over
+  bool learning;
+  int32_t learn_soc;
+  int64_t since_learn;
+
+  // rest detection and resistance steps
+  bool cold_start;  // switched on from power off, the first frame may anchor
+  uint32_t rest_ms;
+  bool rested;  // rested long enough to anchor, capacity is learnt when the rest ends
+  bool have_last;
+  int16_t last_current;
+  uint16_t last_voltage;
+} battery_t;
+
+void battery_init(battery_t *b, uint16_t cells, uint32_t rated_mah);
+void battery_update(battery_t *b, int16_t current, uint16_t voltage, uint32_t delta_ms);
+
+int32_t battery_ocv_soc(uint16_t voltage, uint16_t cells);
+int32_t battery_soc(const battery_t *b);  // -1 until the first anchor
+uint32_t battery_remaining_wh(const battery_t *b);
+uint32_t battery_health(const battery_t *b);  // learnt capacity in % of rated
+
+void battery_save(const battery_t *b, battery_record_t *rec);
+bool battery_restore(battery_t *b, const battery_record_t *rec);
+void battery_save_live(const battery_t *b, battery_live_t *live);
+bool battery_restore_live(battery_t *b, const battery_live_t *live);
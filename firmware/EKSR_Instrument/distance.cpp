@@ -0,0 +1,21 @@
+
+#include "distance.h"
+
+#define FRAC_PER_MM (1000ULL << SPEED_Q)
+
+//
+// integrate speed over delta_ms
+// returns the whole millimetres travelled, the rest is carried in acc
+//
+uint32_t distance_add(distance_acc_t *acc, int32_t speed, uint32_t delta_ms) {
+  uint32_t mm;
+
+  if (speed <= 0 || delta_ms > DISTANCE_MAX_DT)
+    return 0;
+
+  acc->frac += (uint64_t)speed * delta_ms;
+  mm = acc->frac / FRAC_PER_MM;
+  acc->frac -= (uint64_t)mm * FRAC_PER_MM;
+
+  return mm;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Distance integration
+//
+// Speeds are in mm/s with SPEED_Q fractional bits (1 mm/s == 1 um/ms), so
+// speed * ms is an exact integer and distance can be kept in whole millimetres
+// with the remainder carried over. Nothing is lost, however large the total gets.
+//
+#define SPEED_Q 8
+
+#define DISTANCE_MAX_DT 2000  // ms, longer gaps between messages are not integrated
+
+typedef struct {
+  uint64_t frac;  // distance not yet counted, in 1/(1000 << SPEED_Q) mm
+} distance_acc_t;
+
+// speed from motor rpm: rpm / 4 (gearing) * circumference / 60 s
+static inline int32_t rpm_to_speed(uint16_t rpm, uint32_t circumference_mm) {
+  return ((uint32_t)rpm * circumference_mm << (SPEED_Q - 4)) / 15;
+}
+
+uint32_t distance_add(distance_acc_t *acc, int32_t speed, uint32_t delta_ms);
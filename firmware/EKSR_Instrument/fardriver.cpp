@@ -0,0 +1,131 @@
+
+#include "fardriver.h"
+
+#include <string.h>
+
+/*********************************************************/
+
+uint8_t fd_checksum(const uint8_t *frame) {
+  uint8_t sum = 0;
+
+  for (int i = 1; i < 14; i++)
+    sum ^= frame[i];
+  return sum;
+}
+
+/*********************************************************/
+
+//
+// split a frame into its index and data words, returns true if the header and checksum are right
+//
+bool fd_decode(const uint8_t *frame, fd_words_t *out) {
+  out->index = frame[1];
+  out->valid = (frame[0] == FD_HEADER) && (fd_checksum(frame) == frame[14]);
+  for (int i = 0; i < 6; i++)
+    out->w[i] = ((uint16_t)frame[2 + 2 * i] << 8) | frame[3 + 2 * i];
+  out->reserved = 0;
+
+  return out->valid;
+}
+
+//
+// n frames stored back to back
+//
+void fd_decode_batch(const uint8_t *frames, size_t n, fd_words_t *out) {
+  for (size_t i = 0; i < n; i++)
+    fd_decode(frames + i * FD_FRAME_LEN, &out[i]);
+}
+
+/*********************************************************/
+
+//
+// battery (DC bus) power in kW, negative when driving and positive on regen, as iqin is.
+// The motor current vector can't give this: iq*id says nothing of the motor's voltage, and
+// id is negative whenever the field is weakened, driving or not.
+//
+static float fd_power(const fd_state_t *s) {
+  return (s->iqin / 100.0f) * (s->voltage / 10.0f) / 1000.0f;
+}
+
+//
+// take the values out of a frame, returns the frame index or -1 if it's not one we know
+//
+int fd_update(fd_state_t *s, const fd_words_t *w) {
+  switch (w->index) {
+    case 0:
+      s->gear_bits = w->w[1] >> 8;
+      s->rpm = w->w[2];
+      s->flags = w->w[3];
+      s->iq = (int16_t)w->w[4];
+      s->id = (int16_t)w->w[5];
+      return 0;
+
+    case 1:
+      s->voltage = w->w[0];
+      s->iqin = (int16_t)w->w[3];
+      s->power = fd_power(s);  // both from this frame, so they are from the same moment
+      return 1;
+
+    case 4:
+      s->controller_temp = w->w[1] >> 8;
+      return 4;
+
+    case 13:
+      s->motor_temp = w->w[0] >> 8;
+      s->throttle = w->w[1];
+      return 13;
+  }
+  return -1;
+}
+
+/*********************************************************/
+
+static int16_t clamp16(int32_t v) {
+  return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+//
+// one vehicle from several controllers, e.g. front and rear hub motors on one battery.
+// Currents and power add up, flags are or'ed and the temperatures are the hottest. Speed,
+// gear, voltage and throttle are the first controller's. Only the links in mask count
+//
+void fd_combine(const fd_state_t *links, int n, uint32_t mask, fd_state_t *out) {
+  int32_t iq = 0, id = 0, iqin = 0;
+  bool first = true;
+
+  memset(out, 0, sizeof(fd_state_t));
+  for (int i = 0; i < n; i++) {
+    const fd_state_t *s = &links[i];
+
+    if (!(mask & (1u << i)))
+      continue;
+    if (first) {
+      *out = *s;
+      out->power = 0;
+      first = false;
+    }
+    out->flags |= s->flags;
+    iq += s->iq;
+    id += s->id;
+    iqin += s->iqin;
+    out->power += s->power;
+    if (s->controller_temp > out->controller_temp)
+      out->controller_temp = s->controller_temp;
+    if (s->motor_temp > out->motor_temp)
+      out->motor_temp = s->motor_temp;
+  }
+  out->iq = clamp16(iq);  // held at 327 A, as one controller's are
+  out->id = clamp16(id);
+  out->iqin = clamp16(iqin);
+}
+
+/*********************************************************/
+
+//
+// gear bits 00=high, 11=mid, 10=low (00=Disabled), massaged into 1=low, 2=mid, 3=high
+//
+uint8_t fd_gear(const fd_state_t *s) {
+  uint8_t gear = ((s->gear_bits >> 2) & 0x03) - 1;
+
+  return gear > 2 ? 3 : gear;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// FarDriver controller frames
+//
+// Every BLE notification is one 16 byte frame:
+//   0      0xAA header
+//   1      index, which group of values the frame carries (0-29)
+//   2-13   12 data bytes, six big endian 16 bit words
+//   14     checksum, XOR of bytes 1-13
+//   15     0
+//
+// Shared by the firmware and the host tools, so they all decode frames the same way.
+//
+#define FD_FRAME_LEN 16
+#define FD_HEADER    0xAA
+#define FD_MAX_INDEX 29
+
+// a frame with its data words in host order, 16 bytes so batches can be decoded with vector shuffles
+typedef struct {
+  uint8_t index;
+  uint8_t valid;  // header and checksum correct
+  uint16_t w[6];  // data words
+  uint16_t reserved;
+} fd_words_t;
+
+// the latest values from all frames, in the controller's units
+typedef struct {
+  uint16_t rpm;              // index 0 word 2
+  uint8_t gear_bits;         // index 0 byte 2, gear in bits 2-3
+  uint16_t flags;            // index 0 word 3, status and error flags
+  int16_t iq, id;            // index 0 words 4, 5, motor current vector, 0.01 A
+  uint16_t voltage;          // index 1 word 0, 0.1 V
+  int16_t iqin;              // index 1 word 3, battery current, 0.01 A, negative when driving
+  uint8_t controller_temp;   // index 4 byte 2, deg C
+  uint8_t motor_temp;        // index 13 byte 0, deg C
+  uint16_t throttle;         // index 13 word 1, raw ADC reading 0-4095
+  float power;               // battery power in kW from iqin and voltage, negative when driving
+} fd_state_t;
+
+// capture files are a sequence of these, little endian, no header
+typedef struct {
+  uint32_t ms;  // when the frame arrived
+  uint8_t frame[FD_FRAME_LEN];
+} fd_capture_t;
+
+uint8_t fd_checksum(const uint8_t *frame);
+bool fd_decode(const uint8_t *frame, fd_words_t *out);
+void fd_decode_batch(const uint8_t *frames, size_t n, fd_words_t *out);
+int fd_update(fd_state_t *s, const fd_words_t *w);
+void fd_combine(const fd_state_t *links, int n, uint32_t mask, fd_state_t *out);
+uint8_t fd_gear(const fd_state_t *s);
@@ -0,0 +1,92 @@
+
+#include "fontpack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*********************************************************/
+
+size_t fontpack_size(const uint8_t *font) {
+  if (memcmp(font, FONTPACK_MAGIC, 4) != 0)
+    return 0;
+  return font[4] | (font[5] << 8) | (font[6] << 16) | ((uint32_t)font[7] << 24);
+}
+
+//
+// whole runs at a time with memcpy and memset, the bitmaps are mostly long runs of 0x00 and 0xFF
+//
+size_t fontpack_unpack(const uint8_t *font, size_t font_len, uint8_t *dst, size_t dst_len) {
+  size_t size = fontpack_size(font);
+  const uint8_t *src = font + FONTPACK_HEADER;
+  const uint8_t *end = font + font_len;
+  uint8_t *out = dst;
+
+  if (!size || size > dst_len || font_len < FONTPACK_HEADER)
+    return 0;
+
+  while (src < end) {
+    uint8_t c = *src++;
+    size_t n;
+
+    if (c < 0x80) {
+      n = c + 1;
+      if (n > (size_t)(end - src) || n > (size_t)(dst + size - out))
+        return 0;
+      memcpy(out, src, n);
+      src += n;
+    } else {
+      n = c - 0x80 + FONTPACK_MIN_RUN;
+      if (src == end || n > (size_t)(dst + size - out))
+        return 0;
+      memset(out, *src++, n);
+    }
+    out += n;
+  }
+
+  return (out == dst + size) ? size : 0;
+}
+
+/*********************************************************/
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+#define FONT_CACHE 4
+
+static struct {
+  const uint8_t *packed;
+  uint8_t *font;
+} font_cache[FONT_CACHE];
+
+//
+// sprites that share a font share the unpacked copy, it is kept for good
+//
+const uint8_t *font_load(const uint8_t *font, size_t font_len) {
+  size_t size = fontpack_size(font);
+  uint32_t start = micros();
+  int i;
+
+  if (!size)
+    return font;  // plain VLW, used straight from flash
+
+  for (i = 0; i < FONT_CACHE && font_cache[i].packed; i++)
+    if (font_cache[i].packed == font)
+      return font_cache[i].font;
+  if (i == FONT_CACHE)
+    return NULL;
+
+  uint8_t *ram = (uint8_t *)malloc(size);
+  if (!ram)
+    return NULL;
+  if (!fontpack_unpack(font, font_len, ram, size)) {
+    free(ram);
+    return NULL;
+  }
+
+  font_cache[i].packed = font;
+  font_cache[i].font = ram;
+  Serial.printf("Font unpacked: %u -> %u bytes in %lu us\n", (unsigned)font_len, (unsigned)size,
+                (unsigned long)(micros() - start));
+  return ram;
+}
+#endif
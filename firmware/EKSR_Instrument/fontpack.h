@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Packed smooth fonts
+//
+// host/fontpack subsets a VLW font to the glyphs a widget needs and can RLE compress it.
+// A packed font starts with FONTPACK_MAGIC and the unpacked size (32 bit little endian),
+// followed by runs, each starting with a control byte:
+//   0x00-0x7F  n + 1 literal bytes follow
+//   0x80-0xFF  the next byte repeated n - 0x80 + FONTPACK_MIN_RUN times
+// Plain VLW fonts start with a big endian glyph count, so its first byte is 0 and they
+// can be told apart from packed ones.
+//
+// TFT_eSPI and pal4 read glyphs straight from the font, so a packed one is unpacked into RAM
+// and kept there. That only pays off where flash is short and RAM is not: the large font
+// saves 2.4 KB of flash packed, for 5.7 KB of RAM and an unpack at start up, so it isn't.
+//
+#define FONTPACK_MAGIC   "FPZ1"
+#define FONTPACK_HEADER  8
+#define FONTPACK_MIN_RUN 3
+
+// size of the unpacked font, 0 if it isn't packed
+size_t fontpack_size(const uint8_t *font);
+
+// unpack into dst, returns the unpacked size or 0 if the data is bad or dst too small
+size_t fontpack_unpack(const uint8_t *font, size_t font_len, uint8_t *dst, size_t dst_len);
+
+#ifdef ARDUINO
+// the font ready for loadFont(), plain fonts as they are, packed ones unpacked into RAM once
+// and kept; NULL if out of memory
+const uint8_t *font_load(const uint8_t *font, size_t font_len);
+#endif
@@ -0,0 +1,129 @@
+
+#include "gesture.h"
+
+#include <stdlib.h>
+
+typedef enum {
+  GS_IDLE,      // not touched
+  GS_PRESSING,  // touched, waiting for the press to be stable
+  GS_DOWN,      // touched
+  GS_HELD,      // long press reported, waiting for release
+} gesture_state_e;
+
+/*********************************************************/
+
+void gesture_init(gesture_state_t *g) {
+  g->state = GS_IDLE;
+  g->count = 0;
+  g->samples = 0;
+}
+
+/*********************************************************/
+
+//
+// classify a completed touch from its travel and duration
+//
+static gesture_e classify(gesture_state_t *g) {
+  int dx = (int)g->x - (int)g->x0;
+  int dy = (int)g->y - (int)g->y0;
+  int ax = abs(dx);
+  int ay = abs(dy);
+
+  if (ax <= GESTURE_TAP_MOVE && ay <= GESTURE_TAP_MOVE)
+    return GESTURE_TAP;
+
+  if (g->samples > GESTURE_SWIPE_TIME)
+    return GESTURE_NONE;  // slow drag, not a swipe
+
+  // must be mostly along one axis, diagonals are ignored
+  if (ax >= GESTURE_SWIPE_MOVE && ax > 2 * ay)
+    return dx < 0 ? GESTURE_SWIPE_LEFT : GESTURE_SWIPE_RIGHT;
+  if (ay >= GESTURE_SWIPE_MOVE && ay > 2 * ax)
+    return dy < 0 ? GESTURE_SWIPE_UP : GESTURE_SWIPE_DOWN;
+
+  return GESTURE_NONE;
+}
+
+/*********************************************************/
+
+//
+// feed one sample, returns the gesture when one is recognised
+//
+gesture_t gesture_feed(gesture_state_t *g, bool pressed, uint16_t x, uint16_t y) {
+  gesture_t result = { GESTURE_NONE, 0, 0 };
+
+  switch (g->state) {
+    case GS_IDLE:
+      if (pressed) {
+        g->state = GS_PRESSING;
+        g->count = 1;
+        g->samples = 1;
+        g->x0 = g->x = x;
+        g->y0 = g->y = y;
+      }
+      break;
+
+    case GS_PRESSING:
+      if (!pressed) {
+        g->state = GS_IDLE;  // too short, a glitch
+        break;
+      }
+      g->samples++;
+      g->x = (g->x + x) / 2;
+      g->y = (g->y + y) / 2;
+      if (++g->count >= GESTURE_DEBOUNCE) {
+        g->state = GS_DOWN;
+        g->count = 0;
+        g->x0 = g->x;  // averaged start position
+        g->y0 = g->y;
+      }
+      break;
+
+    case GS_DOWN:
+      g->samples++;
+      if (pressed) {
+        g->count = 0;
+        g->x = (g->x + x) / 2;  // the panel is noisy, low pass the position
+        g->y = (g->y + y) / 2;
+
+        if (g->samples >= GESTURE_LONG_TIME
+            && abs((int)g->x - (int)g->x0) <= GESTURE_TAP_MOVE
+            && abs((int)g->y - (int)g->y0) <= GESTURE_TAP_MOVE) {
+          g->state = GS_HELD;
+          result.type = GESTURE_LONG_PRESS;
+        }
+      } else if (++g->count >= GESTURE_RELEASE) {
+        g->samples -= g->count;  // don't count the release time
+        g->state = GS_IDLE;
+        result.type = classify(g);
+      }
+      break;
+
+    case GS_HELD:
+      if (pressed)
+        g->count = 0;
+      else if (++g->count >= GESTURE_RELEASE)
+        g->state = GS_IDLE;
+      break;
+  }
+
+  if (result.type != GESTURE_NONE) {
+    result.x = g->x0;
+    result.y = g->y0;
+  }
+  return result;
+}
+
+/*********************************************************/
+
+const char *gesture_name(gesture_e type) {
+  switch (type) {
+    case GESTURE_TAP: return "tap";
+    case GESTURE_LONG_PRESS: return "long";
+    case GESTURE_SWIPE_LEFT: return "left";
+    case GESTURE_SWIPE_RIGHT: return "right";
+    case GESTURE_SWIPE_UP: return "up";
+    case GESTURE_SWIPE_DOWN: return "down";
+    default: return "none";
+  }
+}
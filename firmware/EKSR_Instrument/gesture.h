@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Gesture recogniser for the resistive touch panel
+//
+// Fed with one touch sample every GESTURE_SAMPLE_MS, all timing is counted in samples.
+// A resistive panel drops out for a sample or two while a finger (or glove) slides,
+// so both press and release are debounced.
+//
+#define GESTURE_SAMPLE_MS  10
+
+#define GESTURE_DEBOUNCE    2    // samples pressed before a touch counts
+#define GESTURE_RELEASE     3    // samples released before a touch ends
+#define GESTURE_LONG_TIME   60   // samples (600 ms) held still for a long press
+#define GESTURE_SWIPE_TIME  80   // samples (800 ms) at most for a swipe
+#define GESTURE_SWIPE_MOVE  50   // pixels of travel for a swipe
+#define GESTURE_TAP_MOVE    20   // pixels of travel at most for a tap or long press
+
+typedef enum {
+  GESTURE_NONE,
+  GESTURE_TAP,
+  GESTURE_LONG_PRESS,
+  GESTURE_SWIPE_LEFT,
+  GESTURE_SWIPE_RIGHT,
+  GESTURE_SWIPE_UP,
+  GESTURE_SWIPE_DOWN,
+} gesture_e;
+
+typedef struct {
+  gesture_e type;
+  uint16_t x, y;  // where the touch started
+} gesture_t;
+
+typedef struct {
+  uint8_t state;
+  uint8_t count;      // debounce counter
+  uint16_t samples;   // samples since the touch started
+  uint16_t x0, y0;    // start position
+  uint16_t x, y;      // filtered current position
+} gesture_state_t;
+
+void gesture_init(gesture_state_t *g);
+gesture_t gesture_feed(gesture_state_t *g, bool pressed, uint16_t x, uint16_t y);
+const char *gesture_name(gesture_e type);
@@ -0,0 +1,116 @@
+
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*********************************************************/
+
+void latency_init(latency_t *l) {
+  memset(l, 0, sizeof(latency_t));
+}
+
+//
+// clear the histograms and start collecting
+//
+void latency_start(latency_t *l) {
+  l->on = false;  // the BLE task leaves it alone while it's cleared
+  latency_init(l);
+  l->on = true;
+}
+
+/*********************************************************/
+
+static int bucket(uint32_t us) {
+  if (us < 2 * LAT_SUB)
+    return us;
+
+  int octave = 31 - __builtin_clz(us);  // 3 and up
+  if (octave >= LAT_OCTAVES + 1)
+    return LAT_BUCKETS - 1;
+  return (octave - 1) * LAT_SUB + ((us >> (octave - 2)) & (LAT_SUB - 1));
+}
+
+uint32_t lat_bucket_floor(int b) {
+  if (b < 2 * LAT_SUB)
+    return b;
+  return (uint32_t)(LAT_SUB + b % LAT_SUB) << (b / LAT_SUB - 1);
+}
+
+void lat_hist_add(lat_hist_t *h, uint32_t us) {
+  h->count[bucket(us)]++;
+  h->n++;
+  h->total += us;
+  if (us > h->max)
+    h->max = us;
+}
+
+uint32_t lat_percentile(const lat_hist_t *h, int pct) {
+  uint64_t want = ((uint64_t)h->n * pct + 99) / 100;
+  uint64_t seen = 0;
+
+  if (!h->n)
+    return 0;
+  for (int b = 0; b < LAT_BUCKETS; b++) {
+    seen += h->count[b];
+    if (seen >= want) {
+      if (b == LAT_BUCKETS - 1 || lat_bucket_floor(b + 1) > h->max)
+        return h->max;
+      return lat_bucket_floor(b + 1) - 1;
+    }
+  }
+  return h->max;
+}
+
+/*********************************************************/
+
+static void end_step(latency_t *l, uint16_t throttle) {
+  l->waiting = false;
+  l->ref_throttle = throttle;
+}
+
+void latency_frame(latency_t *l, uint8_t index, const fd_state_t *s, uint32_t arrival_us) {
+  if (!l->on)
+    return;
+
+  if (l->waiting && (arrival_us - l->step_us) > LAT_TIMEOUT_US) {
+    l->timeouts++;
+    end_step(l, l->step_throttle);  // a move since then is a step of its own
+  }
+
+  switch (index) {
+    case 0:
+      if (l->waiting && ((int32_t)s->iq - l->step_iq) * l->dir >= LAT_IQ_STEP) {
+        lat_hist_add(&l->hist[LAT_THROTTLE_TORQUE], arrival_us - l->step_us);
+        end_step(l, s->throttle);
+      }
+      break;
+
+    case 1:
+      l->data_us = arrival_us;
+      break;
+
+    case 13:
+      if (!l->have_throttle) {
+        l->have_throttle = true;
+        l->ref_throttle = s->throttle;
+      } else if (!l->waiting && abs((int32_t)s->throttle - l->ref_throttle) >= LAT_THROTTLE_STEP) {
+        l->waiting = true;
+        l->dir = s->throttle > l->ref_throttle ? 1 : -1;
+        l->step_us = arrival_us;
+        l->step_throttle = s->throttle;
+        l->step_iq = s->iq;
+      }
+      break;
+  }
+}
+
+//
+// each battery frame is measured once, the first time a reading drawn from it is sent
+//
+void latency_shown(latency_t *l, uint32_t data_us, uint32_t done_us) {
+  if (!l->on || !data_us || data_us == l->shown_us)
+    return;
+  l->shown_us = data_us;
+  lat_hist_add(&l->hist[LAT_DATA_PHOTON], done_us - data_us);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+
+#include "fardriver.h"
+
+//
+// Control loop latency analyser
+//
+// Every frame is stamped with its arrival time in the BLE callback, and the stamp goes along
+// with the values taken out of it. Two latencies are collected into histograms:
+//
+//   throttle to torque  a step in the throttle (index 13) to the motor current iq (index 0)
+//                       following it, as the instrument sees them: the controller's response
+//                       and how often it sends each index
+//   data to photon      a battery frame (index 1) to the power reading drawn from it being on
+//                       the panel: BLE, decoding, waiting for the render job, drawing and SPI
+//
+// A throttle step is a change of LAT_THROTTLE_STEP from where the throttle was when the last
+// measurement ended, the response is when iq has moved LAT_IQ_STEP the same way. Steps with no
+// response within LAT_TIMEOUT_US (the motor at its limit, or braking) are only counted.
+//
+// Histogram buckets are 1 us wide up to 8 us, then LAT_SUB to each doubling, so percentiles are
+// within 1/LAT_SUB of the time. Off unless switched on, then a few compares per frame.
+//
+#define LAT_THROTTLE_STEP 200      // ADC counts, of 4095
+#define LAT_IQ_STEP       300      // 3 A
+#define LAT_TIMEOUT_US    2000000
+#define LAT_SUB           4
+#define LAT_OCTAVES       23       // up to 16 s
+#define LAT_BUCKETS       ((LAT_OCTAVES - 1) * LAT_SUB + LAT_SUB)
+
+typedef enum {
+  LAT_THROTTLE_TORQUE,
+  LAT_DATA_PHOTON,
+  LAT_HISTS,
+} lat_hist_e;
+
+typedef struct {
+  uint32_t count[LAT_BUCKETS];
+  uint32_t n;
+  uint32_t max;     // us
+  uint64_t total;   // us
+} lat_hist_t;
+
+typedef struct {
+  bool on;
+  lat_hist_t hist[LAT_HISTS];
+  uint32_t timeouts;  // throttle steps with no response
+
+  // throttle step waiting for its response
+  bool have_throttle;
+  bool waiting;
+  int8_t dir;              // of the step, 1 up or -1 down
+  uint16_t ref_throttle;   // where the throttle was when the last measurement ended, or its step
+  uint32_t step_us;        // arrival of the frame with the step
+  uint16_t step_throttle;
+  int16_t step_iq;         // iq when the step came
+
+  // the power reading
+  uint32_t data_us;   // arrival of the newest battery frame
+  uint32_t shown_us;  // arrival of the last one measured on the panel
+} latency_t;
+
+void latency_init(latency_t *l);
+void latency_start(latency_t *l);
+
+// after fd_update() with the frame, arrival_us from the BLE callback
+void latency_frame(latency_t *l, uint8_t index, const fd_state_t *s, uint32_t arrival_us);
+
+// the power reading from the frame that arrived at data_us is on the panel at done_us
+void latency_shown(latency_t *l, uint32_t data_us, uint32_t done_us);
+
+void lat_hist_add(lat_hist_t *h, uint32_t us);
+uint32_t lat_bucket_floor(int bucket);                   // us
+uint32_t lat_percentile(const lat_hist_t *h, int pct);  // us, the top of its bucket, or the max
@@ -0,0 +1,135 @@
+
+#include "lz.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_MASK (LZ_WINDOW - 1)
+
+/*********************************************************/
+
+void lz_decoder_init(lz_decoder_t *d) {
+  memset(d, 0, sizeof(lz_decoder_t));
+  d->flags = 1;
+  d->low = -1;
+}
+
+size_t lz_decode(lz_decoder_t *d, const uint8_t *in, size_t len, size_t *used, uint8_t *out, size_t room) {
+  size_t i = 0, o = 0;
+
+  while (o < room) {
+    if (d->left) {
+      uint8_t c = d->window[(d->pos - d->dist) & WINDOW_MASK];
+      d->window[d->pos++ & WINDOW_MASK] = c;
+      out[o++] = c;
+      d->left--;
+      continue;
+    }
+    if (i == len)
+      break;
+
+    if (d->flags == 1)
+      d->flags = 0x100 | in[i++];
+    else if (d->low >= 0) {
+      uint8_t high = in[i++];
+      d->dist = (((high >> 4) << 8) | d->low) + 1;
+      d->left = (high & 15) + LZ_MIN_MATCH;
+      d->low = -1;
+      d->flags >>= 1;
+    } else if (d->flags & 1) {
+      uint8_t c = in[i++];
+      d->window[d->pos++ & WINDOW_MASK] = c;
+      out[o++] = c;
+      d->flags >>= 1;
+    } else
+      d->low = in[i++];
+  }
+
+  *used = i;
+  return o;
+}
+
+/*********************************************************/
+
+size_t lz_bound(size_t n) {
+  return n + n / 8 + 2;
+}
+
+#define HASH_BITS 16
+#define MAX_CHAIN 256
+
+static uint32_t hash3(const uint8_t *p) {
+  return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//
+// greedy, with hash chains over the window. Only runs on the host, the instrument only decodes
+//
+size_t lz_encode(const uint8_t *in, size_t n, uint8_t *out) {
+  int32_t *head = (int32_t *)malloc(sizeof(int32_t) << HASH_BITS);
+  int32_t *prev = (int32_t *)malloc(sizeof(int32_t) * LZ_WINDOW);
+  size_t o = 0, flags_at = 0;
+  int bits = 8;
+
+  if (!head || !prev) {
+    free(head);
+    free(prev);
+    return 0;
+  }
+  memset(head, 0xFF, sizeof(int32_t) << HASH_BITS);
+
+  for (size_t i = 0; i < n;) {
+    size_t best = 0, dist = 0;
+
+    if (bits == 8) {
+      flags_at = o++;
+      out[flags_at] = 0;
+      bits = 0;
+    }
+
+    if (i + LZ_MIN_MATCH <= n) {
+      size_t most = n - i < LZ_MAX_MATCH ? n - i : LZ_MAX_MATCH;
+      int32_t p = head[hash3(in + i)];
+
+      for (int chain = 0; p >= 0 && i - p <= LZ_WINDOW && chain < MAX_CHAIN; chain++) {
+        size_t len = 0;
+        while (len < most && in[p + len] == in[i + len])
+          len++;
+        if (len > best) {
+          best = len;
+          dist = i - p;
+          if (len == most)
+            break;
+        }
+        int32_t next = prev[p & WINDOW_MASK];
+        if (next >= p)
+          break;  // that slot has been taken by a newer position
+        p = next;
+      }
+    }
+
+    if (best < LZ_MIN_MATCH)
+      best = 1;
+    else {
+      out[o++] = (dist - 1) & 0xFF;
+      out[o++] = (((dist - 1) >> 8) << 4) | (best - LZ_MIN_MATCH);
+    }
+    if (best == 1) {
+      out[flags_at] |= 1 << bits;
+      out[o++] = in[i];
+    }
+    bits++;
+
+    for (size_t end = i + best; i < end; i++) {
+      if (i + LZ_MIN_MATCH <= n) {
+        uint32_t h = hash3(in + i);
+        prev[i & WINDOW_MASK] = head[h];
+        head[h] = i;
+      }
+    }
+  }
+
+  free(head);
+  free(prev);
+  return o;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// LZSS compression for firmware images
+//
+// A flags byte comes before every 8 tokens, bit 0 first: 1 is a literal byte, 0 a match of
+// two bytes, the distance back less one in the low byte and the top 4 bits, the length less
+// LZ_MIN_MATCH in the bottom 4 bits. There is no end marker, the image header has the sizes.
+//
+// The decoder keeps the last LZ_WINDOW bytes and nothing else, takes its input in pieces of
+// any size and stops when the output room is full, so it runs straight from BLE writes into
+// flash sized blocks. Shared by the firmware and the host tools.
+//
+#define LZ_WINDOW_BITS 12
+#define LZ_WINDOW      (1 << LZ_WINDOW_BITS)
+#define LZ_MIN_MATCH   3
+#define LZ_MAX_MATCH   (LZ_MIN_MATCH + 15)
+
+typedef struct {
+  uint8_t window[LZ_WINDOW];
+  uint32_t pos;    // bytes out so far
+  uint16_t flags;  // flags of the tokens left, above a marker bit, 1 when a new flags byte is due
+  int16_t low;     // first byte of a match, -1 when there is none
+  uint16_t dist;   // match being copied out
+  uint8_t left;
+} lz_decoder_t;
+
+void lz_decoder_init(lz_decoder_t *d);
+
+// decode from in until it is used up or out is full, returns the bytes put in out
+size_t lz_decode(lz_decoder_t *d, const uint8_t *in, size_t len, size_t *used, uint8_t *out, size_t room);
+
+size_t lz_bound(size_t n);                                // most bytes lz_encode() can write for n
+size_t lz_encode(const uint8_t *in, size_t n, uint8_t *out);  // 0 when out of memory
@@ -3,29 +3,103 @@
 
 
 #include "nimble.h"
+#include "trace.h"
+#include "ota.h"
 
 #include <NimBLEDevice.h>
 
-volatile bool is_connected = false;
-volatile bool service_found = true;
+link_t links[NIMBLE_LINKS];
+uint8_t num_links = 1;
+volatile connect_phase_e connect_phase = CONNECT_IDLE;
+volatile uint8_t connect_link = 0;
+
+static uint32_t phase_start = 0;  // millis() when the current phase started
 
 static uint32_t scanTime = 0; /** 0 = scan forever */
 
 
 void scanEndedCB(NimBLEScanResults results);
 
-static NimBLEAdvertisedDevice* advDevice;
+/** The NimBLE side of each link. Connections go by address, the scan results that found
+ *  a controller are cleared when the scan starts again for the next one
+ */
+typedef struct {
+    NimBLEAddress address;  /** the controller, once found or when given to nimble_start() */
+    bool has_address;
+    NimBLEClient* client;   /** kept for reconnecting, it knows the services */
+    NimBLERemoteService* svc;
+    NimBLERemoteCharacteristic* chr;
+} link_ble_t;
+
+static link_ble_t link_ble[NIMBLE_LINKS];
+
+
+extern void message_handler(uint8_t link, uint8_t *pData, uint32_t arrival_us);
+
+static int link_of_client(NimBLEClient* pClient) {
+    for (int i = 0; i < num_links; i++)
+        if (link_ble[i].client == pClient)
+            return i;
+    return -1;
+}
+
+int nimble_primary(void) {
+    for (int i = 0; i < num_links; i++)
+        if (links[i].connected)
+            return i;
+    return -1;
+}
+
+/*********************************************************/
 
+const char *connect_phase_name(connect_phase_e phase) {
+  switch (phase) {
+    case CONNECT_IDLE: return "idle";
+    case CONNECT_CONNECTING: return "connect";
+    case CONNECT_DISCOVERING: return "discover";
+    case CONNECT_SUBSCRIBING: return "subscribe";
+    case CONNECT_DONE: return "done";
+    case CONNECT_FAILED: return "failed";
+    default: return "?";
+  }
+}
 
-extern void message_handler(uint8_t *pData);
+//
+// move on to the next phase of a connection attempt, logging how long the last one took
+//
+static void set_phase(connect_phase_e phase) {
+  uint32_t now = millis();
+
+  if (connect_phase != CONNECT_IDLE && connect_phase != CONNECT_DONE && connect_phase != CONNECT_FAILED)
+    Serial.printf("BLE %u %s: %lu ms\r\n", connect_link + 1, connect_phase_name(connect_phase), (unsigned long)(now - phase_start));
+  trace(TR_BLE_PHASE, phase, now - phase_start);
+  phase_start = now;
+  connect_phase = phase;
+}
 
 /*********************************************************/
 
+/** With more than one controller every link gets the same interval, 15 ms, so the connection
+ *  events of the links take turns in each interval instead of drifting through each other and
+ *  one link losing events to another. Frames come every 20 to 30 ms, so none wait for long.
+ */
+static void conn_interval(uint16_t *min, uint16_t *max) {
+    *min = num_links > 1 ? 12 : 6;
+    *max = num_links > 1 ? 12 : 16;
+}
+
 /**  None of these are required as they will be handled by the library with defaults. **
  **                       Remove as you see fit for your needs                        */
 class ClientCallbacks : public NimBLEClientCallbacks {
     void onConnect(NimBLEClient* pClient) {
+        int link = link_of_client(pClient);
 //        Serial.println("Connected");
+        if (link < 0)
+            return;
+        links[link].connected = true;
+        if (connect_phase == CONNECT_CONNECTING && connect_link == link)
+            set_phase(CONNECT_DISCOVERING);
+
         /** After connection we should change the parameters if we don't need fast response times.
          *  These settings are 150ms interval, 0 latency, 450ms timout.
          *  Timeout should be a multiple of the interval, minimum is 100ms.
@@ -33,13 +107,18 @@ class ClientCallbacks : public NimBLEClientCallbacks {
          *  Min interval: 120 * 1.25ms = 150, Max interval: 120 * 1.25ms = 150, 0 latency, 60 * 10ms = 600ms timeout
          */
 
-        pClient->updateConnParams(6, 16, 0, 100);
+        uint16_t min, max;
+        conn_interval(&min, &max);
+        pClient->updateConnParams(min, max, 0, 100);
     };
 
     void onDisconnect(NimBLEClient* pClient) {
+        int link = link_of_client(pClient);
         Serial.print(pClient->getPeerAddress().toString().c_str());
         Serial.println(" Disconnected - Starting scan");
-        is_connected = false;
+        if (link >= 0)
+            links[link].connected = false;
+        trace(TR_DISCONNECT);
 //        NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
     };
 
@@ -66,6 +145,9 @@ class ClientCallbacks : public NimBLEClientCallbacks {
             return false;
         }
 #endif
+        /** with more than one controller keep the shared interval, see conn_interval() */
+        if (num_links > 1 && (params->itvl_min > 12 || params->itvl_max < 12))
+            return false;
         return true;
     };
 
@@ -82,15 +164,30 @@ class AdvertisedDeviceCallbacks: public NimBLEAdvertisedDeviceCallbacks {
 //        Serial.print("Advertised Device found: ");
 //        Serial.println(advertisedDevice->toString().c_str());
         if(advertisedDevice->isAdvertisingService(NimBLEUUID("FFE0"))) {
-            Serial.println("Found Our Service");
+            int link = link_for(advertisedDevice->getAddress());
+            if (link < 0)
+                return;  /** not one of ours, or already connected */
+            Serial.printf("Found Our Service, controller %d\r\n", link + 1);
             /** stop scan before connecting */
             NimBLEDevice::getScan()->stop();
-            /** Save the device reference in a global for the client to use*/
-            advDevice = advertisedDevice;
+            /** Save the address for the client to connect to */
+            link_ble[link].address = advertisedDevice->getAddress();
+            link_ble[link].has_address = true;
             /** Ready to connect now */
-            service_found = true;
+            links[link].found = true;
         }
     };
+
+    /** the link this controller belongs to: the one that has had it, else the first free one */
+    int link_for(const NimBLEAddress &address) {
+        for (int i = 0; i < num_links; i++)
+            if (link_ble[i].has_address && link_ble[i].address == address)
+                return (links[i].connected || links[i].found) ? -1 : i;
+        for (int i = 0; i < num_links; i++)
+            if (!link_ble[i].has_address)
+                return i;
+        return -1;
+    }
 };
 
 
@@ -99,7 +196,14 @@ class AdvertisedDeviceCallbacks: public NimBLEAdvertisedDeviceCallbacks {
 /** Notification / Indication receiving handler callback */
 void notifyCB(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify) {
   if (length == 16) {
-    message_handler(pData);
+    uint32_t arrival_us = micros();  // stamped as early as we see it, for the latency analyser
+
+    for (int i = 0; i < num_links; i++) {
+      if (link_ble[i].chr == pRemoteCharacteristic) {
+        links[i].frames++;
+        message_handler(i, pData, arrival_us);
+      }
+    }
   }
 }
 
@@ -117,41 +221,30 @@ void scanEndedCB(NimBLEScanResults results) {
 /** Create a single global instance of the callback class to be used by all clients */
 static ClientCallbacks clientCB;
 
-static NimBLERemoteService* pSvc = nullptr;
-static NimBLERemoteCharacteristic* pRemChar = nullptr;
-static NimBLERemoteDescriptor* pDsc = nullptr;
-
 
 /*********************************************************/
 
-/** Handles the provisioning of clients and connects / interfaces with the server */
-bool connectToServer() {
-    NimBLEClient* pClient = nullptr;
+/** Handles the provisioning of clients and connects / interfaces with the server.
+ *  This blocks for up to the connect timeout, so it only runs in the connect task.
+ */
+static bool connectToServer(uint8_t link) {
+    link_ble_t* l = &link_ble[link];
+    NimBLEClient* pClient = l->client;
 
-    /** Check if we have a client we should reuse first **/
-    if(NimBLEDevice::getClientListSize()) {
-        /** Special case when we already know this device, we send false as the
-         *  second argument in connect() to prevent refreshing the service database.
-         *  This saves considerable time and power.
-         */
-        pClient = NimBLEDevice::getClientByPeerAddress(advDevice->getAddress());
-        if(pClient){
-            if(!pClient->connect(advDevice, false)) {
-                Serial.println("Reconnect failed");
-                return false;
-            }
-            Serial.println("Reconnected client");
-        }
-        /** We don't already have a client that knows this device,
-         *  we will check for a client that is disconnected that we can use.
-         */
-        else {
-            pClient = NimBLEDevice::getDisconnectedClient();
+    /** Special case when we already know this device, we send false as the
+     *  second argument in connect() to prevent refreshing the service database.
+     *  This saves considerable time and power.
+     */
+    if (pClient) {
+        if (!pClient->isConnected() && !pClient->connect(l->address, false)) {
+            Serial.println("Reconnect failed");
+            return false;
         }
+        Serial.println("Reconnected client");
     }
 
     /** No client to reuse? Create a new one. */
-    if (!pClient) {
+    else {
 
         if(NimBLEDevice::getClientListSize() >= NIMBLE_MAX_CONNECTIONS) {
             Serial.println("Max clients reached - no more connections available");
@@ -163,20 +256,24 @@ bool connectToServer() {
 
         pClient->setClientCallbacks(&clientCB, false);
 
-        /** Set initial connection parameters: These settings are 15ms interval, 0 latency, 120ms timout.
-         *  These settings are safe for 3 clients to connect reliably, can go faster if you have less
-         *  connections. Timeout should be a multiple of the interval, minimum is 100ms.
-         *  Min interval: 12 * 1.25ms = 15, Max interval: 12 * 1.25ms = 15, 0 latency, 51 * 10ms = 510ms timeout
+        /** Set initial connection parameters: These settings are 7.5 to 20ms interval, 0 latency,
+         *  1s timeout for one controller, see conn_interval() for more.
+         *  Timeout should be a multiple of the interval, minimum is 100ms.
          */
-        pClient->setConnectionParams(6, 16, 0, 100);
+        uint16_t min, max;
+        conn_interval(&min, &max);
+        pClient->setConnectionParams(min, max, 0, 100);
 
 
         /** Set how long we are willing to wait for the connection to complete (seconds), default is 30. */
         pClient->setConnectTimeout(30);
 
+        /** onConnect() finds the link by its client */
+        l->client = pClient;
 
-        if (!pClient->connect(advDevice)) {
+        if (!pClient->connect(l->address)) {
             /** Created a client but failed to connect, don't need to keep it as it has no data */
+            l->client = nullptr;
             NimBLEDevice::deleteClient(pClient);
             Serial.println("Failed to connect, deleted client");
             return false;
@@ -184,14 +281,6 @@ bool connectToServer() {
     }
 
 
-    if(!pClient->isConnected()) {
-        if (!pClient->connect(advDevice)) {
-            Serial.println("Failed to connect");
-            return false;
-        }
-    }
-
-
     Serial.print("Connected to: ");
     Serial.println(pClient->getPeerAddress().toString().c_str());
     Serial.print("RSSI: ");
@@ -200,12 +289,18 @@ bool connectToServer() {
 
     /** Now we can read/write/subscribe the characteristics of the services we are interested in */
 
-    pSvc = pClient->getService("FFE0");
-    if(pSvc)     /** make sure it's not null */
-        pRemChar = pSvc->getCharacteristic("FFEC");
+    if (connect_phase == CONNECT_CONNECTING)  /** onConnect() isn't called when the link was already up */
+        set_phase(CONNECT_DISCOVERING);
 
+    l->svc = pClient->getService("FFE0");
+    if(l->svc)     /** make sure it's not null */
+        l->chr = l->svc->getCharacteristic("FFEC");
+
+    NimBLERemoteCharacteristic* pRemChar = l->chr;
     if(pRemChar) {     /** make sure it's not null */
 
+        set_phase(CONNECT_SUBSCRIBING);
+
         if(pRemChar->canWrite())
           Serial.println("Can Write");
 
@@ -232,8 +327,12 @@ bool connectToServer() {
         }
 
     }
-    else
+    else {
+        /** without the characteristic there is no data, and nothing to send the keep-alive to */
         Serial.println("Service not found.");
+        pClient->disconnect();
+        return false;
+    }
 
     //Serial.println("Done with this device!");
 
@@ -241,15 +340,66 @@ bool connectToServer() {
 }
 
 
+/*********************************************************/
+
+/** Runs one connection attempt, then deletes itself. The result is left in connect_phase. */
+static void connect_task(void *param) {
+    bool ok = connectToServer(connect_link);
+
+    set_phase(ok ? CONNECT_DONE : CONNECT_FAILED);
+    Serial.printf("BLE connection %u %s after %lu ms\r\n", connect_link + 1, ok ? "done" : "failed",
+                  (unsigned long)(millis() - (uint32_t)param));
+    vTaskDelete(NULL);
+}
+
+/** Start connecting to the controller a link has found, without blocking the caller */
+void nimble_connect(uint8_t link) {
+    uint32_t start = millis();
+
+    if (connect_phase != CONNECT_IDLE && connect_phase != CONNECT_DONE && connect_phase != CONNECT_FAILED)
+        return;  /** already in progress, NimBLE connects one at a time */
+
+    links[link].found = false;
+    connect_link = link;
+    set_phase(CONNECT_CONNECTING);
+    if (xTaskCreate(connect_task, "connect", 4096, (void *)start, 1, NULL) != pdPASS)
+        set_phase(CONNECT_FAILED);
+}
+
+
+
 
 
+/** Scan again while a link has no controller, after a connection attempt or a link was lost */
+void nimble_scan(void) {
+  NimBLEScan* pScan = NimBLEDevice::getScan();
+
+  if (connect_phase != CONNECT_IDLE && connect_phase != CONNECT_DONE && connect_phase != CONNECT_FAILED)
+    return;  /** not while connecting */
+  for (int i = 0; i < num_links; i++) {
+    if (!links[i].connected && !links[i].found) {
+      if (!pScan->isScanning())
+        pScan->start(scanTime, scanEndedCB, false);  /** the old results go, so a controller lost can be found again */
+      return;
+    }
+  }
+}
 
-void nimble_start(void) {
+void nimble_start(uint8_t count, const char *const *addresses) {
 
-  service_found = false;
+  num_links = count < 1 ? 1 : count > NIMBLE_LINKS ? NIMBLE_LINKS : count;
+  for (int i = 0; i < num_links; i++) {
+    if (addresses && addresses[i]) {
+      link_ble[i].address = NimBLEAddress(std::string(addresses[i]));
+      link_ble[i].has_address = true;
+    }
+  }
+
+  /** Initialize NimBLE, the name is only seen when the update service is advertised */
+  NimBLEDevice::init("EKSR Instrument");
 
-  /** Initialize NimBLE, no device name spcified as we are not advertising */
-  NimBLEDevice::init("");
+  /** The largest MTU, the controller frames don't need it but firmware updates go faster */
+  NimBLEDevice::setMTU(BLE_ATT_MTU_MAX);
 
   /** Optional: set the transmit power, default is 3db */
   NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
@@ -276,6 +426,127 @@ void nimble_start(void) {
 
 }
 
-bool nimble_send(uint8_t *pData, uint16_t len) {
-  return pRemChar->writeValue(pData, len, false);
+bool nimble_send(uint8_t link, uint8_t *pData, uint16_t len) {
+  if (link >= num_links || !links[link].connected || !link_ble[link].chr)
+    return false;
+  return link_ble[link].chr->writeValue(pData, len, false);
+}
+
+/*********************************************************/
+
+//
+// Firmware update service, a peripheral role next to the controller connection.
+//   control  write OTA_CMD_BEGIN and the image header, or OTA_CMD_ABORT, notifies ota_status_t
+//   data     write without response, the packed image in order
+// Both only take writes on an encrypted link paired with the passkey (MITM protected), the
+// instrument shows nothing to compare so the client types it in. The pairing is bonded, a
+// client paired once gets back in without it until the bonds are deleted.
+//
+#define OTA_SERVICE_UUID "c5f50001-8280-46da-89f4-6d8051e4aeef"
+#define OTA_CONTROL_UUID "c5f50002-8280-46da-89f4-6d8051e4aeef"
+#define OTA_DATA_UUID    "c5f50003-8280-46da-89f4-6d8051e4aeef"
+
+static NimBLEServer *ota_server = nullptr;
+static NimBLECharacteristic *ota_control = nullptr;
+static bool ota_advertising = false;
+
+class OtaServerCallbacks : public NimBLEServerCallbacks {
+  void onConnect(NimBLEServer *pServer, ble_gap_conn_desc *desc) {
+    Serial.printf("Update client %s connected\r\n", NimBLEAddress(desc->peer_ota_addr).toString().c_str());
+
+    // the fastest link the client takes: 7.5 to 15 ms interval, 2M PHY, longest packets
+    pServer->updateConnParams(desc->conn_handle, 6, 12, 0, 200);
+    ble_gap_set_prefered_le_phy(desc->conn_handle, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+    pServer->setDataLen(desc->conn_handle, 251);
+  };
+
+  void onAuthenticationComplete(ble_gap_conn_desc *desc) {
+    if (!desc->sec_state.encrypted || !desc->sec_state.authenticated)
+      Serial.println("Update client failed to pair, wrong passkey?");
+    else
+      Serial.printf("Update client paired%s\r\n", desc->sec_state.bonded ? ", bonded" : "");
+  };
+
+  void onDisconnect(NimBLEServer *pServer) {
+    ota_abort();  // no one left to send the rest
+  };
+};
+
+class OtaControlCallbacks : public NimBLECharacteristicCallbacks {
+  void onWrite(NimBLECharacteristic *pCharacteristic) {
+    NimBLEAttValue v = pCharacteristic->getValue();
+
+    if (v.length() >= 1 && v.data()[0] == OTA_CMD_BEGIN)
+      ota_begin(v.data() + 1, v.length() - 1);
+    else if (v.length() >= 1 && v.data()[0] == OTA_CMD_ABORT)
+      ota_abort();
+  };
+};
+
+class OtaDataCallbacks : public NimBLECharacteristicCallbacks {
+  void onWrite(NimBLECharacteristic *pCharacteristic) {
+    NimBLEAttValue v = pCharacteristic->getValue();
+
+    ota_data(v.data(), v.length());  // into the stream buffer, the update task writes the flash
+  };
+};
+
+static OtaServerCallbacks ota_server_cb;
+static OtaControlCallbacks ota_control_cb;
+static OtaDataCallbacks ota_data_cb;
+
+//
+// from the update task, every OTA_ACK bytes and on every change of state
+//
+static void ota_notify(const ota_status_t *status) {
+  if (!ota_control)
+    return;
+  ota_control->setValue((const uint8_t *)status, sizeof(ota_status_t));
+  ota_control->notify();
+}
+
+void nimble_ota_start(bool advertise, uint32_t passkey, void (*done)(void)) {
+  // bonding, MITM protection, secure connections. The controllers don't ask for security,
+  // so this only comes into play on the update service
+  NimBLEDevice::setSecurityAuth(true, true, true);
+  NimBLEDevice::setSecurityIOCap(BLE_HS_IO_DISPLAY_ONLY);
+  NimBLEDevice::setSecurityPasskey(passkey);
+
+  ota_server = NimBLEDevice::createServer();
+  ota_server->setCallbacks(&ota_server_cb, false);
+
+  NimBLEService *svc = ota_server->createService(OTA_SERVICE_UUID);
+  ota_control = svc->createCharacteristic(OTA_CONTROL_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_ENC
+                                                               | NIMBLE_PROPERTY::WRITE_AUTHEN | NIMBLE_PROPERTY::NOTIFY);
+  ota_control->setCallbacks(&ota_control_cb);
+  NimBLECharacteristic *data = svc->createCharacteristic(OTA_DATA_UUID, NIMBLE_PROPERTY::WRITE_NR | NIMBLE_PROPERTY::WRITE_ENC
+                                                                          | NIMBLE_PROPERTY::WRITE_AUTHEN);
+  data->setCallbacks(&ota_data_cb);
+  svc->start();
+
+  NimBLEAdvertising *adv = NimBLEDevice::getAdvertising();
+  adv->addServiceUUID(OTA_SERVICE_UUID);
+  adv->setScanResponse(true);
+
+  ota_init(ota_notify, done);
+  if (advertise)
+    nimble_ota_advertise(true);
+}
+
+void nimble_ota_advertise(bool on) {
+  if (!ota_server)
+    return;
+  ota_advertising = on;
+  if (on)
+    NimBLEDevice::getAdvertising()->start();
+  else
+    NimBLEDevice::getAdvertising()->stop();
+}
+
+bool nimble_ota_advertising(void) {
+  return ota_advertising;
+}
+
+void nimble_ota_forget(void) {
+  NimBLEDevice::deleteAllBonds();
 }
@@ -1,9 +1,43 @@
 
 #include <Arduino.h>
 
-extern volatile bool is_connected;
-extern volatile bool service_found;
+// phases of a connection attempt, the blocking NimBLE calls run in their own task
+typedef enum {
+  CONNECT_IDLE,
+  CONNECT_CONNECTING,
+  CONNECT_DISCOVERING,
+  CONNECT_SUBSCRIBING,
+  CONNECT_DONE,
+  CONNECT_FAILED,
+} connect_phase_e;
 
-void nimble_start(void);
-bool connectToServer();
-bool nimble_send(uint8_t *pData, uint16_t len);
+//
+// One link per FarDriver controller, e.g. front and rear hub motors. Links take the controllers
+// in the order they are found, unless nimble_start() is given their addresses. Connection
+// attempts run one at a time, connect_phase is that of the attempt going on
+//
+#define NIMBLE_LINKS 2  // most controllers at once, within NIMBLE_MAX_CONNECTIONS
+
+typedef struct {
+  volatile bool found;      // advertising, ready to connect to
+  volatile bool connected;
+  volatile uint32_t frames;
+} link_t;
+
+extern link_t links[NIMBLE_LINKS];
+extern uint8_t num_links;  // links in use
+extern volatile connect_phase_e connect_phase;
+extern volatile uint8_t connect_link;  // the link connect_phase is for
+
+void nimble_start(uint8_t count, const char *const *addresses);  // addresses may be NULL, or have NULL entries
+void nimble_connect(uint8_t link);
+void nimble_scan(void);  // look for the controllers still missing
+const char *connect_phase_name(connect_phase_e phase);
+bool nimble_send(uint8_t link, uint8_t *pData, uint16_t len);
+int nimble_primary(void);  // lowest link connected, -1 when none
+
+// firmware update service, see ota.h
+void nimble_ota_start(bool advertise, uint32_t passkey, void (*done)(void));  // done is called when the new image is in
+void nimble_ota_advertise(bool on);
+bool nimble_ota_advertising(void);
+void nimble_ota_forget(void);  // delete the bonds, every client pairs again
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+
+//
+// All odometers are saved together as one record, in a single NVS blob.
+// The blob write is atomic, so a power cut leaves either the old or the new set.
+//
+// The same record is mirrored into RTC memory on every update. That survives software,
+// watchdog and panic resets, so flash only needs writing now and then against power off.
+//
+#define NUM_ODOMETERS 3       // Total, Trip1, Trip2
+#define ODO_RECORD_VERSION 2
+
+typedef struct {
+  uint64_t distance;  // mm
+  float speed;        // km/h
+  float power;        // kW
+  float energy;       // Wh, regen subtracted
+  uint32_t reserved;
+} odo_values_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t seq;  // incremented on every RTC mirror update, the higher one is newer
+  odo_values_t odo[NUM_ODOMETERS];
+  uint32_t crc;  // of everything above
+} odo_record_t;
+
+// version 1, before energy was added
+typedef struct {
+  uint64_t distance;
+  float speed;
+  float power;
+} odo_values_v1_t;
+
+typedef struct {
+  uint32_t version;
+  odo_values_v1_t odo[NUM_ODOMETERS];
+  uint32_t crc;
+} odo_record_v1_t;
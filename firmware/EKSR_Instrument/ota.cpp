@@ -0,0 +1,278 @@
+
+#include "ota.h"
+#include "ota_key.h"
+#include "lz.h"
+
+#include <Arduino.h>
+#include "esp_ota_ops.h"
+#include "freertos/stream_buffer.h"
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/sha256.h"
+
+static ota_status_t status;
+static ota_header_t header;
+static StreamBufferHandle_t stream;  // made on the first update, kept after that
+static volatile uint8_t abort_error;  // set from the BLE task, the update task cleans up
+static TaskHandle_t task;
+
+static void (*notify_fn)(const ota_status_t *status);
+static void (*done_fn)(void);
+
+/*********************************************************/
+
+void ota_init(void (*notify)(const ota_status_t *status), void (*done)(void)) {
+  notify_fn = notify;
+  done_fn = done;
+}
+
+void ota_get_status(ota_status_t *s) {
+  *s = status;
+}
+
+static void set_state(ota_state_e state, ota_error_e error) {
+  status.state = state;
+  status.error = error;
+  if (notify_fn)
+    notify_fn(&status);
+}
+
+//
+// cancels the rollback when the bootloader has it switched on, nothing to do when not
+//
+void ota_confirm(void) {
+  esp_ota_mark_app_valid_cancel_rollback();
+}
+
+/*********************************************************/
+
+typedef struct {
+  const esp_partition_t *part;
+  esp_ota_handle_t handle;
+  lz_decoder_t lz;
+  mbedtls_sha256_context sha;
+  uint8_t in[512];
+  uint8_t block[OTA_BLOCK];
+  size_t fill;
+} ota_work_t;
+
+static ota_error_e flush(ota_work_t *w) {
+  if (!w->fill)
+    return OTA_OK;
+  if (status.written + w->fill > header.image_size)
+    return OTA_ERR_STREAM;
+  mbedtls_sha256_update(&w->sha, w->block, w->fill);
+  if (esp_ota_write(w->handle, w->block, w->fill) != ESP_OK)
+    return OTA_ERR_FLASH;
+  status.written += w->fill;
+  w->fill = 0;
+  return OTA_OK;
+}
+
+//
+// take the packed image out of the stream buffer, decompress and write it
+//
+static ota_error_e receive(ota_work_t *w) {
+  uint32_t acked = 0;
+  ota_error_e err;
+
+  while (status.received < header.packed_size) {
+    size_t want = header.packed_size - status.received;
+    size_t n = xStreamBufferReceive(stream, w->in, want < sizeof(w->in) ? want : sizeof(w->in),
+                                    pdMS_TO_TICKS(OTA_TIMEOUT_MS));
+    if (abort_error)
+      return (ota_error_e)abort_error;
+    if (!n)
+      return OTA_ERR_TIMEOUT;
+
+    for (size_t i = 0; i < n;) {
+      size_t used;
+      w->fill += lz_decode(&w->lz, w->in + i, n - i, &used, w->block + w->fill, OTA_BLOCK - w->fill);
+      i += used;
+      if ((w->fill == OTA_BLOCK) && (err = flush(w)) != OTA_OK)
+        return err;
+    }
+
+    status.received += n;
+    if (status.received - acked >= OTA_ACK) {
+      acked = status.received;
+      set_state(OTA_RECEIVING, OTA_OK);  // room for more
+    }
+  }
+
+  // a match can still be going on at the end of the input
+  do {
+    size_t used;
+    w->fill += lz_decode(&w->lz, NULL, 0, &used, w->block + w->fill, OTA_BLOCK - w->fill);
+    if ((err = flush(w)) != OTA_OK)
+      return err;
+  } while (w->lz.left);
+
+  return status.written == header.image_size ? OTA_OK : OTA_ERR_STREAM;
+}
+
+//
+// the header signed with the key in ota_key.h, before anything is written
+//
+static ota_error_e check_signature(void) {
+  uint8_t hash[32];
+  mbedtls_ecp_group grp;
+  mbedtls_ecp_point key;
+  mbedtls_mpi r, s;
+  int ret;
+
+  if (ota_public_key[0] != 0x04)
+    return OTA_ERR_SIGNATURE;  // no key built in
+
+  mbedtls_sha256((const uint8_t *)&header, OTA_SIGNED_LEN, hash, 0);
+  mbedtls_ecp_group_init(&grp);
+  mbedtls_ecp_point_init(&key);
+  mbedtls_mpi_init(&r);
+  mbedtls_mpi_init(&s);
+  ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256R1);
+  if (!ret)
+    ret = mbedtls_ecp_point_read_binary(&grp, &key, ota_public_key, sizeof(ota_public_key));
+  if (!ret)
+    ret = mbedtls_mpi_read_binary(&r, header.signature, 32);
+  if (!ret)
+    ret = mbedtls_mpi_read_binary(&s, header.signature + 32, 32);
+  if (!ret)
+    ret = mbedtls_ecdsa_verify(&grp, hash, sizeof(hash), &key, &r, &s);
+  mbedtls_mpi_free(&s);
+  mbedtls_mpi_free(&r);
+  mbedtls_ecp_point_free(&key);
+  mbedtls_ecp_group_free(&grp);
+  return ret ? OTA_ERR_SIGNATURE : OTA_OK;
+}
+
+static ota_error_e verify(ota_work_t *w) {
+  uint8_t hash[32];
+
+  set_state(OTA_VERIFYING, OTA_OK);
+  mbedtls_sha256_finish(&w->sha, hash);
+  if (memcmp(hash, header.sha256, sizeof(hash)))
+    return OTA_ERR_HASH;
+  esp_err_t end = esp_ota_end(w->handle);  // checks the image, and frees the handle either way
+  w->handle = 0;
+  if (end != ESP_OK)
+    return OTA_ERR_IMAGE;
+  if (esp_ota_set_boot_partition(w->part) != ESP_OK)
+    return OTA_ERR_IMAGE;
+  return OTA_OK;
+}
+
+static void ota_task(void *param) {
+  ota_work_t *w = (ota_work_t *)param;
+  uint32_t start = millis();
+  ota_error_e err = check_signature();  // some ms of maths, kept out of the BLE task
+
+  if (err == OTA_OK && esp_ota_begin(w->part, OTA_WITH_SEQUENTIAL_WRITES, &w->handle) != ESP_OK)
+    err = OTA_ERR_FLASH;
+  if (err == OTA_OK)
+    err = receive(w);
+  if (err == OTA_OK)
+    err = verify(w);
+
+  if (w->handle)
+    esp_ota_abort(w->handle);
+  mbedtls_sha256_free(&w->sha);
+  free(w);
+  task = NULL;
+
+  if (err != OTA_OK) {
+    Serial.printf("OTA failed, error %d after %lu of %lu bytes\r\n", err, (unsigned long)status.written,
+                  (unsigned long)header.image_size);
+    set_state(OTA_FAILED, err);
+  } else {
+    Serial.printf("OTA %lu bytes (%lu packed) in %lu ms\r\n", (unsigned long)header.image_size,
+                  (unsigned long)header.packed_size, (unsigned long)(millis() - start));
+    set_state(OTA_DONE, OTA_OK);
+    vTaskDelay(pdMS_TO_TICKS(500));  // let the status go out before the restart
+    if (done_fn)
+      done_fn();
+  }
+  vTaskDelete(NULL);
+}
+
+/*********************************************************/
+
+//
+// start an update, from the BLE task
+//
+bool ota_begin(const uint8_t *data, size_t len) {
+  ota_work_t *w;
+  const esp_partition_t *part;
+
+  if (status.state == OTA_RECEIVING || status.state == OTA_VERIFYING || status.state == OTA_DONE)
+    return false;  // one at a time
+
+  memset(&status, 0, sizeof(status));
+  if (len < sizeof(ota_header_t)) {
+    set_state(OTA_FAILED, OTA_ERR_HEADER);
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  part = esp_ota_get_next_update_partition(NULL);
+
+  if (!part) {
+    set_state(OTA_FAILED, OTA_ERR_PARTITION);
+    return false;
+  }
+  if (header.magic != OTA_MAGIC || header.version != OTA_HEADER_VERSION || header.header_len < sizeof(ota_header_t)
+      || !header.image_size || header.image_size > part->size || !header.packed_size) {
+    set_state(OTA_FAILED, OTA_ERR_HEADER);
+    return false;
+  }
+
+  if (!stream)
+    stream = xStreamBufferCreate(OTA_BUFFER, 1);
+  w = (ota_work_t *)malloc(sizeof(ota_work_t));
+  if (!stream || !w) {
+    free(w);
+    set_state(OTA_FAILED, OTA_ERR_MEMORY);
+    return false;
+  }
+
+  memset(w, 0, sizeof(ota_work_t));
+  w->part = part;
+  lz_decoder_init(&w->lz);
+  mbedtls_sha256_init(&w->sha);
+  mbedtls_sha256_starts(&w->sha, 0);
+  xStreamBufferReset(stream);
+  abort_error = OTA_OK;
+
+  Serial.printf("OTA %lu bytes into %s\r\n", (unsigned long)header.image_size, part->label);
+  set_state(OTA_RECEIVING, OTA_OK);
+  if (xTaskCreate(ota_task, "ota", 6144, w, 1, &task) != pdPASS) {  // the signature check needs the stack
+    mbedtls_sha256_free(&w->sha);
+    free(w);
+    set_state(OTA_FAILED, OTA_ERR_MEMORY);
+    return false;
+  }
+  return true;
+}
+
+//
+// packed image bytes, from the BLE task, never waits for room
+//
+bool ota_data(const uint8_t *data, size_t len) {
+  if (status.state != OTA_RECEIVING || abort_error)
+    return false;
+  if (xStreamBufferSend(stream, data, len, 0) != len) {
+    abort_error = OTA_ERR_OVERRUN;
+    return false;
+  }
+  return true;
+}
+
+//
+// the sender asked to stop, or went away
+//
+void ota_abort(void) {
+  TaskHandle_t t = task;
+
+  if (status.state != OTA_RECEIVING)
+    return;
+  abort_error = OTA_ERR_ABORTED;
+  if (t)
+    xTaskAbortDelay(t);  // out of waiting for data
+}
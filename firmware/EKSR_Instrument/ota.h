@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Firmware update over BLE
+//
+// The image is packed on the host (host/otapack): a header with the image size and its
+// SHA-256, then the image compressed with lz.h. The packed bytes come in BLE writes and go
+// into a stream buffer, the update task decompresses them into OTA_BLOCK sized blocks and
+// writes each to the inactive OTA partition, erasing as it goes. Nothing blocks the BLE task,
+// so the controller frames keep coming in and the screens stay live until the restart.
+//
+// The sender keeps at most OTA_WINDOW bytes past the last status it was sent, the status goes
+// out every OTA_ACK bytes taken out of the buffer. The boot partition is only switched once
+// the hash of what was written matches the header and the image checks out.
+//
+// Who may update it: the hash only says the image came through whole, the sender writes it.
+// So the header is signed, ECDSA P-256 over its bytes before the signature, with a key kept
+// by whoever builds the firmware (host/otapack -g makes it). Only the public key is in the
+// firmware, in ota_key.h, and the signature is checked before anything goes into flash. A
+// firmware built with the empty ota_key.h in the repository takes no updates at all. The BLE
+// characteristics also take writes only on an encrypted link paired with the passkey, so no
+// one else in range can start an update, even with an image signed for this key. Everything
+// is still checked once paired, a bonded phone or PC is not trusted with the image.
+//
+#define OTA_MAGIC          0x41544F45  // "EOTA"
+#define OTA_HEADER_VERSION 2
+#define OTA_BLOCK          4096   // one flash sector per write
+#define OTA_BUFFER         16384  // packed bytes received, not decompressed yet
+#define OTA_WINDOW         12288  // packed bytes the sender may have in flight
+#define OTA_ACK            4096
+#define OTA_TIMEOUT_MS     10000  // nothing received, the sender has gone
+
+// control characteristic writes
+#define OTA_CMD_BEGIN 0x01  // followed by the header
+#define OTA_CMD_ABORT 0x02
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t header_len;   // the packed data starts here
+  uint32_t image_size;   // bytes, decompressed
+  uint32_t packed_size;  // bytes after the header
+  uint8_t sha256[32];    // of the image
+  uint8_t signature[64]; // ECDSA P-256 r and s, big endian, over the SHA-256 of the bytes before it
+} ota_header_t;
+
+#define OTA_SIGNED_LEN offsetof(ota_header_t, signature)
+
+typedef enum {
+  OTA_IDLE,
+  OTA_RECEIVING,
+  OTA_VERIFYING,
+  OTA_DONE,  // restarting into the new image
+  OTA_FAILED,
+} ota_state_e;
+
+typedef enum {
+  OTA_OK,
+  OTA_ERR_HEADER,     // not an image for this, or too big for the partition
+  OTA_ERR_PARTITION,  // no OTA partition to write to
+  OTA_ERR_MEMORY,
+  OTA_ERR_OVERRUN,    // more sent than the window allows
+  OTA_ERR_TIMEOUT,
+  OTA_ERR_STREAM,     // the data doesn't decompress to the image size
+  OTA_ERR_FLASH,
+  OTA_ERR_HASH,
+  OTA_ERR_IMAGE,      // the bootloader wouldn't take it
+  OTA_ERR_ABORTED,
+  OTA_ERR_SIGNATURE,  // not signed with the key in ota_key.h, or no key built in
+} ota_error_e;
+
+// notified on the control characteristic, little endian
+typedef struct {
+  uint8_t state;
+  uint8_t error;
+  uint16_t reserved;
+  uint32_t received;  // packed bytes taken out of the buffer
+  uint32_t written;   // image bytes in flash
+} ota_status_t;
+
+void ota_init(void (*notify)(const ota_status_t *status), void (*done)(void));
+bool ota_begin(const uint8_t *header, size_t len);
+bool ota_data(const uint8_t *data, size_t len);
+void ota_abort(void);
+void ota_get_status(ota_status_t *status);
+void ota_confirm(void);  // the new image works, keep it
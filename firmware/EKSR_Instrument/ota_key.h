@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Public key that firmware updates must be signed with, see ota.h. Replace this file with
+// the one "otapack -g key.pem" prints, and keep key.pem somewhere safe: an instrument only
+// takes images signed with it from then on. All zeros, as here, takes no updates.
+//
+static const uint8_t ota_public_key[65] = { 0 };  // uncompressed P-256 point, 0x04 X Y
@@ -0,0 +1,255 @@
+
+#include "pal4.h"
+#include "pixels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define VLW_HEADER  24
+#define VLW_METRICS 28
+
+static int32_t get32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+uint16_t *pal4_band[2];
+int pal4_band_pixels;
+
+/*********************************************************/
+
+void pal4_ramp(pal4_palette_t *p, uint16_t fg, uint16_t bg) {
+  for (int i = 0; i < 16; i++) {
+    uint16_t c = pix_blend(fg, bg, i * 17);
+    p->colour[i] = (c >> 8) | (c << 8);
+  }
+}
+
+void pal4_pairs(pal4_pairs_t *t, const pal4_palette_t *p) {
+  if (t->pal == p)
+    return;
+  // left pixel in the high nibble goes first, which is the low half on a little endian CPU
+  for (int b = 0; b < 256; b++)
+    t->pair[b] = p->colour[b >> 4] | ((uint32_t)p->colour[b & 15] << 16);
+  t->pal = p;
+}
+
+/*********************************************************/
+
+//
+// font height worked out the way TFT_eSPI does, so layouts stay the same
+//
+bool pal4_font(pal4_font_t *f, const uint8_t *vlw) {
+  int descent;
+
+  if (!vlw)
+    return false;
+
+  f->data = vlw;
+  f->count = get32(vlw);
+  f->ascent = get32(vlw + 16);
+  descent = get32(vlw + 20);
+
+  for (uint32_t i = 0; i < f->count; i++) {
+    const uint8_t *m = vlw + VLW_HEADER + i * VLW_METRICS;
+    int height = get32(m + 4);
+    int dy = get32(m + 16);
+
+    if (get32(m) <= 0x20)
+      continue;
+    if (dy > f->ascent)
+      f->ascent = dy;
+    if (height - dy > descent)
+      descent = height - dy;
+  }
+  f->height = f->ascent + descent;
+  return f->count > 0;
+}
+
+//
+// metrics and bitmap of one glyph, the fonts are small so a search is fine
+//
+static const uint8_t *find_glyph(const pal4_font_t *f, uint32_t unicode, const uint8_t **bitmap) {
+  const uint8_t *bm = f->data + VLW_HEADER + f->count * VLW_METRICS;
+
+  for (uint32_t i = 0; i < f->count; i++) {
+    const uint8_t *m = f->data + VLW_HEADER + i * VLW_METRICS;
+    if ((uint32_t)get32(m) == unicode) {
+      *bitmap = bm;
+      return m;
+    }
+    bm += get32(m + 4) * get32(m + 8);
+  }
+  return NULL;
+}
+
+int pal4_text_width(const pal4_font_t *f, const char *str) {
+  const uint8_t *bitmap;
+  int width = 0;
+
+  for (; *str; str++) {
+    const uint8_t *m = find_glyph(f, (uint8_t)*str, &bitmap);
+    width += m ? get32(m + 12) : f->height / 4;
+  }
+  return width;
+}
+
+/*********************************************************/
+
+bool pal4_create(pal4_sprite_t *s, int w, int h) {
+  s->w = (w + 1) & ~1;
+  s->h = h;
+  s->pix = (uint8_t *)calloc(s->w / 2 * h, 1);
+  s->shown = (uint8_t *)calloc(s->w / 2 * h, 1);
+  s->pal = NULL;
+  s->shown_pal = NULL;  // all of it is sent the first time
+
+  if (s->pix && s->shown && s->w * PAL4_BAND_LINES > pal4_band_pixels) {
+    free(pal4_band[0]);
+    free(pal4_band[1]);
+    pal4_band_pixels = s->w * PAL4_BAND_LINES;
+    pal4_band[0] = (uint16_t *)malloc(pal4_band_pixels * 2);
+    pal4_band[1] = (uint16_t *)malloc(pal4_band_pixels * 2);
+    if (!pal4_band[0] || !pal4_band[1]) {
+      free(pal4_band[0]);
+      free(pal4_band[1]);
+      pal4_band[0] = pal4_band[1] = NULL;
+      pal4_band_pixels = 0;
+    }
+  }
+
+  if (!s->pix || !s->shown || !pal4_band_pixels) {
+    free(s->pix);
+    free(s->shown);
+    s->pix = s->shown = NULL;
+    return false;
+  }
+  return true;
+}
+
+//
+// the text in the middle of the sprite, on a clear background
+//
+void pal4_text(pal4_sprite_t *s, const pal4_font_t *f, const char *str) {
+  int x = (s->w - pal4_text_width(f, str)) / 2;
+  int stride = s->w / 2;
+
+  memset(s->pix, 0, stride * s->h);
+
+  for (; *str; str++) {
+    const uint8_t *bitmap;
+    const uint8_t *m = find_glyph(f, (uint8_t)*str, &bitmap);
+
+    if (!m) {
+      x += f->height / 4;
+      continue;
+    }
+
+    int height = get32(m + 4);
+    int width = get32(m + 8);
+    int left = x + get32(m + 20);
+    int top = f->ascent - get32(m + 16);
+
+    for (int r = 0; r < height; r++) {
+      int y = top + r;
+      if (y < 0 || y >= s->h)
+        continue;
+      for (int c = 0; c < width; c++) {
+        int px = left + c;
+        uint8_t a = bitmap[r * width + c];
+        if (!a || px < 0 || px >= s->w)
+          continue;
+
+        // 16 levels, overlapping glyphs keep the higher one
+        uint8_t level = (a * 15 + 127) / 255;
+        uint8_t *p = &s->pix[y * stride + px / 2];
+        if (px & 1) {
+          if (level > (*p & 0x0F))
+            *p = (*p & 0xF0) | level;
+        } else if (level > (*p >> 4)) {
+          *p = (*p & 0x0F) | (level << 4);
+        }
+      }
+    }
+    x += get32(m + 12);
+  }
+}
+
+/*********************************************************/
+
+bool pal4_dirty(const pal4_sprite_t *s, int *x0, int *y0, int *x1, int *y1) {
+  int stride = s->w / 2;
+  int left = stride, right = 0, top = s->h, bottom = 0;
+
+  if (s->pal != s->shown_pal) {
+    *x0 = *y0 = 0;
+    *x1 = s->w;
+    *y1 = s->h;
+    return true;
+  }
+
+  for (int y = 0; y < s->h; y++) {
+    const uint8_t *a = s->pix + y * stride;
+    const uint8_t *b = s->shown + y * stride;
+    int l = 0, r = stride;
+
+    while (l < r && a[l] == b[l])
+      l++;
+    if (l == r)
+      continue;
+    while (a[r - 1] == b[r - 1])
+      r--;
+
+    if (l < left)
+      left = l;
+    if (r > right)
+      right = r;
+    if (y < top)
+      top = y;
+    bottom = y + 1;
+  }
+
+  if (top == s->h)
+    return false;
+  *x0 = left * 2;
+  *x1 = right * 2;
+  *y0 = top;
+  *y1 = bottom;
+  return true;
+}
+
+void pal4_shown(pal4_sprite_t *s) {
+  memcpy(s->shown, s->pix, s->w / 2 * s->h);
+  s->shown_pal = s->pal;
+}
+
+/*********************************************************/
+
+void pal4_expand(uint16_t *dst, const uint8_t *src, size_t n, const pal4_pairs_t *t) {
+  const uint32_t *pair = t->pair;
+  const pal4_palette_t *p = t->pal;
+  size_t i = 0;
+
+  if (((uintptr_t)dst & 3) == 0) {
+    uint32_t *d = (uint32_t *)dst;
+    for (; i + 4 <= n; i += 4) {
+      d[i] = pair[src[i]];
+      d[i + 1] = pair[src[i + 1]];
+      d[i + 2] = pair[src[i + 2]];
+      d[i + 3] = pair[src[i + 3]];
+    }
+    for (; i < n; i++)
+      d[i] = pair[src[i]];
+    return;
+  }
+  for (; i < n; i++) {
+    dst[2 * i] = p->colour[src[i] >> 4];
+    dst[2 * i + 1] = p->colour[src[i] & 15];
+  }
+}
+
+void pal4_expand_ref(uint16_t *dst, const uint8_t *src, size_t n, const pal4_palette_t *p) {
+  for (size_t i = 0; i < n; i++) {
+    dst[2 * i] = p->colour[src[i] >> 4];
+    dst[2 * i + 1] = p->colour[src[i] & 15];
+  }
+}
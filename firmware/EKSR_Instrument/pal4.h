@@ -0,0 +1,62 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// 4 bit palette sprites for anti-aliased text
+//
+// Two pixels a byte, the left one in the high nibble. Text is drawn from a smooth (VLW)
+// font with its alpha cut to 16 levels, and the palette is a ramp from the background to
+// the text colour, so changing colour is just a different palette. Pixels are expanded
+// to RGB565 a band of lines at a time when they are sent, two at a time through a 256
+// entry table. There is one table, made again when the colour changes, and one pair of
+// bands, grown by pal4_create() to fit the widest sprite.
+//
+#define PAL4_BAND_LINES 8
+
+// a ramp of 16 colours, in SPI byte order like the display wants them
+typedef struct {
+  uint16_t colour[16];
+} pal4_palette_t;
+
+// the two colours for each byte of pixels, for the palette it was made for
+typedef struct {
+  const pal4_palette_t *pal;
+  uint32_t pair[256];
+} pal4_pairs_t;
+
+typedef struct {
+  int16_t w, h;                 // w is even
+  uint8_t *pix;                 // drawn
+  uint8_t *shown;               // on the screen
+  const pal4_palette_t *pal;    // to draw with
+  const pal4_palette_t *shown_pal;
+} pal4_sprite_t;
+
+// the parts of a VLW font needed to draw it
+typedef struct {
+  const uint8_t *data;
+  uint32_t count;     // glyphs
+  int16_t ascent;     // above the baseline, largest of the glyphs
+  int16_t height;     // ascent + largest descent, like TFT_eSPI fontHeight()
+} pal4_font_t;
+
+extern uint16_t *pal4_band[2];  // one is expanded while the other is sent
+extern int pal4_band_pixels;     // in each
+
+void pal4_ramp(pal4_palette_t *p, uint16_t fg, uint16_t bg);
+void pal4_pairs(pal4_pairs_t *t, const pal4_palette_t *p);  // only made again for another palette
+
+bool pal4_font(pal4_font_t *f, const uint8_t *vlw);
+int pal4_text_width(const pal4_font_t *f, const char *str);
+
+bool pal4_create(pal4_sprite_t *s, int w, int h);
+void pal4_text(pal4_sprite_t *s, const pal4_font_t *f, const char *str);
+
+// the box that changed since pal4_shown(), in pixels, x0 and x1 even; false if nothing did
+bool pal4_dirty(const pal4_sprite_t *s, int *x0, int *y0, int *x1, int *y1);
+void pal4_shown(pal4_sprite_t *s);
+
+// n bytes (2n pixels) to RGB565
+void pal4_expand(uint16_t *dst, const uint8_t *src, size_t n, const pal4_pairs_t *t);
+void pal4_expand_ref(uint16_t *dst, const uint8_t *src, size_t n, const pal4_palette_t *p);
@@ -0,0 +1,102 @@
+
+#include "pixels.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && !defined(PIXELS_NO_PIE)
+#define PIXELS_PIE 1
+#endif
+
+/*********************************************************/
+
+void pix_fill16(uint16_t *dst, uint16_t colour, size_t n) {
+  uint32_t c2 = colour | ((uint32_t)colour << 16);
+
+  // scalar up to a 16 byte boundary
+  while (n && ((uintptr_t)dst & 15)) {
+    *dst++ = colour;
+    n--;
+  }
+
+#if PIXELS_PIE
+  // 8 pixels per 128 bit store
+  size_t blocks = n >> 3;
+  if (blocks) {
+    asm volatile(
+      "ee.movi.32.q q0, %[c], 0      \n"
+      "ee.movi.32.q q0, %[c], 1      \n"
+      "ee.movi.32.q q0, %[c], 2      \n"
+      "ee.movi.32.q q0, %[c], 3      \n"
+      "loopnez %[blocks], 1f         \n"
+      "ee.vst.128.ip q0, %[dst], 16  \n"
+      "1:                            \n"
+      : [dst] "+r"(dst)
+      : [c] "r"(c2), [blocks] "r"(blocks)
+      : "memory");
+    n &= 7;
+  }
+#else
+  uint32_t *d32 = (uint32_t *)dst;
+  for (size_t i = n >> 3; i; i--) {
+    d32[0] = c2;
+    d32[1] = c2;
+    d32[2] = c2;
+    d32[3] = c2;
+    d32 += 4;
+  }
+  dst = (uint16_t *)d32;
+  n &= 7;
+#endif
+
+  while (n--)
+    *dst++ = colour;
+}
+
+/*********************************************************/
+
+//
+// fg and bg are the same for the whole run, so there are only 33 possible results:
+// work them out once and look them up
+//
+void pix_blend16(uint16_t *dst, const uint8_t *alpha, size_t n, uint16_t fg, uint16_t bg, bool swap) {
+  uint16_t level[33];
+
+  for (int a = 0; a <= 32; a++) {
+    uint16_t c = pix_blend(fg, bg, a == 32 ? 255 : a << 3);
+    level[a] = swap ? (uint16_t)((c << 8) | (c >> 8)) : c;
+  }
+
+  for (; n >= 4; n -= 4) {
+    dst[0] = level[(alpha[0] + 4) >> 3];
+    dst[1] = level[(alpha[1] + 4) >> 3];
+    dst[2] = level[(alpha[2] + 4) >> 3];
+    dst[3] = level[(alpha[3] + 4) >> 3];
+    dst += 4;
+    alpha += 4;
+  }
+  while (n--)
+    *dst++ = level[(*alpha++ + 4) >> 3];
+}
+
+/*********************************************************/
+
+void pix_swap16(uint16_t *dst, const uint16_t *src, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = (uint16_t)((src[i] << 8) | (src[i] >> 8));
+}
+
+/*********************************************************/
+
+void pix_fill16_ref(uint16_t *dst, uint16_t colour, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = colour;
+}
+
+void pix_blend16_ref(uint16_t *dst, const uint8_t *alpha, size_t n, uint16_t fg, uint16_t bg, bool swap) {
+  for (size_t i = 0; i < n; i++) {
+    uint16_t c = pix_blend(fg, bg, alpha[i]);
+    dst[i] = swap ? (uint16_t)((c << 8) | (c >> 8)) : c;
+  }
+}
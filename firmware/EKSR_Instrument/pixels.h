@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// RGB565 pixel kernels
+//
+// TFT_eSPI sends pixel buffers as they are, so "swapped" colours have their bytes in
+// SPI (big endian) order, as in 16 bit sprites.
+// On the ESP32-S3 the fill uses the 128 bit PIE vector stores, elsewhere 32 bit stores.
+// Blending works on two colours at a time packed into one 32 bit word.
+//
+
+// fill n pixels with one colour
+void pix_fill16(uint16_t *dst, uint16_t colour, size_t n);
+
+// blend fg over bg with a per pixel alpha (0-255), e.g. an anti-aliased shape over a known background
+void pix_blend16(uint16_t *dst, const uint8_t *alpha, size_t n, uint16_t fg, uint16_t bg, bool swap);
+
+// swap the bytes of n pixels, dst may be src. One pixel at a time, two a word was slower
+void pix_swap16(uint16_t *dst, const uint16_t *src, size_t n);
+
+// one pixel at a time versions, for testing and benchmarks
+void pix_fill16_ref(uint16_t *dst, uint16_t colour, size_t n);
+void pix_blend16_ref(uint16_t *dst, const uint8_t *alpha, size_t n, uint16_t fg, uint16_t bg, bool swap);
+
+// the blend of one pixel, alpha is rounded to 5 bits
+static inline uint16_t pix_blend(uint16_t fg, uint16_t bg, uint8_t alpha) {
+  uint32_t a = (alpha + 4) >> 3;  // 0-32
+  uint32_t f = (fg | ((uint32_t)fg << 16)) & 0x07E0F81F;  // green moved up, out of the way of red and blue
+  uint32_t b = (bg | ((uint32_t)bg << 16)) & 0x07E0F81F;
+  uint32_t r = ((((f - b) * a) >> 5) + b) & 0x07E0F81F;
+
+  return (uint16_t)((r >> 16) | r);
+}
@@ -0,0 +1,215 @@
+
+#include "profiler.h"
+
+#include "driver/gptimer.h"
+#include "esp_heap_caps.h"
+#include "xtensa_context.h"
+
+typedef struct {
+  uint32_t pc;
+  uint32_t caller;  // return address of the interrupted function
+  uint8_t task;     // index into prof_tasks
+  uint8_t core;
+  uint32_t count;
+} prof_entry_t;
+
+typedef struct {
+  TaskHandle_t handle;
+  char name[configMAX_TASK_NAME_LEN];
+} prof_task_t;
+
+static prof_entry_t *prof_table = NULL;
+static prof_task_t prof_tasks[PROF_MAX_TASKS];
+static volatile uint32_t prof_samples = 0;
+static volatile uint32_t prof_dropped = 0;  // table full
+static volatile bool prof_on = false;
+static uint32_t prof_hz = PROF_HZ;
+
+static portMUX_TYPE prof_mux = portMUX_INITIALIZER_UNLOCKED;  // the two cores share the table
+static gptimer_handle_t prof_timers[portNUM_PROCESSORS];
+static TaskHandle_t prof_waiter = NULL;  // waiting for the timer setup
+
+/*********************************************************/
+
+//
+// index of a task in prof_tasks, adding it the first time it is seen
+//
+static uint8_t IRAM_ATTR task_index(TaskHandle_t task) {
+  int i;
+
+  for (i = 0; i < PROF_MAX_TASKS && prof_tasks[i].handle; i++) {
+    if (prof_tasks[i].handle == task)
+      return i;
+  }
+  if (i == PROF_MAX_TASKS)
+    return PROF_MAX_TASKS - 1;  // lumped in with the last one
+
+  const char *name = pcTaskGetName(task);
+  for (int n = 0; n < configMAX_TASK_NAME_LEN - 1 && name[n]; n++)
+    prof_tasks[i].name[n] = name[n];
+  prof_tasks[i].handle = task;
+  return i;
+}
+
+//
+// timer interrupt, one per core
+//
+static bool IRAM_ATTR prof_isr(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *ctx) {
+  if (!prof_on)
+    return false;
+
+  // the interrupt entry code saved the task's registers on its stack and the stack pointer
+  // in the first word of the task control block
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  XtExcFrame *frame = *(XtExcFrame **)task;
+  uint32_t pc = frame->pc;
+  uint32_t caller = frame->a0;
+  uint8_t core = xPortGetCoreID();
+
+  portENTER_CRITICAL_ISR(&prof_mux);
+  uint8_t t = task_index(task);
+  uint32_t h = (pc ^ (caller << 7) ^ (t << 3)) * 2654435761u;
+  uint32_t i = h >> 21;  // top 11 bits
+  int probe;
+
+  for (probe = 0; probe < 16; probe++, i = (i + 1) & (PROF_MAX_ENTRIES - 1)) {
+    prof_entry_t *e = &prof_table[i];
+    if (e->count == 0) {
+      e->pc = pc;
+      e->caller = caller;
+      e->task = t;
+      e->core = core;
+    } else if (e->pc != pc || e->caller != caller || e->task != t || e->core != core)
+      continue;
+    e->count++;
+    break;
+  }
+  if (probe == 16)
+    prof_dropped++;
+  prof_samples++;
+  portEXIT_CRITICAL_ISR(&prof_mux);
+
+  return false;
+}
+
+/*********************************************************/
+
+//
+// the timer interrupt is allocated on the core that registers the callback,
+// so each core's timer is set up from a task pinned to that core
+//
+static void prof_setup_task(void *param) {
+  int core = (int)param;
+  gptimer_config_t config = {};
+  gptimer_event_callbacks_t cbs = {};
+
+  config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+  config.direction = GPTIMER_COUNT_UP;
+  config.resolution_hz = 1000000;
+  config.intr_priority = 1;
+  cbs.on_alarm = prof_isr;
+
+  if ((gptimer_new_timer(&config, &prof_timers[core]) != ESP_OK)
+      || (gptimer_register_event_callbacks(prof_timers[core], &cbs, NULL) != ESP_OK)
+      || (gptimer_enable(prof_timers[core]) != ESP_OK)) {
+    Serial.printf("Profiler timer on core %d failed\r\n", core);
+    prof_timers[core] = NULL;
+  }
+
+  xTaskNotifyGive(prof_waiter);
+  vTaskDelete(NULL);
+}
+
+bool prof_start(uint32_t hz) {
+  if (!prof_table) {
+    prof_table = (prof_entry_t *)heap_caps_calloc(PROF_MAX_ENTRIES, sizeof(prof_entry_t), MALLOC_CAP_INTERNAL);
+    if (!prof_table) {
+      Serial.println("Profiler: not enough memory");
+      return false;
+    }
+
+    prof_waiter = xTaskGetCurrentTaskHandle();
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+      if (xTaskCreatePinnedToCore(prof_setup_task, "profsetup", 3072, (void *)core, 5, NULL, core) == pdPASS)
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    }
+  }
+
+  hz = constrain(hz, PROF_HZ_MIN, PROF_HZ_MAX);
+  if (prof_on) {
+    if (hz == prof_hz)
+      return true;
+    // the dump has one rate for all its samples, so they can't be mixed
+    Serial.printf("Profiler: running at %lu Hz, stop and clear it first\r\n", (unsigned long)prof_hz);
+    return false;
+  }
+  if (prof_samples && hz != prof_hz) {
+    Serial.printf("Profiler: has samples at %lu Hz, clear it first\r\n", (unsigned long)prof_hz);
+    return false;
+  }
+
+  prof_hz = hz;
+  prof_on = true;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    if (!prof_timers[core])
+      continue;
+
+    gptimer_alarm_config_t alarm = {};
+    alarm.alarm_count = 1000000 / hz;
+    alarm.flags.auto_reload_on_alarm = true;
+    gptimer_set_alarm_action(prof_timers[core], &alarm);
+    gptimer_start(prof_timers[core]);
+  }
+
+  Serial.printf("Profiler started, %lu Hz per core\r\n", (unsigned long)hz);
+  return true;
+}
+
+void prof_stop(void) {
+  if (!prof_on)
+    return;
+
+  prof_on = false;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    if (prof_timers[core])
+      gptimer_stop(prof_timers[core]);
+  }
+  Serial.printf("Profiler stopped, %lu samples\r\n", (unsigned long)prof_samples);
+}
+
+void prof_clear(void) {
+  portENTER_CRITICAL(&prof_mux);
+  if (prof_table)
+    memset(prof_table, 0, PROF_MAX_ENTRIES * sizeof(prof_entry_t));
+  memset(prof_tasks, 0, sizeof(prof_tasks));
+  prof_samples = 0;
+  prof_dropped = 0;
+  portEXIT_CRITICAL(&prof_mux);
+}
+
+bool prof_running(void) {
+  return prof_on;
+}
+
+/*********************************************************/
+
+//
+// print the samples for host/profsym, stops the profiler first
+//
+void prof_dump(void) {
+  prof_stop();
+  if (!prof_table)
+    return;
+
+  Serial.printf("PROF BEGIN hz=%lu samples=%lu dropped=%lu\r\n", (unsigned long)prof_hz,
+                (unsigned long)prof_samples, (unsigned long)prof_dropped);
+  for (int i = 0; i < PROF_MAX_TASKS && prof_tasks[i].handle; i++)
+    Serial.printf("PROF TASK %d %s\r\n", i, prof_tasks[i].name);
+  for (int i = 0; i < PROF_MAX_ENTRIES; i++) {
+    prof_entry_t *e = &prof_table[i];
+    if (e->count)
+      Serial.printf("PROF S %u %u %08lx %08lx %lu\r\n", e->core, e->task, (unsigned long)e->pc,
+                    (unsigned long)e->caller, (unsigned long)e->count);
+  }
+  Serial.println("PROF END");
+}
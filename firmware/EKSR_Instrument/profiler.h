@@ -0,0 +1,24 @@
+#pragma once
+#include <Arduino.h>
+
+//
+// Sampling CPU profiler
+//
+// A hardware timer on each core interrupts PROF_HZ times a second and counts the interrupted
+// program counter, its caller and the running task. Samples are aggregated in a hash table,
+// so it can run for a whole ride. The dump is symbolised on a PC with host/profsym.cpp.
+//
+// The timer interrupt runs at level 1, so code with interrupts disabled (critical sections,
+// other interrupts) is not sampled until it enables them again.
+//
+#define PROF_HZ 997          // per core, not a multiple of the 1 kHz tick
+#define PROF_HZ_MIN 1
+#define PROF_HZ_MAX 10000    // 100 timer ticks between samples, the handler takes a few
+#define PROF_MAX_ENTRIES 2048  // distinct pc/caller/task combinations, power of 2
+#define PROF_MAX_TASKS 24
+
+bool prof_start(uint32_t hz = PROF_HZ);
+void prof_stop(void);
+void prof_clear(void);
+void prof_dump(void);
+bool prof_running(void);
@@ -0,0 +1,225 @@
+
+#include "rides.h"
+#include "esp_rom_crc.h"
+
+#include <string.h>
+
+static_assert(sizeof(ride_record_t) == RIDE_RECORD_SIZE, "one ride per slot");
+
+/*********************************************************/
+
+void rides_seal(ride_record_t *rec) {
+  rec->version = RIDE_RECORD_VERSION;
+  rec->crc = esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(ride_record_t, crc));
+}
+
+bool rides_valid(const ride_record_t *rec) {
+  return (rec->version == RIDE_RECORD_VERSION)
+         && (rec->crc == esp_rom_crc32_le(0, (const uint8_t *)rec, offsetof(ride_record_t, crc)));
+}
+
+/*********************************************************/
+
+void ride_init(ride_t *r) {
+  memset(r, 0, sizeof(ride_t));
+}
+
+void ride_start(ride_t *r, uint32_t distance_mm) {
+  uint16_t flags = r->last_flags;
+
+  ride_init(r);
+  r->open = true;
+  r->last_flags = flags;  // a flag already on is not a fault of this ride
+  r->distance_mm = distance_mm;
+}
+
+void ride_move(ride_t *r, const fd_state_t *s, uint16_t speed, uint32_t distance_mm, uint32_t delta_ms) {
+  uint16_t on = s->flags & ~r->last_flags;
+  bool moving = speed || distance_mm;
+
+  r->last_flags = s->flags;
+  if (!r->open)
+    return;
+
+  r->elapsed_ms += delta_ms;
+  if (moving) {
+    r->moved_ms = r->elapsed_ms;
+    r->moving_ms += delta_ms;
+  }
+  r->distance_mm += distance_mm;
+
+  if (speed > r->rec.max_speed)
+    r->rec.max_speed = speed;
+  if (s->controller_temp > r->rec.max_controller_temp)
+    r->rec.max_controller_temp = s->controller_temp;
+  if (s->motor_temp > r->rec.max_motor_temp)
+    r->rec.max_motor_temp = s->motor_temp;
+
+  r->rec.fault_flags |= s->flags;
+  if (on && r->rec.faults < UINT16_MAX)
+    r->rec.faults++;
+}
+
+void ride_power(ride_t *r, const fd_state_t *s, float energy_wh) {
+  int32_t watts = -s->power * 1000;  // drawn from the battery
+
+  if (!r->open)
+    return;
+
+  r->rec.energy_wh += energy_wh;
+  if (energy_wh < 0)
+    r->rec.regen_wh -= energy_wh;
+
+  if (watts > r->rec.max_power)
+    r->rec.max_power = watts > UINT16_MAX ? UINT16_MAX : watts;
+  if (-watts > r->rec.max_regen)
+    r->rec.max_regen = -watts > UINT16_MAX ? UINT16_MAX : -watts;
+
+  if (!r->have_voltage) {
+    r->have_voltage = true;
+    r->rec.start_voltage = s->voltage;
+    r->rec.min_voltage = s->voltage;
+  }
+  if (s->voltage < r->rec.min_voltage)
+    r->rec.min_voltage = s->voltage;
+  r->rec.end_voltage = s->voltage;
+}
+
+void ride_resume(ride_t *r) {
+  if (r->open && r->rec.pauses < UINT8_MAX)
+    r->rec.pauses++;
+}
+
+void ride_summary(const ride_t *r, ride_record_t *rec) {
+  *rec = r->rec;
+  rec->duration_s = r->moved_ms / 1000;  // the standing at the end isn't riding
+  rec->moving_s = r->moving_ms / 1000;
+  rec->distance_m = r->distance_mm / 1000;
+}
+
+bool ride_close(ride_t *r, ride_record_t *rec) {
+  bool keep = r->open && (r->distance_mm >= RIDE_MIN_M * 1000);
+  uint16_t flags = r->last_flags;
+
+  ride_summary(r, rec);
+  ride_init(r);
+  r->last_flags = flags;  // a flag that stays on is not a new fault in the next ride
+  return keep;
+}
+
+/*********************************************************/
+
+static uint32_t slot_offset(const rides_log_t *log, uint32_t n) {
+  return (n % log->slots) * RIDE_RECORD_SIZE;
+}
+
+//
+// ride n if its slot still holds it
+//
+static bool read_ride(const rides_log_t *log, uint32_t n, ride_record_t *rec) {
+  return log->flash->read(slot_offset(log, n), rec, sizeof(ride_record_t)) && rides_valid(rec) && (rec->seq == n);
+}
+
+static bool blank(const rides_log_t *log, uint32_t offset) {
+  uint32_t words[RIDE_RECORD_SIZE / 4];
+
+  if (!log->flash->read(offset, words, sizeof(words)))
+    return false;
+  for (size_t i = 0; i < RIDE_RECORD_SIZE / 4; i++)
+    if (words[i] != 0xFFFFFFFF)
+      return false;
+  return true;
+}
+
+bool rides_open(rides_log_t *log, const rides_flash_t *flash, const rides_index_t *index) {
+  ride_record_t rec;
+
+  log->flash = flash;
+  log->slots = flash->size / RIDES_SECTOR * RIDES_PER_SECTOR;
+  log->next = 0;
+  log->clock_s = 0;
+  if (log->slots < 2 * RIDES_PER_SECTOR) {
+    log->slots = 0;
+    return false;  // a ring needs a sector to erase and one to keep
+  }
+
+  if (index && (index->version == RIDES_INDEX_VERSION)
+      && (index->crc == esp_rom_crc32_le(0, (const uint8_t *)index, offsetof(rides_index_t, crc)))) {
+    log->next = index->next;
+    log->clock_s = index->clock_s;
+  } else {
+    // the newest ride is the one with the highest number
+    bool found = false;
+    for (uint32_t i = 0; i < log->slots; i++) {
+      ride_record_t r;
+      if (!flash->read(i * RIDE_RECORD_SIZE, &r, sizeof(r)) || !rides_valid(&r) || (r.seq % log->slots != i))
+        continue;
+      if (!found || r.seq > rec.seq)
+        rec = r;
+      found = true;
+    }
+    if (found) {
+      log->next = rec.seq + 1;
+      log->clock_s = rec.start_s + rec.duration_s;
+    }
+  }
+
+  // rides written after the index was last saved
+  while (read_ride(log, log->next, &rec)) {
+    log->clock_s = rec.start_s + rec.duration_s;
+    log->next++;
+  }
+  return true;
+}
+
+//
+// give the ride the next number and write it, erasing the sector ahead first when it starts one
+//
+bool rides_append(rides_log_t *log, ride_record_t *rec) {
+  if (!log->slots)
+    return false;
+
+  for (int tries = 0; tries < RIDES_PER_SECTOR; tries++) {
+    uint32_t offset = slot_offset(log, log->next);
+
+    if ((offset % RIDES_SECTOR == 0) && !log->flash->erase(offset, RIDES_SECTOR))
+      return false;
+    if (!blank(log, offset)) {
+      log->next++;  // half written before a power cut, that number is left out
+      continue;
+    }
+
+    rec->seq = log->next;
+    rec->start_s = log->clock_s;
+    rides_seal(rec);
+    log->next++;
+    if (!log->flash->write(offset, rec, sizeof(ride_record_t)))
+      return false;
+    log->clock_s += rec->duration_s;
+    return true;
+  }
+  return false;
+}
+
+void rides_index(const rides_log_t *log, rides_index_t *index) {
+  memset(index, 0, sizeof(rides_index_t));
+  index->version = RIDES_INDEX_VERSION;
+  index->next = log->next;
+  index->clock_s = log->clock_s;
+  index->crc = esp_rom_crc32_le(0, (const uint8_t *)index, offsetof(rides_index_t, crc));
+}
+
+uint32_t rides_first(const rides_log_t *log) {
+  // the sector holding the newest ride was erased when it was started, the rest of the ring is full
+  uint64_t end = ((uint64_t)log->next + RIDES_PER_SECTOR - 1) / RIDES_PER_SECTOR * RIDES_PER_SECTOR;
+
+  if (end <= log->slots)
+    return 0;
+  return end - log->slots;
+}
+
+bool rides_read(const rides_log_t *log, uint32_t n, ride_record_t *rec) {
+  if (!log->slots || n >= log->next || n < rides_first(log))
+    return false;
+  return read_ride(log, n, rec);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fardriver.h"
+
+//
+// Ride history
+//
+// The ride state detector (ridestate.h) says when a ride starts and ends: the record is opened
+// on its start, with the distance it took to be sure of it, and closed on its end or when the
+// connection is lost. It is summed up in one fixed size record, appended to a
+// table in a raw flash partition. Ride n is always in slot n % slots, so any ride is read with
+// one flash read at an offset worked out from its number, nothing is scanned. The table is a
+// ring: when the next slot starts a sector, that sector is erased and the oldest
+// RIDES_PER_SECTOR rides go with it.
+//
+// The index is only the number of the next ride and the ridden time so far, kept in NVS.
+// Records carry their number and a crc, so a ride written just before a power cut, with the
+// index not saved yet, is found in the slot the index points at and taken in when opened.
+//
+#define RIDE_MIN_M          100          // shorter rides are not kept
+#define RIDE_RECORD_VERSION 1
+#define RIDE_RECORD_SIZE    64
+#define RIDES_SECTOR        4096
+#define RIDES_PER_SECTOR    (RIDES_SECTOR / RIDE_RECORD_SIZE)
+#define RIDES_INDEX_VERSION 1
+
+typedef struct {
+  uint32_t seq;                  // ride number, from 0
+  uint8_t version;
+  uint8_t max_controller_temp;   // deg C
+  uint8_t max_motor_temp;        // deg C
+  uint8_t pauses;                // stops the ride went on after, see ridestate.h
+  uint32_t start_s;              // ridden time before this ride, s, there is no real time clock
+  uint32_t start_odo;            // total odometer at the start, m
+  uint32_t duration_s;           // first to last movement
+  uint32_t moving_s;
+  uint32_t distance_m;
+  float energy_wh;               // regen subtracted
+  float regen_wh;
+  uint16_t max_speed;            // 0.1 km/h
+  uint16_t max_power;            // W from the battery
+  uint16_t max_regen;            // W into the battery
+  uint16_t min_voltage;          // 0.1 V
+  uint16_t start_voltage;        // 0.1 V
+  uint16_t end_voltage;          // 0.1 V
+  uint16_t fault_flags;          // every status flag seen
+  uint16_t faults;               // times a flag came on
+  uint32_t reserved[2];
+  uint32_t crc;                  // of everything above
+} ride_record_t;
+
+// the ride going on, updated from the frames
+typedef struct {
+  bool open;
+  bool have_voltage;
+  uint16_t last_flags;
+  uint32_t elapsed_ms;   // since the ride started
+  uint32_t moved_ms;     // elapsed_ms at the last movement
+  uint32_t moving_ms;
+  uint64_t distance_mm;
+  ride_record_t rec;     // the peaks and energy so far
+} ride_t;
+
+// the partition the table is in
+typedef struct {
+  bool (*read)(uint32_t offset, void *data, size_t len);
+  bool (*write)(uint32_t offset, const void *data, size_t len);
+  bool (*erase)(uint32_t offset, size_t len);  // whole sectors
+  uint32_t size;                               // bytes
+} rides_flash_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t next;      // number of the next ride
+  uint32_t clock_s;   // ridden time of all rides
+  uint32_t crc;
+} rides_index_t;
+
+typedef struct {
+  const rides_flash_t *flash;
+  uint32_t slots;
+  uint32_t next;
+  uint32_t clock_s;
+} rides_log_t;
+
+void ride_init(ride_t *r);
+
+// the ride state detector started a ride, distance_mm is what was ridden to be sure of it
+void ride_start(ride_t *r, uint32_t distance_mm);
+
+// index 0, with the speed in 0.1 km/h and the distance travelled since the last one
+void ride_move(ride_t *r, const fd_state_t *s, uint16_t speed, uint32_t distance_mm, uint32_t delta_ms);
+
+// index 1, with the energy used since the last one
+void ride_power(ride_t *r, const fd_state_t *s, float energy_wh);
+
+void ride_resume(ride_t *r);  // the ride state detector saw a stop, and the ride went on
+void ride_summary(const ride_t *r, ride_record_t *rec);  // the ride so far
+bool ride_close(ride_t *r, ride_record_t *rec);          // false if it is too short to keep
+
+void rides_seal(ride_record_t *rec);
+bool rides_valid(const ride_record_t *rec);
+
+// index NULL when there is no valid one, the table is then scanned once to find the newest ride
+bool rides_open(rides_log_t *log, const rides_flash_t *flash, const rides_index_t *index);
+bool rides_append(rides_log_t *log, ride_record_t *rec);
+void rides_index(const rides_log_t *log, rides_index_t *index);
+uint32_t rides_first(const rides_log_t *log);  // the oldest ride still in the table
+bool rides_read(const rides_log_t *log, uint32_t n, ride_record_t *rec);
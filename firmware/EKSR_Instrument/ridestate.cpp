@@ -0,0 +1,70 @@
+
+#include "ridestate.h"
+
+#include <string.h>
+
+/*********************************************************/
+
+void rs_init(ridestate_t *rs) {
+  memset(rs, 0, sizeof(ridestate_t));
+  rs->state = RS_PARKED;
+}
+
+ride_event_e rs_update(ridestate_t *rs, uint16_t rpm, int16_t iq, uint32_t distance_mm, uint32_t delta_ms) {
+  if (rpm >= RS_MOVE_RPM)
+    rs->moving = true;
+  else if (rpm < RS_STILL_RPM)
+    rs->moving = false;
+
+  if (rs->moving || iq >= RS_DRIVE_IQ || iq <= -RS_DRIVE_IQ)
+    rs->still_ms = 0;
+  else if (rs->still_ms < UINT32_MAX - delta_ms)
+    rs->still_ms += delta_ms;
+
+  switch (rs->state) {
+    case RS_PARKED:
+      if (rs->moving) {
+        rs->start_mm += distance_mm;
+        if (rs->start_mm >= RS_START_MM) {
+          rs->state = RS_RIDING;
+          return RS_START;
+        }
+      } else if (rs->still_ms >= RS_START_GAP_MS)
+        rs->start_mm = 0;
+      break;
+
+    case RS_RIDING:
+      if (rs->still_ms >= RS_PAUSE_MS) {
+        rs->state = RS_PAUSED;
+        return RS_PAUSE;
+      }
+      break;
+
+    case RS_PAUSED:
+      if (rs->moving) {
+        rs->state = RS_RIDING;
+        return RS_RESUME;
+      }
+      if (rs->still_ms >= RS_END_MS) {
+        rs->state = RS_PARKED;
+        rs->start_mm = 0;
+        return RS_END;
+      }
+      break;
+  }
+  return RS_NONE;
+}
+
+bool rs_idle(const ridestate_t *rs) {
+  return rs->state == RS_PARKED && rs->still_ms >= RS_SLEEP_MS;
+}
+
+const char *rs_event_name(ride_event_e ev) {
+  switch (ev) {
+    case RS_START: return "start";
+    case RS_PAUSE: return "pause";
+    case RS_RESUME: return "resume";
+    case RS_END: return "end";
+    default: return "none";
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Ride state detector
+//
+// Fed every index 0 frame, works out whether the bike is being ridden, with hysteresis so a
+// stop at the lights is a pause and not the end of the ride, and pushing the bike out of the
+// garage is not a ride at all:
+//
+//   PARKED -> RIDING   the wheel has turned for RS_START_MM, with no stop longer than
+//                      RS_START_GAP_MS in between
+//   RIDING -> PAUSED   the wheel has stood and the motor has pulled no current for RS_PAUSE_MS
+//   PAUSED -> RIDING   the wheel turns again
+//   PAUSED -> PARKED   stood for RS_END_MS, the ride is over
+//
+// The wheel turns above RS_MOVE_RPM and stands below RS_STILL_RPM, in between it stays as it
+// was. Times are the frame intervals added up, so a frame costs a few integer compares.
+// Shared by the firmware and the host tools.
+//
+#define RS_MOVE_RPM     40            // motor rpm, 0.8 km/h on a 1350 mm wheel
+#define RS_STILL_RPM    15
+#define RS_DRIVE_IQ     500           // 0.01 A, the motor pulling or braking
+#define RS_START_MM     50000         // ridden this far before it is a ride
+#define RS_START_GAP_MS 10000         // a longer stop before that starts over
+#define RS_PAUSE_MS     5000
+#define RS_END_MS       (5 * 60000)
+#define RS_SLEEP_MS     (2 * 60000)   // parked this long, the display can be dimmed
+
+typedef enum {
+  RS_PARKED,
+  RS_RIDING,
+  RS_PAUSED,
+} ride_state_e;
+
+typedef enum {
+  RS_NONE,
+  RS_START,
+  RS_PAUSE,
+  RS_RESUME,
+  RS_END,
+} ride_event_e;
+
+typedef struct {
+  uint8_t state;      // ride_state_e
+  bool moving;        // the wheel turning, with the rpm hysteresis
+  uint32_t still_ms;  // since the wheel last turned or the motor last pulled
+  uint32_t start_mm;  // ridden while the start is being made sure of
+} ridestate_t;
+
+void rs_init(ridestate_t *rs);
+
+// rpm and iq as in fd_state_t, the distance since the last frame, returns what happened
+ride_event_e rs_update(ridestate_t *rs, uint16_t rpm, int16_t iq, uint32_t distance_mm, uint32_t delta_ms);
+
+bool rs_idle(const ridestate_t *rs);  // parked for RS_SLEEP_MS
+const char *rs_event_name(ride_event_e ev);
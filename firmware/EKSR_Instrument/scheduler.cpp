@@ -0,0 +1,145 @@
+
+#include "scheduler.h"
+
+static job_t jobs[SCHED_MAX_JOBS];
+static int num_jobs = 0;
+
+static portMUX_TYPE sched_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t sched_task = NULL;  // task running the scheduler, woken by sched_post()
+
+#define SCHED_MAX_SLEEP 10  // ms
+
+/*********************************************************/
+
+//
+// add a job, returns the job number used for posting events
+//
+int sched_add(const char *name, job_fn fn, uint8_t prio, uint32_t period) {
+  if (num_jobs >= SCHED_MAX_JOBS)
+    return -1;
+
+  job_t *j = &jobs[num_jobs];
+  memset(j, 0, sizeof(job_t));
+  j->name = name;
+  j->fn = fn;
+  j->prio = prio;
+  j->period = period;
+  j->due = micros() + period * 1000;
+
+  return num_jobs++;
+}
+
+/*********************************************************/
+
+//
+// post events to a job, can be called from any task (not from an ISR)
+//
+void sched_post(int job, uint32_t events) {
+  if (job < 0 || job >= num_jobs)
+    return;
+
+  portENTER_CRITICAL(&sched_mux);
+  if (!jobs[job].events)
+    jobs[job].posted = micros();
+  jobs[job].events |= events;
+  portEXIT_CRITICAL(&sched_mux);
+
+  if (sched_task)
+    xTaskNotifyGive(sched_task);
+}
+
+/*********************************************************/
+
+//
+// change how often a job runs, only from the scheduler's own task
+//
+void sched_period(int job, uint32_t period) {
+  if (job < 0 || job >= num_jobs)
+    return;
+
+  jobs[job].period = period;
+  jobs[job].due = micros() + period * 1000;
+}
+
+/*********************************************************/
+
+//
+// run the most important ready job, or sleep until the next one is due
+//
+void sched_run(void) {
+  uint32_t now = micros();
+  uint32_t sleep = SCHED_MAX_SLEEP * 1000;
+  int best = -1;
+
+  if (!sched_task)
+    sched_task = xTaskGetCurrentTaskHandle();
+
+  for (int i = 0; i < num_jobs; i++) {
+    job_t *j = &jobs[i];
+    bool ready = (j->events != 0);
+
+    if (j->period) {
+      int32_t until = (int32_t)(j->due - now);
+      if (until <= 0)
+        ready = true;
+      else if ((uint32_t)until < sleep)
+        sleep = until;
+    }
+
+    if (ready && (best < 0 || j->prio < jobs[best].prio))
+      best = i;
+  }
+
+  if (best < 0) {
+    // nothing to do, give the other tasks a go until the next job is due or an event arrives
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep / 1000));
+    return;
+  }
+
+  job_t *j = &jobs[best];
+  uint32_t late = 0;
+  uint32_t events;
+
+  portENTER_CRITICAL(&sched_mux);
+  events = j->events;
+  j->events = 0;
+  portEXIT_CRITICAL(&sched_mux);
+
+  if (events)
+    late = now - j->posted;
+
+  if (j->period && (int32_t)(j->due - now) <= 0) {
+    if (now - j->due > late)
+      late = now - j->due;
+    j->due += j->period * 1000;
+    if ((int32_t)(j->due - now) <= 0)  // fell more than a period behind, don't try to catch up
+      j->due = now + j->period * 1000;
+  }
+
+  j->fn(events);
+
+  uint32_t run = micros() - now;
+  j->runs++;
+  j->run_total += run;
+  if (run > j->run_max)
+    j->run_max = run;
+  j->late_total += late;
+  if (late > j->late_max)
+    j->late_max = late;
+}
+
+/*********************************************************/
+
+//
+// print run time and lateness of all jobs, to find out who is starving the others
+//
+void sched_report(void) {
+  Serial.println("job          runs   avg us   max us  avg late  max late");
+  for (int i = 0; i < num_jobs; i++) {
+    job_t *j = &jobs[i];
+    uint32_t runs = j->runs ? j->runs : 1;
+    Serial.printf("%-10s %6lu %8lu %8lu %9lu %9lu\r\n", j->name, (unsigned long)j->runs,
+                  (unsigned long)(j->run_total / runs), (unsigned long)j->run_max,
+                  (unsigned long)(j->late_total / runs), (unsigned long)j->late_max);
+  }
+}
@@ -0,0 +1,37 @@
+
+#pragma once
+#include <Arduino.h>
+
+//
+// Small cooperative scheduler
+//
+// Jobs run from loop(), one at a time and to completion, so they must never block.
+// A job is ready when its period has elapsed or when events have been posted to it.
+// Of the ready jobs, the one with the lowest prio value runs first.
+//
+#define SCHED_MAX_JOBS 12
+
+typedef void (*job_fn)(uint32_t events);
+
+typedef struct {
+  const char *name;
+  job_fn fn;
+  uint8_t prio;        // 0 is the highest priority
+  uint32_t period;     // ms, 0 = only run on events
+  uint32_t due;        // micros() of next periodic run
+  uint32_t events;     // pending events, guarded by the scheduler lock
+  uint32_t posted;     // micros() when the first pending event was posted
+
+  // statistics, in us
+  uint32_t runs;
+  uint64_t run_total;
+  uint32_t run_max;
+  uint64_t late_total;
+  uint32_t late_max;
+} job_t;
+
+int sched_add(const char *name, job_fn fn, uint8_t prio, uint32_t period);
+void sched_post(int job, uint32_t events);
+void sched_period(int job, uint32_t period);  // from a job, next run a period from now
+void sched_run(void);
+void sched_report(void);
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Display SPI write clock
+//
+// TFT_eSPI takes its write clock from SPI_FREQUENCY every time it starts a transfer, so
+// Setup400_EKSR.h (and platformio.ini) point it at this variable, which spitune.cpp sets
+// at start up. It starts at SPITUNE_DEFAULT, the clock the display always ran at.
+//
+#define SPITUNE_DEFAULT 40000000
+
+extern uint32_t tft_spi_frequency;
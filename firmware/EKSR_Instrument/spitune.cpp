@@ -0,0 +1,203 @@
+
+#include "spitune.h"
+#include "pixels.h"
+#include "esp_rom_crc.h"
+
+uint32_t tft_spi_frequency = SPITUNE_DEFAULT;
+
+// what the SPI clock divider can make from the 80 MHz APB clock, slowest first
+static const uint32_t steps[] = {
+  SPITUNE_MIN, 26666667, SPITUNE_SPEC,
+#if SPITUNE_OVERCLOCK
+  80000000,
+#endif
+};
+#define STEPS (int)(sizeof(steps) / sizeof(steps[0]))
+
+static bool readback = false;  // the display can be read back, so clocks can be checked
+
+/*********************************************************/
+
+static uint32_t step_below(uint32_t hz) {
+  uint32_t below = 0;
+
+  for (int i = 0; i < STEPS; i++)
+    if (steps[i] < hz)
+      below = steps[i];
+  return below;
+}
+
+//
+// DMA transfers have the clock in their device settings, so DMA is set up again
+//
+static void set_clock(TFT_eSPI *tft, uint32_t hz) {
+  tft_spi_frequency = hz;
+  if (tft->DMA_Enabled) {
+    tft->deInitDMA();
+    tft->initDMA();
+  }
+}
+
+//
+// lots of bit changes: alternate bits, random, and black/white checks
+//
+static uint16_t pattern(int p, int x, int y, uint32_t *seed) {
+  switch (p) {
+    case 0:
+      return ((x + y) & 1) ? 0x5555 : 0xAAAA;
+    case 1:
+      *seed ^= *seed << 13;  // xorshift32
+      *seed ^= *seed >> 17;
+      *seed ^= *seed << 5;
+      return *seed;
+    default:
+      return (((x >> 1) + y) & 1) ? 0xFFFF : 0x0000;
+  }
+}
+
+//
+// write the patterns at hz, read them back at SPI_READ_FREQUENCY and compare checksums,
+// SPITUNE_LINES at a time, over the whole screen above SPITUNE_SPEC.
+// readRect() gives pixels back in SPI byte order, whatever setSwapBytes() says, so that
+// pushRect() can send them straight back: the checksum is taken over the lines swapped
+//
+static bool test_clock(TFT_eSPI *tft, uint32_t hz, int patterns) {
+  int w = tft->width();
+  int lines = hz > SPITUNE_SPEC ? tft->height() : SPITUNE_LINES;
+  uint16_t *line = (uint16_t *)malloc(w * 2);
+  uint16_t *back = (uint16_t *)malloc(w * SPITUNE_LINES * 2);
+  bool swap = tft->getSwapBytes();
+  bool ok = (line && back);
+
+  set_clock(tft, hz);
+  tft->setSwapBytes(true);  // the patterns are colours in CPU byte order
+
+  for (int p = 0; p < patterns && ok; p++) {
+    uint32_t seed = 0x9E3779B9 * (p + 1);
+
+    for (int top = 0; top < lines && ok; top += SPITUNE_LINES) {
+      int n = lines - top < SPITUNE_LINES ? lines - top : SPITUNE_LINES;
+      uint32_t sent = 0;
+
+      tft->startWrite();
+      for (int y = top; y < top + n; y++) {
+        for (int x = 0; x < w; x++)
+          line[x] = pattern(p, x, y, &seed);
+        tft->pushImage(0, y, w, 1, line);
+        pix_swap16(line, line, w);
+        sent = esp_rom_crc32_le(sent, (const uint8_t *)line, w * 2);
+      }
+      tft->endWrite();
+
+      tft->readRect(0, top, w, n, back);
+      ok = (esp_rom_crc32_le(0, (const uint8_t *)back, w * n * 2) == sent);
+    }
+  }
+
+  tft->setSwapBytes(swap);
+  free(line);
+  free(back);
+  return ok;
+}
+
+//
+// the same, with the clock saved as pending while it runs in case it never comes back
+//
+static bool guarded_test(TFT_eSPI *tft, Preferences *prefs, uint32_t hz, int patterns) {
+  prefs->putUInt("spi_try", hz);
+  bool ok = test_clock(tft, hz, patterns);
+  prefs->remove("spi_try");
+  return ok;
+}
+
+/*********************************************************/
+
+static uint32_t tune(TFT_eSPI *tft, Preferences *prefs, uint32_t max_hz) {
+  uint32_t best = 0;
+
+  for (int i = 0; i < STEPS && steps[i] <= max_hz; i++) {
+    if (!guarded_test(tft, prefs, steps[i], SPITUNE_PATTERNS)) {
+      Serial.printf("SPI %lu Hz: read back wrong\n", (unsigned long)steps[i]);
+      break;
+    }
+    uint32_t start = micros();
+    tft->fillScreen(TFT_BLACK);
+    Serial.printf("SPI %lu Hz: ok, full screen fill %lu us\n", (unsigned long)steps[i], (unsigned long)(micros() - start));
+    best = steps[i];
+  }
+
+  if (max_hz < SPITUNE_MIN) {
+    best = SPITUNE_MIN;  // everything hung, nothing slower to try
+  } else if (!best) {
+    // not even the slowest clock reads back, the display can't be read
+    Serial.println("SPI: display can't be read back, not tuning");
+    readback = false;
+    prefs->putBool("spi_rb", false);
+    return SPITUNE_DEFAULT;
+  }
+  readback = true;
+  prefs->putBool("spi_rb", true);
+  return best;
+}
+
+void spitune_begin(TFT_eSPI *tft, Preferences *prefs, bool retune) {
+  uint32_t trying = prefs->getUInt("spi_try", 0);
+  uint32_t max_hz = prefs->getUInt("spi_max", UINT32_MAX);
+  uint32_t hz = prefs->getUInt("spi_hz", 0);
+
+  readback = prefs->getBool("spi_rb", true);
+
+  if (trying) {
+    // reset while testing this clock, never try it again
+    Serial.printf("SPI %lu Hz: no return from testing it\n", (unsigned long)trying);
+    prefs->remove("spi_try");
+    max_hz = step_below(trying);
+    prefs->putUInt("spi_max", max_hz);
+    hz = 0;
+  }
+  if (hz > steps[STEPS - 1])
+    hz = 0;  // kept by a build with SPITUNE_OVERCLOCK, not tried by this one
+  if (retune) {
+    hz = 0;
+    max_hz = UINT32_MAX;
+    prefs->remove("spi_max");
+  }
+
+  if (hz && !readback) {
+    set_clock(tft, hz);  // nothing to check it with
+    return;
+  }
+  if (hz) {
+    if (guarded_test(tft, prefs, hz, 1)) {
+      Serial.printf("SPI %lu Hz\n", (unsigned long)hz);
+      return;
+    }
+    Serial.printf("SPI %lu Hz: failed its check, tuning again\n", (unsigned long)hz);
+    max_hz = step_below(hz);
+    prefs->putUInt("spi_max", max_hz);
+  }
+
+  hz = tune(tft, prefs, max_hz);
+  prefs->putUInt("spi_hz", hz);
+  set_clock(tft, hz);
+  Serial.printf("SPI %lu Hz picked\n", (unsigned long)hz);
+}
+
+/*********************************************************/
+
+bool spitune_can_check(void) {
+  return readback;
+}
+
+void spitune_fault(TFT_eSPI *tft, Preferences *prefs) {
+  uint32_t lower = step_below(tft_spi_frequency);
+
+  if (!lower)
+    return;  // already the slowest
+
+  Serial.printf("SPI %lu Hz: display read back wrong, down to %lu Hz\n", (unsigned long)tft_spi_frequency,
+                (unsigned long)lower);
+  prefs->putUInt("spi_max", lower);
+  prefs->putUInt("spi_hz", lower);
+  set_clock(tft, lower);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+#include <Preferences.h>
+#include <TFT_eSPI.h>
+
+#include "spiclock.h"
+
+//
+// Display SPI clock tuning
+//
+// On the first start the display clock is stepped up from SPITUNE_MIN, writing test patterns
+// at each clock and reading them back at SPI_READ_FREQUENCY, and the fastest clock that gives
+// them back intact is kept in NVS. Before each test the clock under test is saved as pending,
+// so if the unit hangs or crashes at that clock it is never tried again.
+// Later starts check the saved clock with one pattern, and step down and tune again if it fails.
+// Displays without a working MISO line can't be read back and stay at SPITUNE_DEFAULT.
+//
+// Nothing above SPITUNE_SPEC is tried unless SPITUNE_OVERCLOCK is set: 80 MHz is well past
+// what the ILI9341 write cycle is rated for, and a few lines read back slowly prove little.
+// When it is set, clocks above SPITUNE_SPEC are checked over the whole screen, band by band.
+//
+#ifndef SPITUNE_OVERCLOCK
+#define SPITUNE_OVERCLOCK 0
+#endif
+#define SPITUNE_MIN      20000000
+#define SPITUNE_SPEC     40000000
+#define SPITUNE_PATTERNS 3
+#define SPITUNE_LINES    16  // of the screen used for the test patterns, and read back at a time
+
+void spitune_begin(TFT_eSPI *tft, Preferences *prefs, bool retune = false);
+bool spitune_can_check(void);
+
+// the display showed something other than what was sent, step down a clock
+void spitune_fault(TFT_eSPI *tft, Preferences *prefs);
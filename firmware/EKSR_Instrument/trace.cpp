@@ -0,0 +1,47 @@
+
+#include "trace.h"
+
+#define TRACE_MAGIC 0x54524331  // "TRC1"
+
+RTC_NOINIT_ATTR trace_ring_t trace_ring;
+
+static const char *const trace_names[] = {
+  "none", "boot", "frame", "decode", "render", "state", "phase", "disconnect", "touch", "restart",
+};
+
+/*********************************************************/
+
+//
+// print the events from before the reset, oldest first, with times relative to the last one
+//
+static void trace_dump(esp_reset_reason_t reason) {
+  uint32_t head = trace_ring.head;
+  uint32_t count = head < TRACE_SIZE ? head : TRACE_SIZE;
+  uint32_t last = trace_ring.ev[(head - 1) & (TRACE_SIZE - 1)].time;
+
+  Serial.printf("Trace of the last %lu events before reset (reason %d)\r\n", (unsigned long)count, (int)reason);
+  for (uint32_t n = head - count; n != head; n++) {
+    trace_event_t *e = &trace_ring.ev[n & (TRACE_SIZE - 1)];
+    const char *name = e->type < sizeof(trace_names) / sizeof(trace_names[0]) ? trace_names[e->type] : "?";
+
+    Serial.printf("%10ld us  %-10s %3u %5u\r\n", -(long)(last - e->time), name, e->arg8, e->arg16);
+  }
+}
+
+/*********************************************************/
+
+//
+// call first thing in setup()
+//
+void trace_boot(void) {
+  esp_reset_reason_t reason = esp_reset_reason();
+
+  // RTC memory is random after power on, the magic number tells if the ring is still there
+  if ((trace_ring.magic == TRACE_MAGIC) && (reason != ESP_RST_POWERON) && (trace_ring.head != 0))
+    trace_dump(reason);
+
+  memset(&trace_ring, 0, sizeof(trace_ring));
+  trace_ring.magic = TRACE_MAGIC;
+
+  trace(TR_BOOT, reason);
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+
+//
+// Post-mortem trace
+//
+// A ring of the most recent pipeline events in RTC memory, which keeps its contents over
+// software, watchdog and panic resets. trace_boot() prints what led up to the reset on the
+// serial port and starts a new ring.
+// Recording an event is a timer read, an atomic add and an 8 byte store, so it stays enabled.
+//
+#define TRACE_SIZE 256  // events, must be a power of 2
+
+typedef enum {
+  TR_NONE,
+  TR_BOOT,        // arg8 = reset reason
+  TR_FRAME,       // arg8 = message index
+  TR_DECODE,      // arg8 = message index, arg16 = us in message_handler()
+  TR_RENDER,      // arg8 = active screen, arg16 = us in render_job()
+  TR_CONN_STATE,  // arg8 = new connection state
+  TR_BLE_PHASE,   // arg8 = new connect phase, arg16 = ms in the previous one
+  TR_DISCONNECT,
+  TR_TOUCH,       // arg8 = gesture
+  TR_RESTART,
+} trace_type_e;
+
+typedef struct {
+  uint32_t time;  // us since boot
+  uint8_t type;
+  uint8_t arg8;
+  uint16_t arg16;
+} trace_event_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t head;  // number of events written, the next goes in head % TRACE_SIZE
+  trace_event_t ev[TRACE_SIZE];
+} trace_ring_t;
+
+extern trace_ring_t trace_ring;
+
+void trace_boot(void);
+
+//
+// record an event, from any task or ISR
+//
+static inline void trace(uint8_t type, uint8_t arg8 = 0, uint32_t arg16 = 0) {
+  uint32_t i = __atomic_fetch_add(&trace_ring.head, 1, __ATOMIC_RELAXED) & (TRACE_SIZE - 1);
+  trace_event_t *e = &trace_ring.ev[i];
+
+  e->time = (uint32_t)esp_timer_get_time();
+  e->type = type;
+  e->arg8 = arg8;
+  e->arg16 = arg16 > 0xFFFF ? 0xFFFF : arg16;
+}
@@ -0,0 +1,151 @@
+
+#include "wheelspeed.h"
+
+#include "driver/mcpwm_cap.h"
+
+//
+// Complementary filter gain, per index 0 message (~8 per second), 16 fractional bits.
+// The motor speed supplies the fast changes, the wheel sensor pulls the
+// result towards the true road speed with a time constant of about a second.
+//
+#define FUSION_GAIN       6554    // 0.1
+#define WHEEL_MIN_PERIOD  20      // ms, ignore pulses faster than ~240 km/h (1.35m wheel)
+#define WHEEL_TIMEOUT     3000    // ms without pulses before the wheel is considered stopped
+
+static uint32_t circ_mm;
+static uint32_t cap_resolution;  // capture timer ticks per second
+
+// written only by the capture ISR
+static portMUX_TYPE cap_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t cap_last;
+static volatile uint32_t cap_prev;
+static volatile uint32_t cap_count;
+
+// owned by the filter
+static uint32_t seen_count;
+static uint32_t seen_millis;
+static int32_t wheel_speed;
+static int32_t fused_speed;
+static int32_t last_rpm_speed;
+static bool present;
+
+/*********************************************************/
+
+/** Capture ISR, store the edge timestamp and nothing else */
+static bool IRAM_ATTR wheel_capture_cb(mcpwm_cap_channel_handle_t chan, const mcpwm_capture_event_data_t *edata, void *user_data) {
+  portENTER_CRITICAL_ISR(&cap_mux);
+  cap_prev = cap_last;
+  cap_last = edata->cap_value;
+  cap_count++;
+  portEXIT_CRITICAL_ISR(&cap_mux);
+  return false;
+}
+
+/*********************************************************/
+
+void wheelspeed_start(uint32_t circumference_mm) {
+  mcpwm_cap_timer_handle_t cap_timer = NULL;
+  mcpwm_cap_channel_handle_t cap_chan = NULL;
+
+  circ_mm = circumference_mm;
+
+  mcpwm_capture_timer_config_t timer_conf = {};
+  timer_conf.group_id = 0;
+  timer_conf.clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT;
+  if (mcpwm_new_capture_timer(&timer_conf, &cap_timer) != ESP_OK) {
+    Serial.println("Wheel sensor: no capture timer");
+    return;
+  }
+
+  mcpwm_capture_channel_config_t chan_conf = {};
+  chan_conf.gpio_num = IO_WHEEL_SENSOR;
+  chan_conf.prescale = 1;
+  chan_conf.flags.pos_edge = true;
+  chan_conf.flags.pull_up = true;
+  if (mcpwm_new_capture_channel(cap_timer, &chan_conf, &cap_chan) != ESP_OK) {
+    Serial.println("Wheel sensor: no capture channel");
+    return;
+  }
+
+  mcpwm_capture_event_callbacks_t cbs = {};
+  cbs.on_cap = wheel_capture_cb;
+  mcpwm_capture_channel_register_event_callbacks(cap_chan, &cbs, NULL);
+  mcpwm_capture_channel_enable(cap_chan);
+
+  mcpwm_capture_timer_get_resolution(cap_timer, &cap_resolution);
+  mcpwm_capture_timer_enable(cap_timer);
+  mcpwm_capture_timer_start(cap_timer);
+}
+
+/*********************************************************/
+
+//
+// update the wheel sensor speed from the latest capture timestamps
+//
+static void wheel_update(uint32_t now_ms) {
+  uint32_t last, prev, count;
+
+  portENTER_CRITICAL(&cap_mux);
+  last = cap_last;
+  prev = cap_prev;
+  count = cap_count;
+  portEXIT_CRITICAL(&cap_mux);
+
+  if (count != seen_count) {
+    // a single pulse after standstill only gives a timestamp, not a period
+    bool valid = (count - seen_count > 1) || (present && (now_ms - seen_millis) <= WHEEL_TIMEOUT);
+    uint32_t period = last - prev;  // ticks, wraps safely
+
+    if (valid && period > (uint64_t)cap_resolution * WHEEL_MIN_PERIOD / 1000)
+      wheel_speed = ((uint64_t)circ_mm * cap_resolution << SPEED_Q) / ((uint64_t)period * WHEEL_MAGNETS);
+
+    present = true;
+    seen_count = count;
+    seen_millis = now_ms;
+  }
+
+  if (!present)
+    return;
+
+  // the wheel can't be faster than one pulse per elapsed time, this
+  // brings the speed down to zero when the wheel stops
+  uint32_t elapsed = now_ms - seen_millis;
+  if (elapsed > WHEEL_TIMEOUT) {
+    wheel_speed = 0;
+  } else if (elapsed > 0) {
+    int32_t limit = ((uint32_t)circ_mm * 1000 / WHEEL_MAGNETS << SPEED_Q) / elapsed;
+    if (wheel_speed > limit)
+      wheel_speed = limit;
+  }
+}
+
+/*********************************************************/
+
+//
+// fuse the rpm derived speed with the wheel sensor
+// called for every index 0 message, speeds in mm/s << SPEED_Q
+//
+int32_t wheelspeed_fuse(int32_t rpm_speed, uint32_t now_ms) {
+  wheel_update(now_ms);
+
+  // follow the changes of the motor speed
+  fused_speed += rpm_speed - last_rpm_speed;
+  last_rpm_speed = rpm_speed;
+
+  if (!present) {
+    fused_speed = rpm_speed;  // no sensor fitted
+    return fused_speed;
+  }
+
+  // and correct towards the wheel speed
+  fused_speed += ((int64_t)(wheel_speed - fused_speed) * FUSION_GAIN) >> 16;
+
+  if (fused_speed < 0)
+    fused_speed = 0;
+
+  return fused_speed;
+}
+
+bool wheelspeed_present(void) {
+  return present;
+}
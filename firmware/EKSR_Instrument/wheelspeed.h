@@ -0,0 +1,18 @@
+#pragma once
+#include <Arduino.h>
+#include "distance.h"
+
+//
+// Optional hall-effect wheel speed sensor
+//
+// The sensor goes on the ADC_IN header (GPIO6) and is timed with the MCPWM
+// capture unit, so the interrupt only stores a hardware timestamp.
+// If no pulses are ever seen, the fused speed is simply the rpm derived speed.
+//
+#define IO_WHEEL_SENSOR 6
+#define WHEEL_MAGNETS   1     // number of magnets (pulses) per wheel revolution
+
+// speeds are in mm/s << SPEED_Q, see distance.h
+void wheelspeed_start(uint32_t circumference_mm);
+int32_t wheelspeed_fuse(int32_t rpm_speed, uint32_t now_ms);
+bool wheelspeed_present(void);
@@ -0,0 +1,216 @@
+/*
+ * FarDriver Batch Decoder Benchmark
+ *
+ * Cross-checks the SSE4 and AVX2 batch decoders in fdbatch.cpp against the scalar decoder
+ * in firmware/EKSR_Instrument/fardriver.cpp and measures their throughput in frames per second.
+ *
+ *   bench_fardriver [capture.fdcap ...]
+ *
+ * Without arguments it uses synthetic frames. Capture files (see fd_capture_t) are
+ * cross-checked as well, and a summary of the values in them is printed.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "fdbatch.h"
+
+#define BENCH_FRAMES (1 << 20)
+#define BENCH_RUNS 20
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("%s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+static bool cpu_has(const char *feature) {
+  __builtin_cpu_init();
+  if (strcmp(feature, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  return __builtin_cpu_supports("sse4.1");
+}
+
+//
+// random frames, like the emulator sends them, with some broken ones
+//
+static void synth_frames(std::vector<uint8_t> &frames, size_t n) {
+  frames.resize(n * FD_FRAME_LEN);
+  for (size_t i = 0; i < n; i++) {
+    uint8_t *f = &frames[i * FD_FRAME_LEN];
+
+    f[0] = FD_HEADER;
+    f[1] = rand() % (FD_MAX_INDEX + 1);
+    for (int b = 2; b < 14; b++)
+      f[b] = rand();
+    f[14] = fd_checksum(f);
+    f[15] = 0;
+
+    switch (rand() % 20) {
+      case 0: f[rand() % 14 + 1] ^= 1 << (rand() % 8); break;  // bit error
+      case 1: f[0] = rand(); break;                            // bad header, mostly
+    }
+  }
+}
+
+static bool same(const std::vector<fd_words_t> &a, const std::vector<fd_words_t> &b, size_t n) {
+  return memcmp(a.data(), b.data(), n * sizeof(fd_words_t)) == 0;
+}
+
+//
+// every decoder against the scalar one, for all short lengths and unaligned input
+//
+static bool cross_check(fd_batch_fn fn, const uint8_t *frames, size_t n) {
+  std::vector<fd_words_t> ref(n + 1), out(n + 1);
+
+  fd_decode_batch(frames, n, ref.data());
+  memset(out.data(), 0x55, out.size() * sizeof(fd_words_t));
+  fn(frames, n, out.data());
+  if (!same(ref, out, n))
+    return false;
+  return memcmp(&out[n], "\x55\x55", 2) == 0;  // nothing written past the end
+}
+
+static double frames_per_second(fd_batch_fn fn, const uint8_t *frames, size_t n, std::vector<fd_words_t> &out) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < BENCH_RUNS; r++)
+    fn(frames, n, out.data());
+  auto end = std::chrono::steady_clock::now();
+  return (double)n * BENCH_RUNS / std::chrono::duration<double>(end - start).count();
+}
+
+/*********************************************************/
+
+static void summarise(const char *filename, const std::vector<fd_capture_t> &caps) {
+  std::vector<uint8_t> frames(caps.size() * FD_FRAME_LEN);
+  std::vector<fd_words_t> words(caps.size());
+  fd_state_t s = {};
+  size_t valid = 0;
+  uint16_t max_rpm = 0, min_v = 0xFFFF, max_v = 0;
+  uint8_t max_ct = 0, max_mt = 0;
+
+  for (size_t i = 0; i < caps.size(); i++)
+    memcpy(&frames[i * FD_FRAME_LEN], caps[i].frame, FD_FRAME_LEN);
+  fd_decode_batch_best()(frames.data(), caps.size(), words.data());
+
+  for (const fd_words_t &w : words) {
+    if (!w.valid)
+      continue;
+    valid++;
+    switch (fd_update(&s, &w)) {
+      case 0: max_rpm = std::max(max_rpm, s.rpm); break;
+      case 1: min_v = std::min(min_v, s.voltage); max_v = std::max(max_v, s.voltage); break;
+      case 4: max_ct = std::max(max_ct, s.controller_temp); break;
+      case 13: max_mt = std::max(max_mt, s.motor_temp); break;
+    }
+  }
+
+  printf("\n%s\n", filename);
+  printf("  frames %zu, valid %zu, %.1f s\n", caps.size(), valid,
+         caps.empty() ? 0.0 : (caps.back().ms - caps.front().ms) / 1000.0);
+  printf("  max rpm %u, voltage %.1f - %.1f V, max controller %u C, max motor %u C\n", max_rpm,
+         min_v == 0xFFFF ? 0.0 : min_v / 10.0, max_v / 10.0, max_ct, max_mt);
+}
+
+static bool load_capture(const char *filename, std::vector<fd_capture_t> &caps) {
+  FILE *f = fopen(filename, "rb");
+  fd_capture_t c;
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  while (fread(&c, sizeof(c), 1, f) == 1)
+    caps.push_back(c);
+  fclose(f);
+  return true;
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  static_assert(sizeof(fd_words_t) == FD_FRAME_LEN, "one frame in, one record out");
+  static_assert(sizeof(fd_capture_t) == 4 + FD_FRAME_LEN, "capture records are packed");
+
+  struct {
+    const char *name;
+    fd_batch_fn fn;
+    bool ok;
+  } decoders[] = {
+    { "scalar", fd_decode_batch, true },
+    { "sse4", fd_decode_batch_sse4, cpu_has("sse4") },
+    { "avx2", fd_decode_batch_avx2, cpu_has("avx2") },
+  };
+  std::vector<uint8_t> frames;
+
+  srand(1);
+  synth_frames(frames, BENCH_FRAMES);
+
+  printf("FarDriver Batch Decoder\n");
+  printf("========================================\n");
+
+  // the scalar decoder itself, on a known frame
+  const uint8_t known[16] = { 0xAA, 0x00, 0x00, 0x00, 0x0C, 0x00, 0x05, 0xDC, 0x00, 0x80, 0xFF, 0x38, 0x00, 0x64, 0x00, 0x00 };
+  uint8_t frame[16];
+  fd_words_t w;
+  fd_state_t s = {};
+  memcpy(frame, known, 16);
+  frame[14] = fd_checksum(frame);
+  check("scalar decodes a good frame", fd_decode(frame, &w) && fd_update(&s, &w) == 0 && s.rpm == 1500
+                                         && s.gear_bits == 0x0C && s.flags == 0x0080 && s.iq == -200 && s.id == 100);
+  frame[5] ^= 0x10;
+  check("scalar rejects a bad checksum", !fd_decode(frame, &w));
+
+  for (auto &d : decoders) {
+    char what[64];
+    bool ok = true;
+
+    if (d.fn == fd_decode_batch)
+      continue;
+    if (!d.ok) {
+      printf("- %s not supported by this CPU\n", d.name);
+      continue;
+    }
+    for (size_t n = 0; n <= 40 && ok; n++)
+      ok = cross_check(d.fn, frames.data(), n);
+    std::vector<uint8_t> unaligned(frames.begin(), frames.begin() + 1000 * FD_FRAME_LEN);
+    unaligned.insert(unaligned.begin(), 0);
+    ok = ok && cross_check(d.fn, unaligned.data() + 1, 999) && cross_check(d.fn, frames.data(), BENCH_FRAMES);
+    snprintf(what, sizeof(what), "%s matches scalar", d.name);
+    check(what, ok);
+  }
+
+  for (int i = 1; i < argc; i++) {
+    std::vector<fd_capture_t> caps;
+    std::vector<uint8_t> cap_frames;
+
+    if (!load_capture(argv[i], caps)) {
+      failures++;
+      continue;
+    }
+    for (const fd_capture_t &c : caps)
+      cap_frames.insert(cap_frames.end(), c.frame, c.frame + FD_FRAME_LEN);
+    for (auto &d : decoders) {
+      if (d.ok && !cross_check(d.fn, cap_frames.data(), caps.size())) {
+        printf("✗ %s differs from scalar on %s\n", d.name, argv[i]);
+        failures++;
+      }
+    }
+    summarise(argv[i], caps);
+  }
+
+  printf("\n%d frames x %d runs        Mframes/s\n", BENCH_FRAMES, BENCH_RUNS);
+  std::vector<fd_words_t> out(BENCH_FRAMES);
+  for (auto &d : decoders) {
+    if (d.ok)
+      printf("%-8s %27.1f\n", d.name, frames_per_second(d.fn, frames.data(), BENCH_FRAMES, out) / 1e6);
+  }
+
+  return failures ? 1 : 0;
+}
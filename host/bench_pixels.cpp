@@ -0,0 +1,106 @@
+/*
+ * Pixel Kernel Benchmark
+ *
+ * Checks the RGB565 kernels in firmware/EKSR_Instrument/pixels.cpp against their one pixel
+ * at a time versions and times both. On a PC this covers the portable code, the ESP32-S3
+ * PIE fill is timed on the device with the "pixbench" serial command.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pixels.h"
+
+#define PIXELS (240 * 320)
+#define RUNS 200
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("%s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+template<typename F>
+static double time_ns_per_pixel(F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < RUNS; i++)
+    f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / RUNS / PIXELS;
+}
+
+// blend of one channel on its own, rounding down
+static int channel(int f, int b, int a) {
+  return b + (int)floor((f - b) * a / 32.0);
+}
+
+int main() {
+  std::vector<uint16_t> a(PIXELS + 8), b(PIXELS + 8);
+  std::vector<uint8_t> alpha(PIXELS);
+  volatile uint16_t sink = 0;
+
+  srand(1);
+  for (int i = 0; i < PIXELS; i++)
+    alpha[i] = rand();
+
+  printf("Pixel Kernels\n");
+  printf("========================================\n");
+
+  // one pixel blend against per channel arithmetic, all colour pairs would take too long,
+  // so all channel values with a spread of alphas
+  bool blend_ok = true;
+  for (int f = 0; f < 64 && blend_ok; f++) {
+    for (int bg = 0; bg < 64 && blend_ok; bg++) {
+      for (int al = 0; al < 256; al += 5) {
+        uint16_t fg = ((f >> 1) << 11) | (f << 5) | (f >> 1);
+        uint16_t bc = ((bg >> 1) << 11) | (bg << 5) | (bg >> 1);
+        uint16_t c = pix_blend(fg, bc, al);
+        int a5 = (al + 4) >> 3;
+        if ((c >> 11) != channel(f >> 1, bg >> 1, a5) || ((c >> 5) & 63) != channel(f, bg, a5)
+            || (c & 31) != channel(f >> 1, bg >> 1, a5)) {
+          printf("  blend %04x over %04x at %d = %04x\n", fg, bc, al, c);
+          blend_ok = false;
+          break;
+        }
+      }
+    }
+  }
+  check("pix_blend matches per channel blending", blend_ok);
+
+  // kernels against the reference versions, at every alignment and odd lengths
+  bool fill_ok = true, blend16_ok = true;
+  for (int offset = 0; offset < 8; offset++) {
+    for (size_t n : { (size_t)0, (size_t)1, (size_t)7, (size_t)33, (size_t)1001 }) {
+      std::fill(a.begin(), a.end(), 0x1234);
+      std::fill(b.begin(), b.end(), 0x1234);
+      pix_fill16(&a[offset], 0xBEEF, n);
+      pix_fill16_ref(&b[offset], 0xBEEF, n);
+      fill_ok &= (a == b);
+
+      for (bool swap : { false, true }) {
+        pix_blend16(&a[offset], alpha.data(), n, 0xF800, 0x07FF, swap);
+        pix_blend16_ref(&b[offset], alpha.data(), n, 0xF800, 0x07FF, swap);
+        blend16_ok &= (a == b);
+      }
+    }
+  }
+  check("pix_fill16 matches reference", fill_ok);
+  check("pix_blend16 matches reference", blend16_ok);
+
+  printf("\nns per pixel, %d pixels     ref    kernel\n", PIXELS);
+  double r, k;
+  r = time_ns_per_pixel([&] { pix_fill16_ref(a.data(), sink, PIXELS); sink = a[PIXELS / 2]; });
+  k = time_ns_per_pixel([&] { pix_fill16(a.data(), sink, PIXELS); sink = a[PIXELS / 2]; });
+  printf("fill                       %6.3f  %6.3f\n", r, k);
+  r = time_ns_per_pixel([&] { pix_blend16_ref(a.data(), alpha.data(), PIXELS, 0xF800, sink, true); sink = a[7]; });
+  k = time_ns_per_pixel([&] { pix_blend16(a.data(), alpha.data(), PIXELS, 0xF800, sink, true); sink = a[7]; });
+  printf("blend + swap               %6.3f  %6.3f\n", r, k);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+
+#include "fdbatch.h"
+
+#include <immintrin.h>
+
+/*********************************************************/
+
+//
+// output bytes: 0 = index, 1 = valid, 2-13 = data words byte swapped, 14-15 = 0
+// (-1 in a shuffle gives 0)
+//
+#define SHUFFLE_BYTES 1, -1, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, -1, -1
+
+// bytes 1-14 go into the checksum, with the checksum itself the XOR is 0 for a good frame
+#define CHECK_BYTES 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0
+
+__attribute__((target("sse4.1"))) static inline __m128i decode_sse(__m128i f) {
+  const __m128i shuffle = _mm_setr_epi8(SHUFFLE_BYTES);
+  const __m128i check = _mm_setr_epi8(CHECK_BYTES);
+  const __m128i header = _mm_set1_epi8((char)FD_HEADER);
+  const __m128i valid_bit = _mm_setr_epi8(0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  // XOR of bytes 1-14 ends up in byte 0
+  __m128i x = _mm_and_si128(f, check);
+  x = _mm_xor_si128(x, _mm_srli_si128(x, 8));
+  x = _mm_xor_si128(x, _mm_srli_si128(x, 4));
+  x = _mm_xor_si128(x, _mm_srli_si128(x, 2));
+  x = _mm_xor_si128(x, _mm_srli_si128(x, 1));
+
+  // byte 0 is 0xFF if the checksum and header are right, move it to byte 1 as 0 or 1
+  __m128i ok = _mm_and_si128(_mm_cmpeq_epi8(x, _mm_setzero_si128()), _mm_cmpeq_epi8(f, header));
+  ok = _mm_and_si128(_mm_slli_si128(ok, 1), valid_bit);
+
+  return _mm_or_si128(_mm_shuffle_epi8(f, shuffle), ok);
+}
+
+__attribute__((target("sse4.1"))) void fd_decode_batch_sse4(const uint8_t *frames, size_t n, fd_words_t *out) {
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i f0 = _mm_loadu_si128((const __m128i *)(frames + (i + 0) * FD_FRAME_LEN));
+    __m128i f1 = _mm_loadu_si128((const __m128i *)(frames + (i + 1) * FD_FRAME_LEN));
+    __m128i f2 = _mm_loadu_si128((const __m128i *)(frames + (i + 2) * FD_FRAME_LEN));
+    __m128i f3 = _mm_loadu_si128((const __m128i *)(frames + (i + 3) * FD_FRAME_LEN));
+    _mm_storeu_si128((__m128i *)&out[i + 0], decode_sse(f0));
+    _mm_storeu_si128((__m128i *)&out[i + 1], decode_sse(f1));
+    _mm_storeu_si128((__m128i *)&out[i + 2], decode_sse(f2));
+    _mm_storeu_si128((__m128i *)&out[i + 3], decode_sse(f3));
+  }
+  for (; i < n; i++)
+    _mm_storeu_si128((__m128i *)&out[i], decode_sse(_mm_loadu_si128((const __m128i *)(frames + i * FD_FRAME_LEN))));
+}
+
+/*********************************************************/
+
+//
+// the same with two frames per register, byte shuffles and shifts work on each 128 bit half on its own
+//
+__attribute__((target("avx2"))) static inline __m256i decode_avx2(__m256i f) {
+  const __m256i shuffle = _mm256_setr_epi8(SHUFFLE_BYTES, SHUFFLE_BYTES);
+  const __m256i check = _mm256_setr_epi8(CHECK_BYTES, CHECK_BYTES);
+  const __m256i header = _mm256_set1_epi8((char)FD_HEADER);
+  const __m256i valid_bit = _mm256_setr_epi8(0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m256i x = _mm256_and_si256(f, check);
+  x = _mm256_xor_si256(x, _mm256_srli_si256(x, 8));
+  x = _mm256_xor_si256(x, _mm256_srli_si256(x, 4));
+  x = _mm256_xor_si256(x, _mm256_srli_si256(x, 2));
+  x = _mm256_xor_si256(x, _mm256_srli_si256(x, 1));
+
+  __m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(x, _mm256_setzero_si256()), _mm256_cmpeq_epi8(f, header));
+  ok = _mm256_and_si256(_mm256_slli_si256(ok, 1), valid_bit);
+
+  return _mm256_or_si256(_mm256_shuffle_epi8(f, shuffle), ok);
+}
+
+__attribute__((target("avx2"))) void fd_decode_batch_avx2(const uint8_t *frames, size_t n, fd_words_t *out) {
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i f0 = _mm256_loadu_si256((const __m256i *)(frames + (i + 0) * FD_FRAME_LEN));
+    __m256i f1 = _mm256_loadu_si256((const __m256i *)(frames + (i + 2) * FD_FRAME_LEN));
+    __m256i f2 = _mm256_loadu_si256((const __m256i *)(frames + (i + 4) * FD_FRAME_LEN));
+    __m256i f3 = _mm256_loadu_si256((const __m256i *)(frames + (i + 6) * FD_FRAME_LEN));
+    _mm256_storeu_si256((__m256i *)&out[i + 0], decode_avx2(f0));
+    _mm256_storeu_si256((__m256i *)&out[i + 2], decode_avx2(f1));
+    _mm256_storeu_si256((__m256i *)&out[i + 4], decode_avx2(f2));
+    _mm256_storeu_si256((__m256i *)&out[i + 6], decode_avx2(f3));
+  }
+  fd_decode_batch_sse4(frames + i * FD_FRAME_LEN, n - i, out + i);
+}
+
+/*********************************************************/
+
+fd_batch_fn fd_decode_batch_best(const char **name) {
+  const char *dummy;
+
+  if (!name)
+    name = &dummy;
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "avx2";
+    return fd_decode_batch_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    *name = "sse4";
+    return fd_decode_batch_sse4;
+  }
+  *name = "scalar";
+  return fd_decode_batch;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "fardriver.h"
+
+//
+// Vectorised batch decoding of FarDriver frames, for the host tools
+//
+// A frame is 16 bytes, one SSE register, and an fd_words_t is 16 bytes as well,
+// so decoding is one byte shuffle plus a checksum fold per frame. AVX2 does two
+// frames per instruction. Results are the same as fd_decode_batch() in fardriver.cpp.
+//
+
+typedef void (*fd_batch_fn)(const uint8_t *frames, size_t n, fd_words_t *out);
+
+void fd_decode_batch_sse4(const uint8_t *frames, size_t n, fd_words_t *out);
+void fd_decode_batch_avx2(const uint8_t *frames, size_t n, fd_words_t *out);
+
+// the fastest one this CPU supports
+fd_batch_fn fd_decode_batch_best(const char **name = nullptr);
@@ -0,0 +1,482 @@
+/*
+ * Fleet Ride Analytics
+ *
+ * Summarises the ride captures of a whole fleet: distance, energy, Wh/km, peak temperatures,
+ * fault events and efficiency against speed, per ride and per bike. Captures are the .fdcap
+ * files written by pc_display (see fd_capture_t in firmware/EKSR_Instrument/fardriver.h),
+ * laid out as <root>/<bike>/<ride>.fdcap.
+ *
+ * Rides are memory mapped and decoded with the batch decoders in fdbatch.cpp, one ride per
+ * task on a work-stealing thread pool, so it scales with the number of cores as long as there
+ * are more rides than threads. A single ride is always processed by one thread.
+ *
+ *   fleet [-j threads] [-w wheel circumference mm] [-c curves.csv] <root>
+ *   fleet -g <root> [bikes] [rides] [minutes]     make a synthetic fleet to try it on
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "distance.h"
+#include "fdbatch.h"
+
+namespace fs = std::filesystem;
+
+#define BLOCK_FRAMES 4096  // frames decoded per batch
+#define CURVE_BINS   20    // efficiency curve, in steps of CURVE_STEP km/h
+#define CURVE_STEP   5
+#define FLAG_BITS    16
+
+struct ride_t {
+  std::string bike, name, path;
+  uint64_t size;
+
+  // results
+  bool ok;
+  uint64_t frames, bad_frames;
+  uint64_t duration_ms;  // summed into the fleet total, so a uint32 would wrap at 49.7 days
+  uint64_t distance_mm;
+  double energy_wh;  // taken from the battery, regen subtracted
+  double regen_wh;
+  uint8_t max_controller_temp, max_motor_temp;
+  uint32_t faults[FLAG_BITS];  // times each flag bit came on
+  double curve_mm[CURVE_BINS], curve_wh[CURVE_BINS];
+};
+
+static uint32_t wheel_circumference = 1350;  // mm, same default as the firmware
+static fd_batch_fn decode_batch;
+
+/*********************************************************/
+
+//
+// everything in one ride, in order
+//
+static void analyse(ride_t *r) {
+  int fd = open(r->path.c_str(), O_RDONLY);
+  struct stat st;
+
+  r->ok = false;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(r->path.c_str());
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+
+  size_t n = st.st_size / sizeof(fd_capture_t);
+  const fd_capture_t *caps = nullptr;
+  if (n) {
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      perror(r->path.c_str());
+      close(fd);
+      return;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    caps = (const fd_capture_t *)p;
+  }
+  close(fd);
+
+  std::vector<uint8_t> frames(BLOCK_FRAMES * FD_FRAME_LEN);
+  std::vector<fd_words_t> words(BLOCK_FRAMES);
+  fd_state_t s = {};
+  distance_acc_t acc = {};
+  uint32_t last_ms[2] = {};
+  bool seen[2] = {};
+  int32_t speed = 0;
+  int bin = 0;
+
+  for (size_t start = 0; start < n; start += BLOCK_FRAMES) {
+    size_t count = std::min(n - start, (size_t)BLOCK_FRAMES);
+
+    // the batch decoders want the frames back to back, without the timestamps
+    for (size_t i = 0; i < count; i++)
+      memcpy(&frames[i * FD_FRAME_LEN], caps[start + i].frame, FD_FRAME_LEN);
+    decode_batch(frames.data(), count, words.data());
+
+    for (size_t i = 0; i < count; i++) {
+      const fd_words_t &w = words[i];
+      uint32_t ms = caps[start + i].ms;
+      uint16_t old_flags = s.flags;
+
+      r->frames++;
+      if (!w.valid) {
+        r->bad_frames++;
+        continue;
+      }
+
+      switch (fd_update(&s, &w)) {
+        case 0: {
+          // distance, integrated the same way as on the instrument
+          uint32_t dt = ms - last_ms[0];
+          speed = rpm_to_speed(s.rpm, wheel_circumference);
+          bin = std::min((int)(speed * 3.6 / (1000 << SPEED_Q) / CURVE_STEP), CURVE_BINS - 1);
+          if (seen[0] && dt <= DISTANCE_MAX_DT) {
+            uint32_t mm = distance_add(&acc, speed, dt);
+            r->distance_mm += mm;
+            r->curve_mm[bin] += mm;
+          }
+          seen[0] = true;
+          last_ms[0] = ms;
+
+          uint16_t on = s.flags & ~old_flags;
+          for (int b = 0; b < FLAG_BITS; b++)
+            if (on & (1 << b))
+              r->faults[b]++;
+          break;
+        }
+
+        case 1: {
+          // energy from the battery power the instrument shows, negative when driving
+          uint32_t dt = ms - last_ms[1];
+          if (seen[1] && dt <= DISTANCE_MAX_DT) {
+            double wh = -s.power * dt / 3600.0;  // kW * ms / 3600 = Wh
+            r->energy_wh += wh;
+            r->curve_wh[bin] += wh;
+            if (wh < 0)
+              r->regen_wh -= wh;
+          }
+          seen[1] = true;
+          last_ms[1] = ms;
+          break;
+        }
+
+        case 4:
+          r->max_controller_temp = std::max(r->max_controller_temp, s.controller_temp);
+          break;
+
+        case 13:
+          r->max_motor_temp = std::max(r->max_motor_temp, s.motor_temp);
+          break;
+      }
+    }
+  }
+
+  if (n) {
+    r->duration_ms = caps[n - 1].ms - caps[0].ms;
+    munmap((void *)caps, st.st_size);
+  }
+  r->ok = true;
+}
+
+/*********************************************************/
+
+//
+// Work-stealing pool: every thread has its own queue and takes its biggest ride from the
+// back of it. When that runs dry it steals from the front of the others, where the small
+// rides are, so a thief never takes a big ride its owner was about to start.
+//
+struct worker_queue_t {
+  std::mutex lock;
+  std::deque<ride_t *> rides;
+};
+
+static bool take(worker_queue_t *q, ride_t **r, bool steal) {
+  std::lock_guard<std::mutex> guard(q->lock);
+  if (q->rides.empty())
+    return false;
+  if (steal) {
+    *r = q->rides.front();
+    q->rides.pop_front();
+  } else {
+    *r = q->rides.back();
+    q->rides.pop_back();
+  }
+  return true;
+}
+
+static void run_pool(std::vector<ride_t> &rides, unsigned threads, std::atomic<uint64_t> *steals) {
+  std::vector<worker_queue_t> queues(threads);
+  std::vector<ride_t *> order;
+  std::vector<std::thread> workers;
+
+  // biggest rides first, dealt out round robin to the front, so each queue has its big
+  // rides at the back and its small ones at the front
+  for (ride_t &r : rides)
+    order.push_back(&r);
+  std::sort(order.begin(), order.end(), [](ride_t *a, ride_t *b) { return a->size > b->size; });
+  for (size_t i = 0; i < order.size(); i++)
+    queues[i % threads].rides.push_front(order[i]);
+
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      ride_t *r;
+      for (;;) {
+        if (take(&queues[t], &r, false)) {
+          analyse(r);
+          continue;
+        }
+        bool stolen = false;
+        for (unsigned k = 1; k < threads && !stolen; k++)
+          stolen = take(&queues[(t + k) % threads], &r, true);
+        if (!stolen)
+          break;  // nothing is added once started, so all queues are empty
+        (*steals)++;
+        analyse(r);
+      }
+    });
+  }
+  for (std::thread &w : workers)
+    w.join();
+}
+
+/*********************************************************/
+
+static void add_ride(ride_t *total, const ride_t &r) {
+  total->frames += r.frames;
+  total->bad_frames += r.bad_frames;
+  total->duration_ms += r.duration_ms;
+  total->distance_mm += r.distance_mm;
+  total->energy_wh += r.energy_wh;
+  total->regen_wh += r.regen_wh;
+  total->max_controller_temp = std::max(total->max_controller_temp, r.max_controller_temp);
+  total->max_motor_temp = std::max(total->max_motor_temp, r.max_motor_temp);
+  for (int b = 0; b < FLAG_BITS; b++)
+    total->faults[b] += r.faults[b];
+  for (int i = 0; i < CURVE_BINS; i++) {
+    total->curve_mm[i] += r.curve_mm[i];
+    total->curve_wh[i] += r.curve_wh[i];
+  }
+}
+
+static void print_row(const char *bike, const char *ride, const ride_t &r) {
+  double km = r.distance_mm / 1e6;
+  uint32_t faults = 0;
+  char fault_bits[FLAG_BITS * 12] = "";
+
+  for (int b = 0; b < FLAG_BITS; b++) {
+    if (r.faults[b]) {
+      faults += r.faults[b];
+      snprintf(fault_bits + strlen(fault_bits), sizeof(fault_bits) - strlen(fault_bits), " b%d:%u", b, r.faults[b]);
+    }
+  }
+
+  printf("%-12s %-20s %8.1f %9.2f %9.1f %8.1f %7.1f %5u %5u %6u%s\n", bike, ride, r.duration_ms / 60000.0, km,
+         r.energy_wh, r.regen_wh, km > 0.01 ? r.energy_wh / km : 0.0, r.max_controller_temp, r.max_motor_temp,
+         faults, fault_bits);
+}
+
+static void print_header() {
+  printf("%-12s %-20s %8s %9s %9s %8s %7s %5s %5s %6s\n", "bike", "ride", "min", "km", "Wh", "regen", "Wh/km",
+         "ctrlC", "motC", "faults");
+}
+
+static bool write_curves(const char *filename, const std::map<std::string, ride_t> &bikes) {
+  FILE *f = fopen(filename, "w");
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "bike,speed_kmh,km,Wh,Wh_per_km\n");
+  for (auto &b : bikes) {
+    for (int i = 0; i < CURVE_BINS; i++) {
+      double km = b.second.curve_mm[i] / 1e6;
+      if (km < 0.01)
+        continue;
+      fprintf(f, "%s,%d,%.3f,%.2f,%.2f\n", b.first.c_str(), i * CURVE_STEP, km, b.second.curve_wh[i],
+              b.second.curve_wh[i] / km);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+/*********************************************************/
+
+static void put_frame(FILE *f, uint32_t ms, uint8_t index, const uint16_t w[6]) {
+  fd_capture_t c;
+
+  c.ms = ms;
+  c.frame[0] = FD_HEADER;
+  c.frame[1] = index;
+  for (int i = 0; i < 6; i++) {
+    c.frame[2 + 2 * i] = w[i] >> 8;
+    c.frame[3 + 2 * i] = w[i];
+  }
+  c.frame[14] = fd_checksum(c.frame);
+  c.frame[15] = 0;
+  fwrite(&c, sizeof(c), 1, f);
+}
+
+//
+// rides of random length with speed changes, heating up, and a flag now and then,
+// frames every 10 ms cycling through all indexes like the emulator
+//
+static int generate(const char *root, int bikes, int rides, int minutes) {
+  srand(1);
+  for (int b = 0; b < bikes; b++) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/bike%02d", root, b);
+    fs::create_directories(dir);
+
+    for (int r = 0; r < rides; r++) {
+      char path[600];
+      snprintf(path, sizeof(path), "%s/ride%03d.fdcap", dir, r);
+      FILE *f = fopen(path, "wb");
+      if (!f) {
+        perror(path);
+        return 1;
+      }
+
+      uint32_t frames = (uint32_t)(minutes * 6000 * (0.2 + 0.8 * rand() / RAND_MAX));
+      double rpm = 0, target = 0, temp = 25;
+      uint16_t flags = 0;
+
+      for (uint32_t i = 0; i < frames; i++) {
+        uint16_t w[6] = {};
+        uint8_t index = i % (FD_MAX_INDEX + 1);
+
+        if (i % 3000 == 0)
+          target = rand() % 1800;
+        rpm += (target - rpm) * 0.002;
+        temp += (rpm / 1800.0 * 60 + 25 - temp) * 0.00002;
+
+        switch (index) {
+          case 0:
+            if (rand() % 20000 == 0)
+              flags ^= 1 << (rand() % 4);
+            w[1] = 0x0C << 8;
+            w[2] = (uint16_t)rpm;
+            w[3] = flags;
+            w[4] = (uint16_t)(rpm * 2);
+            break;
+          case 1:
+            w[0] = 720 - (uint16_t)(rpm / 60);
+            w[3] = (uint16_t)(int16_t)(-(rpm * 0.8) - (target < rpm ? -600 : 0));
+            break;
+          case 4:
+            w[1] = (uint16_t)temp << 8;
+            break;
+          case 13:
+            w[0] = (uint16_t)(temp * 1.2) << 8;
+            w[1] = (uint16_t)(target / 1800 * 4095);
+            break;
+        }
+        put_frame(f, i * 10, index, w);
+      }
+      fclose(f);
+    }
+  }
+  printf("%d bikes with %d rides each written to %s\n", bikes, rides, root);
+  return 0;
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  unsigned threads = std::thread::hardware_concurrency();
+  const char *curves = nullptr;
+  int opt = 1;
+
+  if (argc >= 3 && strcmp(argv[1], "-g") == 0)
+    return generate(argv[2], argc > 3 ? atoi(argv[3]) : 8, argc > 4 ? atoi(argv[4]) : 20,
+                    argc > 5 ? atoi(argv[5]) : 30);
+
+  for (; opt + 1 < argc && argv[opt][0] == '-'; opt += 2) {
+    if (strcmp(argv[opt], "-j") == 0)
+      threads = atoi(argv[opt + 1]);
+    else if (strcmp(argv[opt], "-w") == 0)
+      wheel_circumference = atoi(argv[opt + 1]);
+    else if (strcmp(argv[opt], "-c") == 0)
+      curves = argv[opt + 1];
+    else
+      break;
+  }
+  if (argc - opt != 1 || threads < 1) {
+    fprintf(stderr, "usage: %s [-j threads] [-w wheel circumference mm] [-c curves.csv] <root>\n", argv[0]);
+    fprintf(stderr, "       %s -g <root> [bikes] [rides] [minutes]\n", argv[0]);
+    return 2;
+  }
+
+  // find the rides
+  std::vector<ride_t> rides;
+  std::error_code ec;
+  for (auto &bike : fs::directory_iterator(argv[opt], ec)) {
+    if (!bike.is_directory())
+      continue;
+    for (auto &file : fs::directory_iterator(bike.path(), ec)) {
+      if (!file.is_regular_file() || file.path().extension() != ".fdcap")
+        continue;
+      ride_t r = {};
+      r.bike = bike.path().filename().string();
+      r.name = file.path().stem().string();
+      r.path = file.path().string();
+      r.size = file.file_size();
+      rides.push_back(r);
+    }
+  }
+  if (ec) {
+    fprintf(stderr, "%s: %s\n", argv[opt], ec.message().c_str());
+    return 1;
+  }
+  if (rides.empty()) {
+    fprintf(stderr, "no <bike>/<ride>.fdcap files in %s\n", argv[opt]);
+    return 1;
+  }
+
+  const char *decoder;
+  std::atomic<uint64_t> steals(0);
+  uint64_t bytes = 0;
+
+  decode_batch = fd_decode_batch_best(&decoder);
+  threads = std::min(threads, (unsigned)rides.size());
+
+  auto start = std::chrono::steady_clock::now();
+  run_pool(rides, threads, &steals);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // per ride, then per bike
+  std::sort(rides.begin(), rides.end(), [](const ride_t &a, const ride_t &b) {
+    return a.bike != b.bike ? a.bike < b.bike : a.name < b.name;
+  });
+
+  std::map<std::string, ride_t> bikes;
+  ride_t fleet = {};
+  int failed = 0;
+
+  printf("Rides\n");
+  print_header();
+  for (const ride_t &r : rides) {
+    bytes += r.size;
+    if (!r.ok) {
+      failed++;
+      continue;
+    }
+    print_row(r.bike.c_str(), r.name.c_str(), r);
+    add_ride(&bikes[r.bike], r);
+    add_ride(&fleet, r);
+  }
+
+  printf("\nBikes\n");
+  print_header();
+  for (auto &b : bikes)
+    print_row(b.first.c_str(), "", b.second);
+  print_row("fleet", "", fleet);
+
+  if (curves && !write_curves(curves, bikes))
+    return 1;
+
+  printf("\n%zu rides, %.2f GB, %llu frames (%llu bad) in %.2f s: %.2f GB/s, %d threads, %s decoder, %llu steals\n",
+         rides.size(), bytes / 1e9, (unsigned long long)fleet.frames, (unsigned long long)fleet.bad_frames, seconds,
+         bytes / 1e9 / seconds, threads, decoder, (unsigned long long)steals.load());
+
+  return failed ? 1 : 0;
+}
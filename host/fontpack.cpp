@@ -0,0 +1,293 @@
+/*
+ * Smooth Font Packer
+ *
+ * Subsets a TFT_eSPI smooth font (VLW) to the glyphs a widget needs and optionally RLE
+ * compresses it (see firmware/EKSR_Instrument/fontpack.h), then writes it as a header for the
+ * sketch folder. The input can be a .vlw file or a header made from one, packed or not.
+ *
+ *   fontpack [-g glyphs] [-z] [-n name] [-o out.h] [-x out.vlw] <font.vlw | font.h>
+ *
+ *   -g  characters to keep, e.g. -g "0123456789.-", default all
+ *   -z  RLE compress
+ *   -n  array name, default the input file name
+ *   -o  header to write
+ *   -x  write the result unpacked as a .vlw file, e.g. to get a font back from a packed header
+ *
+ * Prints the glyphs, the sizes before and after, and how fast the firmware decoder unpacks it.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "fontpack.h"
+
+typedef std::vector<uint8_t> bytes_t;
+
+#define VLW_HEADER  24  // glyph count, version, size, unused, ascent, descent
+#define VLW_METRICS 28  // unicode, height, width, x advance, dy, dx, unused
+
+static uint32_t get32(const bytes_t &b, size_t at) {
+  return ((uint32_t)b[at] << 24) | (b[at + 1] << 16) | (b[at + 2] << 8) | b[at + 3];
+}
+
+static void put32(bytes_t &b, size_t at, uint32_t v) {
+  b[at] = v >> 24;
+  b[at + 1] = v >> 16;
+  b[at + 2] = v >> 8;
+  b[at + 3] = v;
+}
+
+/*********************************************************/
+
+//
+// a .vlw file as it is, or the bytes of the array in a header
+//
+static bool load_font(const char *filename, bytes_t &font) {
+  FILE *f = fopen(filename, "rb");
+  bytes_t raw;
+  int c;
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  while ((c = fgetc(f)) != EOF)
+    raw.push_back(c);
+  fclose(f);
+
+  size_t len = strlen(filename);
+  if (len < 2 || strcmp(filename + len - 2, ".h") != 0) {
+    font = raw;
+    return true;
+  }
+
+  // the array starts after the last PROGMEM, the comment at the top has one too
+  std::string text(raw.begin(), raw.end());
+  size_t pos = text.rfind("PROGMEM");
+  pos = text.find('{', pos == std::string::npos ? 0 : pos);
+  if (pos == std::string::npos) {
+    fprintf(stderr, "%s: no array found\n", filename);
+    return false;
+  }
+  const char *p = text.c_str() + pos + 1;
+  while (*p && *p != '}') {
+    char *end;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+      font.push_back((uint8_t)strtoul(p, &end, 16));
+      p = end;
+    } else {
+      p++;
+    }
+  }
+  return true;
+}
+
+//
+// the glyphs in the font that are in keep, everything else as it was
+//
+static bool subset(const bytes_t &in, const std::set<uint32_t> &keep, bytes_t &out, std::string &glyphs) {
+  if (in.size() < VLW_HEADER)
+    return false;
+
+  uint32_t count = get32(in, 0);
+  size_t bitmaps = VLW_HEADER + (size_t)count * VLW_METRICS;
+  if (bitmaps > in.size())
+    return false;
+
+  std::vector<size_t> kept;
+  std::vector<size_t> offset(count);
+  size_t at = bitmaps;
+  for (uint32_t i = 0; i < count; i++) {
+    size_t m = VLW_HEADER + i * VLW_METRICS;
+    offset[i] = at;
+    at += (size_t)get32(in, m + 4) * get32(in, m + 8);
+    if (keep.empty() || keep.count(get32(in, m)))
+      kept.push_back(i);
+  }
+  if (at > in.size())
+    return false;
+
+  out.assign(in.begin(), in.begin() + VLW_HEADER);
+  put32(out, 0, kept.size());
+  for (size_t i : kept) {
+    size_t m = VLW_HEADER + i * VLW_METRICS;
+    out.insert(out.end(), in.begin() + m, in.begin() + m + VLW_METRICS);
+
+    uint32_t u = get32(in, m);
+    glyphs += (u >= 32 && u < 127) ? std::string(1, (char)u) : "U+" + std::to_string(u) + " ";
+  }
+  for (size_t i : kept) {
+    size_t m = VLW_HEADER + i * VLW_METRICS;
+    out.insert(out.end(), in.begin() + offset[i], in.begin() + offset[i] + get32(in, m + 4) * get32(in, m + 8));
+  }
+  out.insert(out.end(), in.begin() + at, in.end());  // font names
+  return true;
+}
+
+/*********************************************************/
+
+//
+// literals up to 128 bytes, runs of 3 to 130, a run of 2 is cheaper as part of a literal
+//
+static bytes_t pack(const bytes_t &in) {
+  bytes_t out(FONTPACK_HEADER);
+  size_t i = 0, lit = 0;
+
+  memcpy(out.data(), FONTPACK_MAGIC, 4);
+  for (int b = 0; b < 4; b++)
+    out[4 + b] = in.size() >> (8 * b);
+
+  auto flush = [&](size_t upto) {
+    while (lit < upto) {
+      size_t n = std::min(upto - lit, (size_t)128);
+      out.push_back(n - 1);
+      out.insert(out.end(), in.begin() + lit, in.begin() + lit + n);
+      lit += n;
+    }
+  };
+
+  while (i < in.size()) {
+    size_t run = 1;
+    while (i + run < in.size() && in[i + run] == in[i] && run < 0x7F + FONTPACK_MIN_RUN)
+      run++;
+    if (run >= FONTPACK_MIN_RUN) {
+      flush(i);
+      out.push_back(0x80 + run - FONTPACK_MIN_RUN);
+      out.push_back(in[i]);
+      i += run;
+      lit = i;
+    } else {
+      i += run;
+    }
+  }
+  flush(i);
+  return out;
+}
+
+static bool write_header(const char *filename, const char *name, const bytes_t &data, const std::string &glyphs,
+                         bool packed, size_t unpacked) {
+  FILE *f = fopen(filename, "w");
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  fprintf(f, "/* Made with host/fontpack from a TFT_eSPI smooth font (VLW)%s.\n\n", packed ? ", RLE packed" : "");
+  if (packed)
+    fprintf(f, "   Unpacks to %zu bytes, pass it through font_load() in fontpack.h before loadFont().\n", unpacked);
+  else
+    fprintf(f, "   Can be passed to loadFont() as it is.\n");
+  const char *base = strrchr(filename, '/');
+  fprintf(f, "   fontpack -x font.vlw %s gets the VLW font back.\n*/\n\n", base ? base + 1 : filename);
+  fprintf(f, "// %s\n", glyphs.c_str());
+  fprintf(f, "const uint8_t  %s[] PROGMEM = {\n", name);
+  for (size_t i = 0; i < data.size(); i++)
+    fprintf(f, "0x%02X,%s", data[i], (i % 16 == 15 || i == data.size() - 1) ? "\n" : " ");
+  fprintf(f, "};\n");
+  fclose(f);
+  return true;
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  const char *keep_chars = nullptr, *name = nullptr, *out_h = nullptr, *out_vlw = nullptr;
+  bool compress = false;
+  int opt = 1;
+
+  for (; opt < argc && argv[opt][0] == '-'; opt++) {
+    if (strcmp(argv[opt], "-z") == 0)
+      compress = true;
+    else if (opt + 1 < argc && strcmp(argv[opt], "-g") == 0)
+      keep_chars = argv[++opt];
+    else if (opt + 1 < argc && strcmp(argv[opt], "-n") == 0)
+      name = argv[++opt];
+    else if (opt + 1 < argc && strcmp(argv[opt], "-o") == 0)
+      out_h = argv[++opt];
+    else if (opt + 1 < argc && strcmp(argv[opt], "-x") == 0)
+      out_vlw = argv[++opt];
+    else
+      break;
+  }
+  if (argc - opt != 1) {
+    fprintf(stderr, "usage: %s [-g glyphs] [-z] [-n name] [-o out.h] [-x out.vlw] <font.vlw | font.h>\n", argv[0]);
+    return 2;
+  }
+
+  bytes_t input, font, sub;
+  if (!load_font(argv[opt], input))
+    return 1;
+
+  // a packed input is unpacked first
+  if (input.size() >= FONTPACK_HEADER && fontpack_size(input.data())) {
+    font.resize(fontpack_size(input.data()));
+    if (!fontpack_unpack(input.data(), input.size(), font.data(), font.size())) {
+      fprintf(stderr, "%s: bad packed font\n", argv[opt]);
+      return 1;
+    }
+  } else {
+    font = input;
+  }
+
+  // ASCII only, that is all the instrument draws
+  std::set<uint32_t> keep;
+  for (const char *c = keep_chars; c && *c; c++)
+    keep.insert((uint8_t)*c);
+
+  std::string glyphs;
+  if (!subset(font, keep, sub, glyphs)) {
+    fprintf(stderr, "%s: not a VLW font\n", argv[opt]);
+    return 1;
+  }
+  for (uint32_t u : keep)
+    if (glyphs.find((char)u) == std::string::npos)
+      fprintf(stderr, "warning: '%c' is not in the font\n", (char)u);
+
+  bytes_t out = compress ? pack(sub) : sub;
+
+  // always check the firmware decoder gets back what went in, and time it
+  double us = 0;
+  if (compress) {
+    bytes_t check(sub.size());
+    const int runs = 1000;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < runs; r++) {
+      if (fontpack_unpack(out.data(), out.size(), check.data(), check.size()) != sub.size() || check != sub) {
+        fprintf(stderr, "unpacking gives a different font\n");
+        return 1;
+      }
+    }
+    us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+  }
+
+  printf("Glyphs:    %u of %u: %s\n", get32(sub, 0), get32(font, 0), glyphs.c_str());
+  printf("Font:      %zu bytes\n", font.size());
+  printf("Subset:    %zu bytes\n", sub.size());
+  if (compress)
+    printf("Packed:    %zu bytes (%.0f%%), unpacks in %.1f us here\n", out.size(), 100.0 * out.size() / sub.size(), us);
+
+  if (out_h) {
+    std::string n = name ? name : "";
+    if (n.empty()) {
+      const char *base = strrchr(argv[opt], '/');
+      n = base ? base + 1 : argv[opt];
+      n = n.substr(0, n.find('.'));
+    }
+    if (!write_header(out_h, n.c_str(), out, glyphs, compress, sub.size()))
+      return 1;
+  }
+  if (out_vlw) {
+    FILE *f = fopen(out_vlw, "wb");
+    if (!f || fwrite(sub.data(), 1, sub.size(), f) != sub.size()) {
+      perror(out_vlw);
+      return 1;
+    }
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Gesture Replay
+ *
+ * Feeds recorded touch traces through the firmware gesture recogniser
+ * (firmware/EKSR_Instrument/gesture.cpp) and reports recognition latency
+ * and false positives.
+ *
+ * Traces are recorded by building the firmware with TOUCH_TRACE defined and
+ * saving the serial output. Lines used:
+ *
+ *   T <ms> <pressed> <x> <y>    touch sample
+ *   L <ms> <gesture>            label added by hand: the gesture that was intended,
+ *                               at about the time the finger was lifted
+ *
+ * Everything else (including the firmware's own "G" lines) is ignored.
+ * Gesture names are tap, long, left, right, up and down.
+ *
+ *   gesture_replay <trace file>
+ *   gesture_replay --synthetic   replay a built-in synthetic trace with noise and dropouts
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "gesture.h"
+
+#define MATCH_WINDOW 1000  // ms between label and recognition
+
+struct sample_t {
+  uint32_t ms;
+  bool pressed;
+  uint16_t x, y;
+};
+
+struct label_t {
+  uint32_t ms;
+  gesture_e type;
+  bool matched;
+};
+
+struct result_t {
+  uint32_t ms;
+  gesture_e type;
+  uint32_t latency;  // ms from lifting the finger (or from pressing, for a long press)
+  bool matched;
+};
+
+static gesture_e parse_gesture(const char *name) {
+  for (int t = GESTURE_TAP; t <= GESTURE_SWIPE_DOWN; t++)
+    if (strcmp(name, gesture_name((gesture_e)t)) == 0)
+      return (gesture_e)t;
+  return GESTURE_NONE;
+}
+
+//
+// the closest label within MATCH_WINDOW that isn't taken yet
+//
+static label_t *closest_label(std::vector<label_t> &labels, const result_t &r, bool same_type) {
+  label_t *best = nullptr;
+  long best_dt = MATCH_WINDOW + 1;
+
+  for (label_t &l : labels) {
+    long dt = labs((long)l.ms - (long)r.ms);
+    if (!l.matched && (!same_type || l.type == r.type) && dt < best_dt) {
+      best = &l;
+      best_dt = dt;
+    }
+  }
+  return best;
+}
+
+/*********************************************************/
+
+static bool load_trace(const char *filename, std::vector<sample_t> &samples, std::vector<label_t> &labels) {
+  FILE *f = fopen(filename, "r");
+  char line[128];
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long ms;
+    int pressed;
+    unsigned x, y;
+    char name[32];
+
+    if (sscanf(line, "T %lu %d %u %u", &ms, &pressed, &x, &y) == 4)
+      samples.push_back({ (uint32_t)ms, pressed != 0, (uint16_t)x, (uint16_t)y });
+    else if (sscanf(line, "L %lu %31s", &ms, name) == 2)
+      labels.push_back({ (uint32_t)ms, parse_gesture(name), false });
+  }
+
+  fclose(f);
+  return true;
+}
+
+/*********************************************************/
+
+static uint32_t seed = 4711;
+static int noise(int n) {
+  seed ^= seed << 13;  // xorshift32
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (int)(seed % (2 * n + 1)) - n;
+}
+
+//
+// one gesture: press at x0,y0, move to x1,y1 over the given time, with position
+// noise and the occasional dropped sample, like a gloved finger on the panel
+//
+static void synth_gesture(std::vector<sample_t> &samples, std::vector<label_t> &labels, uint32_t &ms,
+                          gesture_e type, int x0, int y0, int x1, int y1, int duration) {
+  int n = duration / GESTURE_SAMPLE_MS;
+
+  for (int i = 0; i <= n; i++) {
+    int x = x0 + (x1 - x0) * i / (n ? n : 1) + noise(4);
+    int y = y0 + (y1 - y0) * i / (n ? n : 1) + noise(4);
+    bool pressed = (i == 0 || i == n) || noise(10) != 10;  // ~5% dropouts
+    samples.push_back({ ms, pressed, (uint16_t)x, (uint16_t)y });
+    ms += GESTURE_SAMPLE_MS;
+  }
+  if (type != GESTURE_NONE)
+    labels.push_back({ ms, type, false });
+
+  // released for a while
+  for (int i = 0; i < 30; i++) {
+    samples.push_back({ ms, false, 0, 0 });
+    ms += GESTURE_SAMPLE_MS;
+  }
+}
+
+static void synth_trace(std::vector<sample_t> &samples, std::vector<label_t> &labels) {
+  uint32_t ms = 0;
+
+  for (int round = 0; round < 20; round++) {
+    synth_gesture(samples, labels, ms, GESTURE_TAP, 120, 20, 120, 20, 80 + noise(40));
+    synth_gesture(samples, labels, ms, GESTURE_LONG_PRESS, 120, 160, 122, 158, 900);
+    synth_gesture(samples, labels, ms, GESTURE_SWIPE_LEFT, 200, 160, 60, 165, 250 + noise(100));
+    synth_gesture(samples, labels, ms, GESTURE_SWIPE_RIGHT, 40, 160, 190, 150, 250 + noise(100));
+    synth_gesture(samples, labels, ms, GESTURE_SWIPE_UP, 120, 260, 125, 100, 300 + noise(100));
+    synth_gesture(samples, labels, ms, GESTURE_SWIPE_DOWN, 120, 60, 115, 240, 300 + noise(100));
+
+    // things that should not be recognised: a slow drag and a diagonal
+    synth_gesture(samples, labels, ms, GESTURE_NONE, 40, 100, 200, 110, 1500);
+    synth_gesture(samples, labels, ms, GESTURE_NONE, 40, 60, 160, 180, 300);
+  }
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  std::vector<sample_t> samples;
+  std::vector<label_t> labels;
+  std::vector<result_t> results;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <trace file> | --synthetic\n", argv[0]);
+    return 2;
+  }
+
+  if (strcmp(argv[1], "--synthetic") == 0)
+    synth_trace(samples, labels);
+  else if (!load_trace(argv[1], samples, labels))
+    return 2;
+
+  // replay
+  gesture_state_t g;
+  uint32_t press_ms = 0, last_pressed_ms = 0;
+  bool was_pressed = false;
+
+  gesture_init(&g);
+  for (const sample_t &s : samples) {
+    if (s.pressed) {
+      if (!was_pressed && g.state == 0)
+        press_ms = s.ms;
+      last_pressed_ms = s.ms;
+    }
+    was_pressed = s.pressed;
+
+    gesture_t r = gesture_feed(&g, s.pressed, s.x, s.y);
+    if (r.type == GESTURE_NONE)
+      continue;
+
+    uint32_t from = (r.type == GESTURE_LONG_PRESS) ? press_ms : last_pressed_ms;
+    results.push_back({ s.ms, r.type, s.ms - from, false });
+  }
+
+  // match recognised gestures against the labels
+  int correct = 0, wrong = 0, false_pos = 0;
+  double latency_sum[GESTURE_SWIPE_DOWN + 1] = {};
+  uint32_t latency_max[GESTURE_SWIPE_DOWN + 1] = {};
+  int count[GESTURE_SWIPE_DOWN + 1] = {};
+
+  // first pair up gestures with labels of the same type, so that one extra
+  // gesture doesn't shift all following matches
+  for (result_t &r : results) {
+    label_t *l = closest_label(labels, r, true);
+    if (!l)
+      continue;
+    l->matched = r.matched = true;
+
+    correct++;
+    count[r.type]++;
+    latency_sum[r.type] += r.latency;
+    if (r.latency > latency_max[r.type])
+      latency_max[r.type] = r.latency;
+  }
+
+  // what is left is either recognised as the wrong type or not intended at all
+  for (result_t &r : results) {
+    if (r.matched)
+      continue;
+    label_t *l = closest_label(labels, r, false);
+    if (l) {
+      l->matched = r.matched = true;
+      wrong++;
+    } else {
+      false_pos++;
+    }
+  }
+
+  int missed = 0;
+  for (const label_t &l : labels)
+    if (!l.matched)
+      missed++;
+
+  printf("Gesture Replay\n");
+  printf("========================================\n");
+  printf("Samples:          %zu (%.1f s)\n", samples.size(), samples.size() * GESTURE_SAMPLE_MS / 1000.0);
+  printf("Labelled:         %zu\n", labels.size());
+  printf("Recognised:       %zu\n", results.size());
+  printf("Correct:          %d\n", correct);
+  printf("Wrong type:       %d\n", wrong);
+  printf("Missed:           %d\n", missed);
+  printf("False positives:  %d\n", false_pos);
+  printf("\ngesture   count  avg latency ms  max latency ms\n");
+  for (int t = GESTURE_TAP; t <= GESTURE_SWIPE_DOWN; t++) {
+    if (count[t])
+      printf("%-8s %6d %15.1f %15u\n", gesture_name((gesture_e)t), count[t], latency_sum[t] / count[t], latency_max[t]);
+  }
+
+  return (wrong || missed || false_pos) ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Just enough of the Arduino core to build firmware modules on the host, see host/README.md
+//
+inline uint32_t micros(void) {
+  static uint32_t us;
+  return us += 10;
+}
+
+inline uint32_t millis(void) {
+  return micros() / 1000;
+}
+
+struct MockSerial {
+  bool quiet = false;
+
+  void printf(const char *fmt, ...) {
+    va_list ap;
+    if (quiet)
+      return;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+  }
+  void println(const char *s) {
+    if (!quiet)
+      puts(s);
+  }
+};
+
+inline MockSerial Serial;
@@ -0,0 +1,35 @@
+#pragma once
+#include <map>
+#include <string>
+
+#include "Arduino.h"
+
+//
+// NVS on the host, kept in memory for as long as the object lives
+//
+class Preferences {
+public:
+  uint32_t getUInt(const char *key, uint32_t def = 0) {
+    auto i = values.find(key);
+    return i == values.end() ? def : i->second;
+  }
+  size_t putUInt(const char *key, uint32_t value) {
+    values[key] = value;
+    return 4;
+  }
+  bool getBool(const char *key, bool def = false) {
+    return getUInt(key, def) != 0;
+  }
+  size_t putBool(const char *key, bool value) {
+    return putUInt(key, value);
+  }
+  bool remove(const char *key) {
+    return values.erase(key) > 0;
+  }
+  bool isKey(const char *key) {
+    return values.count(key) > 0;
+  }
+
+private:
+  std::map<std::string, uint32_t> values;
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+
+#include "Arduino.h"
+
+//
+// An ILI9341 on the host, as far as the firmware's use of TFT_eSPI goes. The panel keeps
+// RGB565 colours. Pixels go out on SPI high byte first: pushImage() sends each uint16_t
+// swapped when setSwapBytes(true), as it is in memory otherwise, the way TFT_eSPI does.
+// readRect() reads RGB666 back and returns it as TFT_eSPI does, byte swapped (SPI order)
+// so pushRect() can send it straight back, whatever setSwapBytes() says.
+//
+// What the real one gets wrong is modelled too: writes above max_write_hz flip a bit now
+// and then, and without miso nothing comes back.
+//
+#define TFT_BLACK 0x0000
+
+extern uint32_t tft_spi_frequency;
+
+class TFT_eSPI {
+public:
+  bool DMA_Enabled = false;
+  uint32_t max_write_hz = 40000000;
+  bool miso = true;
+
+  TFT_eSPI(int w = 240, int h = 320) : w(w), h(h), panel(w * h, 0) {}
+
+  int width(void) { return w; }
+  int height(void) { return h; }
+  void startWrite(void) {}
+  void endWrite(void) {}
+  bool initDMA(void) { return DMA_Enabled = true; }
+  void deInitDMA(void) { DMA_Enabled = false; }
+  void setSwapBytes(bool swap) { swap_bytes = swap; }
+  bool getSwapBytes(void) { return swap_bytes; }
+
+  void pushImage(int32_t x, int32_t y, int32_t pw, int32_t ph, const uint16_t *data) {
+    for (int32_t j = 0; j < ph; j++)
+      for (int32_t i = 0; i < pw; i++) {
+        uint16_t v = *data++;
+        write(x + i, y + j, swap_bytes ? v : swap(v));
+      }
+  }
+
+  void fillScreen(uint32_t colour) {
+    for (int32_t j = 0; j < h; j++)
+      for (int32_t i = 0; i < w; i++)
+        write(i, j, colour);
+  }
+
+  void readRect(int32_t x, int32_t y, int32_t rw, int32_t rh, uint16_t *data) {
+    for (int32_t j = 0; j < rh; j++)
+      for (int32_t i = 0; i < rw; i++) {
+        uint16_t c = miso ? panel[(y + j) * w + x + i] : 0xFFFF;  // MISO pulled up
+        uint8_t r = (c >> 8) & 0xF8, g = (c >> 3) & 0xFC, b = (c << 3) & 0xF8;  // RGB666
+        uint16_t colour = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+        *data++ = swap(colour);
+      }
+  }
+
+  uint16_t pixel(int32_t x, int32_t y) { return panel[y * w + x]; }  // the colour on the panel
+
+private:
+  int32_t w, h;
+  bool swap_bytes = false;
+  std::vector<uint16_t> panel;
+  uint32_t written = 0;
+
+  static uint16_t swap(uint16_t v) { return (v >> 8) | (v << 8); }
+
+  void write(int32_t x, int32_t y, uint16_t colour) {
+    if (tft_spi_frequency > max_write_hz && ++written % 997 == 0)
+      colour ^= 0x0020;  // a bit lost on the wire
+    panel[y * w + x] = colour;
+  }
+};
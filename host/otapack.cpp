@@ -0,0 +1,144 @@
+/*
+ * Firmware Image Packer
+ *
+ * Packs a firmware image for the update over BLE (see firmware/EKSR_Instrument/ota.h): the
+ * header with the image size and its SHA-256, signed with the owner's key, then the image
+ * compressed with the firmware's lz.cpp. Checks the packed image decompresses back to the
+ * same bytes and the signature checks out before writing it.
+ *
+ *   otapack -g <key.pem> > ota_key.h                      make a signing key, once
+ *   otapack -k <key.pem> <firmware.bin> <firmware.ota>
+ *
+ * -g prints the firmware's ota_key.h for the key, build the firmware with it and instruments
+ * only take images signed with key.pem. The .bin is the one the Arduino IDE or PlatformIO
+ * builds for the app partition, not the merged one with the bootloader. Send the .ota with
+ * pc_display/ota_upload.py.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "lz.h"
+#include "ota.h"
+#include "otasign.h"
+#include "sha256.h"
+
+typedef std::vector<uint8_t> bytes_t;
+
+static bool load(const char *filename, bytes_t &data) {
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+static bool unpacks_to(const bytes_t &packed, const bytes_t &image) {
+  static lz_decoder_t d;
+  bytes_t out(image.size());
+  size_t used, n;
+
+  lz_decoder_init(&d);
+  n = lz_decode(&d, packed.data(), packed.size(), &used, out.data(), out.size());
+  return used == packed.size() && n == image.size() && out == image;
+}
+
+static void print_key(const uint8_t public_key[65]) {
+  printf("#pragma once\n#include <stdint.h>\n\n");
+  printf("//\n// Public key that firmware updates must be signed with, see ota.h. Made by otapack -g\n//\n");
+  printf("static const uint8_t ota_public_key[65] = {");
+  for (int i = 0; i < 65; i++)
+    printf("%s0x%02x,", i % 13 ? " " : "\n  ", public_key[i]);
+  printf("\n};\n");
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  uint8_t public_key[65];
+
+  if (argc == 3 && strcmp(argv[1], "-g") == 0) {
+    if (!ota_keygen(argv[2], public_key)) {
+      fprintf(stderr, "can't make a key in %s\n", argv[2]);
+      return 1;
+    }
+    print_key(public_key);
+    return 0;
+  }
+  if (argc != 5 || strcmp(argv[1], "-k") != 0) {
+    fprintf(stderr, "usage: %s -g <key.pem> > ota_key.h\n       %s -k <key.pem> <firmware.bin> <firmware.ota>\n",
+            argv[0], argv[0]);
+    return 2;
+  }
+  const char *pem = argv[2], *bin = argv[3], *ota = argv[4];
+  if (!ota_public(pem, public_key))
+    return 1;
+
+  bytes_t image;
+  if (!load(bin, image))
+    return 1;
+  // an app image starts with the ESP image magic
+  if (image.empty() || image[0] != 0xE9) {
+    fprintf(stderr, "%s: not an ESP32 app image\n", bin);
+    return 1;
+  }
+
+  bytes_t packed(lz_bound(image.size()));
+  size_t n = lz_encode(image.data(), image.size(), packed.data());
+  if (!n) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  packed.resize(n);
+  if (!unpacks_to(packed, image)) {
+    fprintf(stderr, "unpacking gives a different image\n");
+    return 1;
+  }
+
+  ota_header_t header;
+  sha256_t sha;
+  memset(&header, 0, sizeof(header));
+  header.magic = OTA_MAGIC;
+  header.version = OTA_HEADER_VERSION;
+  header.header_len = sizeof(header);
+  header.image_size = image.size();
+  header.packed_size = packed.size();
+  sha256_init(&sha);
+  sha256_update(&sha, image.data(), image.size());
+  sha256_final(&sha, header.sha256);
+
+  uint8_t signed_hash[32];
+  sha256_init(&sha);
+  sha256_update(&sha, &header, OTA_SIGNED_LEN);
+  sha256_final(&sha, signed_hash);
+  if (!ota_sign(pem, signed_hash, header.signature) || !ota_verify(public_key, signed_hash, header.signature)) {
+    fprintf(stderr, "%s: can't sign with it\n", pem);
+    return 1;
+  }
+
+  FILE *f = fopen(ota, "wb");
+  if (!f || fwrite(&header, 1, sizeof(header), f) != sizeof(header)
+      || fwrite(packed.data(), 1, packed.size(), f) != packed.size()) {
+    perror(ota);
+    return 1;
+  }
+  fclose(f);
+
+  printf("Image:     %zu bytes\n", image.size());
+  printf("Packed:    %zu bytes (%.0f%%)\n", packed.size(), 100.0 * packed.size() / image.size());
+  printf("SHA-256:   ");
+  for (int i = 0; i < 32; i++)
+    printf("%02x", header.sha256[i]);
+  printf("\nSigned:    with %s, key ", pem);
+  for (int i = 1; i < 9; i++)
+    printf("%02x", public_key[i]);
+  printf("...\n");
+  return 0;
+}
@@ -0,0 +1,114 @@
+
+#include "otasign.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+
+#include <openssl/core_names.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+/*********************************************************/
+
+static EVP_PKEY *load_key(const char *pem) {
+  FILE *f = fopen(pem, "r");
+  if (!f) {
+    perror(pem);
+    return NULL;
+  }
+  EVP_PKEY *key = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+  fclose(f);
+  if (!key)
+    fprintf(stderr, "%s: not a private key\n", pem);
+  return key;
+}
+
+static bool public_point(EVP_PKEY *key, uint8_t public_key[65]) {
+  size_t len = 0;
+  return EVP_PKEY_get_octet_string_param(key, OSSL_PKEY_PARAM_PUB_KEY, public_key, 65, &len) && len == 65
+         && public_key[0] == 0x04;
+}
+
+bool ota_keygen(const char *pem, uint8_t public_key[65]) {
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  FILE *f;
+  bool ok;
+
+  if (!key)
+    return false;
+  mode_t old = umask(077);
+  f = fopen(pem, "wx");  // never over an existing key
+  umask(old);
+  if (!f) {
+    perror(pem);
+    EVP_PKEY_free(key);
+    return false;
+  }
+  ok = PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL) && public_point(key, public_key);
+  ok = fclose(f) == 0 && ok;
+  EVP_PKEY_free(key);
+  return ok;
+}
+
+bool ota_public(const char *pem, uint8_t public_key[65]) {
+  EVP_PKEY *key = load_key(pem);
+  bool ok = key && public_point(key, public_key);
+  EVP_PKEY_free(key);
+  return ok;
+}
+
+bool ota_sign(const char *pem, const uint8_t hash[32], uint8_t signature[64]) {
+  EVP_PKEY *key = load_key(pem);
+  EVP_PKEY_CTX *ctx = key ? EVP_PKEY_CTX_new(key, NULL) : NULL;
+  unsigned char der[80];
+  size_t der_len = sizeof(der);
+  bool ok = false;
+
+  if (ctx && EVP_PKEY_sign_init(ctx) > 0 && EVP_PKEY_sign(ctx, der, &der_len, hash, 32) > 0) {
+    const unsigned char *p = der;
+    ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, &p, der_len);
+    if (sig) {
+      ok = BN_bn2binpad(ECDSA_SIG_get0_r(sig), signature, 32) == 32
+           && BN_bn2binpad(ECDSA_SIG_get0_s(sig), signature + 32, 32) == 32;
+      ECDSA_SIG_free(sig);
+    }
+  }
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(key);
+  return ok;
+}
+
+bool ota_verify(const uint8_t public_key[65], const uint8_t hash[32], const uint8_t signature[64]) {
+  OSSL_PARAM params[] = {
+    OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, (char *)"P-256", 0),
+    OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY, (void *)public_key, 65),
+    OSSL_PARAM_construct_end(),
+  };
+  EVP_PKEY_CTX *from = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+  EVP_PKEY *key = NULL;
+  bool ok = false;
+
+  if (from && EVP_PKEY_fromdata_init(from) > 0)
+    EVP_PKEY_fromdata(from, &key, EVP_PKEY_PUBLIC_KEY, params);
+  EVP_PKEY_CTX_free(from);
+
+  ECDSA_SIG *sig = ECDSA_SIG_new();
+  BIGNUM *r = BN_bin2bn(signature, 32, NULL), *s = BN_bin2bn(signature + 32, 32, NULL);
+  unsigned char *der = NULL;
+  int der_len;
+  if (key && sig && r && s && ECDSA_SIG_set0(sig, r, s)) {
+    r = s = NULL;  // the signature has them now
+    if ((der_len = i2d_ECDSA_SIG(sig, &der)) > 0) {
+      EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(key, NULL);
+      ok = ctx && EVP_PKEY_verify_init(ctx) > 0 && EVP_PKEY_verify(ctx, der, der_len, hash, 32) == 1;
+      EVP_PKEY_CTX_free(ctx);
+    }
+  }
+  OPENSSL_free(der);
+  BN_free(r);
+  BN_free(s);
+  ECDSA_SIG_free(sig);
+  EVP_PKEY_free(key);
+  return ok;
+}
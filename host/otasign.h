@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+//
+// Signing firmware images for the update over BLE (see firmware/EKSR_Instrument/ota.h),
+// ECDSA P-256 with OpenSSL. Link with -lcrypto. The instrument checks with mbedtls, both
+// take the signature as r and s, 32 bytes each, big endian.
+//
+
+// a new key into a PEM file, only the owner can read it, and its public point (0x04 X Y)
+bool ota_keygen(const char *pem, uint8_t public_key[65]);
+bool ota_public(const char *pem, uint8_t public_key[65]);
+bool ota_sign(const char *pem, const uint8_t hash[32], uint8_t signature[64]);
+bool ota_verify(const uint8_t public_key[65], const uint8_t hash[32], const uint8_t signature[64]);
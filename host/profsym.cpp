@@ -0,0 +1,238 @@
+/*
+ * Profile Symboliser
+ *
+ * Turns the output of "prof dump" (firmware/EKSR_Instrument/profiler.cpp), captured from the
+ * serial port, into a top-N function report, using addr2line on the firmware ELF file.
+ * Optionally writes folded stacks (task;caller;function count) for flamegraph.pl.
+ *
+ *   profsym [-n top] [-f folded.txt] [-a addr2line] firmware.elf serial.log
+ *
+ * The default addr2line is xtensa-esp32s3-elf-addr2line, which comes with the ESP32 Arduino core.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+struct sample_t {
+  unsigned core, task;
+  uint32_t pc, caller;
+  uint64_t count;
+};
+
+struct symbol_t {
+  std::string function;
+  std::string line;  // file:line
+};
+
+static std::map<unsigned, std::string> tasks;
+static std::vector<sample_t> samples;
+static std::map<uint32_t, symbol_t> symbols;
+
+/*********************************************************/
+
+//
+// the return address in a0 has the window increment in its top two bits,
+// and points after the call instruction
+//
+static uint32_t caller_address(uint32_t a0) {
+  if (a0 == 0)
+    return 0;
+  return ((a0 & 0x3FFFFFFF) | 0x40000000) - 3;
+}
+
+static bool load_dump(const char *filename, unsigned *hz, uint64_t *dropped) {
+  FILE *f = fopen(filename, "r");
+  char line[256];
+  bool begin = false, end = false;
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    char *p = strstr(line, "PROF ");  // the log may have timestamps in front
+    unsigned core, task;
+    unsigned long pc, a0;
+    unsigned long long count, total, drop;
+    char name[64];
+
+    if (!p)
+      continue;
+    if (sscanf(p, "PROF BEGIN hz=%u samples=%llu dropped=%llu", hz, &total, &drop) == 3) {
+      // only keep the last dump in the log
+      begin = true;
+      end = false;
+      tasks.clear();
+      samples.clear();
+      *dropped = drop;
+    } else if (sscanf(p, "PROF TASK %u %63s", &task, name) == 2)
+      tasks[task] = name;
+    else if (sscanf(p, "PROF S %u %u %lx %lx %llu", &core, &task, &pc, &a0, &count) == 5)
+      samples.push_back({ core, task, (uint32_t)pc, caller_address(a0), count });
+    else if (strncmp(p, "PROF END", 8) == 0)
+      end = true;
+  }
+
+  fclose(f);
+
+  if (!begin || !end) {
+    fprintf(stderr, "%s: no complete PROF BEGIN ... PROF END dump\n", filename);
+    return false;
+  }
+  return true;
+}
+
+/*********************************************************/
+
+//
+// look up all addresses, a few hundred per addr2line run
+//
+static bool symbolise(const char *addr2line, const char *elf) {
+  std::vector<uint32_t> addresses;
+
+  for (const sample_t &s : samples) {
+    addresses.push_back(s.pc);
+    if (s.caller)
+      addresses.push_back(s.caller);
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+  for (size_t start = 0; start < addresses.size(); start += 256) {
+    size_t n = std::min(addresses.size() - start, (size_t)256);
+    std::string cmd = std::string(addr2line) + " -f -C -e '" + elf + "'";
+    char buf[1024];
+
+    for (size_t i = 0; i < n; i++) {
+      snprintf(buf, sizeof(buf), " 0x%08x", addresses[start + i]);
+      cmd += buf;
+    }
+
+    FILE *p = popen(cmd.c_str(), "r");
+    if (!p) {
+      perror(addr2line);
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      symbol_t sym;
+      if (!fgets(buf, sizeof(buf), p))
+        break;
+      buf[strcspn(buf, "\n")] = 0;
+      sym.function = buf;
+      if (!fgets(buf, sizeof(buf), p))
+        break;
+      buf[strcspn(buf, "\n")] = 0;
+      sym.line = buf;
+      if (sym.function == "??") {
+        snprintf(buf, sizeof(buf), "0x%08x", addresses[start + i]);  // ROM or unknown code
+        sym.function = buf;
+      }
+      symbols[addresses[start + i]] = sym;
+    }
+    if (pclose(p) != 0 && symbols.empty()) {
+      fprintf(stderr, "%s failed\n", addr2line);
+      return false;
+    }
+  }
+  return true;
+}
+
+static const std::string &function_of(uint32_t address) {
+  static const std::string none = "[unknown]";
+  auto it = symbols.find(address);
+  return it == symbols.end() ? none : it->second.function;
+}
+
+/*********************************************************/
+
+static void print_top(const char *title, std::map<std::string, uint64_t> &counts, uint64_t total, int top) {
+  std::vector<std::pair<uint64_t, std::string>> sorted;
+
+  for (auto &c : counts)
+    sorted.push_back({ c.second, c.first });
+  std::sort(sorted.rbegin(), sorted.rend());
+
+  printf("\n%s\n", title);
+  printf("  samples      %%\n");
+  for (int i = 0; i < top && i < (int)sorted.size(); i++)
+    printf("%9llu %6.2f  %s\n", (unsigned long long)sorted[i].first, 100.0 * sorted[i].first / total, sorted[i].second.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  const char *addr2line = "xtensa-esp32s3-elf-addr2line";
+  const char *folded = nullptr;
+  int top = 25;
+  int opt = 1;
+
+  for (; opt < argc && argv[opt][0] == '-'; opt += 2) {
+    if (opt + 1 >= argc)
+      break;
+    if (strcmp(argv[opt], "-n") == 0)
+      top = atoi(argv[opt + 1]);
+    else if (strcmp(argv[opt], "-f") == 0)
+      folded = argv[opt + 1];
+    else if (strcmp(argv[opt], "-a") == 0)
+      addr2line = argv[opt + 1];
+    else
+      break;
+  }
+  if (argc - opt != 2) {
+    fprintf(stderr, "usage: %s [-n top] [-f folded.txt] [-a addr2line] firmware.elf serial.log\n", argv[0]);
+    return 2;
+  }
+
+  unsigned hz = 0;
+  uint64_t dropped = 0;
+  if (!load_dump(argv[opt + 1], &hz, &dropped) || !symbolise(addr2line, argv[opt]))
+    return 1;
+
+  std::map<std::string, uint64_t> by_function, by_line, by_task, by_stack;
+  uint64_t total = 0;
+
+  for (const sample_t &s : samples) {
+    const std::string &fn = function_of(s.pc);
+    std::string task = tasks.count(s.task) ? tasks[s.task] : "?";
+    char core[16];
+
+    snprintf(core, sizeof(core), "core%u", s.core);
+    total += s.count;
+    by_function[fn] += s.count;
+    by_line[symbols[s.pc].line + " " + fn] += s.count;
+    by_task[std::string(core) + " " + task] += s.count;
+    by_stack[std::string(core) + ";" + task + ";" + (s.caller ? function_of(s.caller) : "[none]") + ";" + fn] += s.count;
+  }
+
+  if (!total) {
+    fprintf(stderr, "no samples\n");
+    return 1;
+  }
+
+  printf("Profile\n");
+  printf("========================================\n");
+  printf("Samples:  %llu at %u Hz per core (%.1f s)\n", (unsigned long long)total, hz, (double)total / hz / 2);
+  printf("Dropped:  %llu (table full)\n", (unsigned long long)dropped);
+
+  print_top("By task", by_task, total, top);
+  print_top("By function", by_function, total, top);
+  print_top("By line", by_line, total, top);
+
+  if (folded) {
+    FILE *f = fopen(folded, "w");
+    if (!f) {
+      perror(folded);
+      return 1;
+    }
+    for (auto &s : by_stack)
+      fprintf(f, "%s %llu\n", s.first.c_str(), (unsigned long long)s.second);
+    fclose(f);
+    printf("\nFolded stacks written to %s, for flamegraph.pl\n", folded);
+  }
+
+  return 0;
+}
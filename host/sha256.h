@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// SHA-256 for the host tools, the instrument checks firmware images with the mbedtls one
+//
+
+typedef struct {
+  uint32_t h[8];
+  uint64_t len;  // bytes
+  uint8_t block[64];
+  size_t fill;
+} sha256_t;
+
+void sha256_init(sha256_t *s);
+void sha256_update(sha256_t *s, const void *data, size_t len);
+void sha256_final(sha256_t *s, uint8_t hash[32]);
@@ -0,0 +1,199 @@
+/*
+ * Battery Estimator Test
+ *
+ * Rides a simulated pack through the firmware battery estimator
+ * (firmware/EKSR_Instrument/battery.cpp): 80 rides of traffic, stops at the lights and
+ * longer breaks, with the instrument off and the pack charged between rides. The pack
+ * ages from 17 to 15.5 Ah (rated 20 Ah) and has a series resistance plus a slow
+ * relaxation, so the voltage only settles to open circuit some time after the current stops.
+ * What was learnt is saved and restored between rides as on the instrument, and the
+ * instrument restarts once in the middle of a ride.
+ * Checks the state of charge against the pack's, and the learnt capacity and resistance.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "battery.h"
+
+static const int cells = 24;
+static const uint32_t rated_mah = 20000;
+static const int rides = 80;
+static const double r0 = 0.120;   // Ohm, series resistance
+static const double r1 = 0.040;   // Ohm, relaxation
+static const double tau = 25.0;   // s
+static const double max_soc_error = 0.04;
+static const double max_capacity_error = 0.05;
+static const double max_resistance_error = 0.15;
+
+static const double ocv_table[] = { 3.000, 3.450, 3.550, 3.620, 3.680, 3.740, 3.820, 3.900, 3.980, 4.080, 4.200 };
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+static uint32_t seed = 12345;
+static uint32_t rnd(uint32_t n) {
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 8) % n;
+}
+
+typedef struct {
+  double capacity_ah;
+  double soc;
+  double v1;  // across the relaxation
+} pack_t;
+
+static double ocv(double soc) {
+  double x = fmin(fmax(soc, 0.0), 1.0) * 10;
+  int i = std::min((int)x, 9);
+  return (ocv_table[i] + (ocv_table[i + 1] - ocv_table[i]) * (x - i)) * cells;
+}
+
+//
+// draw amps (negative on regen) for ms, returns the voltage at the end
+//
+static double pack_run(pack_t *p, double amps, double ms) {
+  double dt = ms / 1000.0;
+  p->soc -= amps * dt / 3600.0 / p->capacity_ah;
+  p->v1 = amps * r1 + (p->v1 - amps * r1) * exp(-dt / tau);
+  return ocv(p->soc) - amps * r0 - p->v1;
+}
+
+int main() {
+  printf("Testing Battery Estimator\n");
+  printf("========================================\n");
+
+  pack_t pack = { 17.0, 1.0, 0 };
+  battery_record_t saved;
+  bool have_saved = false;
+  battery_t bat;
+  double worst_soc = 0, sum_soc = 0;
+  long frames = 0, soc_frames = 0;
+  double update_ns = 0;
+
+  for (int ride = 0; ride < rides; ride++) {
+    battery_init(&bat, cells, rated_mah);
+    if (have_saved && !battery_restore(&bat, &saved))
+      check("saved record restored", false);
+    bat.cold_start = true;  // switched on
+
+    pack.capacity_ah = 17.0 - 1.5 * ride / (rides - 1);  // ageing
+    pack.v1 = 0;                                          // rested while the instrument was off
+    if (pack.soc < 0.3)
+      pack.soc = 1.0;  // charged overnight
+
+    // ride for 40 minutes: drive for a while at a changing throttle, stop at the lights,
+    // and take a longer break every 12 minutes or so
+    double ride_ms = 0, amps = 0;
+    double next_break = 12 * 60000.0;
+    uint32_t since = 0;
+    int phase_left = 0, phase = 0;  // 0 stopped, 1 driving, 2 braking
+
+    while (ride_ms < 40 * 60000.0 && pack.soc > 0.05) {
+      if (phase_left <= 0) {
+        if (phase == 1) {
+          phase = 2;
+          phase_left = 3000 + rnd(4000);
+        } else if (phase == 2) {
+          phase = 0;
+          phase_left = (ride_ms > next_break) ? 150000 + rnd(120000) : 10000 + rnd(60000);
+          if (ride_ms > next_break)
+            next_break += 12 * 60000.0;
+        } else {
+          phase = 1;
+          phase_left = 60000 + rnd(120000);
+        }
+      }
+      if (phase == 1 && rnd(40) == 0)
+        amps = 8 + rnd(28);  // throttle moves now and then
+      else if (phase == 2)
+        amps = -5;
+      else if (phase == 0)
+        amps = 0;
+
+      uint32_t dt = 70 + rnd(20);  // index 1 frames come about every 80 ms
+      double v = pack_run(&pack, amps, dt);
+      int16_t current = (int16_t)lround(-amps * 100);
+      uint16_t voltage = (uint16_t)lround(v * 10);
+
+      auto t0 = std::chrono::steady_clock::now();
+      battery_update(&bat, current, voltage, since ? dt : 0);
+      update_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+      since += dt;
+      frames++;
+
+      int32_t soc = battery_soc(&bat);
+      if (soc >= 0) {
+        double err = fabs(soc / 65536.0 - pack.soc);
+        worst_soc = fmax(worst_soc, err);
+        sum_soc += err;
+        soc_frames++;
+      }
+
+      ride_ms += dt;
+      phase_left -= dt;
+
+      // the connection is lost half way through a ride and the instrument restarts
+      if (ride == rides / 2 && ride_ms >= 20 * 60000.0 && ride_ms < 20 * 60000.0 + dt) {
+        battery_live_t live;
+        int32_t before = battery_soc(&bat);
+        bool learning = bat.learning;
+
+        battery_save(&bat, &saved);
+        battery_save_live(&bat, &live);
+        battery_init(&bat, cells, rated_mah);
+        battery_restore(&bat, &saved);
+        check("warm reset keeps the state of charge", battery_restore_live(&bat, &live)
+                                                        && battery_soc(&bat) == before && bat.learning == learning);
+        since = 0;
+      }
+    }
+
+    // saved on the instrument when something was learnt
+    if (bat.dirty || !have_saved) {
+      battery_save(&bat, &saved);
+      have_saved = true;
+    }
+  }
+
+  double capacity_error = fabs(bat.capacity_mah / 1000.0 - pack.capacity_ah) / pack.capacity_ah;
+  double resistance = bat.resistance / 256.0 / 1000.0;
+  double resistance_error = fabs(resistance - r0) / r0;
+
+  printf("Frames:          %ld, %.0f ns per update\n", frames, update_ns / frames);
+  printf("State of charge: %.2f %% mean error, %.2f %% worst\n", 100 * sum_soc / soc_frames, 100 * worst_soc);
+  printf("Capacity:        %.2f Ah learnt, pack %.2f Ah, %u%% of rated\n", bat.capacity_mah / 1000.0,
+         pack.capacity_ah, (unsigned)battery_health(&bat));
+  printf("Resistance:      %.1f mOhm learnt, pack %.1f mOhm\n", resistance * 1000, r0 * 1000);
+  printf("Remaining:       %u Wh at %.0f %%\n", (unsigned)battery_remaining_wh(&bat), battery_soc(&bat) / 655.36);
+  printf("History:         %u estimates\n", bat.learnt);
+  for (int i = 0; i < BATTERY_HISTORY && i < bat.learnt; i++) {
+    const battery_history_t *h = &bat.history[(bat.head + BATTERY_HISTORY - 1 - i) % BATTERY_HISTORY];
+    printf("  %5.2f Ah  %5.1f mOhm  over %4.1f %%  at %4.1f cycles\n", h->capacity / 100.0, h->resistance / 10.0,
+           h->swing / 10.0, h->cycles / 10.0);
+  }
+
+  // the first frame only anchors from power off, and is never learnt from
+  battery_t b;
+  battery_init(&b, cells, rated_mah);
+  battery_update(&b, 0, 940, 0);
+  check("no state of charge at rest after a warm reset", battery_soc(&b) < 0);
+  b.cold_start = true;
+  b.have_last = false;
+  battery_update(&b, 0, 940, 0);
+  battery_update(&b, -2000, 900, 80);
+  check("switched on at rest, anchored but not learning", battery_soc(&b) >= 0 && !b.learning);
+
+  check("state of charge within 4% of the pack", worst_soc < max_soc_error);
+  check("capacity within 5% of the aged pack", capacity_error < max_capacity_error);
+  check("resistance within 15% of the pack", resistance_error < max_resistance_error);
+  check("capacity learnt over several rides", bat.learnt >= 5);
+
+  return failures ? 1 : 0;
+}
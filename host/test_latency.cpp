@@ -0,0 +1,141 @@
+/*
+ * Latency Analyser Test
+ *
+ * Checks the histogram buckets and percentiles of the firmware latency analyser
+ * (firmware/EKSR_Instrument/latency.cpp), then drives it with a simulated controller
+ * that sends indexes 0, 1, 4 and 13 in turn every 20 ms, as the emulator does, and whose
+ * motor current follows the throttle after a known delay. Some throttle steps come with the
+ * motor at its limit and get no response. Battery frames are drawn by a render job every
+ * 50 ms that takes a few ms, so both latencies are known and can be checked.
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "latency.h"
+
+static const uint32_t frame_us = 20000;
+static const uint32_t delay_us = 160000;  // throttle to iq in the simulated controller
+static const uint32_t render_us = 50000;
+static const uint32_t draw_us = 8000;
+static const double ride_s = 3600.0;
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+static uint32_t seed = 12345;
+static uint32_t rnd(uint32_t n) {
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 8) % n;
+}
+
+static void print_hist(const char *name, const lat_hist_t *h) {
+  printf("%-20s %6u, mean %6.1f ms, p50 %6.1f, p90 %6.1f, p99 %6.1f, max %6.1f\n", name, h->n,
+         h->n ? h->total / 1000.0 / h->n : 0.0, lat_percentile(h, 50) / 1000.0, lat_percentile(h, 90) / 1000.0,
+         lat_percentile(h, 99) / 1000.0, h->max / 1000.0);
+}
+
+int main() {
+  printf("Testing Latency Analyser\n");
+  printf("========================================\n");
+
+  // buckets: every value lands in the bucket whose floor is at or below it, within 1/LAT_SUB
+  bool buckets_ok = true;
+  for (uint32_t us = 0; us < 20000000; us = us < 100 ? us + 1 : us * 1.01) {
+    lat_hist_t h = {};
+    lat_hist_add(&h, us);
+    int b = 0;
+    while (!h.count[b])
+      b++;
+    uint32_t lo = lat_bucket_floor(b);
+    uint32_t hi = (b + 1 < LAT_BUCKETS) ? lat_bucket_floor(b + 1) : UINT32_MAX;
+    if (us < lo || (b + 1 < LAT_BUCKETS && (us >= hi || (us >= 8 && hi - lo > lo / LAT_SUB))))
+      buckets_ok = false;
+  }
+  check("values land in their buckets, which are 1/LAT_SUB wide", buckets_ok);
+
+  lat_hist_t flat = {};
+  for (uint32_t ms = 1; ms <= 100; ms++)
+    lat_hist_add(&flat, ms * 1000);
+  uint32_t p50 = lat_percentile(&flat, 50), p90 = lat_percentile(&flat, 90);
+  check("percentiles of 1..100 ms", p50 >= 50000 && p50 < 50000 * 1.25 && p90 >= 90000 && p90 < 90000 * 1.25
+                                      && lat_percentile(&flat, 100) == 100000);
+
+  // the simulated ride
+  latency_t lat;
+  fd_state_t s = {};
+  latency_init(&lat);
+  latency_frame(&lat, 13, &s, 1000);
+  check("nothing collected until started", lat.hist[LAT_THROTTLE_TORQUE].n == 0 && !lat.have_throttle);
+  latency_start(&lat);
+
+  static const uint8_t indexes[] = { 0, 1, 4, 13 };
+  uint16_t throttle = 0;
+  uint32_t moved_us = 0;
+  int16_t iq_from = 0, iq_to = 0;
+  bool limited = false;
+  uint32_t next_step = 1000000, next_render = render_us;
+  uint32_t steps = 0, no_response = 0, battery_frames = 0;
+
+  for (uint32_t t = 0, n = 0; t < ride_s * 1e6; t += frame_us, n++) {
+    // the rider moves the throttle every 2 to 4 s, now and then with the motor already at its limit
+    if (t >= next_step) {
+      int dir = throttle > 2000 ? -1 : 1;
+      throttle = (throttle > 2000) ? 500 + rnd(1000) : 2500 + rnd(1500);
+      moved_us = t;
+      iq_from = s.iq;
+      limited = (rnd(10) == 0);
+      iq_to = limited ? s.iq : (int16_t)(throttle * 5);
+      steps++;
+      // at the limit, or after it iq was left where the step doesn't move it far enough
+      no_response += (iq_to - iq_from) * dir < LAT_IQ_STEP;
+      next_step = t + 2000000 + rnd(2000000);
+    }
+
+    // iq jumps to its new value after the controller's delay
+    s.throttle = throttle;
+    s.iq = (t - moved_us >= delay_us) ? iq_to : iq_from;
+
+    uint8_t index = indexes[n % 4];
+    uint32_t arrival = t + rnd(3000);  // BLE jitter
+
+    // the render job draws the newest reading it has, a new one is always different
+    while (next_render < arrival) {
+      latency_shown(&lat, lat.data_us, next_render + draw_us);
+      next_render += render_us;
+    }
+
+    latency_frame(&lat, index, &s, arrival);
+    if (index == 1)
+      battery_frames++;
+  }
+
+  const lat_hist_t *tt = &lat.hist[LAT_THROTTLE_TORQUE];
+  const lat_hist_t *dp = &lat.hist[LAT_DATA_PHOTON];
+  double mean_tt = tt->total / 1000.0 / tt->n;
+  int min_tt = 0, min_dp = 0;
+  while (!tt->count[min_tt])
+    min_tt++;
+  while (!dp->count[min_dp])
+    min_dp++;
+
+  print_hist("throttle to torque", tt);
+  print_hist("data to photon", dp);
+  printf("Throttle steps:      %u, %u with no response, %u timed out\n", steps, no_response, lat.timeouts);
+
+  // both ends are seen by frames of one index, every 80 ms, so each measurement is off by up to that
+  check("throttle to torque mean within 10 ms of the controller's delay", fabs(mean_tt - delay_us / 1000.0) < 10);
+  check("throttle to torque never more than a frame cycle off",
+        tt->max <= delay_us + 4 * frame_us + 3000 && lat_bucket_floor(min_tt + 1) > delay_us - 4 * frame_us - 3000);
+  check("steps with no response time out", lat.timeouts == no_response && tt->n + lat.timeouts == steps);
+  check("each battery frame measured once", dp->n <= battery_frames && dp->n >= battery_frames - 2);
+  check("data to photon between the draw time and a render period later",
+        lat_bucket_floor(min_dp) <= draw_us && lat_bucket_floor(min_dp) >= draw_us * 3 / 4 && dp->max <= render_us + draw_us);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Odometer Integration Test
+ *
+ * Replays a synthetic 10,000 km ride through the firmware distance
+ * integration (firmware/EKSR_Instrument/distance.cpp) and compares the
+ * result with an exact integral of the motor rpm over time.
+ * The old single precision float integration is run alongside for reference.
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "distance.h"
+
+static const uint32_t wheel_circumference = 1350;  // mm
+static const double target_km = 10000.0;
+static const double max_error_m = 10.0;  // allowed odometer error after the whole ride
+
+static uint32_t seed = 12345;
+static uint32_t rnd(uint32_t n) {
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 8) % n;
+}
+
+int main() {
+  printf("Testing Odometer Integration\n");
+  printf("========================================\n");
+
+  distance_acc_t acc = {};
+  uint64_t odo_mm = 0;       // firmware odometer
+  float odo_float_km = 0;    // previous float implementation
+  long double exact_m = 0;   // exact rpm-time integral
+  uint64_t t_ms = 0;
+  uint64_t frames = 0;
+
+  while (exact_m < target_km * 1000.0) {
+    // ride pattern: accelerate, cruise at varying speed, stop at the lights
+    uint32_t cycle = (t_ms / 1000) % 600;
+    double kmh;
+    if (cycle < 20)
+      kmh = cycle * 2.5;
+    else if (cycle < 560)
+      kmh = 50.0 + 25.0 * sin(t_ms / 45000.0);
+    else if (cycle < 580)
+      kmh = (580 - cycle) * 2.5;
+    else
+      kmh = 0;
+
+    // controller reports integer rpm, message timing is jittery
+    uint16_t rpm = (uint16_t)(kmh * 1000.0 / 60.0 / (wheel_circumference / 1000.0) * 4.0);
+    uint32_t dt = 90 + rnd(60);
+
+    int32_t speed = rpm_to_speed(rpm, wheel_circumference);
+    odo_mm += distance_add(&acc, speed, dt);
+
+    float distance_per_min = rpm / 4.0 * (wheel_circumference / 1000.0);
+    odo_float_km += distance_per_min / 60000.0 * (float)dt / 1000.0;
+
+    exact_m += (long double)rpm / 4.0L * (wheel_circumference / 1000.0L) / 60000.0L * dt;
+
+    t_ms += dt;
+    frames++;
+  }
+
+  double odo_m = odo_mm / 1000.0;
+  double error_m = odo_m - (double)exact_m;
+  double float_error_m = odo_float_km * 1000.0 - (double)exact_m;
+
+  printf("Frames:          %llu\n", (unsigned long long)frames);
+  printf("Ride time:       %.1f h\n", t_ms / 3600000.0);
+  printf("Exact distance:  %.3f km\n", (double)exact_m / 1000.0);
+  printf("Odometer:        %.3f km (error %.3f m)\n", odo_m / 1000.0, error_m);
+  printf("Float odometer:  %.3f km (error %.3f m)\n", odo_float_km, float_error_m);
+
+  if (fabs(error_m) < max_error_m) {
+    printf("  ✓ Odometer error within %.0f m\n", max_error_m);
+    return 0;
+  }
+  printf("  ✗ Odometer error %.3f m exceeds %.0f m\n", error_m, max_error_m);
+  return 1;
+}
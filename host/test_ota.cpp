@@ -0,0 +1,233 @@
+/*
+ * Firmware Update Test
+ *
+ * Checks the pieces of the update over BLE that run off the instrument: the host SHA-256
+ * against the standard test vectors, the header signature made by otapack and checked as the
+ * instrument does it, and the LZ compression in firmware/EKSR_Instrument/lz.cpp
+ * round tripping through the firmware decoder fed as it is on the instrument, input in BLE
+ * write sized pieces and output into blocks of any size, on synthetic data, the edge cases of
+ * the format and a real program (this one). Reports the ratio and how fast it decodes.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "lz.h"
+#include "ota.h"
+#include "otasign.h"
+#include "sha256.h"
+
+typedef std::vector<uint8_t> bytes_t;
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+static std::string hex(const uint8_t *p, size_t n) {
+  std::string s;
+  char b[3];
+  for (size_t i = 0; i < n; i++) {
+    snprintf(b, sizeof(b), "%02x", p[i]);
+    s += b;
+  }
+  return s;
+}
+
+static std::string sha(const void *data, size_t len) {
+  sha256_t s;
+  uint8_t hash[32];
+  sha256_init(&s);
+  sha256_update(&s, data, len);
+  sha256_final(&s, hash);
+  return hex(hash, sizeof(hash));
+}
+
+static bytes_t pack(const bytes_t &in) {
+  bytes_t out(lz_bound(in.size()));
+  out.resize(lz_encode(in.data(), in.size(), out.data()));
+  return out;
+}
+
+//
+// decode as the update task does, random input pieces and output room, then drain a match
+// still going on at the end
+//
+static bytes_t unpack(const bytes_t &packed, size_t image_size, std::mt19937 &rng) {
+  static lz_decoder_t d;
+  bytes_t out;
+  uint8_t block[4096];
+  size_t i = 0;
+
+  lz_decoder_init(&d);
+  while (i < packed.size()) {
+    size_t n = std::min<size_t>(packed.size() - i, 1 + rng() % 512);
+    size_t j = 0;
+    while (j < n) {
+      size_t used, room = 1 + rng() % sizeof(block);
+      size_t got = lz_decode(&d, packed.data() + i + j, n - j, &used, block, room);
+      out.insert(out.end(), block, block + got);
+      j += used;
+      if (out.size() > image_size)
+        return out;
+    }
+    i += n;
+  }
+  do {
+    size_t used;
+    size_t got = lz_decode(&d, NULL, 0, &used, block, 1 + rng() % sizeof(block));
+    out.insert(out.end(), block, block + got);
+  } while (d.left);
+  return out;
+}
+
+static bool round_trip(const bytes_t &in, std::mt19937 &rng, size_t *packed_size = NULL) {
+  bytes_t packed = pack(in);
+  if (packed_size)
+    *packed_size = packed.size();
+  return packed.size() <= lz_bound(in.size()) && (in.empty() || !packed.empty()) && unpack(packed, in.size(), rng) == in;
+}
+
+/*********************************************************/
+
+int main() {
+  std::mt19937 rng(98);
+
+  printf("SHA-256\n");
+  check("empty", sha("", 0) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  check("abc", sha("abc", 3) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  check("two blocks", sha(two, strlen(two)) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  bytes_t million(1000000, 'a');
+  check("a million a", sha(million.data(), million.size()) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+  sha256_t s;
+  uint8_t hash[32];
+  sha256_init(&s);
+  for (size_t i = 0; i < million.size();) {
+    size_t n = std::min<size_t>(million.size() - i, rng() % 200);
+    sha256_update(&s, million.data() + i, n);
+    i += n;
+  }
+  sha256_final(&s, hash);
+  check("in pieces of any size", hex(hash, 32) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+  check("the header is 112 bytes, 48 signed", sizeof(ota_header_t) == 112 && OTA_SIGNED_LEN == 48);
+
+  printf("Signature\n");
+  char pem[] = "/tmp/otakeyXXXXXX", other_pem[] = "/tmp/otakeyXXXXXX";
+  uint8_t key[65], other[65], signed_hash[32];
+  ota_header_t h;
+  close(mkstemp(pem));
+  close(mkstemp(other_pem));
+  unlink(pem);
+  unlink(other_pem);
+  check("makes a key", ota_keygen(pem, key) && ota_keygen(other_pem, other) && key[0] == 0x04);
+  check("won't overwrite one", !ota_keygen(pem, other));
+  memset(&h, 0, sizeof(h));
+  h.magic = OTA_MAGIC;
+  h.version = OTA_HEADER_VERSION;
+  h.image_size = 1234567;
+  memcpy(h.sha256, hash, sizeof(hash));
+  sha256_init(&s);
+  sha256_update(&s, &h, OTA_SIGNED_LEN);
+  sha256_final(&s, signed_hash);
+  check("signs a header", ota_sign(pem, signed_hash, h.signature) && ota_verify(key, signed_hash, h.signature));
+  check("not with another key", !ota_verify(other, signed_hash, h.signature));
+  h.image_size++;
+  sha256_init(&s);
+  sha256_update(&s, &h, OTA_SIGNED_LEN);
+  sha256_final(&s, signed_hash);
+  check("not once the header is changed", !ota_verify(key, signed_hash, h.signature));
+  unlink(pem);
+  unlink(other_pem);
+
+  printf("LZ edge cases\n");
+  check("nothing", round_trip(bytes_t(), rng));
+  check("one byte", round_trip(bytes_t(1, 7), rng));
+  check("a long run", round_trip(bytes_t(100000, 0xFF), rng));
+  bytes_t far(3 * LZ_WINDOW);
+  for (size_t i = 0; i < LZ_WINDOW; i++)
+    far[i] = far[i + LZ_WINDOW] = rng();
+  for (size_t i = 2 * LZ_WINDOW; i < far.size(); i++)
+    far[i] = rng();
+  size_t far_packed;
+  check("a match the whole window back", round_trip(far, rng, &far_packed)
+                                             && far_packed < lz_bound(2 * LZ_WINDOW) + LZ_WINDOW / 8);
+  bytes_t noise(200000);
+  for (auto &b : noise)
+    b = rng();
+  size_t noise_packed;
+  check("noise grows by an eighth at most", round_trip(noise, rng, &noise_packed) && noise_packed <= lz_bound(noise.size()));
+
+  // firmware like data: code with repeats, strings, zero padding
+  bytes_t mixed;
+  while (mixed.size() < 1000000) {
+    switch (rng() % 4) {
+    case 0: mixed.insert(mixed.end(), rng() % 300, 0); break;
+    case 1: {
+      size_t back = 1 + rng() % std::min<size_t>(mixed.size() + 1, 6000), n = 3 + rng() % 40;
+      for (size_t i = 0; i < n; i++)
+        mixed.push_back(mixed.size() >= back ? mixed[mixed.size() - back] : rng());
+      break;
+    }
+    default:
+      for (int i = rng() % 30; i >= 0; i--)
+        mixed.push_back(rng() % 64);
+    }
+  }
+  int mixed_ok = 0;
+  for (int r = 0; r < 20; r++)
+    mixed_ok += round_trip(mixed, rng);
+  check("a megabyte of mixed data, 20 ways of feeding it", mixed_ok == 20);
+
+  printf("LZ on a program\n");
+  bytes_t exe;
+  FILE *f = fopen("/proc/self/exe", "rb");
+  if (f) {
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      exe.insert(exe.end(), buf, buf + n);
+    fclose(f);
+  }
+  if (exe.empty()) {
+    printf("  - no /proc/self/exe, using the mixed data\n");
+    exe = mixed;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  bytes_t packed = pack(exe);
+  double encode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  check("round trips", unpack(packed, exe.size(), rng) == exe);
+
+  // decode speed in 512 byte writes into 4 KB blocks, as on the instrument
+  static lz_decoder_t d;
+  uint8_t block[OTA_BLOCK];
+  size_t out = 0;
+  const int runs = 50;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++) {
+    lz_decoder_init(&d);
+    for (size_t i = 0; i < packed.size();) {
+      size_t n = std::min<size_t>(packed.size() - i, 512), used;
+      out += lz_decode(&d, packed.data() + i, n, &used, block, sizeof(block));
+      i += used;
+    }
+  }
+  double decode_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  check("decoded the lot", out >= (exe.size() - LZ_MAX_MATCH) * runs);
+
+  printf("\n%zu bytes packed to %zu (%.0f%%), encode %.1f MB/s, decode %.0f MB/s\n", exe.size(), packed.size(),
+         100.0 * packed.size() / exe.size(), exe.size() / encode_s / 1e6, out / decode_s / 1e6);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Palette Sprite Test
+ *
+ * Checks the 4 bit palette sprites in firmware/EKSR_Instrument/pal4.cpp with the instrument's
+ * large font: line expansion against a one pixel at a time loop, text placement, and that only
+ * what changed is sent. Then replays a ride's power readings at 10 Hz and compares the SPI
+ * bytes against the 16 bit sprite that was used before, which sent all of it every time, and
+ * the RAM of both readings against the two 16 bit sprites.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "fontpack.h"
+#include "pal4.h"
+
+#define PROGMEM
+#include "NotoSansBold36.h"
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("%s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+int main() {
+  pal4_font_t font;
+  pal4_palette_t white, green, red;
+  pal4_pairs_t pairs = {};
+  pal4_sprite_t spr, vspr;
+  int x0, y0, x1, y1;
+
+  printf("Palette Sprites\n");
+  printf("========================================\n");
+
+  check("font is read straight from flash, not packed", fontpack_size(NotoSansBold36) == 0);
+  check("font loads", pal4_font(&font, NotoSansBold36) && font.count == 11 && font.height > 30);
+
+  pal4_ramp(&white, 0xFFFF, 0x0000);
+  pal4_ramp(&green, 0x07E0, 0x0000);
+  pal4_ramp(&red, 0xF800, 0x0000);
+  check("ramp runs from background to colour, byte swapped",
+        green.colour[0] == 0 && green.colour[15] == 0xE007 && red.colour[15] == 0x00F8);
+
+  // expansion against the reference at both alignments
+  std::vector<uint8_t> src(1001);
+  std::vector<uint16_t> a(2010), b(2010);
+  bool expand_ok = true;
+  for (size_t i = 0; i < src.size(); i++)
+    src[i] = rand();
+  pal4_pairs(&pairs, &red);
+  for (int offset = 0; offset < 2; offset++) {
+    for (size_t n : { (size_t)0, (size_t)1, (size_t)5, (size_t)1001 }) {
+      std::fill(a.begin(), a.end(), 0x1234);
+      std::fill(b.begin(), b.end(), 0x1234);
+      pal4_expand(&a[offset], src.data(), n, &pairs);
+      pal4_expand_ref(&b[offset], src.data(), n, &red);
+      expand_ok &= (a == b);
+    }
+  }
+  check("pal4_expand matches reference", expand_ok);
+  pal4_pairs(&pairs, &green);
+  pal4_expand(&a[0], src.data(), 16, &pairs);
+  pal4_expand_ref(&b[0], src.data(), 16, &green);
+  check("pair table made again for another colour", std::equal(a.begin(), a.begin() + 32, b.begin()));
+
+  // text in the middle, nothing cut off
+  int w = pal4_text_width(&font, "7777");
+  check("sprite created", pal4_create(&spr, w, font.height) && spr.w >= w && !(spr.w & 1));
+  check("voltage sprite created", pal4_create(&vspr, pal4_text_width(&font, "77777"), font.height));
+  check("bands fit the widest sprite", pal4_band[0] && pal4_band[1] && pal4_band_pixels == vspr.w * PAL4_BAND_LINES);
+  spr.pal = &green;
+  pal4_text(&spr, &font, "18.8");
+  int left = spr.w, right = 0, top = spr.h, bottom = 0;
+  for (int y = 0; y < spr.h; y++) {
+    for (int x = 0; x < spr.w; x++) {
+      uint8_t p = spr.pix[y * spr.w / 2 + x / 2];
+      if ((x & 1) ? (p & 15) : (p >> 4)) {
+        left = std::min(left, x);
+        right = std::max(right, x + 1);
+        top = std::min(top, y);
+        bottom = std::max(bottom, y + 1);
+      }
+    }
+  }
+  check("text is centred and inside the sprite",
+        left > 0 && right < spr.w && top >= 0 && bottom <= spr.h && abs(left - (spr.w - right)) <= 4);
+
+  // what gets sent
+  check("first push sends everything", pal4_dirty(&spr, &x0, &y0, &x1, &y1) && x0 == 0 && y0 == 0 && x1 == spr.w && y1 == spr.h);
+  pal4_shown(&spr);
+  pal4_text(&spr, &font, "18.8");
+  check("same text sends nothing", !pal4_dirty(&spr, &x0, &y0, &x1, &y1));
+  pal4_text(&spr, &font, "18.9");
+  check("changed digit sends only that part", pal4_dirty(&spr, &x0, &y0, &x1, &y1) && x0 > spr.w / 2 && x1 <= spr.w);
+  pal4_shown(&spr);
+  spr.pal = &red;
+  check("colour change sends everything", pal4_dirty(&spr, &x0, &y0, &x1, &y1) && x1 - x0 == spr.w && y1 - y0 == spr.h);
+  pal4_shown(&spr);
+
+  // a ride at 10 Hz: power drifts, is held steady for a while, sometimes regen
+  uint64_t bytes_old = 0, bytes_new = 0;
+  double power = 0;
+  int frames = 6000;
+  srand(2);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    char str[12];
+    if (rand() % 4 == 0)
+      power += (rand() % 21 - 10) / 10.0;
+    power = std::max(-5.0, std::min(20.0, power));
+
+    spr.pal = power < 0 ? &red : &green;  // regen red, as on the instrument
+    snprintf(str, sizeof(str), "%.1f", fabs(power));
+    pal4_text(&spr, &font, str);
+    if (pal4_dirty(&spr, &x0, &y0, &x1, &y1)) {
+      bytes_new += (x1 - x0) * (y1 - y0) * 2;
+      pal4_pairs(&pairs, spr.pal);
+      for (int y = y0; y < y1; y++)
+        pal4_expand(&a[0], spr.pix + y * spr.w / 2 + x0 / 2, (x1 - x0) / 2, &pairs);
+      pal4_shown(&spr);
+    }
+    bytes_old += spr.w * spr.h * 2;
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / frames;
+
+  // both readings, as on the instrument: pixels and what is shown, three ramps, one pair
+  // table and two bands against two 16 bit sprites
+  int area = spr.w * spr.h + vspr.w * vspr.h;
+  int ram = area + 3 * sizeof(pal4_palette_t) + sizeof(pal4_pairs_t) + 2 * pal4_band_pixels * 2;
+
+  printf("\n%dx%d power reading, %d frames     16 bit  palette\n", spr.w, spr.h, frames);
+  printf("RAM bytes, both readings         %8d %8d\n", area * 2, ram);
+  printf("SPI bytes per frame              %8.0f %8.0f\n", (double)bytes_old / frames, (double)bytes_new / frames);
+  printf("render and expand, us per frame here       %8.2f\n", us);
+
+  check("fewer SPI bytes than the 16 bit sprite", bytes_new < bytes_old / 2);
+  check("less RAM than the 16 bit sprites", ram < area * 2);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Power Test
+ *
+ * Rides the emulator's drive train model (emulator/FarDriverEmulator/powertrain.h) through
+ * hard acceleration, cruising with the field weakened, regenerative braking and stops, and
+ * sends its frames through the firmware decoder (firmware/EKSR_Instrument/fardriver.cpp)
+ * at the emulator's frame rate. Checks the signed currents, the battery power the instrument
+ * shows against the model's, and the peak power and energy taken from it as the odometers do.
+ * The old estimate from the motor current vector is run alongside for reference.
+ *
+ * Then rides a front and a rear drive train together, each with its own controller sending
+ * frames out of step with the other, combined with fd_combine() as the instrument does with
+ * two controllers, and checks the energy against both models and that a controller that drops
+ * out stops counting.
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "distance.h"
+#include "fardriver.h"
+#include "powertrain.h"
+
+static const int frame_ms = 20;  // the emulator sends a frame every 20 ms
+static const uint8_t indexes[] = { 0, 1, 4, 13 };
+static const double ride_s = 2 * 3600.0;
+static const double max_energy_error = 0.005;  // of the energy used
+static const double max_peak_error = 0.01;     // of the peak power
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+//
+// a minute of riding: hard acceleration to 45 km/h, cruising around it, braking hard, stopped
+//
+static void ride(double t, float *kmh, float *accel) {
+  double c = fmod(t, 60.0);
+
+  if (c < 7.5) {
+    *kmh = c * 6.0;
+    *accel = 6.0;
+  } else if (c < 40.0) {
+    *kmh = 45.0 + 3.0 * sin(2 * M_PI * (c - 7.5) / 10.0);
+    *accel = 3.0 * 2 * M_PI / 10.0 * cos(2 * M_PI * (c - 7.5) / 10.0);
+  } else if (c < 45.625) {
+    *kmh = 45.0 - (c - 40.0) * 8.0;
+    *accel = -8.0;
+  } else {
+    *kmh = 0;
+    *accel = 0;
+  }
+}
+
+static void make_frame(uint8_t *frame, uint8_t index, const powertrain_t *pt) {
+  for (int i = 0; i < FD_FRAME_LEN; i++)
+    frame[i] = 0;
+  frame[0] = FD_HEADER;
+  frame[1] = index;
+  powertrain_fill(pt, index, frame);
+  frame[14] = fd_checksum(frame);
+}
+
+//
+// the power the instrument showed before: |Is| * V, regen when iq or id is negative
+//
+static float vector_power(const fd_state_t *s) {
+  float iq = s->iq / 100.0f, id = s->id / 100.0f;
+  float power = -sqrtf(iq * iq + id * id) * (s->voltage / 10.0f) / 1000.0f;
+
+  return (iq < 0 || id < 0) ? -power : power;
+}
+
+//
+// front and rear motors, the rear one pushing harder. Energy is counted on the front
+// controller's battery frames with the power of both, as message_handler() does
+//
+static void two_controllers(void) {
+  fd_state_t links[2] = {}, all;
+  fd_words_t w;
+  powertrain_t pt[2];
+  uint8_t frame[FD_FRAME_LEN];
+  double true_wh = 0, wh = 0, dropped_wh = 0;
+  long power_errors = 0, flag_errors = 0, temp_errors = 0;
+  uint32_t last_ms = 0;
+  bool first = true;
+
+  printf("\nTwo Controllers\n");
+  printf("========================================\n");
+
+  for (uint32_t ms = 0, n = 0; ms < ride_s * 1000; ms += frame_ms, n++) {
+    float kmh, accel;
+
+    ride(ms / 1000.0, &kmh, &accel);
+    powertrain_update(&pt[0], kmh, accel * 0.4f);
+    powertrain_update(&pt[1], kmh, accel * 0.6f);
+    true_wh += -(pt[0].power + pt[1].power) * frame_ms / 3600.0;
+
+    for (int c = 1; c >= 0; c--) {  // out of step, each sends a different frame at a time
+      uint8_t index = indexes[(n + c) % 4];
+      make_frame(frame, index, &pt[c]);
+      if (index == 0)  // flags and temperatures differ per controller
+        frame[9] = c ? 0x40 : 0x01;
+      if (index == 4)
+        frame[4] = c ? 71 : 64;
+      if (index == 13)
+        frame[2] = c ? 55 : 58;
+      frame[14] = fd_checksum(frame);
+      fd_decode(frame, &w);
+      fd_update(&links[c], &w);
+      fd_combine(links, 2, 3, &all);
+
+      if (index == 0 && ms > 1000 && all.flags != (links[0].flags | links[1].flags))
+        flag_errors++;
+      if (ms > 1000 && (all.controller_temp != 71 || all.motor_temp != 58))
+        temp_errors++;
+
+      if (c == 0 && index == 1) {
+        uint32_t dt = ms - last_ms;
+        if (!first && dt <= DISTANCE_MAX_DT)
+          wh += -all.power * dt / 3600.0;
+        if (fabsf(all.power - (links[0].power + links[1].power)) > 1e-6f || all.iqin != links[0].iqin + links[1].iqin)
+          power_errors++;
+        last_ms = ms;
+        first = false;
+      }
+    }
+  }
+
+  fd_combine(links, 2, 1, &all);  // the rear one has gone
+  dropped_wh = all.power;
+
+  double energy_error = fabs(wh - true_wh) / true_wh;
+  printf("Energy:          %.2f Wh (models %.2f Wh, error %.3f%%)\n", wh, true_wh, energy_error * 100);
+
+  check("power and battery current added up", power_errors == 0);
+  check("flags of both controllers", flag_errors == 0);
+  check("hottest controller and motor", temp_errors == 0);
+  check("energy of both within 0.5% of the models", energy_error < max_energy_error);
+  check("a controller gone stops counting", dropped_wh == links[0].power);
+
+  int16_t big = 30000;
+  fd_state_t strong[2] = {};
+  strong[0].iqin = strong[1].iqin = -big;
+  fd_combine(strong, 2, 3, &all);
+  check("currents held at the int16 range", all.iqin == INT16_MIN);
+}
+
+int main() {
+  printf("Testing Battery Power\n");
+  printf("========================================\n");
+
+  fd_state_t s = {};
+  fd_words_t w;
+  powertrain_t pt;
+  uint8_t frame[FD_FRAME_LEN];
+
+  long frames = 0, power_frames = 0, current_errors = 0, power_errors = 0, sign_errors = 0, vector_sign_errors = 0;
+  double worst = 0;
+  double true_wh = 0, true_regen_wh = 0, true_peak = 0;  // from the model at every frame
+  double wh = 0, regen_wh = 0, peak = 0;                 // from the power the instrument shows
+  double vector_wh = 0;
+  uint32_t last_ms = 0;
+
+  for (uint32_t ms = 0; ms < ride_s * 1000; ms += frame_ms, frames++) {
+    float kmh, accel;
+    uint8_t index = indexes[frames % 4];
+
+    ride(ms / 1000.0, &kmh, &accel);
+    powertrain_update(&pt, kmh, accel);
+
+    double step = -pt.power * frame_ms / 3600.0;  // Wh
+    true_wh += step;
+    if (step < 0)
+      true_regen_wh -= step;
+    true_peak = fmax(true_peak, -pt.power);
+
+    make_frame(frame, index, &pt);
+    fd_decode(frame, &w);
+    fd_update(&s, &w);
+
+    switch (index) {
+      case 0:
+        if (s.iq != lroundf(pt.iq * 100) || s.id != lroundf(pt.id * 100))
+          current_errors++;
+        break;
+
+      case 1: {
+        if (s.iqin != lroundf(pt.current * 100))
+          current_errors++;
+
+        // the currents and voltage are rounded to 0.01 A and 0.1 V
+        double bound = (0.005 * pt.voltage + 0.05 * fabs(pt.current) + 0.00025) / 1000.0 * 1.01 + 1e-6;
+        double err = fabs(s.power - pt.power);
+        worst = fmax(worst, err);
+        if (err > bound)
+          power_errors++;
+        if ((pt.current < -0.05 && s.power >= 0) || (pt.current > 0.05 && s.power <= 0))
+          sign_errors++;
+        if ((pt.current < -0.05 && vector_power(&s) >= 0) || (pt.current > 0.05 && vector_power(&s) <= 0))
+          vector_sign_errors++;
+
+        // as message_handler() feeds the odometers
+        uint32_t dt = ms - last_ms;
+        if (power_frames && dt <= DISTANCE_MAX_DT) {
+          double e = -s.power * dt / 3600.0;
+          wh += e;
+          if (e < 0)
+            regen_wh -= e;
+          vector_wh += -vector_power(&s) * dt / 3600.0;
+        }
+        peak = fmax(peak, -s.power);
+        last_ms = ms;
+        power_frames++;
+        break;
+      }
+    }
+  }
+
+  double energy_error = fabs(wh - true_wh) / true_wh;
+  double regen_error = fabs(regen_wh - true_regen_wh) / true_regen_wh;
+  double peak_error = fabs(peak - true_peak) / true_peak;
+
+  printf("Frames:          %ld (%ld with battery current)\n", frames, power_frames);
+  printf("Ride time:       %.1f h\n", ride_s / 3600.0);
+  printf("Worst power:     %.2f W off\n", worst * 1000.0);
+  printf("Energy:          %.2f Wh (model %.2f Wh, error %.3f%%)\n", wh, true_wh, energy_error * 100);
+  printf("Regen:           %.2f Wh (model %.2f Wh, error %.3f%%)\n", regen_wh, true_regen_wh, regen_error * 100);
+  printf("Peak power:      %.3f kW (model %.3f kW)\n", peak, true_peak);
+  printf("Current vector:  %.2f Wh, wrong sign on %ld of %ld frames\n", vector_wh, vector_sign_errors, power_frames);
+
+  check("signed iq, id and iqin decoded", current_errors == 0);
+  check("power within the rounding of iqin and voltage", power_errors == 0);
+  check("power negative when driving, positive on regen", sign_errors == 0);
+  check("energy within 0.5% of the model", energy_error < max_energy_error);
+  check("regen energy within 0.5% of the model", regen_error < max_energy_error);
+  check("peak power within 1% of the model", peak_error < max_peak_error);
+
+  two_controllers();
+
+  return failures ? 1 : 0;
+}
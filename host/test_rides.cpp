@@ -0,0 +1,220 @@
+/*
+ * Ride History Test
+ *
+ * Runs the firmware ride history (firmware/EKSR_Instrument/rides.cpp) on a simulated flash
+ * partition that behaves like NOR flash: writes can only clear bits and erases are whole
+ * sectors. Checks the summary of a simulated ride with stops, started and ended by the ride
+ * state detector (ridestate.cpp) as on the instrument, then appends thousands of rides
+ * so the ring wraps many times, and checks every ride is found in one read, the oldest ones
+ * are gone, and that the log recovers from a lost index, a power cut before the index was
+ * saved and a record half written when the power went.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "rides.h"
+#include "ridestate.h"
+
+static const uint32_t sectors = 16;
+static const int rides = 5000;
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+/*********************************************************/
+
+static std::vector<uint8_t> flash(sectors * RIDES_SECTOR, 0x5A);  // whatever was in the partition before
+static long reads, writes, erases;
+static size_t write_limit = SIZE_MAX;  // bytes written before the power goes
+
+static bool flash_read(uint32_t offset, void *data, size_t len) {
+  if (offset + len > flash.size())
+    return false;
+  memcpy(data, &flash[offset], len);
+  reads++;
+  return true;
+}
+
+static bool flash_write(uint32_t offset, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+
+  if (offset + len > flash.size())
+    return false;
+  for (size_t i = 0; i < len && write_limit; i++, write_limit--)
+    flash[offset + i] &= p[i];
+  writes++;
+  return true;
+}
+
+static bool flash_erase(uint32_t offset, size_t len) {
+  if (offset % RIDES_SECTOR || len % RIDES_SECTOR || offset + len > flash.size())
+    return false;
+  memset(&flash[offset], 0xFF, len);
+  erases++;
+  return true;
+}
+
+static const rides_flash_t part = { flash_read, flash_write, flash_erase, sectors * RIDES_SECTOR };
+
+/*********************************************************/
+
+static ride_record_t make_ride(int n) {
+  ride_record_t rec = {};
+  rec.distance_m = 1000 + n;
+  rec.duration_s = 600 + n % 100;
+  rec.energy_wh = n * 0.5f;
+  return rec;
+}
+
+int main() {
+  printf("Testing Ride History\n");
+  printf("========================================\n");
+
+  // the bike pushed out of the garage, then a ride of 20 minutes at 30 km/h with a stop at
+  // the lights, then parked. Started, paused and ended by the ride state detector, as
+  // message_handler() does it
+  ride_t ride;
+  ridestate_t rs;
+  fd_state_t s = {};
+  ride_record_t rec;
+  double distance_mm = 0, energy_wh = 0, regen_wh = 0;
+  uint32_t start_ms = 0, moved_ms = 0, moving_ms = 0;
+  uint16_t min_voltage = UINT16_MAX;
+  bool started = false, ended = false;
+
+  ride_init(&ride);
+  rs_init(&rs);
+  s.voltage = 900;
+  for (uint32_t ms = 0; ms < 30000; ms += 80) {
+    uint32_t mm = ms < 5000 ? 160 : 0;  // 10 m at 7 km/h
+    s.rpm = mm ? 90 : 0;
+    if (rs_update(&rs, s.rpm, 0, mm, 80) == RS_START)
+      ride_start(&ride, rs.start_mm - mm);
+    ride_move(&ride, &s, mm ? 70 : 0, mm, 80);
+  }
+  check("no ride for pushing the bike", !ride.open);
+
+  for (uint32_t ms = 0; ms < 40 * 60000 && !ended; ms += 80) {
+    bool lights = ms >= 10 * 60000 && ms < 11 * 60000;
+    bool parked = ms >= 20 * 60000;
+    uint16_t speed = (lights || parked) ? 0 : 300;
+    uint32_t mm = speed * 80 / 36;  // 0.1 km/h for 80 ms
+
+    s.rpm = speed ? 400 : 0;
+    s.flags = (ms >= 5 * 60000 && ms < 5 * 60000 + 800) ? 0x0004 : 0;  // one fault, for 10 frames
+    s.controller_temp = 30 + ms / 60000;
+    s.motor_temp = parked ? 20 : 40;
+    s.power = speed ? -0.5f : (ms < 11 * 60000 && ms > 10 * 60000 - 3000 ? 0.2f : 0);
+    s.voltage = 900 - (speed ? 20 : 0) - ms / 60000;
+
+    ride_event_e ev = rs_update(&rs, s.rpm, 0, mm, 80);
+    if (ev == RS_START) {
+      ride_start(&ride, rs.start_mm - mm);
+      started = true;
+      start_ms = ms;
+    }
+    ride_move(&ride, &s, speed, mm, 80);
+    if (ev == RS_RESUME)
+      ride_resume(&ride);
+    float wh = -s.power * 80 / 3600.0;
+    ride_power(&ride, &s, wh);
+    ended = (ev == RS_END);
+
+    distance_mm += mm;
+    if (!started)
+      continue;
+    if (speed) {
+      moved_ms = ms - start_ms + 80;
+      moving_ms += 80;
+    }
+    min_voltage = std::min(min_voltage, s.voltage);
+    energy_wh += wh;
+    if (wh < 0)
+      regen_wh -= wh;
+  }
+  check("ride started 50 m in", started && start_ms == 6000);
+  check("ride ends after standing still", ended && ride.open);
+  check("ride is kept", ride_close(&ride, &rec));
+  printf("Ride:      %lu m in %lu s (%lu s moving), %.1f Wh, %.1f Wh regen, max %.1f km/h, %u W, %u faults\n",
+         (unsigned long)rec.distance_m, (unsigned long)rec.duration_s, (unsigned long)rec.moving_s, rec.energy_wh,
+         rec.regen_wh, rec.max_speed / 10.0, rec.max_power, rec.faults);
+  check("distance from the first turn of the wheel", rec.distance_m == (uint32_t)(distance_mm / 1000));
+  check("duration and moving time from the start", rec.duration_s == moved_ms / 1000 && rec.moving_s == moving_ms / 1000);
+  check("energy and regen", fabs(rec.energy_wh - energy_wh) < energy_wh * 0.001
+                              && fabs(rec.regen_wh - regen_wh) < regen_wh * 0.001 && rec.regen_wh > 0);
+  check("peaks", rec.max_speed == 300 && rec.max_power == 500 && rec.max_regen == 200 && rec.max_motor_temp == 40
+                   && rec.max_controller_temp == s.controller_temp);
+  check("voltages", rec.start_voltage == 880 && rec.min_voltage == min_voltage && rec.end_voltage == s.voltage);
+  check("one fault", rec.faults == 1 && rec.fault_flags == 0x0004);
+  check("one stop, parking is not one", rec.pauses == 1);
+  check("no new ride while parked", (ride_move(&ride, &s, 300, 1000, 80), !ride.open));
+  ride_start(&ride, 0);
+  ride_move(&ride, &s, 50, 10, 80);
+  check("a short ride is not kept", !ride_close(&ride, &rec));
+
+  // thousands of rides through a 16 sector table
+  rides_log_t log;
+  rides_index_t index;
+  bool all_found = true, oldest_gone = true;
+  uint32_t slots = sectors * RIDES_PER_SECTOR;
+
+  check("opens on a partition that was used for something else", rides_open(&log, &part, NULL) && log.next == 0);
+  for (int n = 0; n < rides; n++) {
+    rec = make_ride(n);
+    if (!rides_append(&log, &rec))
+      all_found = false;
+  }
+  rides_index(&log, &index);
+
+  uint32_t first = rides_first(&log);
+  long before = reads;
+  for (uint32_t n = first; n < log.next; n++) {
+    if (!rides_read(&log, n, &rec) || rec.seq != n || rec.distance_m != 1000 + n)
+      all_found = false;
+  }
+  long per_lookup = (reads - before) / (log.next - first);
+  for (uint32_t n = 0; n < first; n++)
+    if (rides_read(&log, n, &rec))
+      oldest_gone = false;
+
+  printf("Table:     %u slots, %d rides appended, %u kept, %ld erases, %ld reads per lookup\n", slots, rides,
+         log.next - first, erases, per_lookup);
+  check("every ride kept is found in one read", all_found && per_lookup == 1);
+  check("a sector short of the table is kept", log.next - first >= slots - RIDES_PER_SECTOR && log.next - first <= slots);
+  check("the older rides are gone", oldest_gone && !rides_read(&log, log.next, &rec));
+  check("the ridden time adds up", log.clock_s == (uint32_t)(rides * 600 + rides / 100 * 4950));
+
+  // open again with the saved index, and without one
+  rides_log_t again;
+  check("reopens from the index", rides_open(&again, &part, &index) && again.next == log.next && again.clock_s == log.clock_s);
+  check("reopens without the index", rides_open(&again, &part, NULL) && again.next == log.next && again.clock_s == log.clock_s);
+
+  // the power goes after a ride is written, before the index is saved
+  rec = make_ride(rides);
+  rides_append(&log, &rec);
+  check("a ride written after the index was saved is taken in",
+        rides_open(&again, &part, &index) && again.next == log.next && again.clock_s == log.clock_s);
+
+  // the power goes half way through writing a ride
+  rides_index(&log, &index);
+  write_limit = RIDE_RECORD_SIZE / 2;
+  rec = make_ride(rides + 1);
+  rides_append(&log, &rec);
+  write_limit = SIZE_MAX;
+  check("a half written ride is not taken in", rides_open(&again, &part, &index) && again.next == log.next - 1);
+  rec = make_ride(rides + 2);
+  check("the next ride goes in the slot after it",
+        rides_append(&again, &rec) && rec.seq == log.next && rides_read(&again, rec.seq, &rec)
+          && !rides_read(&again, rec.seq - 1, &rec) && rides_read(&again, rec.seq - 2, &rec));
+
+  return failures ? 1 : 0;
+}
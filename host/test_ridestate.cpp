@@ -0,0 +1,234 @@
+/*
+ * Ride State Test
+ *
+ * Replays captures through the ride state detector (firmware/EKSR_Instrument/ridestate.cpp),
+ * decoding the frames and working out the distance as the instrument does. A synthetic
+ * capture is made first: the bike parked with rpm noise, pushed out of the garage, ridden
+ * with a stop at the lights, a hill start held on the throttle, a coffee stop, creeping
+ * through a crowd, and parked. Checks it finds one ride, its stops and its end at the right
+ * times, and not the pushing or the noise. Then times the detector per frame.
+ *
+ *   test_ridestate [capture.fdcap ...]
+ *
+ * Captures given are replayed as well, and their rides and stops printed.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "distance.h"
+#include "fardriver.h"
+#include "ridestate.h"
+
+static const uint32_t wheel_circumference = 1350;  // mm, as in EKSR_Instrument.ino
+static const int frame_ms = 20;
+static const uint8_t indexes[] = { 0, 1, 4, 13 };
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+typedef struct {
+  ride_event_e ev;
+  uint32_t ms;
+} event_t;
+
+/*********************************************************/
+
+//
+// the synthetic capture, a piece at a time: speed in km/h, motor current in A
+//
+static void add(std::vector<fd_capture_t> &caps, double seconds, double from_kmh, double to_kmh, double iq = 0,
+                int spike_every = 0) {
+  uint32_t ms = caps.empty() ? 0 : caps.back().ms + frame_ms;
+  int n = seconds * 1000 / frame_ms;
+
+  for (int i = 0; i < n; i++, ms += frame_ms) {
+    fd_capture_t c;
+    uint8_t index = indexes[(ms / frame_ms) % 4];
+    double kmh = from_kmh + (to_kmh - from_kmh) * i / n;
+    uint16_t rpm = lround(kmh / 3.6 * 1000 * 60 * 4 / wheel_circumference);  // motor turns 4 times the wheel
+    int16_t current = lround((iq ? iq : (to_kmh - from_kmh) * 2 + (kmh > 0 ? 3 : 0)) * 100);
+
+    if (spike_every && i % spike_every == 0)
+      rpm = 45;  // a hall sensor glitch, one frame
+    memset(&c, 0, sizeof(c));
+    c.ms = ms;
+    c.frame[0] = FD_HEADER;
+    c.frame[1] = index;
+    if (index == 0) {
+      c.frame[6] = rpm >> 8;
+      c.frame[7] = rpm;
+      c.frame[10] = (uint16_t)current >> 8;
+      c.frame[11] = current;
+    }
+    c.frame[14] = fd_checksum(c.frame);
+    caps.push_back(c);
+  }
+}
+
+//
+// the detector on a capture, as message_handler() feeds it
+//
+static std::vector<event_t> replay(const std::vector<fd_capture_t> &caps, bool print) {
+  std::vector<event_t> events;
+  ridestate_t rs;
+  fd_state_t s = {};
+  distance_acc_t acc = {};
+  fd_words_t w;
+  uint32_t last_ms = 0, ride_start = 0;
+  uint64_t distance = 0, ride_mm = 0;
+  bool seen = false;
+
+  rs_init(&rs);
+  for (const fd_capture_t &c : caps) {
+    if (!fd_decode(c.frame, &w) || fd_update(&s, &w) != 0)
+      continue;
+
+    uint32_t dt = seen ? c.ms - last_ms : 0;
+    uint32_t mm = 0;
+    if (seen && dt <= DISTANCE_MAX_DT)
+      mm = distance_add(&acc, rpm_to_speed(s.rpm, wheel_circumference), dt);
+    seen = true;
+    last_ms = c.ms;
+    distance += mm;
+
+    ride_event_e ev = rs_update(&rs, s.rpm, s.iq, mm, dt);
+    if (ev == RS_NONE)
+      continue;
+    events.push_back({ ev, c.ms });
+
+    if (ev == RS_START) {
+      ride_start = c.ms;
+      ride_mm = distance - rs.start_mm;
+    }
+    if (print) {
+      printf("  %8.1f s  %-6s", c.ms / 1000.0, rs_event_name(ev));
+      if (ev == RS_END)
+        printf("  %.2f km in %.1f min", (distance - ride_mm) / 1e6, (c.ms - ride_start - RS_END_MS) / 60000.0);
+      printf("\n");
+    }
+  }
+  return events;
+}
+
+static bool load_capture(const char *filename, std::vector<fd_capture_t> &caps) {
+  FILE *f = fopen(filename, "rb");
+  fd_capture_t c;
+
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  while (fread(&c, sizeof(c), 1, f) == 1)
+    caps.push_back(c);
+  fclose(f);
+  return true;
+}
+
+static bool near(const event_t &e, ride_event_e ev, double s) {
+  return e.ev == ev && fabs(e.ms / 1000.0 - s) <= 0.1;
+}
+
+/*********************************************************/
+
+int main(int argc, char *argv[]) {
+  std::vector<fd_capture_t> caps;
+
+  printf("Ride State\n");
+  printf("========================================\n");
+
+  add(caps, 60, 0, 0, 0, 500);  // parked, switched on, a glitch every 10 s
+  add(caps, 2, 0, 4);            // pushed out of the garage, about 10 m
+  add(caps, 8, 4, 4);
+  add(caps, 20, 0, 0);
+  double ride_at = caps.back().ms / 1000.0;
+  add(caps, 10, 0, 30);          // away, 42 m in, 50 m a second later
+  add(caps, 120, 30, 30);
+  add(caps, 5, 30, 0);
+  double lights_at = caps.back().ms / 1000.0;
+  add(caps, 30, 0, 0);           // at the lights
+  double green_at = caps.back().ms / 1000.0;
+  add(caps, 10, 0, 30);
+  add(caps, 60, 30, 30);
+  add(caps, 5, 30, 0);
+  add(caps, 8, 0, 0, 12);        // held on a hill with the throttle, no stop
+  add(caps, 10, 0, 30);
+  add(caps, 60, 30, 30);
+  add(caps, 5, 30, 0);
+  double coffee_at = caps.back().ms / 1000.0;
+  add(caps, 240, 0, 0);          // a coffee, shorter than RS_END_MS
+  double back_at = caps.back().ms / 1000.0;
+  add(caps, 3, 0, 1.5);          // creeping through a crowd, between the rpm thresholds
+  add(caps, 20, 1.5, 1.5);
+  add(caps, 10, 1.5, 30);
+  add(caps, 60, 30, 30);
+  add(caps, 5, 30, 0);
+  double parked_at = caps.back().ms / 1000.0;
+  add(caps, 600, 0, 0);          // parked
+
+  std::vector<event_t> ev = replay(caps, true);
+
+  // 50 m in: 0 to 30 km/h in 10 s covers 41.7 m, then 8.3 m at 30 km/h
+  double start_at = ride_at + 10 + 8.33 / (30 / 3.6);
+
+  check("one ride, three stops", ev.size() == 7);
+  if (ev.size() == 7) {
+    check("starts 50 m in, not when pushed or on a glitch", fabs(ev[0].ms / 1000.0 - start_at) < 0.2 && ev[0].ev == RS_START);
+    check("stops at the lights after 5 s", near(ev[1], RS_PAUSE, lights_at + 5));
+    check("goes on when the wheel turns", ev[2].ev == RS_RESUME && ev[2].ms / 1000.0 - green_at < 0.5);
+    check("a coffee is a stop", near(ev[3], RS_PAUSE, coffee_at + 5));
+    check("creeping counts as riding", ev[4].ev == RS_RESUME && ev[4].ms / 1000.0 < back_at + 3);
+    check("parked is a stop", near(ev[5], RS_PAUSE, parked_at + 5));
+    check("and the end after 5 min", near(ev[6], RS_END, parked_at + RS_END_MS / 1000.0));
+  }
+
+  // the same decisions on a few frames
+  ridestate_t rs;
+  rs_init(&rs);
+  rs_update(&rs, 30, 0, 0, 20);
+  check("30 rpm from standing is not moving", !rs.moving);
+  rs_update(&rs, 40, 0, 0, 20);
+  rs_update(&rs, 20, 0, 0, 20);
+  check("20 rpm after moving still is", rs.moving);
+  rs_update(&rs, 10, 0, 0, 20);
+  check("10 rpm is standing", !rs.moving);
+  rs_init(&rs);
+  rs_update(&rs, 0, 0, 0, RS_SLEEP_MS);
+  check("parked, the display can be dimmed", rs_idle(&rs));
+  rs_update(&rs, 0, -600, 0, 20);
+  check("not while the motor pulls", !rs_idle(&rs));
+
+  // cost per frame
+  const int runs = 200;
+  uint32_t frames = 0;
+  rs_init(&rs);
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < runs; r++) {
+    for (size_t i = 0; i < caps.size(); i += 4, frames++) {
+      uint16_t rpm = (caps[i].frame[6] << 8) | caps[i].frame[7];
+      int16_t iq = (caps[i].frame[10] << 8) | caps[i].frame[11];
+      if (rs_update(&rs, rpm, iq, rpm, frame_ms * 4) == RS_END)
+        rs_init(&rs);
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / frames;
+  printf("\n%.1f ns per frame here\n", ns);
+
+  for (int i = 1; i < argc; i++) {
+    std::vector<fd_capture_t> file;
+    if (!load_capture(argv[i], file))
+      return 1;
+    printf("\n%s: %zu frames\n", argv[i], file.size());
+    replay(file, true);
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * SPI Clock Tuning Test
+ *
+ * Runs the display clock tuning in firmware/EKSR_Instrument/spitune.cpp against a modelled
+ * ILI9341 (mock/TFT_eSPI.h): pixels go out on SPI high byte first and readRect() gives them
+ * back byte swapped, whatever setSwapBytes() says, as TFT_eSPI does. Checks the tuning finds
+ * the fastest clock a display takes, that a display without MISO or a clock that hung are
+ * handled, and that a palette sprite in SPI byte order reads back as it was sent, which is
+ * what spicheck_job compares.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TFT_eSPI.h"
+#include "Preferences.h"
+#include "pal4.h"
+#include "spitune.h"
+
+static int failures = 0;
+
+static void check(const char *what, bool ok) {
+  printf("  %s %s\n", ok ? "✓" : "✗", what);
+  if (!ok)
+    failures++;
+}
+
+/*********************************************************/
+
+int main() {
+  printf("SPI Clock Tuning\n");
+  printf("========================================\n");
+  Serial.quiet = true;
+
+  {
+    TFT_eSPI tft;
+    Preferences prefs;
+    tft.max_write_hz = 26666667;
+    spitune_begin(&tft, &prefs);
+    check("tunes to the fastest clock the display takes", tft_spi_frequency == 26666667 && spitune_can_check());
+    check("and keeps it", prefs.getUInt("spi_hz") == 26666667 && !prefs.isKey("spi_try"));
+
+    spitune_begin(&tft, &prefs);
+    check("checks it on the next start", tft_spi_frequency == 26666667);
+    tft.max_write_hz = SPITUNE_MIN;
+    spitune_begin(&tft, &prefs);
+    check("tunes again when it fails its check", tft_spi_frequency == SPITUNE_MIN);
+    spitune_fault(&tft, &prefs);
+    check("a fault at the slowest clock stays there", tft_spi_frequency == SPITUNE_MIN);
+  }
+
+  {
+    TFT_eSPI tft;
+    Preferences prefs;
+    tft.max_write_hz = 80000000;
+    spitune_begin(&tft, &prefs);
+    uint32_t best = tft_spi_frequency;
+    spitune_fault(&tft, &prefs);
+    check("a fault steps a clock down", tft_spi_frequency < best && prefs.getUInt("spi_max") == tft_spi_frequency);
+  }
+
+  {
+    TFT_eSPI tft;
+    Preferences prefs;
+    tft.max_write_hz = 80000000;
+    prefs.putUInt("spi_hz", 80000000);  // from a build that overclocked
+    spitune_begin(&tft, &prefs);
+#if SPITUNE_OVERCLOCK
+    check("80 MHz checked over the whole screen", tft_spi_frequency == 80000000);
+#else
+    check("nothing above SPITUNE_SPEC without SPITUNE_OVERCLOCK", tft_spi_frequency == SPITUNE_SPEC
+                                                                      && prefs.getUInt("spi_hz") == SPITUNE_SPEC);
+#endif
+  }
+
+  {
+    TFT_eSPI tft;
+    Preferences prefs;
+    prefs.putUInt("spi_try", 40000000);  // reset while trying it
+    spitune_begin(&tft, &prefs);
+    check("a clock that hung is not tried again", tft_spi_frequency == 26666667 && prefs.getUInt("spi_max") == 26666667);
+  }
+
+  {
+    TFT_eSPI tft;
+    Preferences prefs;
+    tft.miso = false;
+    spitune_begin(&tft, &prefs);
+    check("a display that can't be read back stays at the default", tft_spi_frequency == SPITUNE_DEFAULT
+                                                                        && !spitune_can_check());
+  }
+
+  // spicheck_job: the palette sprite is expanded in SPI byte order and pushed unswapped
+  {
+    TFT_eSPI tft;
+    static pal4_palette_t pal;
+    static pal4_pairs_t pairs;
+    uint16_t sent[64], got[64];
+    uint8_t packed[32];
+    pal4_ramp(&pal, 0x07E0, 0x0000);
+    pal4_pairs(&pairs, &pal);
+    for (int i = 0; i < 32; i++)
+      packed[i] = i * 0x37;
+    pal4_expand(sent, packed, 32, &pairs);
+    tft_spi_frequency = SPITUNE_DEFAULT;
+    tft.setSwapBytes(false);
+    tft.pushImage(0, 0, 64, 1, sent);
+    tft.readRect(0, 0, 64, 1, got);
+    check("a palette sprite reads back as it was sent", memcmp(got, sent, sizeof(sent)) == 0);
+    check("in the colours of the palette", tft.pixel(0, 0) == (uint16_t)((sent[0] >> 8) | (sent[0] << 8)));
+  }
+
+  return failures ? 1 : 0;
+}
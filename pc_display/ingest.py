@@ -0,0 +1,144 @@
+"""
+FarDriver frame ingest for pc_display
+
+The BLE callback hands each notification to Ingest.feed(), and the display takes the latest
+values with snapshot() and the queued raw frames with drain() once per frame, so nothing is
+done in Python per frame. The native fdingest module (native/fdingest.cpp, built with
+native/setup.py) does this with the instrument's decoder, firmware/EKSR_Instrument/fardriver.cpp.
+Without it the class below does the same in Python, slower but with the same results.
+"""
+
+import os
+import struct
+import sys
+import time
+
+FD_FRAME_LEN = 16
+FD_HEADER = 0xAA
+RECORD_LEN = 20  # capture file record, 4 byte little endian ms then the frame
+SPEED_Q = 8  # fractional bits of rpm_to_speed(), firmware/EKSR_Instrument/distance.h
+WHEEL_CIRCUMFERENCE_MM = 1350  # wheel_circumference in EKSR_Instrument.ino
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native'))
+try:
+    from fdingest import Ingest as NativeIngest
+except ImportError:
+    NativeIngest = None
+finally:
+    sys.path.pop(0)
+
+
+def _signed(word):
+    return word - 0x10000 if word & 0x8000 else word
+
+
+def _power(s):
+    """Battery power in kW from iQin and voltage, negative when driving, as fd_power()"""
+    return (s['iqin'] / 100.0) * (s['voltage'] / 10.0) / 1000.0
+
+
+def display_values(snap, circumference_mm=WHEEL_CIRCUMFERENCE_MM):
+    """What the instrument shows for a snapshot, worked out as message_handler() in EKSR_Instrument.ino
+
+    Only the values of frames that have come are given, the others are still what they started as.
+    """
+    seen = snap['seen']
+    values = {}
+
+    if seen & (1 << 0):
+        # gear bits 00=high, 11=mid, 10=low (00=Disabled), massaged into 1=low, 2=mid, 3=high
+        gear = (((snap['gear_bits'] >> 2) & 0x03) - 1) & 0xFF
+        if gear > 2:
+            gear = 3
+
+        # rpm_to_speed(): rpm / 4 (gearing) * circumference / 60 s, in mm/s << SPEED_Q
+        speed = ((snap['rpm'] * circumference_mm << (SPEED_Q - 4)) & 0xFFFFFFFF) // 15
+
+        values['rpm'] = snap['rpm']
+        values['gear'] = gear
+        values['speed'] = speed * (3.6 / 1000.0 / (1 << SPEED_Q))  # km/h
+    if seen & (1 << 1):
+        values['voltage'] = snap['voltage'] / 10.0
+        values['power'] = snap['power']  # kW, negative when driving
+    if seen & (1 << 4):
+        values['controller_temp'] = snap['controller_temp']
+    if seen & (1 << 13):
+        values['motor_temp'] = snap['motor_temp']
+        values['throttle'] = snap['throttle']
+    return values
+
+
+class PyIngest:
+    """fdingest.Ingest in Python, decoding as fd_decode() and fd_update() do"""
+
+    def __init__(self, capacity=4096):
+        if capacity < 1 or capacity > (1 << 24):
+            raise ValueError("capacity must be 1 to 16777216 frames")
+        self._capacity = 1 << (capacity - 1).bit_length()
+        self._start = time.monotonic()
+        self._ring = []
+        self._dropped = 0
+        self._snap = {
+            'rpm': 0, 'gear_bits': 0, 'flags': 0, 'iq': 0, 'id': 0, 'voltage': 0, 'iqin': 0,
+            'controller_temp': 0, 'motor_temp': 0, 'throttle': 0, 'power': 0.0,
+            'frames': 0, 'errors': 0, 'checksum_errors': 0, 'last_ms': 0, 'seen': 0,
+        }
+
+    def clock(self):
+        return int((time.monotonic() - self._start) * 1000) & 0xFFFFFFFF
+
+    def feed(self, frame):
+        frame = bytes(frame)
+        s = self._snap
+        if len(frame) < FD_FRAME_LEN or frame[0] != FD_HEADER:
+            s['errors'] += 1
+            return
+
+        now = self.clock()
+        checksum = 0
+        for b in frame[1:14]:
+            checksum ^= b
+        w = struct.unpack_from('>6H', frame, 2)
+        index = frame[1]
+
+        if index == 0:
+            s['gear_bits'] = w[1] >> 8
+            s['rpm'] = w[2]
+            s['flags'] = w[3]
+            s['iq'] = _signed(w[4])
+            s['id'] = _signed(w[5])
+        elif index == 1:
+            s['voltage'] = w[0]
+            s['iqin'] = _signed(w[3])
+            s['power'] = _power(s)
+        elif index == 4:
+            s['controller_temp'] = w[1] >> 8
+        elif index == 13:
+            s['motor_temp'] = w[0] >> 8
+            s['throttle'] = w[1]
+        if index in (0, 1, 4, 13):
+            s['seen'] |= 1 << index
+
+        s['frames'] += 1
+        s['last_ms'] = now
+        if checksum != frame[14]:
+            s['checksum_errors'] += 1
+
+        if len(self._ring) >= self._capacity:
+            self._dropped += 1
+        else:
+            self._ring.append((now, frame[:FD_FRAME_LEN]))
+
+    def snapshot(self):
+        snap = dict(self._snap)
+        snap['dropped'] = self._dropped
+        return snap
+
+    def drain(self, max_frames=0, base_ms=0):
+        n = len(self._ring) if max_frames <= 0 else min(max_frames, len(self._ring))
+        batch, self._ring = self._ring[:n], self._ring[n:]
+        return b''.join(struct.pack('<I', max(0, ms - base_ms)) + frame for ms, frame in batch)
+
+
+NATIVE = NativeIngest is not None
+Ingest = NativeIngest if NATIVE else PyIngest
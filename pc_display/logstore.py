@@ -0,0 +1,172 @@
+"""
+Terminal log store for pc_display
+
+The terminal keeps its messages here instead of in the Tk Text widget: a fixed size ring with
+the rows that pass the filters and the search hits kept up to date as messages come in, so the
+view only ever draws the rows it shows. The native fdlog module (native/fdlog.cpp, built with
+native/setup.py) interns the messages in C++. Without it the class below does the same in
+Python, with the same results.
+"""
+
+import bisect
+import os
+import sys
+import threading
+from collections import deque
+from datetime import datetime
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native'))
+try:
+    from fdlog import LogStore as NativeLogStore, LEVELS, CATEGORIES
+except ImportError:
+    NativeLogStore = None
+    # in the order of the level and category masks
+    LEVELS = ("INFO", "WARNING", "ERROR", "SUCCESS", "DATA", "OTHER")
+    CATEGORIES = ("connection", "recording", "performance")
+finally:
+    sys.path.pop(0)
+
+CAT_ALWAYS = 0x80  # shown whatever the filters
+
+
+def _lowered(text):
+    """ASCII letters lowered, as the native store does"""
+    return text.translate(_LOWER)
+
+
+_LOWER = {c: c + 32 for c in range(ord('A'), ord('Z') + 1)}
+
+
+def _category(lower):
+    """Which of the content filters a message falls under"""
+    if "terminal filters updated" in lower:
+        return CAT_ALWAYS
+    if "connected" in lower:
+        return 1
+    if "recording" in lower or "recorded" in lower:
+        return 2
+    if "fps" in lower or "latency" in lower or "performance" in lower:
+        return 4
+    return 0
+
+
+class PyLogStore:
+    """fdlog.LogStore in Python"""
+
+    def __init__(self, capacity=10000):
+        if capacity < 1 or capacity > (1 << 22):
+            raise ValueError("capacity must be 1 to 4194304 messages")
+        self._lock = threading.Lock()  # messages are logged from the BLE thread too
+        self._capacity = capacity
+        self._records = deque()  # (number, time, level, message)
+        self._next = 0
+        self._levels = (1 << len(LEVELS)) - 1
+        self._categories = (1 << len(CATEGORIES)) - 1
+        self._search = ""
+        self._matches = {}  # message -> contains the search text, for this search
+        self._rows = deque()
+        self._hits = deque()
+        self._version = 0
+
+    def _shown(self, level, message):
+        category = _category(_lowered(message))
+        if category & CAT_ALWAYS:
+            return True
+        return bool(self._levels >> level & 1) and not (category & ~self._categories)
+
+    def _matches_search(self, message):
+        if not self._search:
+            return False
+        match = self._matches.get(message)
+        if match is None:
+            match = self._matches[message] = self._search in _lowered(message)
+        return match
+
+    def _evict_oldest(self):
+        number, _, _, message = self._records.popleft()
+        if self._rows and self._rows[0][0] == number:
+            self._rows.popleft()
+        if self._hits and self._hits[0] == number:
+            self._hits.popleft()
+
+    def _find_hits(self):
+        self._hits = deque(n for n, _, _, message in self._rows if self._matches_search(message))
+        self._version += 1
+
+    def append(self, level, message):
+        level = LEVELS.index(level) if level in LEVELS[:-1] else len(LEVELS) - 1
+        with self._lock:
+            if len(self._records) == self._capacity:
+                self._evict_oldest()
+            record = (self._next, datetime.now(), level, message)
+            self._records.append(record)
+            if self._shown(level, message):
+                self._rows.append(record)
+                if self._matches_search(message):
+                    self._hits.append(self._next)
+                self._version += 1
+            self._next += 1
+
+    def clear(self):
+        with self._lock:
+            self._records.clear()
+            self._rows.clear()
+            self._hits.clear()
+            self._version += 1
+
+    def resize(self, capacity):
+        if capacity < 1 or capacity > (1 << 22):
+            raise ValueError("capacity must be 1 to 4194304 messages")
+        with self._lock:
+            while len(self._records) > capacity:
+                self._evict_oldest()
+            self._capacity = capacity
+            self._version += 1
+
+    def set_filter(self, levels, categories):
+        with self._lock:
+            self._levels, self._categories = levels, categories
+            self._rows = deque(r for r in self._records if self._shown(r[2], r[3]))
+            self._find_hits()
+
+    def set_search(self, text):
+        with self._lock:
+            self._search = _lowered(text)
+            self._matches = {}
+            self._find_hits()
+            return len(self._hits)
+
+    def count(self):
+        return len(self._rows)
+
+    def hits(self):
+        return len(self._hits)
+
+    def hit_row(self, k):
+        with self._lock:
+            if k < 0 or k >= len(self._hits):
+                raise IndexError("no such search hit")
+            return bisect.bisect_left([r[0] for r in self._rows], self._hits[k])
+
+    def version(self):
+        return self._version
+
+    def window(self, first, n):
+        with self._lock:
+            first = max(0, min(first, len(self._rows)))
+            n = max(0, min(n, len(self._rows) - first))
+            out = []
+            for i in range(first, first + n):
+                _, when, level, message = self._rows[i]
+                out.append((f"[{when.strftime('%H:%M:%S.%f')[:-3]}] {LEVELS[level]}: {message}", LEVELS[level]))
+            return out
+
+    def stats(self):
+        with self._lock:
+            messages = set(r[3] for r in self._records)
+            return {'records': len(self._records), 'messages': len(messages),
+                    'text_bytes': sum(len(m.encode()) for m in messages), 'capacity': self._capacity}
+
+
+NATIVE = NativeLogStore is not None
+LogStore = NativeLogStore if NATIVE else PyLogStore
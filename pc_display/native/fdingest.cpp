@@ -0,0 +1,379 @@
+/*
+ * FarDriver Frame Ingest
+ *
+ * Takes BLE notifications in for pc_display without any Python work per frame. Each frame is
+ * decoded with the instrument's own decoder (firmware/EKSR_Instrument/fardriver.cpp) into a
+ * snapshot of the latest values, and the raw frame is queued in a bounded ring in capture file
+ * layout. The display polls both once per Tk frame.
+ *
+ * The snapshot is a seqlock and the ring has one producer (feed) and one consumer (drain), so
+ * neither side waits on the other. Both run under the GIL today, but nothing here relies on
+ * it, so feed() could be called from a native BLE thread later.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include "distance.h"
+#include "fardriver.h"
+
+#define INGEST_DEFAULT_CAPACITY 4096
+
+// what instrument_values() gives for each frame
+static const char *instrument_fields[] = { "rpm", "gear", "power", "speed", "voltage", "controller_temp", "motor_temp",
+                                           "throttle" };
+#define INSTRUMENT_FIELDS 8
+
+typedef struct {
+  fd_state_t state;
+  uint32_t frames;           // frames decoded
+  uint32_t errors;           // too short or wrong header, not decoded
+  uint32_t checksum_errors;  // decoded anyway, as the instrument does
+  uint32_t last_ms;          // when the latest frame arrived
+  uint32_t seen;             // bit per index, which frames have been seen
+} snapshot_t;
+
+typedef struct {
+  PyObject_HEAD
+  std::chrono::steady_clock::time_point *start;
+
+  // written by feed() only
+  std::atomic<uint32_t> seq;
+  snapshot_t snap;
+
+  // single producer, single consumer ring of frames, capacity a power of two
+  fd_capture_t *ring;
+  uint32_t mask;
+  std::atomic<uint32_t> head;  // written by feed()
+  std::atomic<uint32_t> tail;  // written by drain()
+  std::atomic<uint32_t> dropped;
+} IngestObject;
+
+/*********************************************************/
+
+static uint32_t clock_ms(IngestObject *self) {
+  auto dt = std::chrono::steady_clock::now() - *self->start;
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(dt).count();
+}
+
+//
+// a consistent copy of the snapshot, tried again if feed() changed it meanwhile
+//
+static void read_snapshot(IngestObject *self, snapshot_t *out) {
+  uint32_t before, after;
+
+  do {
+    before = self->seq.load(std::memory_order_acquire);
+    memcpy(out, &self->snap, sizeof(*out));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = self->seq.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+}
+
+/*********************************************************/
+
+static int Ingest_init(IngestObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "capacity", NULL };
+  Py_ssize_t capacity = INGEST_DEFAULT_CAPACITY;
+  uint32_t size = 1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", (char **)kwlist, &capacity))
+    return -1;
+  if (capacity < 1 || capacity > (1 << 24)) {
+    PyErr_SetString(PyExc_ValueError, "capacity must be 1 to 16777216 frames");
+    return -1;
+  }
+  while (size < (uint32_t)capacity)
+    size <<= 1;
+
+  delete[] self->ring;
+  delete self->start;
+  self->ring = new (std::nothrow) fd_capture_t[size];
+  self->start = new (std::nothrow) std::chrono::steady_clock::time_point(std::chrono::steady_clock::now());
+  if (!self->ring || !self->start)
+    return PyErr_NoMemory(), -1;
+
+  self->mask = size - 1;
+  self->seq = 0;
+  self->head = 0;
+  self->tail = 0;
+  self->dropped = 0;
+  memset(&self->snap, 0, sizeof(self->snap));
+  return 0;
+}
+
+static void Ingest_dealloc(IngestObject *self) {
+  delete[] self->ring;
+  delete self->start;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*********************************************************/
+
+//
+// one notification, from the BLE callback
+//
+static PyObject *Ingest_feed(IngestObject *self, PyObject *arg) {
+  Py_buffer buf;
+  fd_words_t words;
+
+  if (!self->ring) {
+    PyErr_SetString(PyExc_RuntimeError, "Ingest not initialised");
+    return NULL;
+  }
+  if (PyObject_GetBuffer(arg, &buf, PyBUF_SIMPLE) < 0)
+    return NULL;
+
+  const uint8_t *frame = (const uint8_t *)buf.buf;
+  uint32_t now = clock_ms(self);
+  bool ok = (buf.len >= FD_FRAME_LEN) && (frame[0] == FD_HEADER);
+  bool valid = ok && fd_decode(frame, &words);
+
+  self->seq.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  if (ok) {
+    int index = fd_update(&self->snap.state, &words);
+    self->snap.frames++;
+    self->snap.last_ms = now;
+    if (!valid)
+      self->snap.checksum_errors++;
+    if (index >= 0)
+      self->snap.seen |= 1u << index;
+  } else {
+    self->snap.errors++;
+  }
+  self->seq.fetch_add(1, std::memory_order_release);
+
+  if (ok) {
+    uint32_t head = self->head.load(std::memory_order_relaxed);
+    if (head - self->tail.load(std::memory_order_acquire) > self->mask) {
+      self->dropped.fetch_add(1, std::memory_order_relaxed);  // display fell behind, keep the older frames
+    } else {
+      fd_capture_t *c = &self->ring[head & self->mask];
+      c->ms = now;
+      memcpy(c->frame, frame, FD_FRAME_LEN);
+      self->head.store(head + 1, std::memory_order_release);
+    }
+  }
+
+  PyBuffer_Release(&buf);
+  Py_RETURN_NONE;
+}
+
+/*********************************************************/
+
+static int set_item(PyObject *dict, const char *key, unsigned long value) {
+  PyObject *v = PyLong_FromUnsignedLong(value);
+  int r = v ? PyDict_SetItemString(dict, key, v) : -1;
+  Py_XDECREF(v);
+  return r;
+}
+
+static int set_signed(PyObject *dict, const char *key, long value) {
+  PyObject *v = PyLong_FromLong(value);
+  int r = v ? PyDict_SetItemString(dict, key, v) : -1;
+  Py_XDECREF(v);
+  return r;
+}
+
+//
+// the latest values, in the controller's units as fd_state_t has them
+//
+static PyObject *Ingest_snapshot(IngestObject *self, PyObject *Py_UNUSED(ignored)) {
+  snapshot_t s;
+  PyObject *d = PyDict_New();
+
+  if (!d)
+    return NULL;
+  read_snapshot(self, &s);
+
+  PyObject *power = PyFloat_FromDouble(s.state.power);
+  if (!power || PyDict_SetItemString(d, "power", power) < 0 ||
+      set_item(d, "rpm", s.state.rpm) < 0 ||
+      set_item(d, "gear_bits", s.state.gear_bits) < 0 ||
+      set_item(d, "flags", s.state.flags) < 0 ||
+      set_signed(d, "iq", s.state.iq) < 0 ||
+      set_signed(d, "id", s.state.id) < 0 ||
+      set_signed(d, "iqin", s.state.iqin) < 0 ||
+      set_item(d, "voltage", s.state.voltage) < 0 ||
+      set_item(d, "controller_temp", s.state.controller_temp) < 0 ||
+      set_item(d, "motor_temp", s.state.motor_temp) < 0 ||
+      set_item(d, "throttle", s.state.throttle) < 0 ||
+      set_item(d, "frames", s.frames) < 0 ||
+      set_item(d, "errors", s.errors) < 0 ||
+      set_item(d, "checksum_errors", s.checksum_errors) < 0 ||
+      set_item(d, "dropped", self->dropped.load(std::memory_order_relaxed)) < 0 ||
+      set_item(d, "last_ms", s.last_ms) < 0 ||
+      set_item(d, "seen", s.seen) < 0) {
+    Py_XDECREF(power);
+    Py_DECREF(d);
+    return NULL;
+  }
+  Py_DECREF(power);
+  return d;
+}
+
+//
+// the queued frames as one bytes object of 20 byte capture records, ms made relative to base_ms
+//
+static PyObject *Ingest_drain(IngestObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "max_frames", "base_ms", NULL };
+  Py_ssize_t max_frames = 0;
+  unsigned long base_ms = 0;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nk", (char **)kwlist, &max_frames, &base_ms))
+    return NULL;
+
+  uint32_t tail = self->tail.load(std::memory_order_relaxed);
+  uint32_t n = self->head.load(std::memory_order_acquire) - tail;
+  if (max_frames > 0 && (uint32_t)max_frames < n)
+    n = (uint32_t)max_frames;
+
+  PyObject *out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)n * sizeof(fd_capture_t));
+  if (!out)
+    return NULL;
+
+  fd_capture_t *dst = (fd_capture_t *)PyBytes_AS_STRING(out);
+  for (uint32_t i = 0; i < n; i++) {
+    dst[i] = self->ring[(tail + i) & self->mask];
+    dst[i].ms = (dst[i].ms >= base_ms) ? dst[i].ms - (uint32_t)base_ms : 0;
+  }
+  self->tail.store(tail + n, std::memory_order_release);
+  return out;
+}
+
+static PyObject *Ingest_clock(IngestObject *self, PyObject *Py_UNUSED(ignored)) {
+  return PyLong_FromUnsignedLong(clock_ms(self));
+}
+
+/*********************************************************/
+
+//
+// what the instrument shows after each frame of a capture, as message_handler() in
+// EKSR_Instrument.ino works it out (without a wheel speed sensor), for comparing with pc_display
+//
+static PyObject *instrument_values(PyObject *Py_UNUSED(module), PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "records", "circumference_mm", NULL };
+  Py_buffer buf;
+  unsigned int circumference_mm = 1350;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|I", (char **)kwlist, &buf, &circumference_mm))
+    return NULL;
+
+  size_t n = buf.len / sizeof(fd_capture_t);
+  PyObject *out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)(n * INSTRUMENT_FIELDS * sizeof(float)));
+  if (!out) {
+    PyBuffer_Release(&buf);
+    return NULL;
+  }
+
+  const fd_capture_t *records = (const fd_capture_t *)buf.buf;
+  float *v = (float *)PyBytes_AS_STRING(out);
+  float shown[INSTRUMENT_FIELDS] = { 0 };
+  fd_state_t state = {};
+  fd_words_t words;
+
+  for (size_t i = 0; i < n; i++) {
+    fd_decode(records[i].frame, &words);  // the instrument uses every 16 byte notification
+    if (words.index <= FD_MAX_INDEX) {
+      switch (fd_update(&state, &words)) {
+        case 0:
+          shown[0] = state.rpm;
+          shown[1] = fd_gear(&state);
+          shown[3] = rpm_to_speed(state.rpm, circumference_mm) * (3.6 / 1000.0 / (1 << SPEED_Q));
+          break;
+        case 1:
+          shown[2] = state.power;
+          shown[4] = state.voltage / 10.0;
+          break;
+        case 4:
+          shown[5] = state.controller_temp;
+          break;
+        case 13:
+          shown[6] = state.motor_temp;
+          shown[7] = state.throttle;
+          break;
+      }
+    }
+    memcpy(v + i * INSTRUMENT_FIELDS, shown, sizeof(shown));
+  }
+
+  PyBuffer_Release(&buf);
+  return out;
+}
+
+/*********************************************************/
+
+static PyMethodDef Ingest_methods[] = {
+  { "feed", (PyCFunction)Ingest_feed, METH_O, "feed(frame) -- take one BLE notification" },
+  { "snapshot", (PyCFunction)Ingest_snapshot, METH_NOARGS, "snapshot() -- latest values and counters as a dict" },
+  { "drain", (PyCFunction)(void (*)(void))Ingest_drain, METH_VARARGS | METH_KEYWORDS,
+    "drain(max_frames=0, base_ms=0) -- queued frames as 20 byte capture records" },
+  { "clock", (PyCFunction)Ingest_clock, METH_NOARGS, "clock() -- ms on the clock frames are stamped with" },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject IngestType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static PyMethodDef fdingest_functions[] = {
+  { "instrument_values", (PyCFunction)(void (*)(void))instrument_values, METH_VARARGS | METH_KEYWORDS,
+    "instrument_values(records, circumference_mm=1350) -- what the instrument shows after each capture "
+    "record, as float32 in the order of INSTRUMENT_FIELDS" },
+  { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef fdingest_module = {
+  PyModuleDef_HEAD_INIT,
+  "fdingest",
+  "FarDriver frame ingest for pc_display, using the instrument's decoder",
+  -1,
+  fdingest_functions,
+};
+
+static PyObject *fields_tuple(void) {
+  PyObject *t = PyTuple_New(INSTRUMENT_FIELDS);
+  for (int i = 0; t && i < INSTRUMENT_FIELDS; i++) {
+    PyObject *name = PyUnicode_FromString(instrument_fields[i]);
+    if (!name) {
+      Py_DECREF(t);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(t, i, name);
+  }
+  return t;
+}
+
+PyMODINIT_FUNC PyInit_fdingest(void) {
+  IngestType.tp_name = "fdingest.Ingest";
+  IngestType.tp_doc = "Ingest(capacity=4096) -- decoded snapshot and bounded ring of FarDriver frames";
+  IngestType.tp_basicsize = sizeof(IngestObject);
+  IngestType.tp_flags = Py_TPFLAGS_DEFAULT;
+  IngestType.tp_new = PyType_GenericNew;
+  IngestType.tp_init = (initproc)Ingest_init;
+  IngestType.tp_dealloc = (destructor)Ingest_dealloc;
+  IngestType.tp_methods = Ingest_methods;
+
+  if (PyType_Ready(&IngestType) < 0)
+    return NULL;
+
+  PyObject *m = PyModule_Create(&fdingest_module);
+  if (!m)
+    return NULL;
+
+  Py_INCREF(&IngestType);
+  if (PyModule_AddObject(m, "Ingest", (PyObject *)&IngestType) < 0 ||
+      PyModule_AddIntConstant(m, "RECORD_LEN", sizeof(fd_capture_t)) < 0 ||
+      PyModule_AddObject(m, "INSTRUMENT_FIELDS", fields_tuple()) < 0) {
+    Py_DECREF(&IngestType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
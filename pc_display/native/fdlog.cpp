@@ -0,0 +1,487 @@
+/*
+ * Terminal Log Store
+ *
+ * Holds pc_display's terminal messages in a fixed size ring, so an hour of logging costs the
+ * same as a minute. Messages are interned, the same text logged again only adds a 16 byte
+ * record, and each interned message keeps its level filter category and whether it contains
+ * the current search text. The rows that pass the filters, and the ones of those that match
+ * the search, are kept as lists of record numbers that are added to as records come in and
+ * trimmed as the ring overwrites them, so nothing is scanned again per message. The Tk view
+ * asks for only the rows it shows.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define LOG_DEFAULT_CAPACITY 10000
+#define LOG_MAX_CAPACITY     (1 << 22)
+
+// in the order of the level and category masks
+static const char *level_names[] = { "INFO", "WARNING", "ERROR", "SUCCESS", "DATA", "OTHER" };
+static const char *category_names[] = { "connection", "recording", "performance" };
+#define LEVELS     6
+#define CATEGORIES 3
+#define CAT_ALWAYS 0x80  // shown whatever the filters
+
+typedef struct {
+  std::string text;
+  std::string lower;    // for searching, ASCII letters lowered
+  uint32_t refs;        // records using it, free when 0
+  uint8_t category;
+  uint32_t search_gen;  // search the match flag is for
+  bool match;
+} message_t;
+
+typedef struct {
+  int64_t ms;  // wall clock
+  uint32_t msg;
+  uint8_t level;
+} record_t;
+
+typedef struct {
+  std::vector<record_t> ring;
+  uint64_t first, next;  // record numbers held, first to next - 1
+
+  std::vector<message_t> messages;
+  std::vector<uint32_t> free_ids;
+  std::unordered_map<std::string, uint32_t> ids;
+
+  uint32_t level_mask, category_mask;
+  std::string search;
+  uint32_t search_gen;
+  std::deque<uint64_t> rows;  // record numbers that pass the filters
+  std::deque<uint64_t> hits;  // of those, the ones that contain the search text
+  uint64_t version;           // changes whenever the rows do
+} store_t;
+
+typedef struct {
+  PyObject_HEAD
+  store_t *store;
+} LogStoreObject;
+
+/*********************************************************/
+
+static int level_of(const char *name) {
+  for (int i = 0; i < LEVELS - 1; i++)
+    if (!strcmp(name, level_names[i]))
+      return i;
+  return LEVELS - 1;
+}
+
+static std::string lowered(const char *s, size_t len) {
+  std::string out(s, len);
+  for (char &c : out)
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+  return out;
+}
+
+//
+// which of the content filters a message falls under, as the terminal always sorted them
+//
+static uint8_t category_of(const std::string &lower) {
+  if (lower.find("terminal filters updated") != std::string::npos)
+    return CAT_ALWAYS;
+  if (lower.find("connected") != std::string::npos)
+    return 1;
+  if (lower.find("recording") != std::string::npos || lower.find("recorded") != std::string::npos)
+    return 2;
+  if (lower.find("fps") != std::string::npos || lower.find("latency") != std::string::npos ||
+      lower.find("performance") != std::string::npos)
+    return 4;
+  return 0;
+}
+
+static uint32_t intern(store_t *s, const char *text, size_t len) {
+  std::string key(text, len);
+  auto it = s->ids.find(key);
+
+  if (it != s->ids.end()) {
+    s->messages[it->second].refs++;
+    return it->second;
+  }
+
+  uint32_t id;
+  if (!s->free_ids.empty()) {
+    id = s->free_ids.back();
+    s->free_ids.pop_back();
+  } else {
+    id = s->messages.size();
+    s->messages.emplace_back();
+  }
+
+  message_t *m = &s->messages[id];
+  m->lower = lowered(text, len);
+  m->category = category_of(m->lower);
+  m->refs = 1;
+  m->search_gen = 0;
+  m->match = false;
+  m->text = key;
+  s->ids.emplace(std::move(key), id);
+  return id;
+}
+
+static void release(store_t *s, uint32_t id) {
+  message_t *m = &s->messages[id];
+
+  if (--m->refs)
+    return;
+  s->ids.erase(m->text);
+  std::string().swap(m->text);
+  std::string().swap(m->lower);
+  s->free_ids.push_back(id);
+}
+
+/*********************************************************/
+
+static bool shown(const store_t *s, const record_t *r) {
+  uint8_t category = s->messages[r->msg].category;
+
+  if (category & CAT_ALWAYS)
+    return true;
+  return (s->level_mask >> r->level & 1) && !(category & ~s->category_mask);
+}
+
+//
+// worked out once per message and search, however often the message was logged
+//
+static bool matches(store_t *s, const record_t *r) {
+  message_t *m = &s->messages[r->msg];
+
+  if (s->search.empty())
+    return false;
+  if (m->search_gen != s->search_gen) {
+    m->match = m->lower.find(s->search) != std::string::npos;
+    m->search_gen = s->search_gen;
+  }
+  return m->match;
+}
+
+static record_t *record(store_t *s, uint64_t n) {
+  return &s->ring[n % s->ring.size()];
+}
+
+static void evict_oldest(store_t *s) {
+  if (!s->rows.empty() && s->rows.front() == s->first)
+    s->rows.pop_front();
+  if (!s->hits.empty() && s->hits.front() == s->first)
+    s->hits.pop_front();
+  release(s, record(s, s->first)->msg);
+  s->first++;
+}
+
+static void find_hits(store_t *s) {
+  s->hits.clear();
+  for (uint64_t n : s->rows)
+    if (matches(s, record(s, n)))
+      s->hits.push_back(n);
+  s->version++;
+}
+
+static void find_rows(store_t *s) {
+  s->rows.clear();
+  for (uint64_t n = s->first; n < s->next; n++)
+    if (shown(s, record(s, n)))
+      s->rows.push_back(n);
+  find_hits(s);
+}
+
+/*********************************************************/
+
+static int LogStore_init(LogStoreObject *self, PyObject *args, PyObject *kwds) {
+  static const char *kwlist[] = { "capacity", NULL };
+  Py_ssize_t capacity = LOG_DEFAULT_CAPACITY;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", (char **)kwlist, &capacity))
+    return -1;
+  if (capacity < 1 || capacity > LOG_MAX_CAPACITY) {
+    PyErr_Format(PyExc_ValueError, "capacity must be 1 to %d messages", LOG_MAX_CAPACITY);
+    return -1;
+  }
+
+  delete self->store;
+  self->store = new store_t();
+  self->store->ring.resize(capacity);
+  self->store->first = self->store->next = 0;
+  self->store->level_mask = (1 << LEVELS) - 1;
+  self->store->category_mask = (1 << CATEGORIES) - 1;
+  self->store->search_gen = 1;
+  self->store->version = 0;
+  return 0;
+}
+
+static void LogStore_dealloc(LogStoreObject *self) {
+  delete self->store;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+#define STORE(self)                                                 \
+  if (!(self)->store) {                                             \
+    PyErr_SetString(PyExc_RuntimeError, "LogStore not initialised"); \
+    return NULL;                                                    \
+  }                                                                 \
+  store_t *s = (self)->store
+
+/*********************************************************/
+
+static PyObject *LogStore_append(LogStoreObject *self, PyObject *args) {
+  const char *level, *text;
+  Py_ssize_t len;
+
+  STORE(self);
+  if (!PyArg_ParseTuple(args, "ss#", &level, &text, &len))
+    return NULL;
+
+  if (s->next - s->first == s->ring.size())
+    evict_oldest(s);
+
+  record_t *r = record(s, s->next);
+  r->ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+  r->msg = intern(s, text, len);
+  r->level = level_of(level);
+
+  if (shown(s, r)) {
+    s->rows.push_back(s->next);
+    if (matches(s, r))
+      s->hits.push_back(s->next);
+    s->version++;
+  }
+  s->next++;
+  Py_RETURN_NONE;
+}
+
+static PyObject *LogStore_clear(LogStoreObject *self, PyObject *Py_UNUSED(ignored)) {
+  STORE(self);
+  while (s->first < s->next)
+    evict_oldest(s);
+  s->version++;
+  Py_RETURN_NONE;
+}
+
+//
+// keeps the newest messages that still fit
+//
+static PyObject *LogStore_resize(LogStoreObject *self, PyObject *arg) {
+  Py_ssize_t capacity = PyLong_AsSsize_t(arg);
+
+  STORE(self);
+  if (capacity == -1 && PyErr_Occurred())
+    return NULL;
+  if (capacity < 1 || capacity > LOG_MAX_CAPACITY) {
+    PyErr_Format(PyExc_ValueError, "capacity must be 1 to %d messages", LOG_MAX_CAPACITY);
+    return NULL;
+  }
+
+  while (s->next - s->first > (uint64_t)capacity)
+    evict_oldest(s);
+
+  std::vector<record_t> ring(capacity);
+  for (uint64_t n = s->first; n < s->next; n++)
+    ring[n % capacity] = *record(s, n);
+  s->ring.swap(ring);
+  s->version++;
+  Py_RETURN_NONE;
+}
+
+/*********************************************************/
+
+static PyObject *LogStore_set_filter(LogStoreObject *self, PyObject *args) {
+  unsigned int levels, categories;
+
+  STORE(self);
+  if (!PyArg_ParseTuple(args, "II", &levels, &categories))
+    return NULL;
+
+  s->level_mask = levels;
+  s->category_mask = categories;
+  find_rows(s);
+  Py_RETURN_NONE;
+}
+
+static PyObject *LogStore_set_search(LogStoreObject *self, PyObject *arg) {
+  Py_ssize_t len;
+
+  STORE(self);
+  const char *text = PyUnicode_AsUTF8AndSize(arg, &len);
+  if (!text)
+    return NULL;
+
+  s->search = lowered(text, len);
+  s->search_gen++;
+  find_hits(s);
+  return PyLong_FromSize_t(s->hits.size());
+}
+
+static PyObject *LogStore_count(LogStoreObject *self, PyObject *Py_UNUSED(ignored)) {
+  STORE(self);
+  return PyLong_FromSize_t(s->rows.size());
+}
+
+static PyObject *LogStore_hits(LogStoreObject *self, PyObject *Py_UNUSED(ignored)) {
+  STORE(self);
+  return PyLong_FromSize_t(s->hits.size());
+}
+
+static PyObject *LogStore_version(LogStoreObject *self, PyObject *Py_UNUSED(ignored)) {
+  STORE(self);
+  return PyLong_FromUnsignedLongLong(s->version);
+}
+
+//
+// the row a search hit is on, the rows are in record order so it's a binary search
+//
+static PyObject *LogStore_hit_row(LogStoreObject *self, PyObject *arg) {
+  Py_ssize_t k = PyLong_AsSsize_t(arg);
+
+  STORE(self);
+  if (k == -1 && PyErr_Occurred())
+    return NULL;
+  if (k < 0 || (size_t)k >= s->hits.size()) {
+    PyErr_SetString(PyExc_IndexError, "no such search hit");
+    return NULL;
+  }
+  auto it = std::lower_bound(s->rows.begin(), s->rows.end(), s->hits[k]);
+  return PyLong_FromSsize_t(it - s->rows.begin());
+}
+
+//
+// rows first to first + n - 1 as (line, level) tuples, formatted as the terminal always showed them
+//
+static PyObject *LogStore_window(LogStoreObject *self, PyObject *args) {
+  Py_ssize_t first, n;
+
+  STORE(self);
+  if (!PyArg_ParseTuple(args, "nn", &first, &n))
+    return NULL;
+
+  first = std::max<Py_ssize_t>(0, std::min<Py_ssize_t>(first, s->rows.size()));
+  n = std::max<Py_ssize_t>(0, std::min<Py_ssize_t>(n, s->rows.size() - first));
+
+  PyObject *out = PyList_New(n);
+  if (!out)
+    return NULL;
+
+  for (Py_ssize_t i = 0; i < n; i++) {
+    const record_t *r = record(s, s->rows[first + i]);
+    const std::string &text = s->messages[r->msg].text;
+    time_t t = r->ms / 1000;
+    struct tm tm;
+    char stamp[32];
+
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    snprintf(stamp, sizeof(stamp), "[%02d:%02d:%02d.%03d] ", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(r->ms % 1000));
+
+    std::string line = stamp;
+    line += level_names[r->level];
+    line += ": ";
+    line += text;
+
+    PyObject *item = Py_BuildValue("(s#s)", line.data(), (Py_ssize_t)line.size(), level_names[r->level]);
+    if (!item) {
+      Py_DECREF(out);
+      return NULL;
+    }
+    PyList_SET_ITEM(out, i, item);
+  }
+  return out;
+}
+
+//
+// held records and interned messages, to show what the interning saves
+//
+static PyObject *LogStore_stats(LogStoreObject *self, PyObject *Py_UNUSED(ignored)) {
+  STORE(self);
+  size_t text_bytes = 0;
+  for (const message_t &m : s->messages)
+    text_bytes += m.text.size();
+  return Py_BuildValue("{s:K,s:n,s:n,s:n}", "records", (unsigned long long)(s->next - s->first),
+                       "messages", (Py_ssize_t)s->ids.size(), "text_bytes", (Py_ssize_t)text_bytes,
+                       "capacity", (Py_ssize_t)s->ring.size());
+}
+
+/*********************************************************/
+
+static PyMethodDef LogStore_methods[] = {
+  { "append", (PyCFunction)LogStore_append, METH_VARARGS, "append(level, message) -- log one message" },
+  { "clear", (PyCFunction)LogStore_clear, METH_NOARGS, "clear() -- drop all messages" },
+  { "resize", (PyCFunction)LogStore_resize, METH_O, "resize(capacity) -- keep the newest that fit" },
+  { "set_filter", (PyCFunction)LogStore_set_filter, METH_VARARGS,
+    "set_filter(level_mask, category_mask) -- bits in the order of LEVELS and CATEGORIES" },
+  { "set_search", (PyCFunction)LogStore_set_search, METH_O, "set_search(text) -- case blind, returns the hits" },
+  { "count", (PyCFunction)LogStore_count, METH_NOARGS, "count() -- rows that pass the filters" },
+  { "hits", (PyCFunction)LogStore_hits, METH_NOARGS, "hits() -- rows that contain the search text" },
+  { "hit_row", (PyCFunction)LogStore_hit_row, METH_O, "hit_row(k) -- row of the k'th search hit" },
+  { "version", (PyCFunction)LogStore_version, METH_NOARGS, "version() -- changes when the rows do" },
+  { "window", (PyCFunction)LogStore_window, METH_VARARGS, "window(first, n) -- rows as (line, level)" },
+  { "stats", (PyCFunction)LogStore_stats, METH_NOARGS, "stats() -- records, messages and text bytes held" },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject LogStoreType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+};
+
+static struct PyModuleDef fdlog_module = {
+  PyModuleDef_HEAD_INIT,
+  "fdlog",
+  "Fixed size terminal log store for pc_display",
+  -1,
+  NULL,
+};
+
+static PyObject *names_tuple(const char **names, int n) {
+  PyObject *t = PyTuple_New(n);
+  for (int i = 0; t && i < n; i++) {
+    PyObject *name = PyUnicode_FromString(names[i]);
+    if (!name) {
+      Py_DECREF(t);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(t, i, name);
+  }
+  return t;
+}
+
+PyMODINIT_FUNC PyInit_fdlog(void) {
+  LogStoreType.tp_name = "fdlog.LogStore";
+  LogStoreType.tp_doc = "LogStore(capacity=10000) -- ring of terminal messages with filter and search indexes";
+  LogStoreType.tp_basicsize = sizeof(LogStoreObject);
+  LogStoreType.tp_flags = Py_TPFLAGS_DEFAULT;
+  LogStoreType.tp_new = PyType_GenericNew;
+  LogStoreType.tp_init = (initproc)LogStore_init;
+  LogStoreType.tp_dealloc = (destructor)LogStore_dealloc;
+  LogStoreType.tp_methods = LogStore_methods;
+
+  if (PyType_Ready(&LogStoreType) < 0)
+    return NULL;
+
+  PyObject *m = PyModule_Create(&fdlog_module);
+  if (!m)
+    return NULL;
+
+  Py_INCREF(&LogStoreType);
+  if (PyModule_AddObject(m, "LogStore", (PyObject *)&LogStoreType) < 0 ||
+      PyModule_AddObject(m, "LEVELS", names_tuple(level_names, LEVELS)) < 0 ||
+      PyModule_AddObject(m, "CATEGORIES", names_tuple(category_names, CATEGORIES)) < 0) {
+    Py_DECREF(&LogStoreType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
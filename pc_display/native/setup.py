@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""
+Builds the native extensions for pc_display: fdingest, the BLE frame ingest, and fdlog,
+the terminal log store.
+
+    cd pc_display/native
+    python setup.py build_ext --inplace
+
+pc_display finds them here, and uses the same things in Python (ingest.py, logstore.py) if
+they aren't built.
+"""
+
+import os
+import sys
+from setuptools import setup, Extension
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FIRMWARE = os.path.normpath(os.path.join(HERE, '..', '..', 'firmware', 'EKSR_Instrument'))
+
+if sys.platform == 'win32':
+    extra_args = ['/O2', '/std:c++17']
+else:
+    extra_args = ['-O2', '-std=c++17']
+
+setup(
+    name='pc_display_native',
+    version='1.0',
+    description='FarDriver frame ingest and terminal log store for pc_display',
+    ext_modules=[
+        Extension(
+            'fdingest',
+            sources=[os.path.join(HERE, 'fdingest.cpp'), os.path.join(FIRMWARE, 'fardriver.cpp')],
+            include_dirs=[FIRMWARE],
+            extra_compile_args=extra_args,
+            language='c++',
+        ),
+        Extension(
+            'fdlog',
+            sources=[os.path.join(HERE, 'fdlog.cpp')],
+            extra_compile_args=extra_args[:2],
+            language='c++',
+        ),
+    ],
+)
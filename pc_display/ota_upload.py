@@ -0,0 +1,123 @@
+"""
+Firmware update over BLE for the EKSR instrument
+
+Sends a packed image made with host/otapack (firmware/EKSR_Instrument/ota.h has the protocol):
+the header on the control characteristic, then the packed bytes as writes without response on
+the data characteristic, as big as the MTU allows. The instrument notifies its status on the
+control characteristic every few KB taken in, and no more than OTA_WINDOW bytes are sent past
+the last one, so its buffer never overflows. The instrument switches to the new image and
+restarts once the hash checks out.
+
+The instrument only advertises the update service after "ota on" on its serial console, or
+always when built with OTA_ADVERTISE set. Its characteristics only take writes once paired:
+the operating system asks for the passkey "ota on" prints (or OTA_PASSKEY) the first time.
+The image must be packed with the signing key the instrument was built with, otherwise it
+fails with "bad signature" before anything is written.
+
+    python ota_upload.py firmware.ota [address]
+"""
+
+import asyncio
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+OTA_SERVICE_UUID = "c5f50001-8280-46da-89f4-6d8051e4aeef"
+OTA_CONTROL_UUID = "c5f50002-8280-46da-89f4-6d8051e4aeef"
+OTA_DATA_UUID = "c5f50003-8280-46da-89f4-6d8051e4aeef"
+
+OTA_MAGIC = 0x41544F45
+OTA_HEADER = struct.Struct("<IHHII32s64s")
+OTA_STATUS = struct.Struct("<BBHII")
+OTA_WINDOW = 12288
+OTA_CMD_BEGIN = 0x01
+OTA_CMD_ABORT = 0x02
+
+OTA_RECEIVING, OTA_VERIFYING, OTA_DONE, OTA_FAILED = 1, 2, 3, 4
+OTA_ERRORS = ["ok", "bad header", "no OTA partition", "out of memory", "overrun", "timed out",
+              "bad stream", "flash write", "hash mismatch", "image rejected", "aborted", "bad signature"]
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, header_len, image_size, packed_size, _, _ = OTA_HEADER.unpack_from(data)
+    if magic != OTA_MAGIC or len(data) != header_len + packed_size:
+        raise ValueError(f"{path}: not an image packed with otapack")
+    return data[:header_len], data[header_len:], image_size
+
+
+async def find(address):
+    if address:
+        return address
+    print("Scanning for the instrument...")
+    device = await BleakScanner.find_device_by_filter(
+        lambda d, ad: OTA_SERVICE_UUID in [u.lower() for u in ad.service_uuids], timeout=15.0)
+    if not device:
+        raise RuntimeError("no instrument advertising the update service, try \"ota on\" on its console")
+    print(f"Found {device.name} at {device.address}")
+    return device.address
+
+
+async def upload(path, address=None):
+    header, packed, image_size = load(path)
+    status = {"state": 0, "error": 0, "received": 0, "written": 0}
+    changed = asyncio.Event()
+
+    def on_status(_, data):
+        state, error, _, received, written = OTA_STATUS.unpack(bytes(data[:OTA_STATUS.size]))
+        status.update(state=state, error=error, received=received, written=written)
+        changed.set()
+
+    async def wait(condition, timeout=15.0):
+        while not condition():
+            changed.clear()
+            if status["state"] == OTA_FAILED:
+                raise RuntimeError(f"update failed: {OTA_ERRORS[status['error']]}")
+            await asyncio.wait_for(changed.wait(), timeout)
+
+    async with BleakClient(await find(address)) as client:
+        chunk = max(20, client.mtu_size - 3)
+        try:
+            await client.pair()  # the writes need an encrypted, authenticated link
+        except NotImplementedError:
+            pass  # macOS pairs on the first write
+        await client.start_notify(OTA_CONTROL_UUID, on_status)
+        await client.write_gatt_char(OTA_CONTROL_UUID, bytes([OTA_CMD_BEGIN]) + header, response=True)
+        await wait(lambda: status["state"] == OTA_RECEIVING)
+
+        print(f"Sending {len(packed)} bytes for a {image_size} byte image, {chunk} bytes a write")
+        start = time.monotonic()
+        sent = 0
+        try:
+            while sent < len(packed):
+                await wait(lambda: sent - status["received"] < OTA_WINDOW)
+                n = min(chunk, len(packed) - sent, OTA_WINDOW - (sent - status["received"]))
+                await client.write_gatt_char(OTA_DATA_UUID, packed[sent:sent + n], response=False)
+                sent += n
+                print(f"\r  {100 * status['written'] // image_size:3d}%  {status['written']} bytes written", end="")
+            await wait(lambda: status["state"] == OTA_DONE, timeout=30.0)
+        except (asyncio.TimeoutError, KeyboardInterrupt):
+            await client.write_gatt_char(OTA_CONTROL_UUID, bytes([OTA_CMD_ABORT]), response=True)
+            raise
+
+        seconds = time.monotonic() - start
+        print(f"\rUpdated in {seconds:.1f} s, {len(packed) / seconds / 1024:.1f} KB/s over the air, "
+              f"{image_size / seconds / 1024:.1f} KB/s of image, the instrument is restarting")
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print(__doc__)
+        sys.exit(2)
+    try:
+        asyncio.run(upload(sys.argv[1], sys.argv[2] if len(sys.argv) == 3 else None))
+    except (RuntimeError, ValueError, asyncio.TimeoutError) as e:
+        print(f"\n{e or 'timed out'}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
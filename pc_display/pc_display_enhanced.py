@@ -23,6 +23,7 @@ DEVELOPMENT FEATURES:
 """
 
 import tkinter as tk
+import tkinter.font as tkfont
 from tkinter import ttk, scrolledtext, messagebox, filedialog
 import asyncio
 import threading
@@ -34,6 +35,8 @@ import os
 from datetime import datetime
 from bleak import BleakScanner, BleakClient
 import struct
+from ingest import Ingest, NATIVE as NATIVE_INGEST, RECORD_LEN, display_values
+from logstore import LogStore, LEVELS as LOG_LEVELS, CATEGORIES as LOG_CATEGORIES
 
 # Optional imports with fallbacks
 try:
@@ -42,6 +45,8 @@ try:
 except ImportError:
     PSUTIL_AVAILABLE = False
     print("Warning: psutil not available. Performance monitoring will be limited.")
+if not NATIVE_INGEST:
+    print("Warning: native fdingest not built (see native/setup.py). Using the slower Python ingest.")
 import gc
 
 # BLE Service and Characteristic UUIDs
@@ -131,11 +136,14 @@ class ControllerData:
         self.recorded_data = []
         self.csv_file = None
         self.csv_writer = None
+        self.capture_file = None  # raw frames, for host/bench_fardriver and host/fleet
+        self.capture_base_ms = 0  # ingest clock when recording started
         self.recording_start_time = None
         
         # Performance monitoring
         self.packet_count = 0
         self.packet_errors = 0
+        self.packet_dropped = 0
         self.last_packet_time = 0
         self.avg_latency = 0
         self.latency_samples = []
@@ -191,11 +199,15 @@ class ControllerData:
             
             # Write header with descriptive column names
             header = ['Timestamp', 'Throttle', 'Gear', 'RPM', 'Controller_Temp_C', 
-                     'Motor_Temp_C', 'Speed_kmh', 'Power_W', 'Voltage_V', 'Packet_Count', 'Latency_ms']
+                     'Motor_Temp_C', 'Speed_kmh', 'Power_kW', 'Voltage_V', 'Packet_Count', 'Latency_ms']
             self.csv_writer.writerow(header)
             
+            # Raw frames next to the CSV: 4 byte little endian ms since start, then the 16 byte frame
+            self.capture_file = open(os.path.splitext(filename)[0] + '.fdcap', 'wb')
+            
             self.recording = True
             self.recording_start_time = time.time()
+            self.capture_base_ms = ingest.clock()
             self.recorded_data = []
             
             # Log the filename being used
@@ -218,6 +230,10 @@ class ControllerData:
             self.csv_file = None
             self.csv_writer = None
         
+        if self.capture_file:
+            self.capture_file.close()
+            self.capture_file = None
+        
         # Handle different recording modes
         if self.recorded_data:
             if settings.get('auto_save', True):
@@ -255,9 +271,16 @@ class ControllerData:
             self.csv_writer.writerow(row)
             self.csv_file.flush()  # Ensure data is written immediately
     
-    def update_performance_metrics(self, packet_time, latency):
+    def record_frames(self, records):
+        """Append a batch of capture records from ingest.drain() to the capture file"""
+        if not self.recording or not self.capture_file:
+            return
+        
+        self.capture_file.write(records)
+    
+    def update_performance_metrics(self, packet_time, latency, count=1):
         """Update performance monitoring metrics"""
-        self.packet_count += 1
+        self.packet_count += count
         self.last_packet_time = packet_time
         
         # Update latency tracking (keep last 100 samples)
@@ -351,8 +374,8 @@ class PacketInspector:
         gear = gear_map.get(gear_bits, 'Unknown')
         
         rpm = (data[4] << 8) | data[5]
-        iq = ((data[8] << 8) | data[9]) / 100.0
-        id = ((data[10] << 8) | data[11]) / 100.0
+        iq = int.from_bytes(data[8:10], 'big', signed=True) / 100.0
+        id = int.from_bytes(data[10:12], 'big', signed=True) / 100.0
         is_mag = (iq * iq + id * id) ** 0.5
         
         return {
@@ -377,13 +400,18 @@ class PacketInspector:
         """Parse voltage data packet (index 1)"""
         voltage_raw = (data[2] << 8) | data[3]
         voltage = voltage_raw / 10.0
+        iqin = int.from_bytes(data[8:10], 'big', signed=True) / 100.0  # negative when driving
         
         return {
             'voltage_raw': voltage_raw,
             'voltage': f'{voltage:.1f}V',
+            'iqin_current': f'{iqin:.2f}A',
+            'battery_power': f'{iqin * voltage / 1000.0:.3f}kW',
             'data_bytes': {
                 'voltage_high': f'0x{data[2]:02X}',
-                'voltage_low': f'0x{data[3]:02X}'
+                'voltage_low': f'0x{data[3]:02X}',
+                'iqin_high': f'0x{data[8]:02X}',
+                'iqin_low': f'0x{data[9]:02X}'
             }
         }
     
@@ -446,6 +474,8 @@ class PacketInspector:
 # Global variables
 ctr_data = ControllerData()
 packet_inspector = PacketInspector()
+ingest = Ingest()  # BLE frames, decoded and queued until the display takes them
+TERMINAL_FRAMES_PER_POLL = 20  # raw frames logged per display frame
 is_connected = False
 client = None
 terminal_widget = None
@@ -463,7 +493,7 @@ cpu_usage = 0
 settings = {
     'display_fps': 60,
     'gauge_animation_fps': 120,
-    'terminal_max_lines': 1000,
+    'terminal_max_lines': 10000,
     'packet_history_size': 1000,
     'auto_record': False,
     'auto_save': True,  # Automatically save CSV files
@@ -473,17 +503,13 @@ settings = {
     'theme': 'dark'
 }
 
+# Terminal text colour tag for each level, others are shown as info
+TERMINAL_TAGS = {'ERROR': "error", 'WARNING': "warning", 'DATA': "data", 'SUCCESS': "success"}
+
 def log_to_terminal(message, level="INFO"):
     """Global function to log messages to terminal"""
-    global terminal_paused
-    if terminal_widget and hasattr(terminal_widget, 'log_to_terminal') and not terminal_paused:
-        # Check if message should be shown based on filters
-        if hasattr(terminal_widget, 'should_show_message'):
-            if terminal_widget.should_show_message(level, message):
-                terminal_widget.log_to_terminal(message, level)
-        else:
-            # Fallback if filter system not available
-            terminal_widget.log_to_terminal(message, level)
+    if terminal_widget and hasattr(terminal_widget, 'log_to_terminal'):
+        terminal_widget.log_to_terminal(message, level)
 
 class ModernButton(tk.Button):
     """Custom modern button with hover effects"""
@@ -767,11 +793,16 @@ class EKSRDisplayEnhanced:
             'show_performance': tk.BooleanVar(value=True)
         }
         
+        # Terminal messages, kept in a fixed size store and drawn a screenful at a time
+        self.log_store = LogStore(settings['terminal_max_lines'])
+        self.terminal_top = 0  # first row shown
+        self.terminal_follow = True  # keep showing the newest rows
+        self.terminal_drawn = None  # what the terminal shows, to draw it only when that changes
+        
         # Initialize search variables
         self.search_active = False
         self.search_frame = None
         self.search_entry = None
-        self.search_results = []
         self.current_search_index = -1
         
         # Create sidebar
@@ -967,18 +998,31 @@ class EKSRDisplayEnhanced:
                                           command=self.open_data_folder)
         self.data_folder_btn.pack(side='left', padx=2)
         
-        # Terminal widget
-        self.terminal = scrolledtext.ScrolledText(
-            terminal_frame,
+        # Terminal widget, showing only the rows in view, see render_terminal()
+        text_frame = tk.Frame(terminal_frame, bg=COLORS['bg_dark'])
+        text_frame.pack(fill='both', expand=True)
+        
+        self.terminal_scrollbar = tk.Scrollbar(text_frame, command=self.scroll_terminal)
+        self.terminal_scrollbar.pack(side='right', fill='y')
+        
+        self.terminal = tk.Text(
+            text_frame,
             bg=COLORS['bg_dark'],
             fg=COLORS['text_primary'],
             font=FONTS['mono'],
             insertbackground=COLORS['text_primary'],
             selectbackground=COLORS['accent_blue'],
             relief='flat',
-            borderwidth=0
+            borderwidth=0,
+            wrap='none',
+            state='disabled'
         )
-        self.terminal.pack(fill='both', expand=True)
+        self.terminal.pack(side='left', fill='both', expand=True)
+        self.terminal_line_height = tkfont.Font(font=FONTS['mono']).metrics('linespace')
+        
+        self.terminal.bind('<MouseWheel>', lambda e: self.scroll_terminal('scroll', -e.delta // 120 * 3, 'units'))
+        self.terminal.bind('<Button-4>', lambda e: self.scroll_terminal('scroll', -3, 'units'))
+        self.terminal.bind('<Button-5>', lambda e: self.scroll_terminal('scroll', 3, 'units'))
         
         # Configure terminal colors
         self.terminal.tag_configure("error", foreground=COLORS['error'])
@@ -992,50 +1036,43 @@ class EKSRDisplayEnhanced:
     
     def update_terminal_filters(self):
         """Update terminal display based on filter settings"""
-        # This will be called when checkboxes are toggled
-        # For now, we'll just log the current filter state
+        self.apply_terminal_filters()
         active_filters = [key for key, var in self.terminal_filters.items() if var.get()]
         self.log_to_terminal(f"Terminal filters updated: {', '.join(active_filters)}", "INFO")
     
-    def should_show_message(self, level, message):
-        """Determine if a message should be shown based on filter settings"""
-        # Always show filter update messages to avoid confusion
-        if "Terminal filters updated" in message:
-            return True
-        
-        # Check level-based filters
-        if level == "INFO":
-            return self.terminal_filters['show_info'].get()
-        elif level == "WARNING":
-            return self.terminal_filters['show_warning'].get()
-        elif level == "ERROR":
-            return self.terminal_filters['show_error'].get()
-        elif level == "SUCCESS":
-            return self.terminal_filters['show_success'].get()
-        elif level == "DATA":
-            return self.terminal_filters['show_data'].get()
-        
-        # Check content-based filters
-        if "connected" in message.lower() or "disconnected" in message.lower():
-            return self.terminal_filters['show_connection'].get()
-        elif "recording" in message.lower() or "recorded" in message.lower():
-            return self.terminal_filters['show_recording'].get()
-        elif "fps" in message.lower() or "latency" in message.lower() or "performance" in message.lower():
-            return self.terminal_filters['show_performance'].get()
-        
-        # Default to showing if no specific filter applies
-        return True
+    def apply_terminal_filters(self):
+        """Show the logged messages that pass the filters, earlier ones included"""
+        # A message is shown when its level is, and when it's about connection, recording or
+        # performance, that has to be too. Levels without a filter of their own are always shown,
+        # and "Terminal filters updated" is always shown to avoid confusion.
+        level_filters = {'INFO': 'show_info', 'WARNING': 'show_warning', 'ERROR': 'show_error',
+                         'SUCCESS': 'show_success', 'DATA': 'show_data'}
+        levels = 0
+        for i, level in enumerate(LOG_LEVELS):
+            if level not in level_filters or self.terminal_filters[level_filters[level]].get():
+                levels |= 1 << i
+        
+        categories = 0
+        for i, category in enumerate(LOG_CATEGORIES):
+            if self.terminal_filters['show_' + category].get():
+                categories |= 1 << i
+        
+        self.log_store.set_filter(levels, categories)
+        if self.search_active and self.search_entry:
+            self.perform_search()
     
     def select_all_filters(self):
         """Select all terminal filters"""
         for var in self.terminal_filters.values():
             var.set(True)
+        self.apply_terminal_filters()
         self.log_to_terminal("All terminal filters enabled", "INFO")
     
     def clear_all_filters(self):
         """Clear all terminal filters"""
         for var in self.terminal_filters.values():
             var.set(False)
+        self.apply_terminal_filters()
         self.log_to_terminal("All terminal filters disabled", "INFO")
     
     def create_main_content(self):
@@ -1308,9 +1345,68 @@ class EKSRDisplayEnhanced:
     
     def clear_terminal(self):
         """Clear the terminal display"""
-        self.terminal.delete(1.0, tk.END)
+        self.log_store.clear()
+        self.terminal_follow = True
         self.log_to_terminal("Terminal cleared", "INFO")
     
+    def terminal_rows(self):
+        """How many rows the terminal has room for"""
+        return max(1, self.terminal.winfo_height() // self.terminal_line_height)
+    
+    def scroll_terminal(self, *args):
+        """Scrollbar and mouse wheel, moving the first row shown"""
+        count = self.log_store.count()
+        rows = self.terminal_rows()
+        
+        if args[0] == 'moveto':
+            top = int(float(args[1]) * count)
+        elif args[2] == 'pages':
+            top = self.terminal_top + int(args[1]) * rows
+        else:
+            top = self.terminal_top + int(args[1])
+        
+        self.terminal_top = max(0, min(top, count - rows))
+        self.terminal_follow = self.terminal_top >= count - rows
+        self.render_terminal()
+    
+    def render_terminal(self):
+        """Draw the rows in view, if they or the search changed"""
+        count = self.log_store.count()
+        rows = self.terminal_rows()
+        
+        if self.terminal_follow:
+            self.terminal_top = max(0, count - rows)
+        self.terminal_top = max(0, min(self.terminal_top, count - 1))
+        
+        search_text = self.search_entry.get().strip() if self.search_active and self.search_entry else ""
+        drawn = (self.log_store.version(), self.terminal_top, rows, search_text, self.current_search_index)
+        if drawn == self.terminal_drawn:
+            return
+        self.terminal_drawn = drawn
+        
+        self.terminal.config(state='normal')
+        self.terminal.delete(1.0, tk.END)
+        for line, level in self.log_store.window(self.terminal_top, rows):
+            self.terminal.insert(tk.END, line + "\n", TERMINAL_TAGS.get(level, "info"))
+        
+        # Highlight the search text in the rows in view
+        if search_text:
+            start_pos = 1.0
+            while True:
+                pos = self.terminal.search(search_text, start_pos, tk.END, nocase=True)
+                if not pos:
+                    break
+                end_pos = f"{pos}+{len(search_text)}c"
+                self.terminal.tag_add("search_highlight", pos, end_pos)
+                start_pos = end_pos
+        
+        self.terminal.config(state='disabled')
+        
+        if count:
+            self.terminal_scrollbar.set(self.terminal_top / count, min(1.0, (self.terminal_top + rows) / count))
+        else:
+            self.terminal_scrollbar.set(0.0, 1.0)
+    
     def toggle_search(self):
         """Toggle search functionality on/off"""
         if self.search_active:
@@ -1413,36 +1509,12 @@ class EKSRDisplayEnhanced:
             self.search_count_label.config(text="0 results")
             return
         
-        # Clear previous highlights
-        self.clear_search_highlights()
-        
-        # Get terminal content
-        content = self.terminal.get(1.0, tk.END)
-        
-        # Find all matches
-        self.search_results = []
-        start_pos = 1.0
-        
-        while True:
-            pos = self.terminal.search(search_text, start_pos, tk.END, nocase=True)
-            if not pos:
-                break
-            
-            # Calculate end position
-            end_pos = f"{pos}+{len(search_text)}c"
-            self.search_results.append((pos, end_pos))
-            start_pos = end_pos
-        
-        # Update count
-        count = len(self.search_results)
+        # Find all matches, in everything that passes the filters, not only what's in view
+        count = self.log_store.set_search(search_text)
         self.search_count_label.config(text=f"{count} result{'s' if count != 1 else ''}")
         
-        # Highlight all matches
-        for pos, end_pos in self.search_results:
-            self.terminal.tag_add("search_highlight", pos, end_pos)
-        
         # Go to first match if any found
-        if self.search_results:
+        if count:
             self.current_search_index = 0
             self.highlight_current_match()
         else:
@@ -1450,48 +1522,33 @@ class EKSRDisplayEnhanced:
     
     def search_next(self):
         """Go to next search result"""
-        if not self.search_results:
+        if not self.log_store.hits():
             return
         
-        self.current_search_index = (self.current_search_index + 1) % len(self.search_results)
+        self.current_search_index = (self.current_search_index + 1) % self.log_store.hits()
         self.highlight_current_match()
     
     def search_previous(self):
         """Go to previous search result"""
-        if not self.search_results:
+        if not self.log_store.hits():
             return
         
-        self.current_search_index = (self.current_search_index - 1) % len(self.search_results)
+        self.current_search_index = (self.current_search_index - 1) % self.log_store.hits()
         self.highlight_current_match()
     
     def highlight_current_match(self):
-        """Highlight the current search match and scroll to it"""
-        if not self.search_results or self.current_search_index < 0:
+        """Scroll the current search match into the middle of the terminal"""
+        count = self.log_store.hits()
+        if not count or self.current_search_index < 0:
             return
         
-        # Remove previous current highlight
-        self.terminal.tag_remove("search_highlight", 1.0, tk.END)
-        
-        # Re-add all search highlights
-        search_text = self.search_entry.get().strip()
-        start_pos = 1.0
-        while True:
-            pos = self.terminal.search(search_text, start_pos, tk.END, nocase=True)
-            if not pos:
-                break
-            end_pos = f"{pos}+{len(search_text)}c"
-            self.terminal.tag_add("search_highlight", pos, end_pos)
-            start_pos = end_pos
-        
-        # Highlight current match with different color
-        current_pos, current_end = self.search_results[self.current_search_index]
-        self.terminal.tag_add("search_highlight", current_pos, current_end)
-        
-        # Scroll to current match
-        self.terminal.see(current_pos)
+        self.current_search_index = min(self.current_search_index, count - 1)
+        row = self.log_store.hit_row(self.current_search_index)
+        self.terminal_top = max(0, row - self.terminal_rows() // 2)
+        self.terminal_follow = False
+        self.render_terminal()
         
         # Update count label to show current position
-        count = len(self.search_results)
         current = self.current_search_index + 1
         self.search_count_label.config(text=f"{current}/{count} result{'s' if count != 1 else ''}")
     
@@ -1500,13 +1557,14 @@ class EKSRDisplayEnhanced:
         if self.search_entry:
             self.search_entry.delete(0, tk.END)
         self.clear_search_highlights()
-        self.search_results = []
         self.current_search_index = -1
         self.search_count_label.config(text="0 results")
     
     def clear_search_highlights(self):
         """Clear all search highlights"""
-        self.terminal.tag_remove("search_highlight", 1.0, tk.END)
+        self.log_store.set_search("")
+        self.terminal_follow = True
+        self.render_terminal()
     
     def toggle_recording(self):
         """Toggle data recording on/off"""
@@ -1557,7 +1615,7 @@ class EKSRDisplayEnhanced:
                         writer = csv.writer(f)
                         # Write standardized header
                         header = ['Timestamp', 'Throttle', 'Gear', 'RPM', 'Controller_Temp_C', 
-                                 'Motor_Temp_C', 'Speed_kmh', 'Power_W', 'Voltage_V', 'Packet_Count', 'Latency_ms']
+                                 'Motor_Temp_C', 'Speed_kmh', 'Power_kW', 'Voltage_V', 'Packet_Count', 'Latency_ms']
                         writer.writerow(header)
                         
                         # Write data rows
@@ -1760,56 +1818,8 @@ Index Distribution:
         if terminal_paused and "Display paused" not in message and "Display resumed" not in message:
             return
         
-        # Check filter settings
-        if not self.should_show_message(level, message):
-            return
-            
-        timestamp = datetime.now().strftime("%H:%M:%S.%f")[:-3]
-        formatted_message = f"[{timestamp}] {level}: {message}\n"
-        
-        # Color coding based on level
-        tag = "info"
-        if level == "ERROR":
-            tag = "error"
-        elif level == "WARNING":
-            tag = "warning"
-        elif level == "DATA":
-            tag = "data"
-        elif level == "SUCCESS":
-            tag = "success"
-        
-        # Store current search state - safely check if search_entry exists
-        current_search_text = ""
-        if hasattr(self, 'search_entry') and self.search_entry:
-            try:
-                current_search_text = self.search_entry.get().strip()
-            except (tk.TclError, AttributeError):
-                current_search_text = ""
-        
-        self.terminal.insert(tk.END, formatted_message, tag)
-        
-        # Auto-scroll to bottom
-        self.terminal.see(tk.END)
-        
-        # Limit terminal size to prevent memory issues
-        lines = self.terminal.get(1.0, tk.END).split('\n')
-        if len(lines) > settings['terminal_max_lines']:
-            self.terminal.delete(1.0, f"{len(lines) - settings['terminal_max_lines']//2}.0")
-            # Re-apply search highlighting after content deletion
-            if current_search_text and hasattr(self, 'search_active') and self.search_active:
-                self.perform_search()
-        
-        # Apply search highlighting to new content if search is active
-        if current_search_text and hasattr(self, 'search_active') and self.search_active:
-            # Find and highlight any matches in the new content
-            start_pos = f"{len(lines) - 1}.0"
-            while True:
-                pos = self.terminal.search(current_search_text, start_pos, tk.END, nocase=True)
-                if not pos:
-                    break
-                end_pos = f"{pos}+{len(current_search_text)}c"
-                self.terminal.tag_add("search_highlight", pos, end_pos)
-                start_pos = end_pos
+        # Filters are applied, and the terminal drawn, by the log store and render_terminal()
+        self.log_store.append(level, message)
     
     def on_closing(self):
         """Handle window closing - disconnect and cleanup"""
@@ -1862,6 +1872,10 @@ Index Distribution:
         # Update performance monitoring
         self.update_performance_display()
         
+        # Take in what arrived, even when paused so the ring doesn't fill up and recording carries on
+        ingest_poll()
+        self.render_terminal()
+        
         # If paused, only update time and schedule next update
         if terminal_paused:
             # Schedule next update
@@ -1885,8 +1899,8 @@ Index Distribution:
         
         # Only update displays if data changed or we need to update connection status
         if data_changed:
-            # Update power gauge (max 5000W)
-            self.power_gauge.set_value(abs(ctr_data.power), 5000)
+            # Update power gauge (max 5000W), power is kW as on the instrument
+            self.power_gauge.set_value(abs(ctr_data.power) * 1000, 5000)
             
             # Update speed display
             self.speed_display.config(text=f"{ctr_data.speed:.0f}")
@@ -2184,6 +2198,7 @@ Index Distribution:
             settings['display_fps'] = int(self.fps_var.get())
             settings['gauge_animation_fps'] = int(self.gauge_fps_var.get())
             settings['terminal_max_lines'] = int(self.terminal_lines_var.get())
+            self.log_store.resize(settings['terminal_max_lines'])
             settings['auto_record'] = self.auto_record_var.get()
             settings['auto_save'] = self.auto_save_var.get()
             settings['record_interval'] = float(self.interval_var.get())
@@ -2212,6 +2227,7 @@ Index Distribution:
                 with open('eksr_settings.json', 'r') as f:
                     loaded_settings = json.load(f)
                     settings.update(loaded_settings)
+                self.log_store.resize(settings['terminal_max_lines'])
                 self.log_to_terminal("Settings loaded from file", "INFO")
                 
                 # Update UI to reflect loaded settings
@@ -2219,99 +2235,92 @@ Index Distribution:
         except Exception as e:
             self.log_to_terminal(f"Failed to load settings: {e}", "WARNING")
 
-def message_handler(data):
-    """Process incoming BLE data packets"""
+def ingest_poll():
+    """Take the frames that arrived since the last display frame, called from the display loop"""
     global ctr_data, is_connected
     
-    packet_start_time = time.time()
-    
-    # Analyze packet with inspector
-    packet_info = packet_inspector.analyze_packet(data)
-    
-    if len(data) < 16:
-        log_to_terminal(f"Invalid packet length: {len(data)}", "ERROR")
-        ctr_data.packet_errors += 1
-        return
-    
-    # Check for 0xAA header
-    if data[0] != 0xAA:
-        log_to_terminal(f"Invalid header: 0x{data[0]:02X}", "ERROR")
-        ctr_data.packet_errors += 1
+    poll_time = time.time()
+    base_ms = ctr_data.capture_base_ms if ctr_data.recording else 0
+    snap = ingest.snapshot()
+    records = ingest.drain(0, base_ms)
+    count = len(records) // RECORD_LEN
+    
+    # Frames too short or with the wrong header are only counted by ingest
+    if snap['errors'] > ctr_data.packet_errors:
+        log_to_terminal(f"Invalid packets: {snap['errors'] - ctr_data.packet_errors} too short or wrong header", "ERROR")
+        ctr_data.packet_errors = snap['errors']
+    if snap['dropped'] > ctr_data.packet_dropped:
+        log_to_terminal(f"Dropped packets: {snap['dropped'] - ctr_data.packet_dropped}, display fell behind", "WARNING")
+        ctr_data.packet_dropped = snap['dropped']
+    
+    if count == 0:
         return
     
-    index = data[1]
     ctr_data.last_update = time.time()
+    ctr_data.record_frames(records)
     
     # Update connection status when we receive data
     if not is_connected:
         is_connected = True
         log_to_terminal("Connection status updated - data received", "INFO")
     
-    # Log raw data to terminal - display exactly as received from FarDriver
-    hex_data = ' '.join([f"{b:02X}" for b in data])
-    log_to_terminal(f"DATA: {hex_data}", "DATA")
+    # Log raw data to terminal - display exactly as received from FarDriver, the newest if many came at once
+    first = max(0, count - TERMINAL_FRAMES_PER_POLL)
+    if first:
+        log_to_terminal(f"DATA: {first} earlier frames not shown", "DATA")
+    for i in range(first, count):
+        hex_data = ' '.join([f"{b:02X}" for b in records[i * RECORD_LEN + 4:(i + 1) * RECORD_LEN]])
+        log_to_terminal(f"DATA: {hex_data}", "DATA")
     
-    # Log detailed packet info if enabled
+    # Inspect the newest packet
+    data = records[-16:]
+    packet_info = packet_inspector.analyze_packet(data)
     if settings['show_packet_details'] and packet_info['valid']:
-        log_to_terminal(f"Packet {index}: {packet_info['parsed_data']}", "INFO")
+        log_to_terminal(f"Packet {data[1]}: {packet_info['parsed_data']}", "INFO")
     
-    # Calculate latency
-    latency = (time.time() - packet_start_time) * 1000  # Convert to ms
-    ctr_data.update_performance_metrics(packet_start_time, latency)
+    # Latency is how long the oldest frame waited for the display
+    oldest_ms = struct.unpack_from('<I', records)[0] + base_ms
+    ctr_data.update_performance_metrics(poll_time, max(0, ingest.clock() - oldest_ms), count)
     
-    # Process different packet types
-    if index == 0:  # Main data
-        rpm = (data[4] << 8) | data[5]
-        gear = ((data[2] >> 2) & 0x03)
-        gear = max(1, min(3, gear))
-        
-        # Calculate power from current values
-        iq = ((data[8] << 8) | data[9]) / 100.0
-        id = ((data[10] << 8) | data[11]) / 100.0
-        is_mag = (iq * iq + id * id) ** 0.5
-        power = -is_mag * ctr_data.voltage  # Power in watts
-        
-        if iq < 0 or id < 0:
-            power = -power
-        
-        # Calculate speed (simplified)
-        wheel_circumference = 1.350  # meters
-        rear_wheel_rpm = rpm / 4.0
-        distance_per_min = rear_wheel_rpm * wheel_circumference
-        speed = distance_per_min * 0.06  # km/h
+    # Values from the instrument's decoder, worked out as the instrument does, logged when they change
+    values = display_values(snap)
+    
+    if 'voltage' in values:  # Voltage and battery power
+        voltage = values['voltage']
+        power = values['power']  # kW from iQin and voltage, negative when driving
+        if (voltage, power) != (ctr_data.voltage, ctr_data.power):
+            log_to_terminal(f"Voltage: {voltage:.1f}V, Power: {power:.2f}kW", "INFO")
+        ctr_data.update_value('voltage', voltage)
+        ctr_data.update_value('power', power)
+    
+    if 'rpm' in values:  # Main data
+        rpm = values['rpm']
+        gear = values['gear']
+        speed = values['speed']
         
-        # Update values using the new method for change tracking
+        if (rpm, gear) != (ctr_data.rpm, ctr_data.gear):
+            log_to_terminal(
+                f"Main Data - RPM: {rpm}, Gear: {gear}, Speed: {speed:.1f}km/h", "INFO"
+            )
         ctr_data.update_value('rpm', rpm)
         ctr_data.update_value('gear', gear)
-        ctr_data.update_value('power', power)
         ctr_data.update_value('speed', speed)
-        
-        log_to_terminal(
-            f"Main Data - RPM: {rpm}, Gear: {gear}, "
-            f"Power: {power:.0f}W, Speed: {speed:.1f}km/h", "INFO"
-        )
-        
-    elif index == 1:  # Voltage
-        voltage = ((data[2] << 8) | data[3]) / 10.0
-        ctr_data.update_value('voltage', voltage)
-        log_to_terminal(f"Voltage: {voltage:.1f}V", "INFO")
-        
-    elif index == 4:  # Controller temperature
-        controller_temp = data[2]
+    
+    if 'controller_temp' in values:
+        controller_temp = values['controller_temp']
+        if controller_temp != ctr_data.controller_temp:
+            log_to_terminal(f"Controller Temp: {controller_temp}°C", "INFO")
         ctr_data.update_value('controller_temp', controller_temp)
-        log_to_terminal(f"Controller Temp: {controller_temp}°C", "INFO")
-        
-    elif index == 13:  # Motor temperature and throttle
-        motor_temp = data[2]
-        throttle = (data[4] << 8) | data[5]
+    
+    if 'motor_temp' in values:  # Motor temperature and throttle
+        motor_temp = values['motor_temp']
+        throttle = values['throttle']
+        if (motor_temp, throttle) != (ctr_data.motor_temp, ctr_data.throttle):
+            log_to_terminal(
+                f"Motor Temp: {motor_temp}°C, Throttle: {throttle}", "INFO"
+            )
         ctr_data.update_value('motor_temp', motor_temp)
         ctr_data.update_value('throttle', throttle)
-        log_to_terminal(
-            f"Motor Temp: {motor_temp}°C, Throttle: {throttle}", "INFO"
-        )
-    
-    else:
-        log_to_terminal(f"Unknown packet type: {index}", "WARNING")
 
 async def scan_and_connect():
     """Scan for and connect to FarDriver emulator"""
@@ -2358,7 +2367,7 @@ async def scan_and_connect():
                             # Subscribe to notifications with retry
                             try:
                                 await client.start_notify(FARDRIVER_CHARACTERISTIC_UUID, 
-                                                        lambda sender, data: message_handler(data))
+                                                        lambda sender, data: ingest.feed(data))
                                 log_to_terminal("Successfully subscribed to FarDriver characteristic", "SUCCESS")
                             except Exception as e:
                                 log_to_terminal(f"Failed to subscribe to characteristic: {e}", "ERROR")
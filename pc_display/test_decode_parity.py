@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""
+Decode Parity Test
+
+Runs capture files (.fdcap, as recorded next to the CSV) through the instrument's decoder and
+through pc_display's, and reports every field where they show something different. The
+instrument side is firmware/EKSR_Instrument/fardriver.cpp with message_handler()'s working out,
+built into the native fdingest module. The pc_display side is the Python ingest (or with -n the
+native one) and display_values(), as the display loop uses them.
+
+    python test_decode_parity.py [-n] [capture.fdcap ...]
+
+Without files a synthetic capture is made with every gear, current, voltage and temperature
+value the words can carry. Build the native module first (native/setup.py build_ext --inplace).
+"""
+
+import math
+import os
+import random
+import struct
+import sys
+import time
+
+from ingest import NativeIngest, PyIngest, RECORD_LEN, display_values
+
+try:
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native'))
+    import fdingest
+except ImportError:
+    fdingest = None
+finally:
+    sys.path.pop(0)
+
+EXAMPLES = 3  # divergences shown per field
+
+
+def make_frame(index, words):
+    frame = bytearray(16)
+    frame[0] = 0xAA
+    frame[1] = index
+    struct.pack_into('>6H', frame, 2, *words)
+    for b in frame[1:14]:
+        frame[14] ^= b
+    return bytes(frame)
+
+
+def synthetic_capture(n, seed=1):
+    """Capture records of the indexes the instrument uses and others, every value a word can have"""
+    rnd = random.Random(seed)
+    out = bytearray()
+    ms = 0
+    for i in range(n):
+        index = rnd.choice((0, 0, 1, 1, 4, 13, 2, 29, 30, 255))
+        words = [rnd.getrandbits(16) for _ in range(6)]
+        if i % 3 == 0:
+            words = [w & 0x0FFF for w in words]  # small values too, not only huge ones
+        frame = make_frame(index, words)
+        if rnd.random() < 0.01:
+            frame = frame[:14] + bytes([frame[14] ^ 0xFF]) + frame[15:]  # bad checksum, used by both
+        ms += rnd.randrange(1, 40)
+        out += struct.pack('<I', ms) + frame
+    return bytes(out)
+
+
+def same(a, b):
+    if isinstance(a, float) or isinstance(b, float):
+        return math.isclose(a, b, rel_tol=1e-5, abs_tol=1e-5)  # the instrument works in float32
+    return a == b
+
+
+def compare(name, records, ingest):
+    """Returns the number of fields that diverged"""
+    n = len(records) // RECORD_LEN
+    fields = fdingest.INSTRUMENT_FIELDS
+    instrument = struct.iter_unpack(f'<{len(fields)}f', fdingest.instrument_values(records))
+
+    start = time.perf_counter()
+    divergent = {field: [] for field in fields + ('accepted',)}
+    feed, snapshot = ingest.feed, ingest.snapshot
+    unseen = dict.fromkeys(fields, 0)  # what both start with
+    frames = 0
+    for i, shown in enumerate(instrument):
+        frame = records[i * RECORD_LEN + 4:(i + 1) * RECORD_LEN]
+        feed(frame)
+        snap = snapshot()
+        desktop = dict(unseen, **display_values(snap))
+
+        if snap['frames'] == frames:  # the instrument takes every 16 byte notification
+            divergent['accepted'].append((i, frame, True, False))
+        frames = snap['frames']
+        for field, value in zip(fields, shown):
+            if not same(value, desktop[field]):
+                divergent[field].append((i, frame, value, desktop[field]))
+    seconds = time.perf_counter() - start
+
+    print(f"{name}: {n} frames, {n / max(seconds, 1e-9) / 1000:.0f}k frames/s")
+    diverged = 0
+    for field, cases in divergent.items():
+        if not cases:
+            print(f"  ✓ {field}")
+            continue
+        diverged += 1
+        print(f"  ✗ {field}: {len(cases)} frames differ")
+        for i, frame, value, desktop in cases[:EXAMPLES]:
+            print(f"      frame {i} [{frame.hex(' ').upper()}]  instrument {value}  pc_display {desktop}")
+    return diverged
+
+
+def main():
+    args = sys.argv[1:]
+    native = '-n' in args
+    files = [a for a in args if a != '-n']
+
+    print("Decode Parity")
+    print("=" * 40)
+
+    if fdingest is None:
+        print("✗ native fdingest not built, the instrument's decoder is needed (native/setup.py build_ext --inplace)")
+        return 1
+    if native and NativeIngest is None:
+        print("✗ -n needs the native fdingest module")
+        return 1
+
+    captures = [(f, open(f, 'rb').read()) for f in files] or [("synthetic", synthetic_capture(200000))]
+    diverged = 0
+    for name, records in captures:
+        records = records[:len(records) // RECORD_LEN * RECORD_LEN]
+        diverged += compare(name, records, NativeIngest(1 << 24) if native else PyIngest(1 << 24))
+
+    print(f"\n{'All fields match' if not diverged else f'{diverged} fields diverge'}")
+    return 1 if diverged else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""
+Frame Ingest Test
+
+Feeds the same frames, good and bad, to the native fdingest module and to its Python
+stand-in in ingest.py, and checks they give the same snapshots and capture records.
+Then times how long feeding takes per frame, which is all the BLE callback does now.
+Build the native module first (native/setup.py build_ext --inplace), or only the Python
+one is checked.
+"""
+
+import math
+import random
+import struct
+import sys
+import time
+
+from ingest import NativeIngest, PyIngest, RECORD_LEN
+
+failures = 0
+
+
+def check(what, ok):
+    global failures
+    print(f"{'✓' if ok else '✗'} {what}")
+    if not ok:
+        failures += 1
+
+
+def make_frame(index, words):
+    frame = bytearray(16)
+    frame[0] = 0xAA
+    frame[1] = index
+    struct.pack_into('>6H', frame, 2, *words)
+    for b in frame[1:14]:
+        frame[14] ^= b
+    return bytes(frame)
+
+
+def frames(n, seed=1):
+    """A stream with the indexes the instrument uses, others, bad checksums, headers and lengths"""
+    rnd = random.Random(seed)
+    out = []
+    for _ in range(n):
+        frame = make_frame(rnd.choice((0, 1, 4, 13, 0, 1, 2, 29)), [rnd.getrandbits(16) for _ in range(6)])
+        r = rnd.random()
+        if r < 0.02:
+            frame = frame[:14] + bytes([frame[14] ^ 1]) + frame[15:]
+        elif r < 0.03:
+            frame = b'\x55' + frame[1:]
+        elif r < 0.04:
+            frame = frame[:rnd.randrange(16)]
+        out.append(frame)
+    return out
+
+
+def same_snapshot(a, b):
+    """Power is a float on the native side and a double in Python, the rest must be equal"""
+    return (a.keys() == b.keys() and math.isclose(a['power'], b['power'], rel_tol=1e-5, abs_tol=1e-5)
+            and all(a[k] == b[k] for k in a if k != 'power'))
+
+
+def run(ingest, stream):
+    snaps, records = [], b''
+    for i, frame in enumerate(stream):
+        ingest.feed(frame)
+        if i % 7 == 0:
+            snaps.append({k: v for k, v in ingest.snapshot().items() if k != 'last_ms'})
+            records += ingest.drain(3)
+    records += ingest.drain()
+    return snaps, records
+
+
+def main():
+    print("Frame Ingest")
+    print("=" * 40)
+
+    stream = frames(5000)
+    py = PyIngest()
+    snaps, records = run(py, stream)
+    good = [f for f in stream if len(f) >= 16 and f[0] == 0xAA]
+    last = py.snapshot()
+
+    check("Python: good frames counted", last['frames'] == len(good))
+    check("Python: short and bad header frames counted", last['errors'] == len(stream) - len(good))
+    check("Python: capture records are the good frames in order",
+          [records[i + 4:i + RECORD_LEN] for i in range(0, len(records), RECORD_LEN)] == good)
+    regen = PyIngest()
+    regen.feed(make_frame(1, [0, 0, 0, 0xFF38, 0, 0]))
+    check("Python: signed bus current", regen.snapshot()['iqin'] == -200)
+    regen.feed(make_frame(0, [0, 0, 0, 0, 0xFE0C, 0xFF9C]))
+    regen.feed(make_frame(1, [900, 0, 0, 0x00C8, 0, 0]))
+    snap = regen.snapshot()
+    check("Python: signed motor currents", (snap['iq'], snap['id']) == (-500, -100))
+    check("Python: battery power from bus current and voltage", abs(snap['power'] - 0.18) < 1e-9)
+
+    small = PyIngest(capacity=4)
+    for f in good[:10]:
+        small.feed(f)
+    check("Python: full ring drops new frames", small.snapshot()['dropped'] == 6 and len(small.drain()) == 4 * RECORD_LEN)
+
+    if NativeIngest is None:
+        print("native fdingest not built, skipping the comparison")
+        return 1 if failures else 0
+
+    native = NativeIngest()
+    native_snaps, native_records = run(native, stream)
+    check("native snapshots match Python", all(same_snapshot(a, b) for a, b in zip(native_snaps, snaps)))
+    check("native capture frames match Python",
+          [native_records[i + 4:i + RECORD_LEN] for i in range(0, len(native_records), RECORD_LEN)] ==
+          [records[i + 4:i + RECORD_LEN] for i in range(0, len(records), RECORD_LEN)])
+
+    small = NativeIngest(capacity=4)
+    for f in good[:10]:
+        small.feed(f)
+    check("native full ring drops new frames", small.snapshot()['dropped'] == 6 and len(small.drain()) == 4 * RECORD_LEN)
+
+    small.feed(good[0])
+    base = small.clock() + 1000
+    check("native capture ms relative to base, never negative", struct.unpack_from('<I', small.drain(0, base))[0] == 0)
+
+    # what the BLE callback costs per frame
+    stream = frames(100000, seed=2)
+    for name, ingest in (("Python", PyIngest(capacity=1 << 17)), ("native", NativeIngest(capacity=1 << 17))):
+        start = time.perf_counter()
+        feed = ingest.feed
+        for f in stream:
+            feed(f)
+        us = (time.perf_counter() - start) / len(stream) * 1e6
+        print(f"  {name:8s} feed {us:6.2f} us per frame")
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
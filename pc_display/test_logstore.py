@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""
+Terminal Log Store Test
+
+Logs the same messages to the native fdlog store and to its Python stand-in in logstore.py,
+with filter, search and size changes along the way, and checks both show the same rows and
+search hits. Then logs a long session's worth of messages and checks that appending and
+drawing a screenful cost the same at the end as at the start. Build the native module first
+(native/setup.py build_ext --inplace), or only the Python one is checked.
+"""
+
+import random
+import sys
+import time
+
+from logstore import NativeLogStore, PyLogStore, LEVELS, CATEGORIES
+
+failures = 0
+
+
+def check(what, ok):
+    global failures
+    print(f"{'✓' if ok else '✗'} {what}")
+    if not ok:
+        failures += 1
+
+
+def messages(n, seed=1):
+    """What the terminal sees: raw frames, value lines, connection and performance messages"""
+    rnd = random.Random(seed)
+    out = []
+    for _ in range(n):
+        r = rnd.random()
+        if r < 0.5:
+            out.append(("DATA", "DATA: " + ' '.join(f"{rnd.getrandbits(8):02X}" for _ in range(16))))
+        elif r < 0.8:
+            out.append(("INFO", f"Voltage: {rnd.randrange(480, 540) / 10:.1f}V"))
+        elif r < 0.85:
+            out.append(("INFO", "Connection status updated - data received"))
+        elif r < 0.9:
+            out.append(("INFO", f"Performance - FPS: {rnd.randrange(50, 61)}, Latency: 1.0ms"))
+        elif r < 0.95:
+            out.append(("ERROR", f"Invalid packets: {rnd.randrange(1, 4)} too short or wrong header"))
+        else:
+            out.append((rnd.choice(("WARNING", "SUCCESS", "DEBUG")), "Recording started - saving to: data/x.csv"))
+    return out
+
+
+def view(store):
+    """Rows without their timestamps, the search hit rows, and the counts"""
+    rows = [(line.split('] ', 1)[1], level) for line, level in store.window(0, store.count())]
+    return rows, [store.hit_row(k) for k in range(store.hits())], store.count(), store.hits()
+
+
+def run(store, stream):
+    views = []
+    steps = [
+        lambda: store.set_search("voltage: 5"),
+        lambda: store.set_filter((1 << len(LEVELS)) - 1 & ~(1 << LEVELS.index("DATA")), (1 << len(CATEGORIES)) - 1),
+        lambda: store.set_filter((1 << len(LEVELS)) - 1, (1 << len(CATEGORIES)) - 1 & ~(1 << CATEGORIES.index("performance"))),
+        lambda: store.resize(150),
+        lambda: store.set_search("DATA: A"),
+        lambda: store.resize(400),
+        lambda: store.clear(),
+        lambda: store.set_search(""),
+    ]
+    for i, (level, message) in enumerate(stream):
+        store.append(level, message)
+        if i % 250 == 249:
+            steps[(i // 250) % len(steps)]()
+            views.append(view(store))
+    views.append(view(store))
+    return views
+
+
+def main():
+    print("Terminal Log Store")
+    print("=" * 40)
+
+    py = PyLogStore(300)
+    for level, message in messages(1000):
+        py.append(level, message)
+    check("Python: holds only its capacity", py.count() == 300 and py.stats()['records'] == 300)
+    py.set_search("VOLTAGE")
+    rows, hit_rows, _, hits = view(py)
+    check("Python: search is case blind and finds every row", hits > 0 and
+          [i for i, (line, _) in enumerate(rows) if "voltage" in line.split(': ', 1)[1].lower()] == hit_rows)
+    py.set_filter(1 << LEVELS.index("ERROR"), (1 << len(CATEGORIES)) - 1)
+    check("Python: level filter", all(level == "ERROR" for _, level in py.window(0, py.count())))
+    py.append("INFO", "Terminal filters updated: show_error")
+    check("Python: filter change messages always shown", py.window(py.count() - 1, 1)[0][1] == "INFO")
+    py.append("DEBUG", "something else")
+    py.set_filter((1 << len(LEVELS)) - 1, (1 << len(CATEGORIES)) - 1)
+    check("Python: unknown levels are OTHER", py.window(py.count() - 1, 1)[0][1] == "OTHER")
+
+    if NativeLogStore is None:
+        print("native fdlog not built, skipping the comparison")
+        return 1 if failures else 0
+
+    stream = messages(5000, seed=2)
+    check("native views match Python through filter, search and size changes",
+          run(NativeLogStore(300), stream) == run(PyLogStore(300), stream))
+
+    native = NativeLogStore(1000)
+    for level, message in messages(20000, seed=3):
+        native.append(level, message)
+    stats = native.stats()
+    print(f"  {stats['records']} messages held as {stats['messages']} interned, {stats['text_bytes']} text bytes")
+    check("native interning shares repeated messages", stats['messages'] < stats['records'])
+
+    # a long session: appending and drawing a screen stays the same cost
+    for name, store in (("Python", PyLogStore(10000)), ("native", NativeLogStore(10000))):
+        store.set_search("voltage: 50")
+        stream = messages(200000, seed=4)
+        costs = []
+        for part in range(4):
+            start = time.perf_counter()
+            for level, message in stream[part * 50000:(part + 1) * 50000]:
+                store.append(level, message)
+            for _ in range(100):
+                store.window(max(0, store.count() - 40), 40)
+            costs.append((time.perf_counter() - start) / 50000 * 1e6)
+        print(f"  {name:8s} us per message over the session: {' '.join(f'{c:.2f}' for c in costs)}")
+        check(f"{name}: cost flat over a long session", costs[-1] < costs[0] * 2)
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())